@@ -0,0 +1,27 @@
+//
+//  CIImage+LatencyTrace.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Carries a captured frame's arrival time along with the CIImages made from it, so the
+//  mixer and the viewers can record their LatencyTrace stages. Each stage is recorded
+//  once per frame, however often the image is composited or redrawn.
+//
+
+#import <QuartzCore/QuartzCore.h>
+#import "LatencyTrace.h"
+
+@interface CIImage (LatencyTrace)
+
+// Tags the image with the MonotonicNanos() arrival time of its frame
+-(void) setLatencyArrivalTime:(uint64_t)arrivalNanos;
+
+// For images derived from a tagged one, eg. a filter or mixer output
+-(void) copyLatencyTagFrom:(CIImage*)image;
+
+// Records the stage for the image's frame, unless it was recorded for it already.
+// Does nothing for untagged images.
+-(void) recordLatencyStage:(LatencyStage)stage;
+
+@end
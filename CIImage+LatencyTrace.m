@@ -0,0 +1,49 @@
+//
+//  CIImage+LatencyTrace.m
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#import "CIImage+LatencyTrace.h"
+#import <objc/runtime.h>
+
+// Shared by every image showing the same frame
+@interface LatencyTag : NSObject{
+@public
+    uint64_t arrivalTime;
+    volatile uint32_t recordedStages;
+}
+@end
+
+@implementation LatencyTag
+@end
+
+static void *LatencyTagKey = &LatencyTagKey;
+
+@implementation CIImage (LatencyTrace)
+
+-(void) setLatencyArrivalTime:(uint64_t)arrivalNanos{
+    LatencyTag * tag = [[LatencyTag alloc] init];
+    tag->arrivalTime = arrivalNanos;
+    objc_setAssociatedObject(self, LatencyTagKey, tag, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+-(void) copyLatencyTagFrom:(CIImage*)image{
+    if(image && image != self){
+        objc_setAssociatedObject(self, LatencyTagKey, objc_getAssociatedObject(image, LatencyTagKey), OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    }
+}
+
+-(void) recordLatencyStage:(LatencyStage)stage{
+    LatencyTag * tag = objc_getAssociatedObject(self, LatencyTagKey);
+    if(!tag){
+        return;
+    }
+    uint32_t bit = 1u << stage;
+    if(!(__sync_fetch_and_or(&tag->recordedStages, bit) & bit)){
+        LatencyTraceRecord(stage, tag->arrivalTime);
+    }
+}
+
+@end
@@ -7,6 +7,7 @@
 //
 
 #import "CoreImageViewer.h"
+#import "CIImage+LatencyTrace.h"
 
 @implementation CoreImageViewer
 
@@ -67,7 +68,10 @@ static void *CIImageContext = &CIImageContext;
                 }
             }
             
-            [ciContext drawImage:image inRect:NSRectToCGRect(dirtyRect) fromRect:NSMakeRect(0, 0, 720, 576)];
+            // The whole input, whatever its size (HD inputs and scaled down previews). The
+            // unfiltered extent, so the transform filter still moves the picture around
+            [ciContext drawImage:image inRect:NSRectToCGRect(dirtyRect) fromRect:[self.ciImage extent]];
+            [self.ciImage recordLatencyStage:LatencyStageDraw];
             
             if(self.highlight){
                 [[NSColor colorWithDeviceRed:1.0 green:0.0 blue:0.0 alpha:1.0] set];
@@ -0,0 +1,143 @@
+//
+//  AudioRing.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "AudioRing.h"
+
+#include <string.h>
+#include <algorithm>
+
+AudioRing::AudioRing(int channels, int sampleBytes, size_t capacityFrames)
+: channels(channels), sampleBytes(sampleBytes), frameBytes((size_t)channels * sampleBytes),
+  generation(0), start(0), reserved(0), committed(0), started(false),
+  packets(0), samples(0), silenceSamples(0), restarts(0)
+{
+    capacity = 1024;
+    while(capacity < capacityFrames){
+        capacity <<= 1;
+    }
+    buffer = new unsigned char[capacity * frameBytes]();
+}
+
+AudioRing::~AudioRing()
+{
+    delete [] buffer;
+}
+
+void AudioRing::Write(const void * packet, size_t frames, int64_t position)
+{
+    packets.fetch_add(1, std::memory_order_relaxed);
+
+    int64_t end = committed.load(std::memory_order_relaxed);
+    if(!started || position < end || position - end >= (int64_t)capacity || frames > capacity){
+        if(started){
+            restarts.fetch_add(1, std::memory_order_relaxed);
+        }
+        if(frames > capacity){
+            packet = (const unsigned char *)packet + (frames - capacity) * frameBytes;
+            position += frames - capacity;
+            frames = capacity;
+        }
+        Restart(position);
+    } else if(position > end){
+        // Lost packets, keep the positions lined up with the video
+        size_t gap = (size_t)(position - end);
+        CopyIn(NULL, gap, end);
+        silenceSamples.fetch_add(gap, std::memory_order_relaxed);
+    }
+
+    CopyIn(packet, frames, position);
+}
+
+void AudioRing::CopyIn(const void * packet, size_t frames, int64_t position)
+{
+    int64_t end = position + (int64_t)frames;
+
+    // Readers of the samples about to be overwritten see this when they check afterwards
+    reserved.store(end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    size_t offset = (size_t)position & (capacity - 1);
+    size_t first = std::min(frames, capacity - offset);
+    if(packet){
+        memcpy(buffer + offset * frameBytes, packet, first * frameBytes);
+        memcpy(buffer, (const unsigned char *)packet + first * frameBytes, (frames - first) * frameBytes);
+    } else {
+        memset(buffer + offset * frameBytes, 0, first * frameBytes);
+        memset(buffer, 0, (frames - first) * frameBytes);
+    }
+
+    committed.store(end, std::memory_order_release);
+    samples.fetch_add(frames, std::memory_order_relaxed);
+}
+
+void AudioRing::Restart(int64_t position)
+{
+    generation.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    start.store(position, std::memory_order_relaxed);
+    reserved.store(position, std::memory_order_relaxed);
+    committed.store(position, std::memory_order_relaxed);
+
+    generation.fetch_add(1, std::memory_order_release);
+    started = true;
+}
+
+bool AudioRing::Read(int64_t position, size_t frames, void * dest) const
+{
+    if(frames > capacity){
+        return false;
+    }
+
+    uint32_t readGeneration = generation.load(std::memory_order_acquire);
+    if(readGeneration & 1){
+        return false;
+    }
+
+    int64_t end = position + (int64_t)frames;
+    if(position < start.load(std::memory_order_relaxed) ||
+       end > committed.load(std::memory_order_acquire) ||
+       position < reserved.load(std::memory_order_relaxed) - (int64_t)capacity){
+        return false;
+    }
+
+    size_t offset = (size_t)position & (capacity - 1);
+    size_t first = std::min(frames, capacity - offset);
+    memcpy(dest, buffer + offset * frameBytes, first * frameBytes);
+    memcpy((unsigned char *)dest + first * frameBytes, buffer, (frames - first) * frameBytes);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return generation.load(std::memory_order_relaxed) == readGeneration &&
+           position >= reserved.load(std::memory_order_relaxed) - (int64_t)capacity;
+}
+
+void AudioRing::Available(int64_t & availableStart, int64_t & availableEnd) const
+{
+    uint32_t readGeneration;
+    do {
+        readGeneration = generation.load(std::memory_order_acquire);
+        availableStart = start.load(std::memory_order_relaxed);
+        availableEnd = committed.load(std::memory_order_acquire);
+        int64_t overwritten = reserved.load(std::memory_order_relaxed) - (int64_t)capacity;
+        availableStart = std::max(availableStart, overwritten);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while((readGeneration & 1) || generation.load(std::memory_order_relaxed) != readGeneration);
+
+    if(availableStart > availableEnd){
+        availableStart = availableEnd;
+    }
+}
+
+AudioRingStats AudioRing::Stats() const
+{
+    AudioRingStats stats;
+    stats.packets = packets.load(std::memory_order_relaxed);
+    stats.samples = samples.load(std::memory_order_relaxed);
+    stats.silenceSamples = silenceSamples.load(std::memory_order_relaxed);
+    stats.restarts = restarts.load(std::memory_order_relaxed);
+    return stats;
+}
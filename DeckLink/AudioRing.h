@@ -0,0 +1,83 @@
+//
+//  AudioRing.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Captured audio, kept by sample position on the input's stream clock (the packet time
+//  at 48 kHz), so the audio belonging to a video frame is a plain range of positions.
+//  The driver callback is the only writer and only copies the packet in. Any number of
+//  threads can read a range without taking a lock. A read copies the samples and then
+//  checks that the writer did not overwrite them meanwhile.
+//
+//  Gaps in the packet times are filled with silence. A packet time going backwards
+//  means the streams were restarted, and everything before it is forgotten.
+//
+
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+struct AudioRingStats {
+    uint64_t packets;
+    uint64_t samples;           // sample frames written, silence included
+    uint64_t silenceSamples;    // sample frames of silence inserted for gaps
+    uint64_t restarts;          // packet time went backwards or jumped past the ring
+};
+
+class AudioRing {
+public:
+    // capacityFrames is rounded up to a power of two
+    AudioRing(int channels, int sampleBytes, size_t capacityFrames);
+    ~AudioRing();
+
+    // Driver callback only. position is the first sample frame's packet time at 48 kHz
+    void Write(const void * packet, size_t frames, int64_t position);
+
+    // Copies the sample frames [position, position + frames) into dest. Any thread.
+    // False if any of them have not arrived yet, were overwritten or are from before a
+    // restart; dest may be partly written then.
+    bool Read(int64_t position, size_t frames, void * dest) const;
+
+    // The positions that can be read right now, [start, end)
+    void Available(int64_t & start, int64_t & end) const;
+
+    int Channels() const { return channels; }
+    int SampleBytes() const { return sampleBytes; }
+    size_t FrameBytes() const { return frameBytes; }
+    size_t Capacity() const { return capacity; }
+
+    AudioRingStats Stats() const;
+
+private:
+    void CopyIn(const void * packet, size_t frames, int64_t position);   // NULL packet writes silence
+    void Restart(int64_t position);
+
+    int channels;
+    int sampleBytes;
+    size_t frameBytes;
+    size_t capacity;
+    unsigned char * buffer;
+
+    // Readers check these around their copy, as in a seqlock. generation is odd during
+    // a restart; reserved moves ahead before samples are overwritten, committed after
+    // they were written.
+    std::atomic<uint32_t> generation;
+    std::atomic<int64_t> start;
+    std::atomic<int64_t> reserved;
+    std::atomic<int64_t> committed;
+    bool started;
+
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> samples;
+    std::atomic<uint64_t> silenceSamples;
+    std::atomic<uint64_t> restarts;
+
+    AudioRing(const AudioRing &);
+    AudioRing & operator=(const AudioRing &);
+};
+
+#endif
@@ -11,6 +11,8 @@
 
 @interface BlackMagicController : NSObject{
     std::vector<IDeckLink*>		deviceList;
+    dispatch_source_t           latencyLogTimer;
+    CaptureScheduler *          captureScheduler;
 
 }
 
@@ -23,4 +25,10 @@
 
 -(id)initWithNumItems:(int)numItems;
 
+// p50/p99/max of every LatencyTrace stage since the last reset, over all inputs
+-(NSString*) latencyStatistics;
+
+// CPU time, load and deadline misses of each input's processing thread
+-(NSString*) captureStatistics;
+
 @end
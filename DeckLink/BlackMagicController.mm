@@ -7,6 +7,9 @@
 //
 
 #import "BlackMagicController.h"
+#import "ConversionPool.h"
+#import "ThreadUtils.h"
+#import "LatencyTrace.h"
 
 @implementation BlackMagicController
 
@@ -14,9 +17,14 @@
 -(id)initWithNumItems:(int)numItems{
     self = [self init];
     if (self) {
+        uint64_t t0 = MonotonicNanos();
         
         self.items = [NSMutableArray array];
         
+        // The YUV conversion workers are shared by all devices. 0 threads means one per core
+        NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+        ConversionPool::ConfigureShared((int)[defaults integerForKey:@"conversionThreads"], [defaults boolForKey:@"conversionThreadAffinity"]);
+        
         IDeckLinkIterator*          deckLinkIterator = NULL;
         IDeckLink*                  deckLink = NULL;
         
@@ -30,27 +38,128 @@
                 deviceList.push_back(deckLink);
             }
         }
+        uint64_t t1 = MonotonicNanos();
+        
+        // Input mode by BMDDisplayMode, PAL unless set in the defaults. "inputDisplayMode2"
+        // etc. overrides it for a single input
+        BMDDisplayMode defaultMode = bmdModePAL;
+        if([defaults objectForKey:@"inputDisplayMode"]){
+            defaultMode = (BMDDisplayMode)[defaults integerForKey:@"inputDisplayMode"];
+        }
+        
+        // Open the devices concurrently, each one spends most of its time waiting on
+        // the driver, so startup takes as long as the slowest device
+        int numDevices = (int)MIN((size_t)numItems, deviceList.size());
+        std::vector<BMDDisplayMode> modes(numDevices, defaultMode);
+        for(int index=0;index<numDevices;index++){
+            NSString * key = [NSString stringWithFormat:@"inputDisplayMode%i", index+1];
+            if([defaults objectForKey:key]){
+                modes[index] = (BMDDisplayMode)[defaults integerForKey:key];
+            }
+        }
         
-        for(int index=0;index<numItems;index++){
-            //    for(int index=0;index<deviceList.size();index++){
-            int mode = 2;
-            /*    if(index == 1){
-             mode = 10;
-             }*/
-            if(deviceList.size()> index){
-                BlackMagicItem * newItem = [[BlackMagicItem alloc] initWithDecklink:deviceList[index] mode:mode];
-                if(newItem){
-                    newItem.index = index;
-                    [self.items addObject:newItem];
+        // A processing thread per input, "captureThreadCpu1" etc. pins it to a core and
+        // "captureNumaNode1" overrides the node its buffers go on. "captureThreadPriority"
+        // (1-99) raises all of them, SCHED_FIFO on Linux
+        std::vector<CaptureThreadConfig> threadConfigs(numDevices);
+        for(int index=0;index<numDevices;index++){
+            NSString * cpuKey = [NSString stringWithFormat:@"captureThreadCpu%i", index+1];
+            NSString * nodeKey = [NSString stringWithFormat:@"captureNumaNode%i", index+1];
+            threadConfigs[index].cpu = [defaults objectForKey:cpuKey] ? (int)[defaults integerForKey:cpuKey] : -1;
+            threadConfigs[index].priority = (int)[defaults integerForKey:@"captureThreadPriority"];
+            threadConfigs[index].numaNode = [defaults objectForKey:nodeKey] ? (int)[defaults integerForKey:nodeKey] : -1;
+        }
+        captureScheduler = new CaptureScheduler(threadConfigs);
+        CaptureScheduler * scheduler = captureScheduler;
+        
+        NSMutableArray * opened = [NSMutableArray arrayWithCapacity:numDevices];
+        for(int index=0;index<numDevices;index++){
+            [opened addObject:[NSNull null]];
+        }
+        NSLock * openedLock = [[NSLock alloc] init];
+        
+        dispatch_apply(numDevices, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t index){
+            BlackMagicItem * newItem = [[BlackMagicItem alloc] initWithDecklink:deviceList[index] displayMode:modes[index] captureDevice:scheduler->Device((int)index)];
+            if(newItem){
+                newItem.index = (int)index;
+                if([defaults boolForKey:@"sharedFrameBus"]){
+                    int slots = [defaults objectForKey:@"sharedFrameBusSlots"] ? (int)[defaults integerForKey:@"sharedFrameBusSlots"] : 8;
+                    [newItem publishOnFrameBus:[NSString stringWithFormat:@"/sh-input-%i", (int)index+1] slots:slots];
+                }
+                
+                // Pre-roll for the recorder, "prerollSeconds" for every input or
+                // "prerollSeconds1" etc. for one, capped at "prerollMemoryMB" (default 512)
+                // per input. "prerollCompress" keeps UYVY at 4:2:0 to fit more in it
+                double prerollSeconds = [BlackMagicItem prerollSecondsForInput:(int)index];
+                if(prerollSeconds > 0){
+                    double megabytes = [defaults objectForKey:@"prerollMemoryMB"] ? [defaults doubleForKey:@"prerollMemoryMB"] : 512;
+                    [newItem keepPreroll:prerollSeconds maxBytes:(size_t)(megabytes * 1048576) compress:[defaults boolForKey:@"prerollCompress"]];
                 }
+                [openedLock lock];
+                opened[index] = newItem;
+                [openedLock unlock];
+            }
+        });
+        uint64_t t2 = MonotonicNanos();
+        
+        for(int index=0;index<numDevices;index++){
+            if(opened[index] != [NSNull null]){
+                BlackMagicItem * item = opened[index];
+                NSLog(@"Device %i: %@", index+1, item.startupTimings);
+                [self.items addObject:item];
             }
         }
         
+        NSLog(@"Started %lu of %i inputs in %.1f ms (device list %.1f ms, bring-up %.1f ms)",
+              (unsigned long)self.items.count, numItems, (t2-t0)/1e6, (t1-t0)/1e6, (t2-t1)/1e6);
+        
+        // Frame latencies in the log every "latencyTraceLogSeconds", off by default
+        double logSeconds = [defaults doubleForKey:@"latencyTraceLogSeconds"];
+        if(logSeconds > 0){
+            latencyLogTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0));
+            dispatch_source_set_timer(latencyLogTimer, dispatch_time(DISPATCH_TIME_NOW, logSeconds * NSEC_PER_SEC), logSeconds * NSEC_PER_SEC, NSEC_PER_SEC / 10);
+            __weak BlackMagicController * weakSelf = self;
+            dispatch_source_set_event_handler(latencyLogTimer, ^{
+                NSLog(@"Frame latency since arrival:\n%@", [weakSelf latencyStatistics]);
+                NSLog(@"Capture threads:\n%@", [weakSelf captureStatistics]);
+            });
+            dispatch_resume(latencyLogTimer);
+        }
     }
     return self;
     
 }
 
+-(NSString *)latencyStatistics{
+    NSMutableString * statistics = [NSMutableString string];
+    for(int stage=0;stage<LatencyStageCount;stage++){
+        LatencyStats stats;
+        LatencyTraceGetStats((LatencyStage)stage, &stats);
+        [statistics appendFormat:@"%-10s %8llu frames  p50 %7.2f ms  p99 %7.2f ms  max %7.2f ms\n",
+         LatencyStageName((LatencyStage)stage), stats.count, stats.p50 / 1e6, stats.p99 / 1e6, stats.max / 1e6];
+    }
+    return statistics;
+}
+
+-(NSString *)captureStatistics{
+    NSMutableString * statistics = [NSMutableString string];
+    double totalLoad = 0;
+    for(BlackMagicItem * item in self.items){
+        CaptureDevice * device = captureScheduler->Device(item.index);
+        if(!device){
+            continue;
+        }
+        CaptureDeviceStats stats = device->Stats();
+        totalLoad += stats.load;
+        [statistics appendFormat:@"input %i  %8llu frames  cpu %6.2f ms/frame  load %5.1f%%  max %7.2f ms  deadline misses %llu%@%@%@\n",
+         item.index+1, stats.frames, stats.cpuMs, stats.load * 100, stats.maxMs, stats.deadlineMisses,
+         stats.pinned ? @"  pinned" : @"", stats.raised ? @"  raised" : @"",
+         stats.numaNode >= 0 ? [NSString stringWithFormat:@"  node %i", stats.numaNode] : @""];
+    }
+    [statistics appendFormat:@"total load %.2f of %i cores", totalLoad, HardwareConcurrency()];
+    return statistics;
+}
+
 -(NSArray*)getDeviceNameList{
     NSMutableArray*		nameList = [NSMutableArray array];
 	int					deviceIndex = 0;
@@ -9,43 +9,75 @@
 #import <Foundation/Foundation.h>
 #import "DeckLinkAPI.h"
 #import "DecklinkCallback.h"
+#import "PooledMemoryAllocator.h"
 
 @class BlackMagicItem;
 @protocol BlackMagicItemDelegate <NSObject>
 
 @optional
--(void)newFrameWithBufer:(CVPixelBufferRef)buffer image:(CIImage*)image item:(BlackMagicItem*)bmItem;
+// frame holds the pixels and timestamps, buffer wraps the same memory (ARGB, or 2vuy/v210
+// in native YUV mode). Keep a FrameRef (or retain the buffer) to use the frame after
+// returning, it is recycled otherwise. Called on the item's own serial queue in capture
+// order; frames are skipped (see frameStatistics) while it is several frames behind.
+-(void)newFrame:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer item:(BlackMagicItem*)bmItem;
 
 
 @end
 
 
 @interface BlackMagicItem : NSObject{
-    unsigned char * bytes;
-    dispatch_once_t onceMallocToken;
     int counter;
 }
 
 @property IDeckLinkInput  *  deckLinkInput;
 @property IDeckLinkOutput  *  deckLinkOutput;
 @property DecklinkCallback * callback;
+@property PooledMemoryAllocator * captureAllocator;
 @property IDeckLinkGLScreenPreviewHelper* glhelper;
 
 @property CIImage * inputImage;
 
+// Smaller, lower rate version of inputImage for the preview views, see the
+// "previewDownscale" and "previewInterval" defaults
+@property CIImage * previewImage;
+
 
 @property (readonly) NSString * name;
 @property NSString * modeDescription;
 @property int index;
 @property NSSize size;
-@property int mode;
+@property BMDDisplayMode displayMode;
+
+// How long each step of initWithDecklink took, for the startup log
+@property (readonly) NSString * startupTimings;
 
 @property id<BlackMagicItemDelegate> delegate;
 
 
--(id) initWithDecklink:(IDeckLink*)deckLink mode:(int)mode;
--(void) newFrame:(DecklinkCallback*)callback;
+// Can be called off the main thread, the controller opens all devices concurrently.
+// Frames are processed on captureDevice's thread
+-(id) initWithDecklink:(IDeckLink*)deckLink displayMode:(BMDDisplayMode)displayMode captureDevice:(CaptureDevice*)captureDevice;
+-(void) newFrame:(const FrameRef &)frame callback:(DecklinkCallback*)callback;
+
+// Wraps the frame without copying, the buffer holds a reference on it until released
+-(CVPixelBufferRef) createCVImageBufferFromFrame:(const FrameRef &)frame;
+
+// Received, processed and dropped frame counts and format change restarts for this input
+-(NSString*) frameStatistics;
+
+// Also publish the frames in shared memory under `name` (eg. "/sh-input-1") for
+// recorders and monitors running as separate processes, see SharedFrameBus.h
+-(void) publishOnFrameBus:(NSString*)name slots:(int)slots;
+
+// Keep the last `seconds` of frames, at most maxBytes of them, for recordings to start
+// from before record was pressed. compress stores UYVY at 4:2:0, see PrerollBuffer.h
+-(void) keepPreroll:(double)seconds maxBytes:(size_t)maxBytes compress:(BOOL)compress;
+
+// The pre-roll configured for the input, "prerollSeconds" for every input or
+// "prerollSeconds1" etc. for one
++(double) prerollSecondsForInput:(int)index;
 
--(CVPixelBufferRef) createCVImageBufferFromCallback:(DecklinkCallback*)callback;
+// Called on the main thread after the input was restarted in a newly detected mode
+-(void) inputFormatChanged:(BMDDisplayMode)displayMode name:(NSString*)modeName;
 
 @end
@@ -7,26 +7,69 @@
 //
 
 #import "BlackMagicItem.h"
+#import "DisplayModeTable.h"
+#import "ThreadUtils.h"
+#import "CIImage+LatencyTrace.h"
+#import "PreviewScaler.h"
+
+@interface BlackMagicItem (){
+    // Frames handed to recorderQueue that the delegate has not had yet, and the frames
+    // not handed over because maxRecorderBacklog already were
+    std::atomic<int> recorderBacklog;
+    int maxRecorderBacklog;
+    std::atomic<uint64_t> recorderDrops;
+    
+    // A preview is being made on previewQueue, frames that come meanwhile do not start one
+    std::atomic<bool> previewBusy;
+    // An update of inputImage and previewImage is queued on the main thread
+    std::atomic<bool> imagesPending;
+}
+
+// previewImage is scaled down by 2, 4 or 8 (0 for the full size input image) and
+// updated every previewInterval frames
+@property int previewDownscale;
+@property PreviewFilter previewFilter;
+@property int previewInterval;
+
+// Frames go to the delegate in order, next to the preview work
+@property dispatch_queue_t recorderQueue;
+@property dispatch_queue_t previewQueue;
+
+// Newest images for the main thread to pick up, see -postImages
+@property CIImage * pendingInputImage;
+@property CIImage * pendingPreviewImage;
+
+-(CVPixelBufferRef) createCVImageBufferWrappingFrame:(const FrameRef &)frame;
 
-@interface BlackMagicItem ()
 @end
 @implementation BlackMagicItem
 
 
 
 
--(id) initWithDecklink:(IDeckLink*)deckLink mode:(int)mode{
+-(id) initWithDecklink:(IDeckLink*)deckLink displayMode:(BMDDisplayMode)displayMode captureDevice:(CaptureDevice*)captureDevice{
     self = [self init];
     
     if(self){
-        self.mode = mode;
-        IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
-        
-        IDeckLinkDisplayMode*			displayMode = NULL;
-        std::vector<IDeckLinkDisplayMode*>	modeList;
+        uint64_t t0 = MonotonicNanos();
         
-        self.callback = new DecklinkCallback();
+        // Frames queued between the driver callback and the processing thread, and what
+        // to do when that queue is full (0 = drop oldest, 1 = drop newest, 2 = block)
+        NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+        int ringSize = (int)[defaults integerForKey:@"frameRingSize"];
+        if(ringSize <= 0){
+            ringSize = 4;
+        }
+        self.callback = new DecklinkCallback(captureDevice, ringSize, (FrameRingOverflowPolicy)[defaults integerForKey:@"frameRingOverflowPolicy"]);
         self.callback->delegate = self;
+        // Keep frames in UYVY for the recorder and loop-through, only the preview converts
+        self.callback->nativeYuv = [defaults boolForKey:@"nativeYuvCapture"];
+        // HD inputs are brought down to the 576 line PAL canvas as they arrive
+        // ("canvasScaler" lanczos3 or bicubic)
+        if([defaults boolForKey:@"normalizeToPal"]){
+            ScalerFilter filter = [[defaults stringForKey:@"canvasScaler"] isEqualToString:@"bicubic"] ? ScalerFilterBicubic : ScalerFilterLanczos3;
+            self.callback->canvasScaler = new PolyphaseScaler(self.callback->scalerPool, filter);
+        }
         
         // self.glhelper = CreateOpenGLScreenPreviewHelper();
         
@@ -40,62 +83,131 @@
         {
             NSLog(@"This application was unable to obtain IDeckLinkOutput for the selected device.");
         }
-        
+        uint64_t t1 = MonotonicNanos();
         
         //
-        // Retrieve and cache mode list
-        if (self.deckLinkInput->GetDisplayModeIterator(&displayModeIterator) == S_OK)
-        {
-            CFStringRef			modeName;
-            int i=0;
-            
-            while (displayModeIterator->Next(&displayMode) == S_OK){
-                modeList.push_back(displayMode);
-                
-                if (displayMode->GetName(&modeName) == S_OK)
-                {
-                    NSLog(@"Mode: %i %@",i++,(__bridge NSString *)modeName);
-                }
-            }
-            
-            displayModeIterator->Release();
+        // Mode list, cached in the user defaults after the first launch with this model
+        DisplayModeTable modes = DisplayModeTable::ForDevice(deckLink, self.deckLinkInput);
+        const DisplayModeEntry * modeEntry = modes.Find(displayMode);
+        if(!modeEntry){
+            NSLog(@"Display mode %08x is not supported by this input, using PAL", (unsigned)displayMode);
+            modeEntry = modes.Find(bmdModePAL);
         }
-        
-        
-        
+        uint64_t t2 = MonotonicNanos();
         
         // Set capture callback
         BMDVideoInputFlags		videoInputFlags = bmdVideoInputFlagDefault;
         
+        // Follow the signal when the card can detect its format, the callback restarts
+        // the input in the new mode (eg. a camera switching between 1080i and PAL)
+        IDeckLinkAttributes * attributes = NULL;
+        int64_t maxAudioChannels = 2;
+        if(deckLink->QueryInterface(IID_IDeckLinkAttributes, (void**)&attributes) == S_OK){
+            bool formatDetection = false;
+            if(attributes->GetFlag(BMDDeckLinkSupportsInputFormatDetection, &formatDetection) == S_OK && formatDetection){
+                videoInputFlags |= bmdVideoInputEnableFormatDetection;
+            }
+            attributes->GetInt(BMDDeckLinkMaximumAudioChannels, &maxAudioChannels);
+            attributes->Release();
+        }
+        
         self.deckLinkInput->SetCallback(self.callback);
         
+        // Loop-through on the same card's output ("loopThrough"), kept "playoutDepth"
+        // frames (default 3) ahead of the output's clock
+        BOOL loopThrough = [defaults boolForKey:@"loopThrough"] && self.deckLinkOutput;
+        int playoutDepth = [defaults objectForKey:@"playoutDepth"] ? (int)[defaults integerForKey:@"playoutDepth"] : 3;
+        
+        // Let the driver capture into our own recycled, page aligned buffers. The output
+        // holds on to the captured frames it has scheduled, and to the newest and last
+        // ones, so those stay out of the cache while it plays
+        unsigned cacheSize = ringSize + 4 + (loopThrough ? MAX(playoutDepth, 2) + 2 : 0);
+        self.captureAllocator = new PooledMemoryAllocator(cacheSize, [defaults boolForKey:@"captureHugePages"]);
+        self.captureAllocator->Pool().SetNumaNode(captureDevice->NumaNode());
+        self.recorderQueue = dispatch_queue_create("com.halfdanj.recorder", DISPATCH_QUEUE_SERIAL);
+        self.previewQueue = dispatch_queue_create("com.halfdanj.preview", DISPATCH_QUEUE_SERIAL);
+        recorderBacklog = 0;
+        maxRecorderBacklog = ringSize;
+        recorderDrops = 0;
+        previewBusy = false;
+        imagesPending = false;
+        
+        // Previews are converted and scaled down in one pass from the UYVY, at a lower
+        // rate than the input ("previewDownscale" 2, 4 or 8, "previewInterval" frames)
+        int previewDownscale = (int)[defaults integerForKey:@"previewDownscale"];
+        self.previewDownscale = (previewDownscale == 2 || previewDownscale == 4 || previewDownscale == 8) ? previewDownscale : 0;
+        self.previewFilter = [defaults boolForKey:@"previewBilinear"] ? PreviewFilterBilinear : PreviewFilterBox;
+        self.previewInterval = [defaults objectForKey:@"previewInterval"] ? (int)[defaults integerForKey:@"previewInterval"] : 2;
+        if(self.deckLinkInput->SetVideoInputFrameMemoryAllocator(self.captureAllocator) != S_OK){
+            NSLog(@"Could not set the capture memory allocator, using the driver's own buffers");
+        }
+        
         self.callback->decklinkOutput = self.deckLinkOutput;
         
         
         // Set the video input mode
-        CFStringRef			modeName;
-        modeList[self.mode]->GetName(&modeName);
-        self.modeDescription = (__bridge NSString*)modeName;
+        self.displayMode = modeEntry ? modeEntry->mode : bmdModePAL;
+        self.modeDescription = modeEntry ? [NSString stringWithUTF8String:modeEntry->name] : @"Unknown";
+        
+        // 10 bit v210 capture, previews are dithered down to 8 bit
+        BMDPixelFormat pixelFormat = [defaults boolForKey:@"captureTenBit"] ? bmdFormat10BitYUV : bmdFormat8BitYUV;
+        
+        self.callback->decklinkInput = self.deckLinkInput;
+        self.callback->pixelFormat = pixelFormat;
+        self.callback->inputFlags = videoInputFlags;
+        if(modeEntry){
+            self.callback->frameTimeScale = modeEntry->timeScale;
+        }
+        self.callback->deinterlacer->SetFieldDominance(modeEntry ? modeEntry->fieldDominance : bmdUnknownFieldDominance);
+        if(self.callback->canvasScaler){
+            self.callback->canvasScaler->SetFieldDominance(modeEntry ? modeEntry->fieldDominance : bmdUnknownFieldDominance);
+        }
         
-        if (self.deckLinkInput->EnableVideoInput(modeList[mode]->GetDisplayMode(), bmdFormat8BitYUV, videoInputFlags) != S_OK)
+        if (self.deckLinkInput->EnableVideoInput(self.displayMode, pixelFormat, videoInputFlags) != S_OK)
         {
             /*  [uiDelegate showErrorMessage:@"This application was unable to select the chosen video mode. Perhaps, the selected device is currently in-use." title:@"Error starting the capture"];
              return false;*/
             NSLog(@"This application was unable to select the chosen video mode. Perhaps, the selected device is currently in-use.");
         }
         
-        HRESULT				theResult;
-        /*   // Turn on video output
-         theResult = deckLinkOutputs[index]->EnableVideoOutput(modeList[2]->GetDisplayMode(), bmdVideoOutputFlagDefault);
-         if (theResult != S_OK)
-         printf("EnableVideoOutput failed with result %08x\n", (unsigned int)theResult);
-         //
-         theResult = deckLinkOutputs[index]->StartScheduledPlayback(0, 600, 1.0);
-         if (theResult != S_OK)
-         printf("StartScheduledPlayback failed with result %08x\n", (unsigned int)theResult);
-         */
+        // Embedded audio, 2, 8 or 16 channels of 16 or 32 bit samples as in the Capture sample.
+        // The ring holds "audioRingSeconds" (default 4) for consumers to pull from, and at
+        // least as much as the recorder can fall behind: the pre-roll a take starts from
+        // and the recorder's write queue, with a second to spare
+        if([defaults boolForKey:@"captureAudio"]){
+            int channels = (int)[defaults integerForKey:@"audioChannels"];
+            if(channels != 8 && channels != 16){
+                channels = 2;
+            }
+            if(channels > maxAudioChannels){
+                NSLog(@"This input has at most %lld audio channels, capturing 2", maxAudioChannels);
+                channels = 2;
+            }
+            BMDAudioSampleType sampleType = [defaults integerForKey:@"audioSampleDepth"] == 32 ? bmdAudioSampleType32bitInteger : bmdAudioSampleType16bitInteger;
+            double seconds = [defaults objectForKey:@"audioRingSeconds"] ? [defaults doubleForKey:@"audioRingSeconds"] : 4;
+            double queueSeconds = [defaults objectForKey:@"recorderQueueSeconds"] ? [defaults doubleForKey:@"recorderQueueSeconds"] : 2;
+            seconds = MAX(seconds, [BlackMagicItem prerollSecondsForInput:captureDevice->Index()] + queueSeconds + 1);
+            
+            if(self.deckLinkInput->EnableAudioInput(bmdAudioSampleRate48kHz, sampleType, channels) == S_OK){
+                self.callback->audioRing = new AudioRing(channels, sampleType / 8, (size_t)(seconds * bmdAudioSampleRate48kHz));
+            } else {
+                NSLog(@"This application was unable to enable audio input with %i channels of %i bit", channels, (int)sampleType);
+            }
+        }
+        
+        if(loopThrough && modeEntry){
+            PlayoutEngine * playout = new PlayoutEngine(self.deckLinkOutput, playoutDepth);
+            if(playout->Start(self.displayMode, modeEntry->frameDuration, modeEntry->timeScale)){
+                self.callback->playout = playout;
+            } else {
+                NSLog(@"This application was unable to enable the loop-through output");
+                delete playout;
+            }
+        }
         
         
+        uint64_t t3 = MonotonicNanos();
+        
         // Start the capture
         if (self.deckLinkInput->StartStreams() != S_OK)
         {
@@ -103,9 +215,10 @@
             /*  [uiDelegate showErrorMessage:@"This application was unable to start the capture. Perhaps, the selected device is currently in-use." title:@"Error starting the capture"];
              return false;*/
         }
+        uint64_t t4 = MonotonicNanos();
         
-        
-        
+        _startupTimings = [NSString stringWithFormat:@"interfaces %.1f ms, %lu modes %.1f ms%@, enable input %.1f ms, start streams %.1f ms",
+                           (t1-t0)/1e6, modes.Count(), (t2-t1)/1e6, modes.FromCache() ? @" (cached)" : @"", (t3-t2)/1e6, (t4-t3)/1e6];
         
         // result = true;
     }
@@ -115,13 +228,12 @@
 }
 
 
-static dispatch_once_t onceToken;
+// Runs on the device's thread and never waits for the other queues. The recorder and
+// the scaled preview run on their own serial queues, the main thread is only told to
+// pick up the newest images
+-(void) newFrame:(const FrameRef &)frame callback:(DecklinkCallback*)callback{
 
--(void) newFrame:(DecklinkCallback*)callback{
-
-    callback->delegateBusy = YES;
-    //        CVPixelBufferRef buffer = [self createCVImageBufferFromCallback:callback];
-    CVPixelBufferRef buffer = callback->buffer;
+    CVPixelBufferRef buffer = [self createCVImageBufferFromFrame:frame];
     if(!buffer){
         NSLog(@"No buffer");
     } else {
@@ -143,39 +255,73 @@ static dispatch_once_t onceToken;
          
          */
         
-        //         unsigned t0=clock(),t1;
-        
-        
-          dispatch_group_t group = dispatch_group_create();
-         dispatch_queue_t queue = dispatch_queue_create("com.halfdanj.imageWithCVImage", 0);
-         dispatch_queue_t queue2 = dispatch_queue_create("com.halfdanj.recorder", DISPATCH_QUEUE_SERIAL);
-         
-        __block CIImage * image;
-        dispatch_group_async(group, queue, ^{
-        image = [CIImage imageWithCVImageBuffer:buffer];
-                });
+        // The block gets its own references, the frame stays valid until it is done. A
+        // recorder that falls a ring's worth of frames behind has frames dropped for it
+        // (counted in frameStatistics) rather than holding on to more capture buffers
+        if(recorderBacklog.fetch_add(1) < maxRecorderBacklog){
+            FrameRef recorderFrame = frame;
+            CVPixelBufferRetain(buffer);
+            dispatch_async(self.recorderQueue, ^{
+                [self.delegate newFrame:recorderFrame buffer:buffer item:self];
+                CVPixelBufferRelease(buffer);
+                recorderBacklog--;
+            });
+        } else {
+            recorderBacklog--;
+            recorderDrops++;
+        }
         
+        // The preview needs RGB, in native YUV mode this is where the frame gets converted.
+        // When Filters has picked a CPU deinterlacer it runs first, still on the UYVY
+        CIImage * image = nil;
+        FrameRef argbFrame = callback->deinterlacer->Process(frame, DeinterlacerMode())->Argb();
+        if(argbFrame.Get() == frame.Get()){
+            image = [CIImage imageWithCVImageBuffer:buffer];
+        } else if(argbFrame){
+            CVPixelBufferRef argbBuffer = [self createCVImageBufferFromFrame:argbFrame];
+            if(argbBuffer){
+                image = [CIImage imageWithCVImageBuffer:argbBuffer];
+                CVPixelBufferRelease(argbBuffer);
+            }
+        }
         
-         dispatch_group_async(group, queue2, ^{
-         [self.delegate newFrameWithBufer:buffer image:nil item:self];
-         });
-         
-         dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
-         
-        //   t1=clock()-t0;
-        // printf("%i\n",t1);
+        // The CIImage retains the buffer for as long as it is drawn
+        CVPixelBufferRelease(buffer);
         
         if(!image){
             NSLog(@"No image");
-        } else {
-            dispatch_sync(dispatch_get_main_queue(), ^{
-                self.inputImage  = image;
-             });
+            return;
         }
+        [image setLatencyArrivalTime:frame->timestamps.arrivalTime];
+        LatencyTraceRecord(LatencyStageConvert, frame->timestamps.arrivalTime);
+        self.pendingInputImage = image;
+        
+        // Only native UYVY frames can be scaled in one pass, the previews show the input
+        // image otherwise. A preview still being made skips this one
+        BOOL updatePreview = self.previewInterval <= 1 || counter++ % self.previewInterval == 0;
+        if(updatePreview && !self.previewDownscale){
+            self.pendingPreviewImage = image;
+        } else if(updatePreview && !previewBusy.exchange(true)){
+            FrameRef previewFrame = frame;
+            dispatch_async(self.previewQueue, ^{
+                CIImage * preview = nil;
+                FrameRef scaled = DownscaleToArgb(self.callback->previewPool, previewFrame, self.previewDownscale, self.previewFilter);
+                if(scaled){
+                    CVPixelBufferRef previewBuffer = [self createCVImageBufferWrappingFrame:scaled];
+                    if(previewBuffer){
+                        preview = [CIImage imageWithCVImageBuffer:previewBuffer];
+                        CVPixelBufferRelease(previewBuffer);
+                    }
+                }
+                self.pendingPreviewImage = preview ? preview : image;
+                previewBusy = false;
+                [self postImages];
+            });
+        }
+        
+        [self postImages];
     }
     
-    callback->delegateBusy = NO;
-    
     // }
     /*
      CoreImageViewer * preview = nil;
@@ -288,6 +434,91 @@ static dispatch_once_t onceToken;
     //  NSLog(@"--New Frame stop");
 }
 
+// At most one update is queued on the main thread. When it falls behind it gets the
+// newest images, not a backlog of old ones holding on to their frames
+-(void) postImages{
+    if(imagesPending.exchange(true)){
+        return;
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        // Cleared first, images set from here on are picked up by the next update
+        imagesPending = false;
+        CIImage * input = self.pendingInputImage;
+        CIImage * preview = self.pendingPreviewImage;
+        if(input && input != self.inputImage){
+            self.inputImage = input;
+        }
+        if(preview && preview != self.previewImage){
+            self.previewImage = preview;
+        }
+    });
+}
+
+-(NSString *)frameStatistics{
+    FrameRingStats stats = self.callback->GetFrameStats();
+    FormatChangeStats formatStats = self.callback->GetFormatChangeStats();
+    NSString * statistics = [NSString stringWithFormat:@"received %llu processed %llu dropped oldest %llu dropped newest %llu queued %lu/%lu format changes %llu restart %.1f ms (max %.1f ms) recorder busy %llu",
+            stats.received, stats.processed, stats.droppedOldest, stats.droppedNewest, stats.depth, stats.capacity,
+            formatStats.changes, formatStats.lastRestartMs, formatStats.maxRestartMs, recorderDrops.load()];
+    
+    if(self.callback->audioRing){
+        AudioRingStats audioStats = self.callback->audioRing->Stats();
+        statistics = [statistics stringByAppendingFormat:@" audio packets %llu silence inserted %llu restarts %llu",
+                      audioStats.packets, audioStats.silenceSamples, audioStats.restarts];
+    }
+    
+    if(self.callback->playout){
+        PlayoutStats playoutStats = self.callback->playout->Stats();
+        statistics = [statistics stringByAppendingFormat:@" output %llu late %llu dropped %llu repeated %llu skipped %llu buffered %u/%u",
+                      playoutStats.completed, playoutStats.late, playoutStats.dropped, playoutStats.repeated, playoutStats.skipped,
+                      playoutStats.buffered, playoutStats.depth];
+    }
+    
+    SharedFrameBus * bus = self.callback->frameBus.load();
+    if(bus){
+        statistics = [statistics stringByAppendingFormat:@" shared %llu failed %llu", bus->Published(), bus->Failed()];
+    }
+    
+    PrerollBuffer * preroll = self.callback->preroll.load();
+    if(preroll){
+        PrerollStats prerollStats = preroll->Stats();
+        statistics = [statistics stringByAppendingFormat:@" preroll %lu frames %.1f s %.0f MB not kept %llu",
+                      prerollStats.frames, prerollStats.seconds, prerollStats.bytes / 1048576.0, prerollStats.failed];
+    }
+    return statistics;
+}
+
+-(void) publishOnFrameBus:(NSString*)name slots:(int)slots{
+    if(self.callback->frameBus.load()){
+        return;
+    }
+    self.callback->frameBus = new SharedFrameBus([name UTF8String], slots);
+}
+
+-(void) keepPreroll:(double)seconds maxBytes:(size_t)maxBytes compress:(BOOL)compress{
+    if(self.callback->preroll.load() || seconds <= 0){
+        return;
+    }
+    // Audio for the pre-roll frames comes from the audio ring as well
+    AudioRing * audioRing = self.callback->audioRing;
+    if(audioRing && audioRing->Capacity() < (seconds + 1) * bmdAudioSampleRate48kHz){
+        NSLog(@"Input %i: audio ring is shorter than the %.1f s pre-roll, raise audioRingSeconds or the take starts without sound", self.index+1, seconds);
+    }
+    self.callback->preroll = new PrerollBuffer(self.callback->prerollPool, seconds, maxBytes, compress);
+}
+
++(double) prerollSecondsForInput:(int)index{
+    NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+    NSString * key = [NSString stringWithFormat:@"prerollSeconds%i", index+1];
+    double seconds = [defaults objectForKey:key] ? [defaults doubleForKey:key] : [defaults doubleForKey:@"prerollSeconds"];
+    return MAX(seconds, 0);
+}
+
+-(void) inputFormatChanged:(BMDDisplayMode)displayMode name:(NSString*)modeName{
+    self.displayMode = displayMode;
+    self.modeDescription = modeName;
+}
+
 -(NSString *)name{
     return [NSString stringWithFormat:@"%i - %@",self.index+1, self.modeDescription];
 }
@@ -297,39 +528,58 @@ static dispatch_once_t onceToken;
 }
 
 
+// Called when the last user of a CVPixelBuffer from createCVImageBufferFromFrame is done
 void MyPixelBufferReleaseCallback(void *releaseRefCon, const void *baseAddress){
-    //   NSLog(@" release %i",baseAddress);
-    //   delete (unsigned char*)baseAddress;
-    
+    ((VideoFrame*)releaseRefCon)->Release();
 }
 
 
 
 
--(CVPixelBufferRef) createCVImageBufferFromCallback:(DecklinkCallback*)callback{
-    int w = callback->w;
-    int h = callback->h;
+-(CVPixelBufferRef) createCVImageBufferFromFrame:(const FrameRef &)frame{
+    int w = frame->Width();
+    int h = frame->Height();
     
     if(self.size.width != w || self.size.height != h)
         self.size = NSMakeSize(w, h);
-    //  unsigned char * bytes = callback->bytes;
     
   //  NSLog(@"%i %i",w,h);
     
-    dispatch_once(&onceMallocToken, ^{
-        bytes = (unsigned char * ) malloc(callback->w*callback->h*4 * sizeof(unsigned char)) ;
-    });
-    
-    memcpy(bytes, callback->bytes, callback->w*callback->h*4);
-    //    NSLog(@" create %i",bytes);
-    
+    return [self createCVImageBufferWrappingFrame:frame];
+}
+
+// Same without taking the frame's size as the input's, for the scaled previews
+-(CVPixelBufferRef) createCVImageBufferWrappingFrame:(const FrameRef &)frame{
+    int w = frame->Width();
+    int h = frame->Height();
     
-    NSDictionary *d = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithBool:YES], kCVPixelBufferCGImageCompatibilityKey, [NSNumber numberWithBool:YES], kCVPixelBufferCGBitmapContextCompatibilityKey, nil];
+    // No copy, the buffer wraps the frame's own memory and drops its reference when released
+    OSType pixelFormat;
+    NSDictionary *d = nil;
+    switch(frame->PixelFormat()){
+        case bmdFormat8BitARGB:
+            pixelFormat = k32ARGBPixelFormat;
+            d = [NSDictionary dictionaryWithObjectsAndKeys:[NSNumber numberWithBool:YES], kCVPixelBufferCGImageCompatibilityKey, [NSNumber numberWithBool:YES], kCVPixelBufferCGBitmapContextCompatibilityKey, nil];
+            break;
+        case bmdFormat8BitYUV:
+            pixelFormat = kCVPixelFormatType_422YpCbCr8;
+            break;
+        case bmdFormat10BitYUV:
+            pixelFormat = kCVPixelFormatType_422YpCbCr10;
+            break;
+        default:
+            NSLog(@"No CVPixelBuffer format for frame format %u", (unsigned)frame->PixelFormat());
+            return NULL;
+    }
     
     
     CVPixelBufferRef buffer = NULL;
     
-    CVPixelBufferCreateWithBytes(kCFAllocatorDefault, w, h, k32ARGBPixelFormat, bytes, 4*w, (CVPixelBufferReleaseBytesCallback )MyPixelBufferReleaseCallback, (void*)bytes, (__bridge CFDictionaryRef)d, &buffer);
+    VideoFrame * ref = FrameRef(frame).Detach();
+    if(CVPixelBufferCreateWithBytes(kCFAllocatorDefault, w, h, pixelFormat, ref->Bytes(), ref->RowBytes(), (CVPixelBufferReleaseBytesCallback )MyPixelBufferReleaseCallback, (void*)ref, (__bridge CFDictionaryRef)d, &buffer) != kCVReturnSuccess){
+        ref->Release();
+        buffer = NULL;
+    }
     // NSLog(@"buffer %i",buffer);
     return buffer;
 }
@@ -0,0 +1,172 @@
+//
+//  BufferPool.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "BufferPool.h"
+
+#include <sys/mman.h>
+#include <stdio.h>
+
+#ifdef __APPLE__
+#include <mach/vm_statistics.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+static const size_t kHugePageSize = 2*1024*1024;
+
+// Sizes with buffers cached, enough for a frame, its ARGB conversion and a couple of
+// other stages sharing the pool. Sizes not used for longest go first, eg. after a
+// format change
+static const size_t kCachedSizes = 4;
+
+BufferPool::BufferPool(unsigned cacheSize, bool useHugePages) : acquires(0), cacheSize(cacheSize), useHugePages(useHugePages), warnedHugePages(false), numaNode(-1)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(std::map<void*, Allocation>::iterator it = allocations.begin(); it != allocations.end(); ++it){
+        munmap(it->first, it->second.mappedSize);
+    }
+}
+
+void * BufferPool::AllocatePages(size_t size)
+{
+    void * buffer = MAP_FAILED;
+    Allocation allocation = { size, size, false };
+
+    if(useHugePages){
+        size_t hugeSize = (size + kHugePageSize - 1) & ~(kHugePageSize - 1);
+#if defined(__APPLE__)
+        buffer = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, VM_FLAGS_SUPERPAGE_SIZE_2MB, 0);
+#elif defined(MAP_HUGETLB)
+        buffer = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+#endif
+        if(buffer != MAP_FAILED){
+            allocation.mappedSize = hugeSize;
+            allocation.hugePages = true;
+        } else {
+            // Not enough reserved large pages, fall back to normal ones
+            if(!warnedHugePages){
+                fprintf(stderr, "BufferPool: no huge pages for %zu bytes, using 4K pages\n", size);
+                warnedHugePages = true;
+            }
+        }
+    }
+
+    if(buffer == MAP_FAILED){
+        buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        if(buffer == MAP_FAILED){
+            return NULL;
+        }
+    }
+
+#if defined(__linux__) && defined(SYS_mbind)
+    // Before anything touches the pages, so they are faulted in on the node. Only a
+    // preference, the kernel falls back to other nodes when this one is full
+    if(numaNode >= 0 && numaNode < 64){
+        unsigned long mask = 1UL << numaNode;
+        if(syscall(SYS_mbind, buffer, allocation.mappedSize, MPOL_PREFERRED, &mask, 64, 0) != 0){
+            fprintf(stderr, "BufferPool: could not place buffers on NUMA node %d\n", numaNode);
+            numaNode = -1;
+        }
+    }
+#endif
+
+    allocations[buffer] = allocation;
+    return buffer;
+}
+
+void BufferPool::FreePages(void * buffer)
+{
+    std::map<void*, Allocation>::iterator it = allocations.find(buffer);
+    if(it != allocations.end()){
+        munmap(buffer, it->second.mappedSize);
+        allocations.erase(it);
+    }
+}
+
+void BufferPool::FreeCache(SizeCache & sizeCache)
+{
+    for(size_t i=0;i<sizeCache.buffers.size();i++){
+        FreePages(sizeCache.buffers[i]);
+    }
+    sizeCache.buffers.clear();
+}
+
+void * BufferPool::Acquire(size_t size)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    SizeCache & sizeCache = cache[size];
+    sizeCache.lastUsed = ++acquires;
+
+    if(cache.size() > kCachedSizes){
+        std::map<size_t, SizeCache>::iterator oldest = cache.begin();
+        for(std::map<size_t, SizeCache>::iterator it = cache.begin(); it != cache.end(); ++it){
+            if(it->second.lastUsed < oldest->second.lastUsed){
+                oldest = it;
+            }
+        }
+        FreeCache(oldest->second);
+        cache.erase(oldest);
+    }
+
+    if(!sizeCache.buffers.empty()){
+        // Most recently released buffer is the most likely to still be in cache
+        void * buffer = sizeCache.buffers.back();
+        sizeCache.buffers.pop_back();
+        return buffer;
+    }
+
+    return AllocatePages(size);
+}
+
+void BufferPool::Release(void * buffer)
+{
+    if(!buffer){
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<void*, Allocation>::iterator it = allocations.find(buffer);
+    if(it == allocations.end()){
+        return;
+    }
+
+    // Buffers of a size no longer cached (eg. from before a format change) are freed
+    std::map<size_t, SizeCache>::iterator sizeCache = cache.find(it->second.size);
+    if(sizeCache != cache.end() && sizeCache->second.buffers.size() < cacheSize){
+        sizeCache->second.buffers.push_back(buffer);
+    } else {
+        FreePages(buffer);
+    }
+}
+
+void BufferPool::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(std::map<size_t, SizeCache>::iterator it = cache.begin(); it != cache.end(); ++it){
+        FreeCache(it->second);
+    }
+    cache.clear();
+}
+
+void BufferPool::SetNumaNode(int node)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    numaNode = node;
+}
+
+size_t BufferPool::AllocatedCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocations.size();
+}
@@ -0,0 +1,75 @@
+//
+//  BufferPool.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Recycling pool of page aligned frame buffers. Buffers come straight from mmap, so
+//  they are aligned for SIMD and DMA, and can optionally be backed by 2 MB pages to
+//  take TLB pressure off the full-frame passes.
+//
+//  Released buffers are kept per size, so a pool handing out both a frame and its
+//  ARGB conversion reuses both. Only the most recently used few sizes are kept.
+//
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <mutex>
+
+class BufferPool {
+public:
+    // cacheSize is how many released buffers of each size are kept around for reuse
+    BufferPool(unsigned cacheSize, bool useHugePages);
+    ~BufferPool();
+
+    // Returns a buffer of at least `size` bytes, reusing a released one if possible
+    void * Acquire(size_t size);
+
+    // Hands a buffer from Acquire() back. Thread safe, can be called from any thread.
+    void Release(void * buffer);
+
+    // Frees all cached buffers. Buffers still out are freed when they come back.
+    void Flush();
+
+    // Buffers currently allocated, cached or not
+    size_t AllocatedCount();
+
+    // Places buffers allocated from now on in memory of NUMA `node` (Linux only, -1 for
+    // the default first touch placement)
+    void SetNumaNode(int node);
+
+private:
+    struct Allocation {
+        size_t size;            // as asked for in Acquire()
+        size_t mappedSize;
+        bool hugePages;
+    };
+
+    struct SizeCache {
+        std::vector<void*> buffers;
+        uint64_t lastUsed;
+    };
+
+    void * AllocatePages(size_t size);
+    void FreePages(void * buffer);
+    void FreeCache(SizeCache & sizeCache);
+
+    std::mutex mutex;
+    std::map<size_t, SizeCache> cache;
+    std::map<void*, Allocation> allocations;
+    uint64_t acquires;
+    unsigned cacheSize;
+    bool useHugePages;
+    bool warnedHugePages;
+    int numaNode;
+
+    BufferPool(const BufferPool &);
+    BufferPool & operator=(const BufferPool &);
+};
+
+#endif
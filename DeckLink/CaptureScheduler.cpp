@@ -0,0 +1,110 @@
+//
+//  CaptureScheduler.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "CaptureScheduler.h"
+#include "ThreadUtils.h"
+
+#include <stdio.h>
+
+CaptureDevice::CaptureDevice(int index, const CaptureThreadConfig & config)
+: index(index), config(config), frameCpuStart(0), firstFrameTime(0), frames(0), deadlineMisses(0),
+  cpuNanos(0), maxNanos(0), pinned(false), raised(false)
+{
+    numaNode = config.numaNode;
+    if(numaNode < 0 && config.cpu >= 0){
+        numaNode = NumaNodeOfCpu(config.cpu);
+    }
+}
+
+void CaptureDevice::Start(std::function<void()> loop)
+{
+    thread = std::thread(&CaptureDevice::Run, this, loop);
+}
+
+void CaptureDevice::Join()
+{
+    if(thread.joinable()){
+        thread.join();
+    }
+}
+
+void CaptureDevice::Run(std::function<void()> loop)
+{
+    if(config.cpu >= 0){
+        pinned = SetCurrentThreadAffinity(config.cpu);
+        if(!pinned){
+            fprintf(stderr, "CaptureScheduler: could not pin input %d to cpu %d\n", index+1, config.cpu);
+        }
+    }
+    if(config.priority > 0){
+        raised = SetCurrentThreadPriority(config.priority);
+        if(!raised){
+            fprintf(stderr, "CaptureScheduler: priority %d refused for input %d\n", config.priority, index+1);
+        }
+    }
+    loop();
+}
+
+void CaptureDevice::FrameStarted()
+{
+    frameCpuStart = CurrentThreadCpuNanos();
+}
+
+void CaptureDevice::FrameFinished(uint64_t arrivalTime, uint64_t deadline)
+{
+    uint64_t now = MonotonicNanos();
+    cpuNanos.fetch_add(CurrentThreadCpuNanos() - frameCpuStart, std::memory_order_relaxed);
+
+    uint64_t first = 0;
+    firstFrameTime.compare_exchange_strong(first, now, std::memory_order_relaxed);
+    frames.fetch_add(1, std::memory_order_relaxed);
+    if(now > deadline){
+        deadlineMisses.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint64_t elapsed = now > arrivalTime ? now - arrivalTime : 0;
+    if(elapsed > maxNanos.load(std::memory_order_relaxed)){
+        maxNanos.store(elapsed, std::memory_order_relaxed);
+    }
+}
+
+CaptureDeviceStats CaptureDevice::Stats() const
+{
+    CaptureDeviceStats stats;
+    stats.frames = frames.load(std::memory_order_relaxed);
+    stats.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+    uint64_t cpu = cpuNanos.load(std::memory_order_relaxed);
+    stats.cpuMs = stats.frames ? cpu / 1e6 / stats.frames : 0;
+    stats.maxMs = maxNanos.load(std::memory_order_relaxed) / 1e6;
+    uint64_t first = firstFrameTime.load(std::memory_order_relaxed);
+    uint64_t wall = first ? MonotonicNanos() - first : 0;
+    stats.load = wall ? (double)cpu / wall : 0;
+    stats.pinned = pinned;
+    stats.raised = raised;
+    stats.numaNode = numaNode;
+    return stats;
+}
+
+CaptureScheduler::CaptureScheduler(const std::vector<CaptureThreadConfig> & configs)
+{
+    for(size_t i=0;i<configs.size();i++){
+        devices.push_back(new CaptureDevice((int)i, configs[i]));
+    }
+}
+
+// The devices' loops have to have returned, the callbacks join them when they go
+CaptureScheduler::~CaptureScheduler()
+{
+    for(size_t i=0;i<devices.size();i++){
+        devices[i]->Join();
+        delete devices[i];
+    }
+}
+
+CaptureDevice * CaptureScheduler::Device(int index)
+{
+    return index >= 0 && index < (int)devices.size() ? devices[index] : NULL;
+}
@@ -0,0 +1,100 @@
+//
+//  CaptureScheduler.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  One processing thread per capture device, owned by the BlackMagicController. Each
+//  thread can be pinned to a core and raised above normal threads, and the device's
+//  frame buffers placed on that core's NUMA node, so the inputs stop competing for
+//  whichever cores the system picks.
+//
+//  The thread times every frame it processes: CPU time it spent and whether it was done
+//  within a frame duration of the frame's arrival. Work handed to the ConversionPool
+//  or to dispatch queues is not in the CPU time, the deadline covers it.
+//
+
+#ifndef CAPTURESCHEDULER_H
+#define CAPTURESCHEDULER_H
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+struct CaptureThreadConfig {
+    int cpu;            // core to pin the thread to, -1 to leave it to the system
+    int priority;       // 1-99 for SCHED_FIFO / precedence, 0 for a normal thread
+    int numaNode;       // node for the device's buffers, -1 for the pinned core's node
+};
+
+struct CaptureDeviceStats {
+    uint64_t frames;
+    uint64_t deadlineMisses;    // finished more than a frame duration after arrival
+    double cpuMs;               // per frame, average
+    double maxMs;               // longest frame, arrival to finished
+    double load;                // CPU time over wall time since the first frame, 1 is a whole core
+    bool pinned;
+    bool raised;                // priority was granted
+    int numaNode;
+};
+
+class CaptureDevice {
+public:
+    // Runs `loop` on the device's thread, set up as configured. Once per device
+    void Start(std::function<void()> loop);
+    void Join();
+
+    // On the device's thread, around each frame. deadline is in MonotonicNanos()
+    void FrameStarted();
+    void FrameFinished(uint64_t arrivalTime, uint64_t deadline);
+
+    CaptureDeviceStats Stats() const;
+
+    // Where the device's buffers should go, -1 for anywhere
+    int NumaNode() const { return numaNode; }
+    int Index() const { return index; }
+
+private:
+    friend class CaptureScheduler;
+    CaptureDevice(int index, const CaptureThreadConfig & config);
+
+    void Run(std::function<void()> loop);
+
+    int index;
+    CaptureThreadConfig config;
+    int numaNode;
+    std::thread thread;
+
+    uint64_t frameCpuStart;
+    std::atomic<uint64_t> firstFrameTime;
+    std::atomic<uint64_t> frames;
+    std::atomic<uint64_t> deadlineMisses;
+    std::atomic<uint64_t> cpuNanos;
+    std::atomic<uint64_t> maxNanos;
+    std::atomic<bool> pinned;
+    std::atomic<bool> raised;
+
+    CaptureDevice(const CaptureDevice &);
+    CaptureDevice & operator=(const CaptureDevice &);
+};
+
+class CaptureScheduler {
+public:
+    // One device per config, in input order
+    CaptureScheduler(const std::vector<CaptureThreadConfig> & configs);
+    ~CaptureScheduler();
+
+    // NULL past the configured devices
+    CaptureDevice * Device(int index);
+    int Count() const { return (int)devices.size(); }
+
+private:
+    std::vector<CaptureDevice*> devices;
+
+    CaptureScheduler(const CaptureScheduler &);
+    CaptureScheduler & operator=(const CaptureScheduler &);
+};
+
+#endif
@@ -0,0 +1,159 @@
+//
+//  ConversionPool.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "ConversionPool.h"
+#include "ThreadUtils.h"
+
+#include <atomic>
+#include <algorithm>
+
+struct ConversionPool::Job {
+    TileFunc func;
+    void * context;
+    int rows;
+    int rowsPerTile;
+    int numSlices;
+
+    std::atomic<int> next[kMaxSlices];
+    int end[kMaxSlices];
+
+    // Workers currently inside RunTiles for this job, guarded by the pool mutex
+    int users;
+};
+
+static int  sharedThreads = 0;
+static bool sharedPin = false;
+
+void ConversionPool::ConfigureShared(int numThreads, bool pinThreads)
+{
+    sharedThreads = numThreads;
+    sharedPin = pinThreads;
+}
+
+ConversionPool & ConversionPool::Shared()
+{
+    static ConversionPool pool(sharedThreads, sharedPin);
+    return pool;
+}
+
+ConversionPool::ConversionPool(int numThreads, bool pinThreads) : stop(false)
+{
+    if(numThreads <= 0){
+        numThreads = std::max(1, HardwareConcurrency() - 1);
+    }
+    jobs.reserve(16);
+    for(int i=0;i<numThreads;i++){
+        threads.push_back(std::thread(&ConversionPool::WorkerLoop, this, i, pinThreads));
+    }
+}
+
+ConversionPool::~ConversionPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    workAvailable.notify_all();
+    for(size_t i=0;i<threads.size();i++){
+        threads[i].join();
+    }
+}
+
+int ConversionPool::RowsPerTile(int rows, long inRowBytes, long outRowBytes)
+{
+    long rowsPerTile = (long)(L2CacheSize() / 2) / std::max(1L, inRowBytes + outRowBytes);
+    return (int)std::max(1L, std::min((long)rows, rowsPerTile));
+}
+
+void ConversionPool::RunTiles(Job * job, int slice)
+{
+    // Drain our own slice first, then steal from the others
+    for(int i=0;i<job->numSlices;i++){
+        int s = (slice + i) % job->numSlices;
+        int tile;
+        while((tile = job->next[s].fetch_add(1, std::memory_order_relaxed)) < job->end[s]){
+            int firstRow = tile * job->rowsPerTile;
+            int numRows = std::min(job->rowsPerTile, job->rows - firstRow);
+            job->func(job->context, firstRow, numRows);
+        }
+    }
+}
+
+void ConversionPool::WorkerLoop(int index, bool pin)
+{
+    if(pin){
+        SetCurrentThreadAffinity(index);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!stop){
+        if(jobs.empty()){
+            workAvailable.wait(lock);
+            continue;
+        }
+
+        // Spread the workers over the jobs that are running concurrently
+        Job * job = jobs[index % jobs.size()];
+        job->users++;
+        lock.unlock();
+
+        RunTiles(job, (index + 1) % job->numSlices);
+
+        lock.lock();
+        // Every tile has been claimed, so nobody else should pick it up
+        std::vector<Job*>::iterator it = std::find(jobs.begin(), jobs.end(), job);
+        if(it != jobs.end()){
+            jobs.erase(it);
+        }
+        if(--job->users == 0){
+            jobReleased.notify_all();
+        }
+    }
+}
+
+void ConversionPool::ParallelRows(int rows, int rowsPerTile, TileFunc func, void * context)
+{
+    if(rows <= 0){
+        return;
+    }
+    rowsPerTile = std::max(1, rowsPerTile);
+
+    int numTiles = (rows + rowsPerTile - 1) / rowsPerTile;
+
+    Job job;
+    job.func = func;
+    job.context = context;
+    job.rows = rows;
+    job.rowsPerTile = rowsPerTile;
+    job.numSlices = std::min(std::min((int)threads.size() + 1, numTiles), (int)kMaxSlices);
+    job.users = 0;
+
+    for(int s=0;s<job.numSlices;s++){
+        job.next[s].store(s * numTiles / job.numSlices, std::memory_order_relaxed);
+        job.end[s] = (s+1) * numTiles / job.numSlices;
+    }
+
+    if(numTiles > 1){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(&job);
+        }
+        workAvailable.notify_all();
+    }
+
+    RunTiles(&job, 0);
+
+    // All tiles are claimed once we get here, wait for the ones still running elsewhere
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<Job*>::iterator it = std::find(jobs.begin(), jobs.end(), &job);
+    if(it != jobs.end()){
+        jobs.erase(it);
+    }
+    while(job.users > 0){
+        jobReleased.wait(lock);
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  ConversionPool.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Long lived worker pool for the per frame pixel work (YUV conversion and friends).
+//  One pool is shared by all capture devices, so three cards converting at the same
+//  time split the cores between them instead of each spinning up its own threads.
+//
+//  A job is cut into tiles of whole rows. Each participating thread owns a contiguous
+//  slice of tiles and steals from the other slices when its own runs dry.
+//
+
+#ifndef CONVERSIONPOOL_H
+#define CONVERSIONPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+class ConversionPool {
+public:
+    typedef void (*TileFunc)(void * context, int firstRow, int numRows);
+
+    // Must be called before the first Shared(). numThreads <= 0 means one worker per core
+    // (minus the calling thread, which helps out)
+    static void ConfigureShared(int numThreads, bool pinThreads);
+    static ConversionPool & Shared();
+
+    ConversionPool(int numThreads, bool pinThreads);
+    ~ConversionPool();
+
+    // Runs func over rows [0, rows) in tiles of rowsPerTile rows and returns when every
+    // tile is done. The calling thread works on the job too. Safe to call from several
+    // threads at once.
+    void ParallelRows(int rows, int rowsPerTile, TileFunc func, void * context);
+
+    template<typename F>
+    void ParallelRows(int rows, int rowsPerTile, F & func){
+        ParallelRows(rows, rowsPerTile, &CallFunctor<F>, &func);
+    }
+
+    // Tile height so that the input and output rows of one tile fit in half of L2
+    static int RowsPerTile(int rows, long inRowBytes, long outRowBytes);
+
+    int ThreadCount() const { return (int)threads.size(); }
+
+private:
+    enum { kMaxSlices = 64 };
+    struct Job;
+
+    template<typename F>
+    static void CallFunctor(void * context, int firstRow, int numRows){
+        (*(F*)context)(firstRow, numRows);
+    }
+
+    void WorkerLoop(int index, bool pin);
+    void RunTiles(Job * job, int slice);
+
+    std::vector<std::thread> threads;
+    std::vector<Job*> jobs;
+    std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable jobReleased;
+    bool stop;
+};
+
+#endif
@@ -6,28 +6,79 @@
 //
 //
 #include <vector>
+#include <thread>
+#include <atomic>
 
 #include "DeckLinkAPI.h"
+#include "FrameRing.h"
+#include "VideoFrame.h"
+#include "SharedFrameBus.h"
+#include "AudioRing.h"
+#include "Deinterlacer.h"
+#include "PolyphaseScaler.h"
+#include "PlayoutEngine.h"
+#include "CaptureScheduler.h"
+#include "PrerollBuffer.h"
 #import <QuartzCore/QuartzCore.h>
 #import <QTKit/QTKit.h>
 
+// Input restarts after a detected format change, and how long each took from the
+// change notification to the first frame with a valid input source
+struct FormatChangeStats {
+    unsigned long long changes;
+    double lastRestartMs;
+    double maxRestartMs;
+};
+
 class DecklinkCallback : public IDeckLinkInputCallback{
 public:
-    DecklinkCallback();
+    // Frames are processed on `device`'s thread, which is started here
+    DecklinkCallback(CaptureDevice * device, int ringSize = 4, FrameRingOverflowPolicy overflowPolicy = FrameRingDropOldest);
+    virtual ~DecklinkCallback();
     
-    unsigned char * bytes;
     NSBitmapImageRep * imageRep;
     
-    int w;
-    int h;
-    int size;
-    bool newFrame;
+    // Frames handed to the delegate. Every frame gets its own buffer, which goes back
+    // to the pool once the last FrameRef and CVPixelBuffer using it are released
+    FramePool * framePool;
+    
+    // Output of canvasScaler, apart from framePool so the two stages' buffers are
+    // recycled separately
+    FramePool * scalerPool;
+    
+    // Scaled down ARGB previews (PreviewScaler), made next to the frame's other work
+    FramePool * previewPool;
+    
+    // Hand the delegate the captured UYVY/v210 frames as they are instead of converting
+    // them to ARGB, consumers that need RGB call VideoFrame::Argb() themselves
+    bool nativeYuv;
     
-    unsigned char                                red[256][256];
-    unsigned char                                blue[256][256];
-    unsigned char                                green[256][256][256];
+    // When set, every delegate frame is also published here for other processes.
+    // Owned by the callback, set it once before frames arrive
+    std::atomic<SharedFrameBus*> frameBus;
     
-    unsigned char * rgb;
+    // When set, keeps the last seconds of delegate frames for recordings to start from
+    // before record was pressed. Emptied on format changes. Owned by the callback, set it
+    // once before frames arrive. The frames it restores come from prerollPool
+    std::atomic<PrerollBuffer*> preroll;
+    FramePool * prerollPool;
+    
+    // Audio packets by their stream time when audio input is enabled, NULL otherwise.
+    // Use a frame's timestamps.audioPosition and audioSamples to read its audio span.
+    // Owned by the callback, set it before starting the streams
+    AudioRing * audioRing;
+    
+    // Deinterlaces the preview frames in the mode Filters picked, see DeinterlacerSetMode.
+    // Follows the input's field dominance across format changes. Its frames come from
+    // deinterlacePool
+    Deinterlacer * deinterlacer;
+    FramePool * deinterlacePool;
+    
+    // When set, frames taller than canvasHeight are scaled down to it before anything
+    // else sees them, so HD inputs reach the mixer, previews and recorder already at the
+    // PAL canvas size. Owned by the callback, set it before starting the streams
+    PolyphaseScaler * canvasScaler;
+    int canvasHeight;
 
         bool cameraActive;
     // IUnknown needs only a dummy implementation
@@ -42,23 +93,60 @@ public:
     
     IDeckLinkOutput * decklinkOutput;
     
-    unsigned char Clamp(int value);
-    void CreateLookupTables();
-    void YuvToRgbChunk(unsigned char *yuv, unsigned char * rgb, unsigned int offset, unsigned int chunk_size, unsigned int rowBytes);
-    unsigned char * YuvToRgb(IDeckLinkVideoInputFrame* pArrivedFrame);
+    // Loop-through output, NULL when it is off. Fed from the driver callback with every
+    // captured frame and restarted in the new mode on format changes. Owned by the
+    // callback, set it before starting the streams
+    PlayoutEngine * playout;
     
-    NSLock * lock;
+    // The input is restarted in the detected mode with the same pixel format and
+    // flags when it reports a format change
+    IDeckLinkInput * decklinkInput;
+    BMDPixelFormat pixelFormat;
+    BMDVideoInputFlags inputFlags;
     
-    id delegate;
-    bool delegateBusy;
+    // Time scale of the frame timestamps, the input mode's own (25000 for PAL, 30000 for
+    // 29.97) so every frame starts on a whole number of it. Follows format changes
+    std::atomic<BMDTimeScale> frameTimeScale;
     
-        CVPixelBufferRef buffer;
+    FrameRef YuvToRgb(IDeckLinkVideoInputFrame* pArrivedFrame);
     
-    int counter;
+    // Where `monotonicNanos` (MonotonicNanos()) falls on the card's hardware reference
+    // clock in timeScale units, the clock of the frames' timestamps.hardwareTime. False
+    // if the input can not tell
+    bool HardwareTimeAt(uint64_t monotonicNanos, BMDTimeScale timeScale, BMDTimeValue & hardwareTime);
+    
+    // Received/processed/dropped counters of the frame ring
+    FrameRingStats GetFrameStats();
+    FormatChangeStats GetFormatChangeStats();
     
-    IDeckLinkVideoInputFrame* _videoFrame;
+    id delegate;
+    
+    int counter;
     
     bool even;
+    
+private:
+    struct QueuedFrame {
+        IDeckLinkVideoInputFrame * frame;
+        uint64_t arrivalTime;
+    };
+    static void ReleaseQueuedFrame(QueuedFrame queued);
+    
+    // Frames go from the driver callback to the device's thread through the ring
+    FrameRing<QueuedFrame> * frameRing;
+    dispatch_semaphore_t frameSemaphore;
+    CaptureDevice * device;
+    std::atomic<bool> running;
+    
+    void ProcessingLoop();
+    void ProcessFrame(IDeckLinkVideoInputFrame* videoFrame, uint64_t arrivalTime);
+    
+    // MonotonicNanos() of the last format change, 0 once a good frame has arrived
+    std::atomic<uint64_t> formatChangeTime;
+    std::atomic<unsigned long long> formatChanges;
+    std::atomic<uint64_t> lastRestartNanos;
+    std::atomic<uint64_t> maxRestartNanos;
+    std::atomic<bool> restartToReport;
 
 };
 
@@ -27,286 +27,297 @@
 
 
 #import "AppDelegate.h"
+#import "ThreadUtils.h"
+#import "LatencyTrace.h"
 
 
-// clamp values between 0 and 255
-unsigned char DecklinkCallback::Clamp(int value)
+// The conversion itself lives in VideoFrame::Argb() (YuvConverter.cpp and V210.cpp,
+// picked at runtime), which replaces the 16 MB red/green/blue lookup tables every
+// callback used to build. The wrapped driver frame is let go again right after.
+FrameRef DecklinkCallback::YuvToRgb(IDeckLinkVideoInputFrame* pArrivedFrame)
 {
-    if(value > 255) return 255;
-    if(value < 0)   return 0;
-    return value;
+    FrameRef native = framePool->Wrap(pArrivedFrame);
+    if(!native){
+        return native;
+    }
+    return native->Argb();
 }
 
+void bwFrames(unsigned char * bytes, int size){
+    for(int i=0;i<size;i++){
+        unsigned char * r = bytes + i*3;
+        unsigned char * g = bytes + i*3+1;
+        unsigned char * b = bytes + i*3+2;
+        int c =  (*r +  *g + *b)/3.0;
+        bytes[i] = c;
+    }
+}
 
-void DecklinkCallback::CreateLookupTables(){
-    
-    int yy, uu, vv, ug_plus_vg, ub, vr, val;
+
+
+
+static int64_t FloorDiv(int64_t value, int64_t divisor){
+    int64_t quotient = value / divisor;
+    return (value % divisor < 0) ? quotient - 1 : quotient;
+}
+
+// The first timecode the frame carries, RP188 (VITC1, LTC or VITC2) before VITC and
+// serial. Only copies the BCD out, strings are made by whoever needs them
+static FrameTimecode ReadTimecode(IDeckLinkVideoInputFrame * videoFrame){
+    static const BMDTimecodeFormat formats[] = { bmdTimecodeRP188Any, bmdTimecodeVITC, bmdTimecodeVITCField2, bmdTimecodeSerial };
     
-    // Red
-    for (int v = 0; v < 256; v++) {
-        for (int y = 0; y < 256; y++) {
-            yy         = y << 8;
-            vv         = v - 128;
-            vr         = vv * 359;
-            val        = (yy + vr) >>  8;
-            red[v][y]  = Clamp(val);
+    FrameTimecode timecode = {};
+    for(size_t i=0;i<sizeof(formats)/sizeof(formats[0]);i++){
+        IDeckLinkTimecode * deckLinkTimecode = NULL;
+        if(videoFrame->GetTimecode(formats[i], &deckLinkTimecode) == S_OK && deckLinkTimecode){
+            timecode.format = formats[i];
+            timecode.bcd = deckLinkTimecode->GetBCD();
+            timecode.flags = deckLinkTimecode->GetFlags();
+            deckLinkTimecode->GetTimecodeUserBits(&timecode.userBits);
+            deckLinkTimecode->Release();
+            break;
         }
     }
+    return timecode;
+}
+
+void DecklinkCallback::ReleaseQueuedFrame(QueuedFrame queued){
+    queued.frame->Release();
+}
+
+DecklinkCallback::DecklinkCallback(CaptureDevice * device, int ringSize, FrameRingOverflowPolicy overflowPolicy) : device(device){
+    framePool = new FramePool(6, false);
+    framePool->SetNumaNode(device->NumaNode());
+    scalerPool = new FramePool(6, false);
+    scalerPool->SetNumaNode(device->NumaNode());
+    previewPool = new FramePool(4, false);
+    previewPool->SetNumaNode(device->NumaNode());
+    nativeYuv = false;
+    frameBus = NULL;
+    preroll = NULL;
+    audioRing = NULL;
+    deinterlacePool = new FramePool(4, false);
+    deinterlacePool->SetNumaNode(device->NumaNode());
+    prerollPool = new FramePool(4, false);
+    prerollPool->SetNumaNode(device->NumaNode());
+    deinterlacer = new Deinterlacer(deinterlacePool);
+    canvasScaler = NULL;
+    canvasHeight = 576;
     
-    // Blue
-    for (int u = 0; u < 256; u++) {
-        for (int y = 0; y < 256; y++) {
-            yy          = y << 8;
-            uu          = u - 128;
-            ub          = uu * 454;
-            val         = (yy + ub) >> 8;
-            blue[u][y]  = Clamp(val);
-        }
-    }
+    decklinkInput = NULL;
+    decklinkOutput = NULL;
+    playout = NULL;
+    pixelFormat = bmdFormat8BitYUV;
+    inputFlags = bmdVideoInputFlagDefault;
+    frameTimeScale = 600;
     
-    // Green
-    for (int u = 0; u < 256; u++) {
-        for (int v = 0; v < 256; v++) {
-            for (int y = 0; y < 256; y++) {
-                yy              = y << 8;
-                uu              = u - 128;
-                vv              = v - 128;
-                ug_plus_vg      = uu * 88 + vv * 183;
-                val             = (yy - ug_plus_vg) >> 8;
-                green[u][v][y]  = Clamp(val);
-            }
-        }
-    }
+    formatChangeTime = 0;
+    formatChanges = 0;
+    lastRestartNanos = 0;
+    maxRestartNanos = 0;
+    restartToReport = false;
+    
+    frameRing = new FrameRing<QueuedFrame>(ringSize, overflowPolicy, ReleaseQueuedFrame);
+    frameSemaphore = dispatch_semaphore_create(0);
+    
+    running = true;
+    device->Start(std::bind(&DecklinkCallback::ProcessingLoop, this));
+};
+
+DecklinkCallback::~DecklinkCallback(){
+    running = false;
+    dispatch_semaphore_signal(frameSemaphore);
+    device->Join();
+    
+    delete frameRing;
+    delete frameBus.load();
+    delete preroll.load();
+    delete audioRing;
+    delete deinterlacer;
+    delete canvasScaler;
+    delete playout;
+    framePool->Release();
+    scalerPool->Release();
+    previewPool->Release();
+    deinterlacePool->Release();
+    prerollPool->Release();
 }
 
+FrameRingStats DecklinkCallback::GetFrameStats(){
+    return frameRing->Stats();
+}
 
+FormatChangeStats DecklinkCallback::GetFormatChangeStats(){
+    FormatChangeStats stats;
+    stats.changes = formatChanges;
+    stats.lastRestartMs = lastRestartNanos / 1e6;
+    stats.maxRestartMs = maxRestartNanos / 1e6;
+    return stats;
+}
 
+// The clock is read between two host clock readings, their midpoint is taken as the
+// moment it was read
+bool DecklinkCallback::HardwareTimeAt(uint64_t monotonicNanos, BMDTimeScale timeScale, BMDTimeValue & hardwareTime){
+    if(!decklinkInput){
+        return false;
+    }
+    BMDTimeValue now, timeInFrame, ticksPerFrame;
+    uint64_t before = MonotonicNanos();
+    if(decklinkInput->GetHardwareReferenceClock(timeScale, &now, &timeInFrame, &ticksPerFrame) != S_OK){
+        return false;
+    }
+    uint64_t after = MonotonicNanos();
+    int64_t elapsed = (int64_t)(before + (after - before) / 2) - (int64_t)monotonicNanos;
+    hardwareTime = now - (BMDTimeValue)((double)elapsed * timeScale / 1e9);
+    return true;
+}
 
-void DecklinkCallback::YuvToRgbChunk(unsigned char *yuv, unsigned char * rgb, unsigned int offset, unsigned int chunk_size, unsigned int rowBytes)
-{
-    
-    // convert 4 YUV macropixels to 6 RGB pixels
-	unsigned int i, j;
-    unsigned int boundry = offset + chunk_size;
-    unsigned char y, u, v;
-    
-    int yy, uu, vv, ug_plus_vg, ub, vr, val;
-    
-    int num = (offset/4)*8;
-    for(i=offset, j=num; i<boundry; i+=4, j+=8){
-//        if(i % rowBytes*2 < rowBytes)
-        
-        y = yuv[i+1];
-        u = yuv[i];
-        v = yuv[i+2];
-        
-        yy         = y << 8;
-        vv         = v - 128;
-        uu              = u - 128;
-        
-        unsigned char * r = red[v];
-        unsigned char * g = green[u][v];
-        unsigned char * b = blue[u];
-        
-        rgb[j+1] =r[y];
-        rgb[j+2] = g[y];
-        rgb[j+3] = b[y];
-        /*
-         // rgb[j+1]   =red[y][v];
-         {
-         vr         = vv * 359;
-         val        = (yy + vr) >>  8;
-         rgb[j+1]  = Clamp(val);
-         
-         }
-         
-         //rgb[j+2] = green[y][u][v];
-         {
-         ug_plus_vg      = uu * 88 + vv * 183;
-         val             = (yy - ug_plus_vg) >> 8;
-         rgb[j+2]  = Clamp(val);
-         }
-         //  rgb[j+3] = blue[y][u];
-         {
-         ub          = uu * 454;
-         val         = (yy + ub) >> 8;
-         rgb[j+3]  = Clamp(val);
-         }*/
-        /*
-         rgb[j+3] = 1.164*(y - 16)                   + 2.018*(u - 128);
-         rgb[j+2] = 1.164*(u - 16) - 0.813*(v - 128) - 0.391*(u - 128);
-         rgb[j+1] = 1.164*(v - 16) + 1.596*(v - 128);
-         */
-        y = yuv[i+3];
-        
-        yy         = y << 8;
-        
-        rgb[j+5] =r[y];
-        rgb[j+6] = g[y];
-        rgb[j+7] = b[y];
-        /*
-         // rgb[j+1]   =red[y][v];
-         {
-         val        = (yy + vr) >>  8;
-         rgb[j+5]  = Clamp(val);
-         
-         }
-         
-         //rgb[j+2] = green[y][u][v];
-         {
-         val             = (yy - ug_plus_vg) >> 8;
-         rgb[j+6]  = Clamp(val);
-         }
-         //  rgb[j+3] = blue[y][u];
-         {
-         val         = (yy + ub) >> 8;
-         rgb[j+7]  = Clamp(val);
-         }
-         */
-        /*        rgb[j+3] = 1.164*(y - 16)                   + 2.018*(u - 128);
-         rgb[j+2] = 1.164*(u - 16) - 0.813*(v - 128) - 0.391*(u - 128);
-         rgb[j+1] = 1.164*(v - 16) + 1.596*(v - 128);
-         */
+// Pulls frames queued by the driver callback and does all the actual work on them
+void DecklinkCallback::ProcessingLoop(){
+    while(running){
+        dispatch_semaphore_wait(frameSemaphore, dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC));
         
+        QueuedFrame queued;
+        while(running && frameRing->Pop(queued)){
+            // Due before the next frame would arrive
+            BMDTimeValue frameTime, frameDuration;
+            uint64_t deadline = queued.arrivalTime + 40000000;
+            if(queued.frame->GetStreamTime(&frameTime, &frameDuration, 1000000) == S_OK && frameDuration > 0){
+                deadline = queued.arrivalTime + frameDuration * 1000;
+            }
+            device->FrameStarted();
+            @autoreleasepool {
+                LatencyTraceRecord(LatencyStageDequeue, queued.arrivalTime);
+                ProcessFrame(queued.frame, queued.arrivalTime);
+            }
+            device->FrameFinished(queued.arrivalTime, deadline);
+            queued.frame->Release();
+            frameRing->MarkProcessed();
+        }
     }
-    
-    /*
-     // fixed point math implementation - superceded by the lookup table method
-     unsigned int i, j;
-     unsigned int boundry = offset + chunk_size;
-     int yy, uu, vv, ug_plus_vg, ub, vr;
-     int r,g,b;
-     for(i=offset, j=(offset/4)*6; i<boundry; i+=4, j+=6){
-     yy = yuv[i+1] << 8;
-     uu = yuv[i] - 128;
-     vv = yuv[i+2] - 128;
-     ug_plus_vg = uu * 88 + vv * 183;
-     ub = uu * 454;
-     vr = vv * 359;
-     r = (yy + vr) >> 8;
-     g = (yy - ug_plus_vg) >> 8;
-     b = (yy + ub) >> 8;
-     rgb->pixels[j]   = r < 0 ? 0 : (r > 255 ? 255 : (unsigned char)r);
-     rgb->pixels[j+1] = g < 0 ? 0 : (g > 255 ? 255 : (unsigned char)g);
-     rgb->pixels[j+2] = b < 0 ? 0 : (b > 255 ? 255 : (unsigned char)b);
-     yy = yuv[i+3] << 8;
-     r = (yy + vr) >> 8;
-     g = (yy - ug_plus_vg) >> 8;
-     b = (yy + ub) >> 8;
-     rgb->pixels[j+3] = r < 0 ? 0 : (r > 255 ? 255 : (unsigned char)r);
-     rgb->pixels[j+4] = g < 0 ? 0 : (g > 255 ? 255 : (unsigned char)g);
-     rgb->pixels[j+5] = b < 0 ? 0 : (b > 255 ? 255 : (unsigned char)b);
-     }
-     */
 }
 
-
-unsigned char * DecklinkCallback::YuvToRgb(IDeckLinkVideoInputFrame* pArrivedFrame)
-{
-    unsigned char * yuv;
-    pArrivedFrame->GetBytes((void**)&yuv);
+void DecklinkCallback::ProcessFrame(IDeckLinkVideoInputFrame* videoFrame, uint64_t arrivalTime){
+    BMDTimeScale        timeScale = frameTimeScale;
+    BMDTimeValue		frameTime, frameDuration;
+    videoFrame->GetStreamTime(&frameTime, &frameDuration, timeScale);
     
-    // allocate space for the rgb image
-    if(rgb == nil){
-        int size = pArrivedFrame->GetWidth() * pArrivedFrame->GetHeight()*4*sizeof(unsigned char);
-        rgb = (unsigned char *) malloc(size);
-        memset(rgb,255,size);
-    }
-    //    shared_ptr<DLFrame> rgb(new DLFrame(mCaptureWidth, mCaptureHeight, mRgbRowBytes, DLFrame::DL_RGB));
+    //                    NSLog(@"%i",videoFrame->GetFlags());
     
-    int num_workers = 8;
+    // Loop-through was handed the driver's UYVY/v210 frame on arrival, the delegate gets
+    // either the same frame or an ARGB copy
+    if(restartToReport.exchange(false)){
+        NSLog(@"Input restarted, first good frame %.1f ms after the format change", lastRestartNanos / 1e6);
+    }
     
-    int a;
-    //   unsigned t0=clock(),t1;
+    FrameRef frame = nativeYuv ? framePool->Wrap(videoFrame) : YuvToRgb(videoFrame);
+    if(!frame){
+        NSLog(@"Could not allocate frame");
+        return;
+    }
     
-    // split up the image into memory-aligned chunks so they take advantage of
-    // the CPU cache
-    int     mConversionChunkSize = pArrivedFrame->GetRowBytes() * (long)ceil(pArrivedFrame->GetHeight() /(float) num_workers);
+    FrameTimestamps & timestamps = frame->timestamps;
+    timestamps.timeScale = timeScale;
+    timestamps.streamTime = frameTime;
+    timestamps.streamDuration = frameDuration;
+    videoFrame->GetHardwareReferenceTimestamp(timeScale, &timestamps.hardwareTime, &timestamps.hardwareDuration);
+    timestamps.arrivalTime = arrivalTime;
     
-    int rowBytes = pArrivedFrame->GetRowBytes();
+    // 240 kHz is a whole multiple of every frame rate's duration (1001/30000 is 8008) and
+    // of 48 kHz, so each frame's audio ends exactly where the next frame's starts
+    BMDTimeValue audioTime, audioDuration;
+    videoFrame->GetStreamTime(&audioTime, &audioDuration, 240000);
+    timestamps.audioPosition = FloorDiv(audioTime, 5);
+    timestamps.audioSamples = FloorDiv(audioTime + audioDuration, 5) - timestamps.audioPosition;
+    frame->flags = videoFrame->GetFlags();
+    frame->timecode = ReadTimecode(videoFrame);
     
-    dispatch_queue_t queue = dispatch_queue_create("com.halfdanj.yuv", 0);
-    dispatch_group_t group = dispatch_group_create();
+    // Scaled once here rather than by each consumer. v210 frames pass through as they are
+    if(canvasScaler){
+        frame = canvasScaler->ScaleToHeight(frame, canvasHeight);
+    }
     
-    for(int i=0;i<num_workers;i++){
-        dispatch_group_async(group,queue,^{
-            YuvToRgbChunk(yuv,rgb, mConversionChunkSize*i, mConversionChunkSize, rowBytes);
-        });
+    // Kept before the delegate sees it, a take starting with this frame reaches back
+    // from here
+    PrerollBuffer * kept = preroll.load();
+    if(kept){
+        kept->Add(frame);
     }
-    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
     
-    //   t1=clock()-t0;
-    //printf("%i\n",t1);
+    LatencyTraceRecord(LatencyStageDelegate, arrivalTime);
+    [delegate newFrame:frame callback:this];
     
-    return rgb;
-}
-
-void bwFrames(unsigned char * bytes, int size){
-    for(int i=0;i<size;i++){
-        unsigned char * r = bytes + i*3;
-        unsigned char * g = bytes + i*3+1;
-        unsigned char * b = bytes + i*3+2;
-        int c =  (*r +  *g + *b)/3.0;
-        bytes[i] = c;
+    SharedFrameBus * bus = frameBus.load();
+    if(bus){
+        bus->Publish(*frame);
     }
 }
 
 
 
-
-DecklinkCallback::DecklinkCallback(){
-    bytes = 0;
-    CreateLookupTables();
-    
-    lock = [[NSLock alloc] init];
-};
-
-
-
+// Runs on the driver's thread. Only the input is restarted, the ring, the processing
+// thread and the delegate carry on, and the pools drop their old sized buffers.
 HRESULT		DecklinkCallback::VideoInputFormatChanged (/* in */ BMDVideoInputFormatChangedEvents notificationEvents, /* in */ IDeckLinkDisplayMode *newMode, /* in */ BMDDetectedVideoInputFormatFlags detectedSignalFlags)
 {
-	//UInt32				modeIndex = 0;
-    printf("Video format changed");
-    /*
-     NSAutoreleasePool* pool = [[NSAutoreleasePool alloc] init];
-     
-     // Restart capture with the new video mode if told to
-     if ([uiDelegate shouldRestartCaptureWithNewVideoMode] == YES)
-     {
-     // Stop the capture
-     deckLinkInput->StopStreams();
-     
-     // Set the video input mode
-     if (deckLinkInput->EnableVideoInput(newMode->GetDisplayMode(), bmdFormat8BitYUV, bmdVideoInputEnableFormatDetection) != S_OK)
-     {
-     [uiDelegate stopCapture];
-     [uiDelegate showErrorMessage:@"This application was unable to select the new video mode." title:@"Error restarting the capture."];
-     goto bail;
-     }
-     
-     // Start the capture
-     if (deckLinkInput->StartStreams() != S_OK)
-     {
-     [uiDelegate stopCapture];
-     [uiDelegate showErrorMessage:@"This application was unable to start the capture on the selected device." title:@"Error restarting the capture."];
-     goto bail;
-     }
-     }
-     
-     // Find the index of the new mode in the mode list so we can update the UI
-     while (modeIndex < modeList.size()) {
-     if (modeList[modeIndex]->GetDisplayMode() == newMode->GetDisplayMode())
-     {
-     [uiDelegate selectDetectedVideoModeWithIndex: modeIndex];
-     break;
-     }
-     modeIndex++;
-     }
-     
-     
-     bail:
-     [pool release];
-     return S_OK;*/
+    if(!decklinkInput || !(notificationEvents & (bmdVideoInputDisplayModeChanged | bmdVideoInputFieldDominanceChanged))){
+        return S_OK;
+    }
+    
+    formatChangeTime = MonotonicNanos();
+    formatChanges++;
+    
+    CFStringRef modeName = NULL;
+    newMode->GetName(&modeName);
+    NSString * name = (__bridge_transfer NSString*)modeName;
+    NSLog(@"Video format changed to %@, restarting the input", name);
+    
+    decklinkInput->StopStreams();
+    framePool->Flush();
+    scalerPool->Flush();
+    previewPool->Flush();
+    deinterlacePool->Flush();
+    prerollPool->Flush();
+    PrerollBuffer * kept = preroll.load();
+    if(kept){
+        kept->Clear();
+    }
+    
+    BMDTimeValue modeFrameDuration;
+    BMDTimeScale modeTimeScale;
+    newMode->GetFrameRate(&modeFrameDuration, &modeTimeScale);
+    frameTimeScale = modeTimeScale;
+    deinterlacer->SetFieldDominance(newMode->GetFieldDominance());
+    if(canvasScaler){
+        canvasScaler->SetFieldDominance(newMode->GetFieldDominance());
+    }
+    
+    // Set the video input mode
+    if (decklinkInput->EnableVideoInput(newMode->GetDisplayMode(), pixelFormat, inputFlags) != S_OK)
+    {
+        NSLog(@"This application was unable to select the new video mode.");
+        formatChangeTime = 0;
+        return S_OK;
+    }
+    
+    // Start the capture
+    if (decklinkInput->StartStreams() != S_OK)
+    {
+        NSLog(@"This application was unable to start the capture on the selected device.");
+        formatChangeTime = 0;
+        return S_OK;
+    }
+    
+    if(playout){
+        playout->Start(newMode->GetDisplayMode(), modeFrameDuration, modeTimeScale);
+    }
+    
+    id target = delegate;
+    BMDDisplayMode displayMode = newMode->GetDisplayMode();
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [target inputFormatChanged:displayMode name:name];
+    });
+    
+    return S_OK;
 }
 
 
@@ -315,57 +326,40 @@ HRESULT 	DecklinkCallback::VideoInputFrameArrived (/* in */ IDeckLinkVideoInputF
 {
     //NSLog(@"-Frame arrived start");
     even = !even;
-    @autoreleasepool {
-        if(!delegateBusy){
-            
-            if(!_videoFrame && [lock tryLock]){
-                
-                _videoFrame = videoFrame;
-                _videoFrame->AddRef();
-                
-                //dispatch_queue_t queue = dispatch_get_main_queue();
-                dispatch_queue_t queue = dispatch_queue_create("com.halfdanj.newFrame", 0);
-                dispatch_async(queue, ^{
-                    [lock lock];
-                    
-                    BMDTimeValue		frameTime, frameDuration;
-                    _videoFrame->GetStreamTime(&frameTime, &frameDuration, 600);
-                    decklinkOutput->ScheduleVideoFrame(_videoFrame, frameTime, frameDuration, 600);
-                    
-                    w = (int)_videoFrame->GetWidth();
-                    h = (int)_videoFrame->GetHeight();
-                    //                    NSLog(@"%i",_videoFrame->GetFlags());
-                    size = w * h * 4;
-                    
-                    // NSLog(@"%i %i",w,h);
-                    
-                    bytes = YuvToRgb(videoFrame);
-                    //                    videoFrame->GetBytes((void**)&bytes);
-                    
-                    
-                    if(buffer){
-                        CVPixelBufferRelease(buffer);
-                    }
-                    buffer = [delegate createCVImageBufferFromCallback:this];
-                    
-                    newFrame = true;
-                    
-                    delegateBusy = YES;
-                    [delegate newFrame:this];
-                    
-                    _videoFrame->Release();
-                    _videoFrame = nil;
-                    [lock unlock];
-                });
-                
-                [lock unlock];
-                
-            } else {
-                //   NSLog(@"Could not arqquire lock");
+    
+    // Copied straight into the ring, readers find it by stream time
+    if(audioPacket && audioRing){
+        void * samples = NULL;
+        BMDTimeValue packetTime;
+        if(audioPacket->GetBytes(&samples) == S_OK && audioPacket->GetPacketTime(&packetTime, bmdAudioSampleRate48kHz) == S_OK){
+            audioRing->Write(samples, audioPacket->GetSampleFrameCount(), packetTime);
+        }
+    }
+    
+    if(videoFrame){
+        uint64_t now = MonotonicNanos();
+        
+        // First frame with a signal after a restart, time it for GetFormatChangeStats()
+        uint64_t changeTime = formatChangeTime.load(std::memory_order_relaxed);
+        if(changeTime && !(videoFrame->GetFlags() & bmdFrameHasNoInputSource) && formatChangeTime.compare_exchange_strong(changeTime, 0)){
+            uint64_t restart = now - changeTime;
+            lastRestartNanos = restart;
+            if(restart > maxRestartNanos){
+                maxRestartNanos = restart;
             }
-            //   NSLog(@"Frame out %i",this);
-        } else {
-            // NSLog(@"###########busy delegate");
+            restartToReport = true;
+        }
+        
+        // The output paces itself from here on, see PlayoutEngine
+        if(playout){
+            playout->Push(videoFrame);
+        }
+        
+        videoFrame->AddRef();
+        QueuedFrame queued = { videoFrame, now };
+        if(frameRing->Push(queued)){
+            LatencyTraceRecord(LatencyStageEnqueue, now);
+            dispatch_semaphore_signal(frameSemaphore);
         }
     }
     
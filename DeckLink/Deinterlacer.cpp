@@ -0,0 +1,355 @@
+//
+//  Deinterlacer.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "Deinterlacer.h"
+#include "ConversionPool.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DEINTERLACE_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DEINTERLACE_NEON 1
+#endif
+
+static std::atomic<int> sharedMode(DeinterlaceModeOff);
+
+void DeinterlacerSetMode(DeinterlaceMode mode)
+{
+    sharedMode.store(mode, std::memory_order_relaxed);
+}
+
+DeinterlaceMode DeinterlacerMode(void)
+{
+    return (DeinterlaceMode)sharedMode.load(std::memory_order_relaxed);
+}
+
+// All kernels round averages up, (a + b + 1) >> 1, like pavgb / vrhadd, so every
+// kernel gives the same bytes as the scalar one
+
+static inline unsigned char Average(unsigned char a, unsigned char b)
+{
+    return (a + b + 1) >> 1;
+}
+
+static inline unsigned char AbsDiff(unsigned char a, unsigned char b)
+{
+    return a > b ? a - b : b - a;
+}
+
+// Line between above and below
+static void AverageRowScalar(const unsigned char * above, const unsigned char * below, unsigned char * out, int bytes)
+{
+    for(int i=0;i<bytes;i++){
+        out[i] = Average(above[i], below[i]);
+    }
+}
+
+// (above + 2 row + below) / 4
+static void BlendRowScalar(const unsigned char * above, const unsigned char * row, const unsigned char * below, unsigned char * out, int bytes)
+{
+    for(int i=0;i<bytes;i++){
+        out[i] = Average(Average(above[i], below[i]), row[i]);
+    }
+}
+
+// row where it is static against the previous frame, the average of above and below
+// where it moved
+static void MotionRowScalar(const unsigned char * above, const unsigned char * row, const unsigned char * below,
+                            const unsigned char * prevAbove, const unsigned char * prevRow, const unsigned char * prevBelow,
+                            unsigned char * out, int bytes, int threshold)
+{
+    for(int i=0;i<bytes;i++){
+        int motion = AbsDiff(row[i], prevRow[i]);
+        int motionAbove = AbsDiff(above[i], prevAbove[i]);
+        int motionBelow = AbsDiff(below[i], prevBelow[i]);
+        if(motionAbove > motion) motion = motionAbove;
+        if(motionBelow > motion) motion = motionBelow;
+        out[i] = motion > threshold ? Average(above[i], below[i]) : row[i];
+    }
+}
+
+#ifdef DEINTERLACE_X86
+
+static inline __m128i AbsDiffSSE2(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+static void AverageRowSSE2(const unsigned char * above, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(above+i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(below+i));
+        _mm_storeu_si128((__m128i*)(out+i), _mm_avg_epu8(a, b));
+    }
+    AverageRowScalar(above+i, below+i, out+i, bytes-i);
+}
+
+static void BlendRowSSE2(const unsigned char * above, const unsigned char * row, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(above+i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(row+i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(below+i));
+        _mm_storeu_si128((__m128i*)(out+i), _mm_avg_epu8(_mm_avg_epu8(a, b), r));
+    }
+    BlendRowScalar(above+i, row+i, below+i, out+i, bytes-i);
+}
+
+static void MotionRowSSE2(const unsigned char * above, const unsigned char * row, const unsigned char * below,
+                          const unsigned char * prevAbove, const unsigned char * prevRow, const unsigned char * prevBelow,
+                          unsigned char * out, int bytes, int threshold)
+{
+    const __m128i limit = _mm_set1_epi8((char)threshold);
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m128i a = _mm_loadu_si128((const __m128i*)(above+i));
+        __m128i r = _mm_loadu_si128((const __m128i*)(row+i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(below+i));
+        __m128i motion = AbsDiffSSE2(r, _mm_loadu_si128((const __m128i*)(prevRow+i)));
+        motion = _mm_max_epu8(motion, AbsDiffSSE2(a, _mm_loadu_si128((const __m128i*)(prevAbove+i))));
+        motion = _mm_max_epu8(motion, AbsDiffSSE2(b, _mm_loadu_si128((const __m128i*)(prevBelow+i))));
+
+        // All ones where motion <= threshold
+        __m128i still = _mm_cmpeq_epi8(_mm_subs_epu8(motion, limit), zero);
+        __m128i interpolated = _mm_avg_epu8(a, b);
+        _mm_storeu_si128((__m128i*)(out+i), _mm_or_si128(_mm_and_si128(still, r), _mm_andnot_si128(still, interpolated)));
+    }
+    MotionRowScalar(above+i, row+i, below+i, prevAbove+i, prevRow+i, prevBelow+i, out+i, bytes-i, threshold);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i AbsDiffAVX2(__m256i a, __m256i b)
+{
+    return _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+}
+
+__attribute__((target("avx2")))
+static void AverageRowAVX2(const unsigned char * above, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+32<=bytes; i+=32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(above+i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(below+i));
+        _mm256_storeu_si256((__m256i*)(out+i), _mm256_avg_epu8(a, b));
+    }
+    AverageRowSSE2(above+i, below+i, out+i, bytes-i);
+}
+
+__attribute__((target("avx2")))
+static void BlendRowAVX2(const unsigned char * above, const unsigned char * row, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+32<=bytes; i+=32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(above+i));
+        __m256i r = _mm256_loadu_si256((const __m256i*)(row+i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(below+i));
+        _mm256_storeu_si256((__m256i*)(out+i), _mm256_avg_epu8(_mm256_avg_epu8(a, b), r));
+    }
+    BlendRowSSE2(above+i, row+i, below+i, out+i, bytes-i);
+}
+
+__attribute__((target("avx2")))
+static void MotionRowAVX2(const unsigned char * above, const unsigned char * row, const unsigned char * below,
+                          const unsigned char * prevAbove, const unsigned char * prevRow, const unsigned char * prevBelow,
+                          unsigned char * out, int bytes, int threshold)
+{
+    const __m256i limit = _mm256_set1_epi8((char)threshold);
+    const __m256i zero = _mm256_setzero_si256();
+    int i = 0;
+    for(; i+32<=bytes; i+=32){
+        __m256i a = _mm256_loadu_si256((const __m256i*)(above+i));
+        __m256i r = _mm256_loadu_si256((const __m256i*)(row+i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(below+i));
+        __m256i motion = AbsDiffAVX2(r, _mm256_loadu_si256((const __m256i*)(prevRow+i)));
+        motion = _mm256_max_epu8(motion, AbsDiffAVX2(a, _mm256_loadu_si256((const __m256i*)(prevAbove+i))));
+        motion = _mm256_max_epu8(motion, AbsDiffAVX2(b, _mm256_loadu_si256((const __m256i*)(prevBelow+i))));
+
+        __m256i still = _mm256_cmpeq_epi8(_mm256_subs_epu8(motion, limit), zero);
+        _mm256_storeu_si256((__m256i*)(out+i), _mm256_blendv_epi8(_mm256_avg_epu8(a, b), r, still));
+    }
+    MotionRowSSE2(above+i, row+i, below+i, prevAbove+i, prevRow+i, prevBelow+i, out+i, bytes-i, threshold);
+}
+
+#endif
+
+#ifdef DEINTERLACE_NEON
+
+static void AverageRowNEON(const unsigned char * above, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        vst1q_u8(out+i, vrhaddq_u8(vld1q_u8(above+i), vld1q_u8(below+i)));
+    }
+    AverageRowScalar(above+i, below+i, out+i, bytes-i);
+}
+
+static void BlendRowNEON(const unsigned char * above, const unsigned char * row, const unsigned char * below, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        vst1q_u8(out+i, vrhaddq_u8(vrhaddq_u8(vld1q_u8(above+i), vld1q_u8(below+i)), vld1q_u8(row+i)));
+    }
+    BlendRowScalar(above+i, row+i, below+i, out+i, bytes-i);
+}
+
+static void MotionRowNEON(const unsigned char * above, const unsigned char * row, const unsigned char * below,
+                          const unsigned char * prevAbove, const unsigned char * prevRow, const unsigned char * prevBelow,
+                          unsigned char * out, int bytes, int threshold)
+{
+    const uint8x16_t limit = vdupq_n_u8((uint8_t)threshold);
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        uint8x16_t a = vld1q_u8(above+i);
+        uint8x16_t r = vld1q_u8(row+i);
+        uint8x16_t b = vld1q_u8(below+i);
+        uint8x16_t motion = vabdq_u8(r, vld1q_u8(prevRow+i));
+        motion = vmaxq_u8(motion, vabdq_u8(a, vld1q_u8(prevAbove+i)));
+        motion = vmaxq_u8(motion, vabdq_u8(b, vld1q_u8(prevBelow+i)));
+        vst1q_u8(out+i, vbslq_u8(vcgtq_u8(motion, limit), vrhaddq_u8(a, b), r));
+    }
+    MotionRowScalar(above+i, row+i, below+i, prevAbove+i, prevRow+i, prevBelow+i, out+i, bytes-i, threshold);
+}
+
+#endif
+
+
+struct DeinterlaceKernels {
+    void (*average)(const unsigned char * above, const unsigned char * below, unsigned char * out, int bytes);
+    void (*blend)(const unsigned char * above, const unsigned char * row, const unsigned char * below, unsigned char * out, int bytes);
+    void (*motion)(const unsigned char * above, const unsigned char * row, const unsigned char * below,
+                   const unsigned char * prevAbove, const unsigned char * prevRow, const unsigned char * prevBelow,
+                   unsigned char * out, int bytes, int threshold);
+    const char * name;
+};
+
+static DeinterlaceKernels SelectKernels()
+{
+#ifdef DEINTERLACE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        DeinterlaceKernels kernels = { AverageRowAVX2, BlendRowAVX2, MotionRowAVX2, "avx2" };
+        return kernels;
+    }
+    DeinterlaceKernels kernels = { AverageRowSSE2, BlendRowSSE2, MotionRowSSE2, "sse2" };
+#elif defined(DEINTERLACE_NEON)
+    DeinterlaceKernels kernels = { AverageRowNEON, BlendRowNEON, MotionRowNEON, "neon" };
+#else
+    DeinterlaceKernels kernels = { AverageRowScalar, BlendRowScalar, MotionRowScalar, "scalar" };
+#endif
+    return kernels;
+}
+
+static const DeinterlaceKernels & Kernels()
+{
+    static const DeinterlaceKernels kernels = SelectKernels();
+    return kernels;
+}
+
+const char * DeinterlaceKernelName(void)
+{
+    return Kernels().name;
+}
+
+
+static bool IsPacked8Bit(BMDPixelFormat pixelFormat)
+{
+    return pixelFormat == bmdFormat8BitYUV || pixelFormat == bmdFormat8BitARGB || pixelFormat == bmdFormat8BitBGRA;
+}
+
+Deinterlacer::Deinterlacer(FramePool * pool) : motionThreshold(12), pool(pool), fieldDominance(bmdUnknownFieldDominance)
+{
+    pool->AddRef();
+}
+
+Deinterlacer::~Deinterlacer()
+{
+    previous.Reset();
+    pool->Release();
+}
+
+void Deinterlacer::SetFieldDominance(BMDFieldDominance dominance)
+{
+    fieldDominance.store(dominance, std::memory_order_relaxed);
+}
+
+FrameRef Deinterlacer::Process(const FrameRef & frame, DeinterlaceMode mode)
+{
+    BMDFieldDominance dominance = fieldDominance.load(std::memory_order_relaxed);
+    if(!frame || mode == DeinterlaceModeOff || dominance == bmdProgressiveFrame || dominance == bmdProgressiveSegmentedFrame){
+        previous.Reset();
+        return frame;
+    }
+
+    FrameRef source = IsPacked8Bit(frame->PixelFormat()) ? frame : frame->Argb();
+    if(!source || source->Height() < 2){
+        previous.Reset();
+        return frame;
+    }
+
+    int height = source->Height();
+    long rowBytes = source->RowBytes();
+    FrameRef deinterlaced = pool->Acquire(source->Width(), height, rowBytes, source->PixelFormat());
+    if(!deinterlaced){
+        return frame;
+    }
+
+    // A previous frame from before a format change is no use for motion detection
+    bool motionAdaptive = mode == DeinterlaceModeMotionAdaptive;
+    bool havePrevious = motionAdaptive && previous && previous->Height() == height && previous->RowBytes() == rowBytes &&
+                        previous->PixelFormat() == source->PixelFormat();
+
+    // The field that comes second in time is the one kept, the other one is the
+    // interpolated (or, where static, woven) one
+    int keptParity = dominance == bmdLowerFieldFirst ? 0 : 1;
+
+    const DeinterlaceKernels & kernels = Kernels();
+    const unsigned char * in = source->Bytes();
+    const unsigned char * prev = havePrevious ? previous->Bytes() : NULL;
+    unsigned char * out = deinterlaced->Bytes();
+    int threshold = motionThreshold < 0 ? 0 : (motionThreshold > 255 ? 255 : motionThreshold);
+    int bytes = (int)rowBytes;
+
+    auto deinterlaceTile = [&](int firstRow, int numRows){
+        for(int y=firstRow;y<firstRow+numRows;y++){
+            // The edges reflect, the line beyond is the one on the other side
+            long aboveOffset = (long)(y > 0 ? y-1 : 1) * rowBytes;
+            long rowOffset = (long)y * rowBytes;
+            long belowOffset = (long)(y+1 < height ? y+1 : y-1) * rowBytes;
+
+            if(mode == DeinterlaceModeBlend){
+                kernels.blend(in + aboveOffset, in + rowOffset, in + belowOffset, out + rowOffset, bytes);
+            } else if((y & 1) == keptParity){
+                memcpy(out + rowOffset, in + rowOffset, bytes);
+            } else if(prev){
+                kernels.motion(in + aboveOffset, in + rowOffset, in + belowOffset,
+                               prev + aboveOffset, prev + rowOffset, prev + belowOffset, out + rowOffset, bytes, threshold);
+            } else {
+                kernels.average(in + aboveOffset, in + belowOffset, out + rowOffset, bytes);
+            }
+        }
+    };
+    // Motion reads three rows of each frame per row written
+    ConversionPool::Shared().ParallelRows(height, ConversionPool::RowsPerTile(height, rowBytes * (prev ? 6 : 3), rowBytes), deinterlaceTile);
+
+    deinterlaced->timestamps = source->timestamps;
+    deinterlaced->timecode = source->timecode;
+    deinterlaced->flags = source->flags;
+
+    if(motionAdaptive){
+        previous = source;
+    } else {
+        previous.Reset();
+    }
+    return deinterlaced;
+}
@@ -0,0 +1,77 @@
+//
+//  Deinterlacer.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  CPU deinterlacing of captured frames, ahead of the RGB conversion for the preview.
+//  Works on the packed 8 bit formats byte by byte, so UYVY is done directly at half
+//  the bytes of ARGB. Other formats (v210) go through Argb() first.
+//
+//  Bob keeps the later field and interpolates the lines of the other one. Blend runs
+//  a [1 2 1] vertical filter over every line, a smoother take on the CIKernel's line
+//  averaging. Motion adaptive keeps the other field's line
+//  where nothing moved since the previous frame, so static areas stay at full
+//  resolution, and interpolates it where something did.
+//
+//  The mode is shared by all inputs and picked by Filters, the C part is for that.
+//
+
+#ifndef DEINTERLACER_H
+#define DEINTERLACER_H
+
+typedef enum {
+    DeinterlaceModeOff = 0,         // inputs are left alone, Filters uses the CIKernel
+    DeinterlaceModeBob,
+    DeinterlaceModeBlend,
+    DeinterlaceModeMotionAdaptive
+} DeinterlaceMode;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// The mode every input's Deinterlacer uses from the next frame on. Any thread
+void DeinterlacerSetMode(DeinterlaceMode mode);
+DeinterlaceMode DeinterlacerMode(void);
+
+// "avx2", "sse2", "neon" or "scalar"
+const char * DeinterlaceKernelName(void);
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+
+#include "VideoFrame.h"
+
+// One per input, it keeps the previous frame for motion detection
+class Deinterlacer {
+public:
+    Deinterlacer(FramePool * pool);
+    ~Deinterlacer();
+
+    // From the input's display mode. Progressive frames are passed through. Any thread
+    void SetFieldDominance(BMDFieldDominance dominance);
+
+    // A byte that changed more than this since the previous frame, on the missing line
+    // or the lines around it, counts as moving
+    int motionThreshold;
+
+    // Deinterlaced copy of `frame` with its timestamps and timecode, or `frame` itself
+    // when the mode is off, the input is progressive or no buffer could be had.
+    // One frame at a time, in capture order.
+    FrameRef Process(const FrameRef & frame, DeinterlaceMode mode);
+
+private:
+    FramePool * pool;
+    FrameRef previous;
+    std::atomic<uint32_t> fieldDominance;
+
+    Deinterlacer(const Deinterlacer &);
+    Deinterlacer & operator=(const Deinterlacer &);
+};
+
+#endif
+
+#endif
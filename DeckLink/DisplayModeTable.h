@@ -0,0 +1,49 @@
+//
+//  DisplayModeTable.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  The display modes an input supports, keyed by BMDDisplayMode. Walking the driver's
+//  mode iterator is slow, so the table is kept in the user defaults per model and
+//  only rebuilt when a model is seen for the first time.
+//
+
+#ifndef DISPLAYMODETABLE_H
+#define DISPLAYMODETABLE_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "DeckLinkAPI.h"
+
+struct DisplayModeEntry {
+    BMDDisplayMode      mode;
+    int32_t             width;
+    int32_t             height;
+    BMDTimeValue        frameDuration;
+    BMDTimeScale        timeScale;
+    BMDFieldDominance   fieldDominance;
+    char                name[32];
+};
+
+class DisplayModeTable {
+public:
+    // Cached table for the device's model, built from `input` if there is none yet
+    static DisplayModeTable ForDevice(IDeckLink * deckLink, IDeckLinkInput * input);
+
+    // The entry for `mode`, NULL if the input does not support it
+    const DisplayModeEntry * Find(BMDDisplayMode mode) const;
+
+    size_t Count() const { return entries.size(); }
+    bool FromCache() const { return fromCache; }
+
+private:
+    DisplayModeTable() : fromCache(false) {}
+
+    // Sorted by mode
+    std::vector<DisplayModeEntry> entries;
+    bool fromCache;
+};
+
+#endif
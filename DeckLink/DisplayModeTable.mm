@@ -0,0 +1,87 @@
+//
+//  DisplayModeTable.mm
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#include "DisplayModeTable.h"
+
+#include <algorithm>
+#include <string.h>
+
+// Bump when DisplayModeEntry changes, old tables are then ignored and rebuilt
+static NSString * const kTableKeyPrefix = @"displayModeTable1.";
+
+static bool EntryLess(const DisplayModeEntry & a, const DisplayModeEntry & b)
+{
+    return a.mode < b.mode;
+}
+
+DisplayModeTable DisplayModeTable::ForDevice(IDeckLink * deckLink, IDeckLinkInput * input)
+{
+    DisplayModeTable table;
+
+    CFStringRef modelName = NULL;
+    NSString * key = nil;
+    if(deckLink->GetModelName(&modelName) == S_OK){
+        key = [kTableKeyPrefix stringByAppendingString:(__bridge NSString*)modelName];
+        CFRelease(modelName);
+    }
+
+    NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+    if(key){
+        NSData * data = [defaults dataForKey:key];
+        if(data.length > 0 && data.length % sizeof(DisplayModeEntry) == 0){
+            table.entries.resize(data.length / sizeof(DisplayModeEntry));
+            memcpy(&table.entries[0], data.bytes, data.length);
+            table.fromCache = true;
+            return table;
+        }
+    }
+
+    IDeckLinkDisplayModeIterator * iterator = NULL;
+    if(!input || input->GetDisplayModeIterator(&iterator) != S_OK){
+        return table;
+    }
+
+    IDeckLinkDisplayMode * displayMode = NULL;
+    while(iterator->Next(&displayMode) == S_OK){
+        DisplayModeEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.mode = displayMode->GetDisplayMode();
+        entry.width = (int32_t)displayMode->GetWidth();
+        entry.height = (int32_t)displayMode->GetHeight();
+        displayMode->GetFrameRate(&entry.frameDuration, &entry.timeScale);
+        entry.fieldDominance = displayMode->GetFieldDominance();
+
+        CFStringRef name = NULL;
+        if(displayMode->GetName(&name) == S_OK){
+            CFStringGetCString(name, entry.name, sizeof(entry.name), kCFStringEncodingUTF8);
+            CFRelease(name);
+        }
+
+        table.entries.push_back(entry);
+        displayMode->Release();
+    }
+    iterator->Release();
+
+    std::sort(table.entries.begin(), table.entries.end(), EntryLess);
+
+    if(key && !table.entries.empty()){
+        [defaults setObject:[NSData dataWithBytes:&table.entries[0] length:table.entries.size() * sizeof(DisplayModeEntry)] forKey:key];
+    }
+    return table;
+}
+
+const DisplayModeEntry * DisplayModeTable::Find(BMDDisplayMode mode) const
+{
+    DisplayModeEntry key;
+    key.mode = mode;
+    std::vector<DisplayModeEntry>::const_iterator it = std::lower_bound(entries.begin(), entries.end(), key, EntryLess);
+    if(it == entries.end() || it->mode != mode){
+        return NULL;
+    }
+    return &*it;
+}
@@ -0,0 +1,182 @@
+//
+//  FrameRing.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Bounded lock-free ring between the DeckLink driver callback (single producer) and
+//  the processing thread(s) (any number of consumers). Cells carry a sequence number
+//  so producer and consumers never take a lock, which keeps the driver callback down
+//  to a couple of atomic operations.
+//
+//  What happens when the ring is full is up to the producer: evict the oldest queued
+//  item, refuse the new one, or wait for a consumer to make room. Evicted and refused
+//  items are handed to the discard function (eg. to Release() a frame).
+//
+
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+#include <stddef.h>
+
+enum FrameRingOverflowPolicy {
+    FrameRingDropOldest = 0,
+    FrameRingDropNewest = 1,
+    FrameRingBlock      = 2
+};
+
+struct FrameRingStats {
+    uint64_t received;
+    uint64_t processed;
+    uint64_t droppedOldest;     // evicted from the ring to make room for a newer frame
+    uint64_t droppedNewest;     // refused because the ring was full
+    size_t   depth;             // currently queued
+    size_t   capacity;
+};
+
+template<typename T>
+class FrameRing {
+public:
+    typedef void (*DiscardFunc)(T item);
+
+    FrameRing(size_t minCapacity, FrameRingOverflowPolicy policy, DiscardFunc discard)
+    : policy(policy), discard(discard), enqueuePos(0), dequeuePos(0),
+      received(0), processed(0), droppedOldest(0), droppedNewest(0)
+    {
+        capacity = 2;
+        while(capacity < minCapacity){
+            capacity <<= 1;
+        }
+        mask = capacity - 1;
+        cells = new Cell[capacity];
+        for(size_t i=0;i<capacity;i++){
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~FrameRing(){
+        T item;
+        while(TryPop(item)){
+            if(discard) discard(item);
+        }
+        delete [] cells;
+    }
+
+    // Producer side. Returns false if the item was refused (FrameRingDropNewest).
+    bool Push(T item){
+        received.fetch_add(1, std::memory_order_relaxed);
+
+        while(!TryPush(item)){
+            if(policy == FrameRingDropNewest){
+                droppedNewest.fetch_add(1, std::memory_order_relaxed);
+                if(discard) discard(item);
+                return false;
+            }
+
+            T oldest;
+            if(policy == FrameRingDropOldest && TryPop(oldest)){
+                droppedOldest.fetch_add(1, std::memory_order_relaxed);
+                if(discard) discard(oldest);
+            } else {
+                // Blocking, or a consumer is halfway through freeing a cell
+                std::this_thread::yield();
+            }
+        }
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool Pop(T & item){
+        return TryPop(item);
+    }
+
+    // Consumers call this once they are done with a popped item
+    void MarkProcessed(){
+        processed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t Depth() const {
+        size_t enq = enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+    FrameRingStats Stats() const {
+        FrameRingStats stats;
+        stats.received      = received.load(std::memory_order_relaxed);
+        stats.processed     = processed.load(std::memory_order_relaxed);
+        stats.droppedOldest = droppedOldest.load(std::memory_order_relaxed);
+        stats.droppedNewest = droppedNewest.load(std::memory_order_relaxed);
+        stats.depth         = Depth();
+        stats.capacity      = capacity;
+        return stats;
+    }
+
+    FrameRingOverflowPolicy policy;
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    bool TryPush(T item){
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for(;;){
+            Cell * cell = &cells[pos & mask];
+            intptr_t diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+            if(diff == 0){
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    cell->data = item;
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0){
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool TryPop(T & item){
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for(;;){
+            Cell * cell = &cells[pos & mask];
+            intptr_t diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+            if(diff == 0){
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                    item = cell->data;
+                    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0){
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    FrameRing(const FrameRing &);
+    FrameRing & operator=(const FrameRing &);
+
+    DiscardFunc discard;
+    Cell * cells;
+    size_t capacity;
+    size_t mask;
+
+    // Keep the producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+
+    alignas(64) std::atomic<uint64_t> received;
+    std::atomic<uint64_t> processed;
+    std::atomic<uint64_t> droppedOldest;
+    std::atomic<uint64_t> droppedNewest;
+};
+
+#endif
@@ -0,0 +1,138 @@
+//
+//  LatencyTrace.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "LatencyTrace.h"
+#include "ThreadUtils.h"
+
+#include <atomic>
+
+// Values below 64 ns get a bucket each, above that every power of two is split into
+// 32 buckets. 64 bit values need (63 - 5) * 32 + 64 buckets.
+static const int kSubBucketBits = 5;
+static const int kBucketCount = (63 - kSubBucketBits) * (1 << kSubBucketBits) + (2 << kSubBucketBits);
+
+static int BucketIndex(uint64_t value)
+{
+    if(value < (2u << kSubBucketBits)){
+        return (int)value;
+    }
+    int power = 63 - __builtin_clzll(value);
+    int shift = power - kSubBucketBits;
+    return (shift << kSubBucketBits) + (int)(value >> shift);
+}
+
+// Middle of the bucket's range
+static uint64_t BucketValue(int index)
+{
+    if(index < (2 << kSubBucketBits)){
+        return index;
+    }
+    int shift = (index >> kSubBucketBits) - 1;
+    uint64_t lowest = (uint64_t)((index & ((1 << kSubBucketBits) - 1)) + (1 << kSubBucketBits)) << shift;
+    return lowest + ((1ull << shift) >> 1);
+}
+
+namespace {
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[kBucketCount];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+
+    void Record(uint64_t value){
+        buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t seen = max.load(std::memory_order_relaxed);
+        while(value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed)){
+        }
+    }
+
+    void Reset(){
+        for(int i=0;i<kBucketCount;i++){
+            buckets[i].store(0, std::memory_order_relaxed);
+        }
+        count.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+};
+
+}
+
+// Zero initialised as a static, about 100 KB in all
+static Histogram histograms[LatencyStageCount];
+
+void LatencyTraceRecord(LatencyStage stage, uint64_t arrivalNanos)
+{
+    if(stage < 0 || stage >= LatencyStageCount || !arrivalNanos){
+        return;
+    }
+    uint64_t now = MonotonicNanos();
+    histograms[stage].Record(now > arrivalNanos ? now - arrivalNanos : 0);
+}
+
+void LatencyTraceGetStats(LatencyStage stage, LatencyStats * stats)
+{
+    *stats = LatencyStats();
+    if(stage < 0 || stage >= LatencyStageCount){
+        return;
+    }
+    Histogram & histogram = histograms[stage];
+
+    // The buckets are summed up again rather than trusting count, which may be a few
+    // records ahead of them while frames are coming in
+    uint64_t total = 0;
+    for(int i=0;i<kBucketCount;i++){
+        total += histogram.buckets[i].load(std::memory_order_relaxed);
+    }
+    if(!total){
+        return;
+    }
+
+    uint64_t p50Rank = (total * 50 + 99) / 100;
+    uint64_t p99Rank = (total * 99 + 99) / 100;
+    uint64_t seen = 0;
+    for(int i=0;i<kBucketCount && seen < p99Rank;i++){
+        uint64_t inBucket = histogram.buckets[i].load(std::memory_order_relaxed);
+        if(seen < p50Rank && seen + inBucket >= p50Rank){
+            stats->p50 = BucketValue(i);
+        }
+        if(seen + inBucket >= p99Rank){
+            stats->p99 = BucketValue(i);
+        }
+        seen += inBucket;
+    }
+
+    stats->count = total;
+    stats->max = histogram.max.load(std::memory_order_relaxed);
+    stats->mean = (double)histogram.sum.load(std::memory_order_relaxed) / histogram.count.load(std::memory_order_relaxed);
+    if(stats->p99 > stats->max){
+        stats->p99 = stats->max;
+    }
+    if(stats->p50 > stats->max){
+        stats->p50 = stats->max;
+    }
+}
+
+void LatencyTraceReset(void)
+{
+    for(int i=0;i<LatencyStageCount;i++){
+        histograms[i].Reset();
+    }
+}
+
+const char * LatencyStageName(LatencyStage stage)
+{
+    static const char * names[LatencyStageCount] = { "enqueue", "dequeue", "delegate", "convert", "composite", "draw", "append" };
+    if(stage < 0 || stage >= LatencyStageCount){
+        return "unknown";
+    }
+    return names[stage];
+}
@@ -0,0 +1,59 @@
+//
+//  LatencyTrace.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  How long captured frames take from the driver callback to each later stage. Every
+//  stage records the time since the frame's arrival (FrameTimestamps::arrivalTime) into
+//  its own histogram. The histograms are log-linear like HdrHistogram: 32 linear steps
+//  per power of two, so any percentile is within about 3%. Recording is a few relaxed
+//  atomic adds and never locks, so tracing stays on during shows.
+//
+//  Plain C, so the Objective-C views and the mixer can record too.
+//
+
+#ifndef LATENCYTRACE_H
+#define LATENCYTRACE_H
+
+#include <stdint.h>
+
+typedef enum {
+    LatencyStageEnqueue = 0,    // queued in the frame ring by the driver callback
+    LatencyStageDequeue,        // taken off the ring by the processing thread
+    LatencyStageDelegate,       // handed to BlackMagicItem, converted to RGB unless in native YUV mode
+    LatencyStageConvert,        // preview CIImage ready
+    LatencyStageComposite,      // first mixed into the live output
+    LatencyStageDraw,           // first drawn by a CoreImageViewer
+    LatencyStageAppend,         // appended to a recording
+    LatencyStageCount
+} LatencyStage;
+
+// Nanoseconds
+typedef struct {
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t max;
+    double mean;
+} LatencyStats;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Records MonotonicNanos() - arrivalNanos for the stage. Any thread.
+void LatencyTraceRecord(LatencyStage stage, uint64_t arrivalNanos);
+
+void LatencyTraceGetStats(LatencyStage stage, LatencyStats * stats);
+
+// Clears all stages, eg. after the show has settled in
+void LatencyTraceReset(void);
+
+const char * LatencyStageName(LatencyStage stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,179 @@
+//
+//  PlayoutEngine.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "PlayoutEngine.h"
+
+#include <stdio.h>
+#include <string.h>
+
+PlayoutEngine::PlayoutEngine(IDeckLinkOutput * output, int depth)
+: output(output), depth(depth > 1 ? depth : 2), state(StateStopped),
+  frameDuration(1), timeScale(25), nextFrameTime(0), newestFrame(NULL), lastFrame(NULL)
+{
+    memset(&stats, 0, sizeof(stats));
+    stats.depth = this->depth;
+    output->AddRef();
+}
+
+PlayoutEngine::~PlayoutEngine()
+{
+    Stop();
+    output->Release();
+}
+
+bool PlayoutEngine::Start(BMDDisplayMode mode, BMDTimeValue duration, BMDTimeScale scale)
+{
+    Stop();
+
+    if(output->EnableVideoOutput(mode, bmdVideoOutputFlagDefault) != S_OK){
+        fprintf(stderr, "PlayoutEngine: could not enable the output in mode %08x\n", (unsigned)mode);
+        return false;
+    }
+    output->SetScheduledFrameCompletionCallback(this);
+
+    std::lock_guard<std::mutex> guard(lock);
+    frameDuration = duration;
+    timeScale = scale;
+    nextFrameTime = 0;
+    stats.buffered = 0;
+    state = StateWaiting;
+    return true;
+}
+
+// Playback is stopped outside the lock, the driver may report the flushed frames from
+// inside StopScheduledPlayback()
+void PlayoutEngine::Stop()
+{
+    State previous;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        previous = state;
+        state = StateStopped;
+    }
+    if(previous == StateStopped){
+        return;
+    }
+    if(previous == StatePlaying){
+        output->StopScheduledPlayback(0, NULL, 0);
+    }
+    output->DisableVideoOutput();
+    output->SetScheduledFrameCompletionCallback(NULL);
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(newestFrame){
+        newestFrame->Release();
+        newestFrame = NULL;
+    }
+    if(lastFrame){
+        lastFrame->Release();
+        lastFrame = NULL;
+    }
+    stats.buffered = 0;
+}
+
+void PlayoutEngine::Push(IDeckLinkVideoFrame * frame)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(state == StateStopped){
+        return;
+    }
+    if(newestFrame){
+        newestFrame->Release();
+        stats.skipped++;
+    }
+    frame->AddRef();
+    newestFrame = frame;
+
+    if(state == StateWaiting){
+        for(unsigned i=0; i<depth; i++){
+            if(!ScheduleNextFrame(true)){
+                return;
+            }
+        }
+        if(output->StartScheduledPlayback(0, timeScale, 1.0) != S_OK){
+            fprintf(stderr, "PlayoutEngine: could not start scheduled playback\n");
+            return;
+        }
+        state = StatePlaying;
+    }
+}
+
+bool PlayoutEngine::ScheduleNextFrame(bool prerolling)
+{
+    if(newestFrame){
+        if(lastFrame){
+            lastFrame->Release();
+        }
+        lastFrame = newestFrame;
+        newestFrame = NULL;
+    } else if(lastFrame && !prerolling){
+        stats.repeated++;
+    }
+    if(!lastFrame){
+        return false;
+    }
+
+    if(output->ScheduleVideoFrame(lastFrame, nextFrameTime, frameDuration, timeScale) != S_OK){
+        fprintf(stderr, "PlayoutEngine: could not schedule frame at %lld\n", (long long)nextFrameTime);
+        return false;
+    }
+    nextFrameTime += frameDuration;
+    stats.scheduled++;
+    stats.buffered++;
+    return true;
+}
+
+// The output's clock has passed frames still in the queue. Leave those, but schedule
+// the next one a frame after the current time rather than in the past
+void PlayoutEngine::Resync()
+{
+    BMDTimeValue now;
+    double speed;
+    if(output->GetScheduledStreamTime(timeScale, &now, &speed) != S_OK){
+        return;
+    }
+    BMDTimeValue earliest = (now / frameDuration + 1) * frameDuration;
+    if(nextFrameTime < earliest){
+        nextFrameTime = earliest;
+        stats.resyncs++;
+    }
+}
+
+HRESULT PlayoutEngine::ScheduledFrameCompleted(IDeckLinkVideoFrame * completedFrame, BMDOutputFrameCompletionResult result)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    switch(result){
+        case bmdOutputFrameCompleted:       stats.completed++; break;
+        case bmdOutputFrameDisplayedLate:   stats.late++; break;
+        case bmdOutputFrameDropped:         stats.dropped++; break;
+        case bmdOutputFrameFlushed:         stats.flushed++; break;
+    }
+    if(stats.buffered > 0){
+        stats.buffered--;
+    }
+    if(state != StatePlaying){
+        return S_OK;
+    }
+
+    if(result == bmdOutputFrameDisplayedLate || result == bmdOutputFrameDropped){
+        Resync();
+    }
+    while(stats.buffered < depth && ScheduleNextFrame(false)){
+    }
+    return S_OK;
+}
+
+HRESULT PlayoutEngine::ScheduledPlaybackHasStopped()
+{
+    return S_OK;
+}
+
+PlayoutStats PlayoutEngine::Stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
@@ -0,0 +1,87 @@
+//
+//  PlayoutEngine.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Scheduled loop-through output, modelled on TestPattern::ScheduleNextFrame in the SDK
+//  samples. The input side only hands over its newest frame; the output schedules one
+//  frame for every frame it completes, at its own frame times, so its cadence does not
+//  depend on when or whether the capture side got around to a frame.
+//
+//  Playback starts with `depth` frames prerolled from the first frame pushed and the
+//  output is kept that many frames ahead. When no new frame has arrived since the last
+//  one was scheduled the last one is repeated; frames pushed faster than the output
+//  takes them are skipped. Late or dropped frames move the schedule forward past the
+//  output's clock so it does not stay behind.
+//
+
+#ifndef PLAYOUTENGINE_H
+#define PLAYOUTENGINE_H
+
+#include <mutex>
+#include <stdint.h>
+#include "DeckLinkAPI.h"
+
+struct PlayoutStats {
+    uint64_t scheduled;
+    uint64_t completed;         // shown on time
+    uint64_t late;              // shown, but after their frame time
+    uint64_t dropped;           // never shown
+    uint64_t flushed;           // still queued when playback stopped
+    uint64_t repeated;          // underruns, the last frame scheduled again
+    uint64_t skipped;           // replaced by a newer frame before being scheduled
+    uint64_t resyncs;           // schedule moved forward after a late or dropped frame
+    unsigned buffered;          // frames scheduled and not completed yet
+    unsigned depth;
+};
+
+class PlayoutEngine : public IDeckLinkVideoOutputCallback {
+public:
+    PlayoutEngine(IDeckLinkOutput * output, int depth = 3);
+    virtual ~PlayoutEngine();
+
+    // Enables the output in `mode`, stopping it first if it is running. Playback starts
+    // with the first frame pushed after this. False if the output refused the mode
+    bool Start(BMDDisplayMode mode, BMDTimeValue frameDuration, BMDTimeScale timeScale);
+    void Stop();
+
+    // The newest captured frame, from the driver's input callback. Must be in the mode
+    // Start() was given, it is kept referenced until a newer one has been scheduled
+    void Push(IDeckLinkVideoFrame * frame);
+
+    PlayoutStats Stats();
+
+    // IDeckLinkVideoOutputCallback, on the driver's thread
+    virtual HRESULT     ScheduledFrameCompleted (IDeckLinkVideoFrame * completedFrame, BMDOutputFrameCompletionResult result);
+    virtual HRESULT     ScheduledPlaybackHasStopped ();
+
+    // IUnknown needs only a dummy implementation
+    virtual HRESULT     QueryInterface (REFIID iid, LPVOID *ppv)    {return E_NOINTERFACE;}
+    virtual ULONG       AddRef ()                                   {return 1;}
+    virtual ULONG       Release ()                                  {return 1;}
+
+private:
+    enum State { StateStopped, StateWaiting, StatePlaying };
+
+    // With lock held. Schedules the newest frame, or repeats the last one
+    bool ScheduleNextFrame(bool prerolling);
+    void Resync();
+
+    IDeckLinkOutput * output;
+    unsigned depth;
+
+    std::mutex lock;
+    State state;
+    BMDTimeValue frameDuration;
+    BMDTimeScale timeScale;
+    BMDTimeValue nextFrameTime;
+    IDeckLinkVideoFrame * newestFrame;      // pushed, not scheduled yet
+    IDeckLinkVideoFrame * lastFrame;        // scheduled last, repeated on underrun
+    PlayoutStats stats;
+
+    PlayoutEngine(const PlayoutEngine &);
+    PlayoutEngine & operator=(const PlayoutEngine &);
+};
+
+#endif
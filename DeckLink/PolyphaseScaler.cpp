@@ -0,0 +1,560 @@
+//
+//  PolyphaseScaler.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "PolyphaseScaler.h"
+#include "ConversionPool.h"
+
+#include <stdint.h>
+#include <math.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCALER_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALER_NEON 1
+#endif
+
+static const int kWeightBits = 14;
+static const int kWeightRound = 1 << (kWeightBits - 1);
+
+// Bytes past the end of a plane the horizontal kernels may read, they load 8 taps at
+// a time and the taps are padded up to that
+static const int kPlanePadding = 16;
+
+//
+// Filter tables
+//
+
+namespace {
+
+struct ScalerTable {
+    int taps;                       // padded to a multiple of 8 with zero weights
+    int span;                       // taps before padding, what the vertical pass uses
+    std::vector<int> starts;        // first source sample of each destination sample
+    std::vector<int16_t> weights;   // `taps` per destination sample, summing to 1 << kWeightBits
+};
+
+}
+
+static double Sinc(double x)
+{
+    if(x == 0){
+        return 1;
+    }
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double FilterWeight(ScalerFilter filter, double x)
+{
+    x = fabs(x);
+    if(filter == ScalerFilterBicubic){
+        // Catmull-Rom, a = -0.5
+        if(x < 1) return 1.5*x*x*x - 2.5*x*x + 1;
+        if(x < 2) return -0.5*x*x*x + 2.5*x*x - 4*x + 2;
+        return 0;
+    }
+    return x < 3 ? Sinc(x) * Sinc(x / 3) : 0;
+}
+
+// For one field of an interlaced frame (`field` 0 or 1, -1 for whole frames) source
+// and dest count the field's lines. The fields are a frame line apart in the source and
+// in the output, which are different distances, so field 0's samples move up and field
+// 1's down by (scale - 1) / 4 field lines to land where they are in the output frame
+static ScalerTable * BuildTable(int source, int dest, ScalerFilter filter, int field)
+{
+    double scale = (double)source / dest;
+    double offset = field < 0 ? 0 : (field - 0.5) * (scale - 1) / 2;
+    // Scaling down widens the filter to the source spacing of the output samples
+    double stretch = scale > 1 ? scale : 1;
+    double support = (filter == ScalerFilterBicubic ? 2 : 3) * stretch;
+    int span = (int)ceil(support * 2) + 1;
+    if(span > source){
+        span = source;
+    }
+
+    ScalerTable * table = new ScalerTable();
+    table->span = span;
+    table->taps = (span + 7) & ~7;
+    table->starts.resize(dest);
+    table->weights.assign((size_t)dest * table->taps, 0);
+
+    std::vector<double> weights(span);
+    for(int i=0;i<dest;i++){
+        double center = (i + 0.5) * scale - 0.5 + offset;
+        int first = (int)ceil(center - support);
+
+        // The window stays inside the source, taps beyond the edges count for the edge sample
+        int start = first < 0 ? 0 : (first > source - span ? source - span : first);
+        table->starts[i] = start;
+
+        double sum = 0;
+        std::fill(weights.begin(), weights.end(), 0.0);
+        for(int k=0;k<span;k++){
+            int index = first + k;
+            index = index < 0 ? 0 : (index >= source ? source - 1 : index);
+            double weight = FilterWeight(filter, (first + k - center) / stretch);
+            weights[index - start] += weight;
+            sum += weight;
+        }
+
+        // Rounded to fixed point, with the rounding error put on the biggest weight so
+        // flat areas stay exactly flat
+        int16_t * fixed = &table->weights[(size_t)i * table->taps];
+        int total = 0;
+        int biggest = 0;
+        for(int k=0;k<span;k++){
+            fixed[k] = (int16_t)lrint(weights[k] / sum * (1 << kWeightBits));
+            total += fixed[k];
+            if(fixed[k] > fixed[biggest]){
+                biggest = k;
+            }
+        }
+        fixed[biggest] += (1 << kWeightBits) - total;
+    }
+    return table;
+}
+
+static std::shared_ptr<const ScalerTable> Table(int source, int dest, ScalerFilter filter, int field = -1)
+{
+    typedef std::tuple<int, int, int, int> Key;
+    static std::mutex mutex;
+    static std::map<Key, std::shared_ptr<const ScalerTable> > tables;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::shared_ptr<const ScalerTable> & table = tables[Key(source, dest, filter, field)];
+    if(!table){
+        table.reset(BuildTable(source, dest, filter, field));
+    }
+    return table;
+}
+
+//
+// Kernels
+//
+
+static inline unsigned char ClampWeighted(int sum)
+{
+    sum = (sum + kWeightRound) >> kWeightBits;
+    if(sum > 255) return 255;
+    if(sum < 0)   return 0;
+    return sum;
+}
+
+// out = sum of rows[k] * weights[k] over `taps` rows, byte by byte from `first` on.
+// The SIMD kernels finish their rows with it.
+static void VerticalFrom(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int first, int bytes)
+{
+    for(int i=first;i<bytes;i++){
+        int sum = 0;
+        for(int k=0;k<taps;k++){
+            sum += rows[k][i] * weights[k];
+        }
+        out[i] = ClampWeighted(sum);
+    }
+}
+
+#if !defined(SCALER_X86) && !defined(SCALER_NEON)
+static void VerticalScalar(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int bytes)
+{
+    VerticalFrom(rows, weights, taps, out, 0, bytes);
+}
+#endif
+
+// One plane, one destination sample at a time from `first` on
+static void HorizontalFrom(const unsigned char * plane, const ScalerTable & table, unsigned char * out, int first, int count)
+{
+    for(int i=first;i<count;i++){
+        const unsigned char * in = plane + table.starts[i];
+        const int16_t * weights = &table.weights[(size_t)i * table.taps];
+        int sum = 0;
+        for(int k=0;k<table.span;k++){
+            sum += in[k] * weights[k];
+        }
+        out[i] = ClampWeighted(sum);
+    }
+}
+
+// There is no NEON horizontal kernel, it uses this one
+#ifndef SCALER_X86
+static void HorizontalScalar(const unsigned char * plane, const ScalerTable & table, unsigned char * out, int count)
+{
+    HorizontalFrom(plane, table, out, 0, count);
+}
+#endif
+
+#ifdef SCALER_X86
+
+// Two taps' weights for madd, matching rows or samples interleaved a0 b0 a1 b1 ...
+static inline int WeightPair(const int16_t * weights, int k, int taps)
+{
+    int16_t second = k+1 < taps ? weights[k+1] : 0;
+    return (uint16_t)weights[k] | ((int)second << 16);
+}
+
+static inline __m128i PackWeighted(__m128i a, __m128i b)
+{
+    const __m128i round = _mm_set1_epi32(kWeightRound);
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(a, round), kWeightBits), _mm_srai_epi32(_mm_add_epi32(b, round), kWeightBits));
+}
+
+static void VerticalSSE2(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int bytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m128i acc0 = zero, acc1 = zero, acc2 = zero, acc3 = zero;
+        for(int k=0;k<taps;k+=2){
+            __m128i w = _mm_set1_epi32(WeightPair(weights, k, taps));
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k]+i));
+            __m128i b = k+1 < taps ? _mm_loadu_si128((const __m128i*)(rows[k+1]+i)) : zero;
+            __m128i lo = _mm_unpacklo_epi8(a, b);
+            __m128i hi = _mm_unpackhi_epi8(a, b);
+            acc0 = _mm_add_epi32(acc0, _mm_madd_epi16(_mm_unpacklo_epi8(lo, zero), w));
+            acc1 = _mm_add_epi32(acc1, _mm_madd_epi16(_mm_unpackhi_epi8(lo, zero), w));
+            acc2 = _mm_add_epi32(acc2, _mm_madd_epi16(_mm_unpacklo_epi8(hi, zero), w));
+            acc3 = _mm_add_epi32(acc3, _mm_madd_epi16(_mm_unpackhi_epi8(hi, zero), w));
+        }
+        _mm_storeu_si128((__m128i*)(out+i), _mm_packus_epi16(PackWeighted(acc0, acc1), PackWeighted(acc2, acc3)));
+    }
+
+    VerticalFrom(rows, weights, taps, out, i, bytes);
+}
+
+// Sums of a0..a3 lanes, of b0..b3 and so on, into one vector
+static inline __m128i SumLanes(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+    __m128i ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+    __m128i cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+    return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+
+static void HorizontalSSE2(const unsigned char * plane, const ScalerTable & table, unsigned char * out, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int taps = table.taps;
+    int i = 0;
+    for(; i+4<=count; i+=4){
+        __m128i acc[4];
+        for(int o=0;o<4;o++){
+            const unsigned char * in = plane + table.starts[i+o];
+            const int16_t * weights = &table.weights[(size_t)(i+o) * taps];
+            acc[o] = zero;
+            for(int k=0;k<taps;k+=8){
+                __m128i samples = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in+k)), zero);
+                acc[o] = _mm_add_epi32(acc[o], _mm_madd_epi16(samples, _mm_loadu_si128((const __m128i*)(weights+k))));
+            }
+        }
+        __m128i sums = PackWeighted(SumLanes(acc[0], acc[1], acc[2], acc[3]), zero);
+        *(int*)(out+i) = _mm_cvtsi128_si32(_mm_packus_epi16(sums, zero));
+    }
+    HorizontalFrom(plane, table, out, i, count);
+}
+
+__attribute__((target("avx2")))
+static void VerticalAVX2(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int bytes)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m256i round = _mm256_set1_epi32(kWeightRound);
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m256i acc0 = _mm256_setzero_si256(), acc1 = _mm256_setzero_si256();
+        for(int k=0;k<taps;k+=2){
+            __m256i w = _mm256_set1_epi32(WeightPair(weights, k, taps));
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[k]+i));
+            __m128i b = k+1 < taps ? _mm_loadu_si128((const __m128i*)(rows[k+1]+i)) : zero;
+            acc0 = _mm256_add_epi32(acc0, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpacklo_epi8(a, b)), w));
+            acc1 = _mm256_add_epi32(acc1, _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_unpackhi_epi8(a, b)), w));
+        }
+        acc0 = _mm256_srai_epi32(_mm256_add_epi32(acc0, round), kWeightBits);
+        acc1 = _mm256_srai_epi32(_mm256_add_epi32(acc1, round), kWeightBits);
+
+        // packs work per 128 bit lane, 0-3 8-11 | 4-7 12-15 until permuted back
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(acc0, acc1), _MM_SHUFFLE(3,1,2,0));
+        __m256i bytes8 = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), _MM_SHUFFLE(3,1,2,0));
+        _mm_storeu_si128((__m128i*)(out+i), _mm256_castsi256_si128(bytes8));
+    }
+    VerticalFrom(rows, weights, taps, out, i, bytes);
+}
+
+// Two destination samples per register, one in each 128 bit lane
+__attribute__((target("avx2")))
+static void HorizontalAVX2(const unsigned char * plane, const ScalerTable & table, unsigned char * out, int count)
+{
+    int taps = table.taps;
+    const __m256i round = _mm256_set1_epi32(kWeightRound);
+    int i = 0;
+    for(; i+8<=count; i+=8){
+        __m256i acc[4];
+        for(int p=0;p<4;p++){
+            int o = i + 2*p;
+            const unsigned char * in0 = plane + table.starts[o];
+            const unsigned char * in1 = plane + table.starts[o+1];
+            const int16_t * w0 = &table.weights[(size_t)o * taps];
+            const int16_t * w1 = w0 + taps;
+            acc[p] = _mm256_setzero_si256();
+            for(int k=0;k<taps;k+=8){
+                __m128i samples = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in0+k)), _mm_loadl_epi64((const __m128i*)(in1+k)));
+                __m256i weights = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(w0+k))),
+                                                          _mm_loadu_si128((const __m128i*)(w1+k)), 1);
+                acc[p] = _mm256_add_epi32(acc[p], _mm256_madd_epi16(_mm256_cvtepu8_epi16(samples), weights));
+            }
+        }
+
+        // Lane 0 ends up with the sums of 0 2 4 6, lane 1 with 1 3 5 7
+        __m256i sums = _mm256_hadd_epi32(_mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+        sums = _mm256_srai_epi32(_mm256_add_epi32(sums, round), kWeightBits);
+        __m128i even = _mm256_castsi256_si128(sums);
+        __m128i odd = _mm256_extracti128_si256(sums, 1);
+        __m128i words = _mm_packs_epi32(_mm_unpacklo_epi32(even, odd), _mm_unpackhi_epi32(even, odd));
+        _mm_storel_epi64((__m128i*)(out+i), _mm_packus_epi16(words, words));
+    }
+    HorizontalFrom(plane, table, out, i, count);
+}
+
+#endif
+
+#ifdef SCALER_NEON
+
+static void VerticalNEON(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int bytes)
+{
+    int i = 0;
+    for(; i+8<=bytes; i+=8){
+        int32x4_t lo = vdupq_n_s32(kWeightRound);
+        int32x4_t hi = lo;
+        for(int k=0;k<taps;k++){
+            int16x8_t samples = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(rows[k]+i)));
+            lo = vmlal_n_s16(lo, vget_low_s16(samples), weights[k]);
+            hi = vmlal_n_s16(hi, vget_high_s16(samples), weights[k]);
+        }
+        int16x8_t words = vcombine_s16(vqshrn_n_s32(lo, kWeightBits), vqshrn_n_s32(hi, kWeightBits));
+        vst1_u8(out+i, vqmovun_s16(words));
+    }
+
+    VerticalFrom(rows, weights, taps, out, i, bytes);
+}
+
+#endif
+
+
+struct ScalerKernels {
+    void (*vertical)(const unsigned char * const * rows, const int16_t * weights, int taps, unsigned char * out, int bytes);
+    void (*horizontal)(const unsigned char * plane, const ScalerTable & table, unsigned char * out, int count);
+    const char * name;
+};
+
+static ScalerKernels SelectKernels()
+{
+#ifdef SCALER_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        ScalerKernels kernels = { VerticalAVX2, HorizontalAVX2, "avx2" };
+        return kernels;
+    }
+    ScalerKernels kernels = { VerticalSSE2, HorizontalSSE2, "sse2" };
+#elif defined(SCALER_NEON)
+    ScalerKernels kernels = { VerticalNEON, HorizontalScalar, "neon" };
+#else
+    ScalerKernels kernels = { VerticalScalar, HorizontalScalar, "scalar" };
+#endif
+    return kernels;
+}
+
+static const ScalerKernels & Kernels()
+{
+    static const ScalerKernels kernels = SelectKernels();
+    return kernels;
+}
+
+const char * PolyphaseScaler::KernelName()
+{
+    return Kernels().name;
+}
+
+//
+// Planes
+//
+
+// UYVY line into Y, Cb and Cr planes
+static void SplitUyvy(const unsigned char * line, int width, unsigned char * y, unsigned char * cb, unsigned char * cr)
+{
+    int x = 0;
+#ifdef SCALER_X86
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    for(; x+16<=width; x+=16, line+=32){
+        __m128i a = _mm_loadu_si128((const __m128i*)line);
+        __m128i b = _mm_loadu_si128((const __m128i*)(line+16));
+        _mm_storeu_si128((__m128i*)(y+x), _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8)));
+        __m128i chroma = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+        _mm_storel_epi64((__m128i*)(cb+x/2), _mm_packus_epi16(_mm_and_si128(chroma, low), low));
+        _mm_storel_epi64((__m128i*)(cr+x/2), _mm_packus_epi16(_mm_srli_epi16(chroma, 8), low));
+    }
+#endif
+    for(; x+1<width; x+=2, line+=4){
+        cb[x/2] = line[0];
+        y[x] = line[1];
+        cr[x/2] = line[2];
+        y[x+1] = line[3];
+    }
+}
+
+static void MergeUyvy(const unsigned char * y, const unsigned char * cb, const unsigned char * cr, int width, unsigned char * line)
+{
+    int x = 0;
+#ifdef SCALER_X86
+    for(; x+16<=width; x+=16, line+=32){
+        __m128i luma = _mm_loadu_si128((const __m128i*)(y+x));
+        __m128i chroma = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cb+x/2)), _mm_loadl_epi64((const __m128i*)(cr+x/2)));
+        _mm_storeu_si128((__m128i*)line, _mm_unpacklo_epi8(chroma, luma));
+        _mm_storeu_si128((__m128i*)(line+16), _mm_unpackhi_epi8(chroma, luma));
+    }
+#endif
+    for(; x+1<width; x+=2, line+=4){
+        line[0] = cb[x/2];
+        line[1] = y[x];
+        line[2] = cr[x/2];
+        line[3] = y[x+1];
+    }
+}
+
+//
+// PolyphaseScaler
+//
+
+PolyphaseScaler::PolyphaseScaler(FramePool * pool, ScalerFilter filter) : pool(pool), filter(filter), fieldDominance(bmdUnknownFieldDominance)
+{
+    pool->AddRef();
+}
+
+PolyphaseScaler::~PolyphaseScaler()
+{
+    pool->Release();
+}
+
+void PolyphaseScaler::SetFieldDominance(BMDFieldDominance dominance)
+{
+    fieldDominance.store(dominance, std::memory_order_relaxed);
+}
+
+FrameRef PolyphaseScaler::Scale(const FrameRef & frame, int width, int height)
+{
+    if(!frame){
+        return frame;
+    }
+    BMDPixelFormat pixelFormat = frame->PixelFormat();
+    bool uyvy = pixelFormat == bmdFormat8BitYUV;
+    if(!uyvy && pixelFormat != bmdFormat8BitARGB && pixelFormat != bmdFormat8BitBGRA){
+        return FrameRef();
+    }
+    if(uyvy){
+        width &= ~1;
+    }
+    int sourceWidth = uyvy ? frame->Width() & ~1 : frame->Width();
+    int sourceHeight = frame->Height();
+    if(width <= 0 || height <= 0 || sourceWidth <= 0 || sourceHeight <= 0){
+        return FrameRef();
+    }
+    if(width == frame->Width() && height == sourceHeight){
+        return frame;
+    }
+
+    long rowBytes = (long)width * (uyvy ? 2 : 4);
+    FrameRef scaled = pool->Acquire(width, height, rowBytes, pixelFormat);
+    if(!scaled){
+        return FrameRef();
+    }
+
+    // Interlaced frames are scaled as two frames of half the height, line y of the
+    // output from the field it belongs to
+    BMDFieldDominance dominance = fieldDominance.load(std::memory_order_relaxed);
+    bool fields = (dominance == bmdUpperFieldFirst || dominance == bmdLowerFieldFirst) &&
+                  sourceHeight % 2 == 0 && height % 2 == 0;
+    int fieldCount = fields ? 2 : 1;
+    std::shared_ptr<const ScalerTable> vertical[2];
+    vertical[0] = Table(sourceHeight / fieldCount, height / fieldCount, filter, fields ? 0 : -1);
+    vertical[1] = fields ? Table(sourceHeight / 2, height / 2, filter, 1) : vertical[0];
+    int span = vertical[0]->span;
+
+    // UYVY has a full width luma plane and two half width chroma planes, RGB four full width
+    int planes = uyvy ? 3 : 4;
+    std::shared_ptr<const ScalerTable> luma = Table(sourceWidth, width, filter);
+    std::shared_ptr<const ScalerTable> chroma = uyvy ? Table(sourceWidth / 2, width / 2, filter) : luma;
+
+    const ScalerKernels & kernels = Kernels();
+    const unsigned char * in = frame->Bytes();
+    long inRowBytes = frame->RowBytes();
+    int lineBytes = sourceWidth * (uyvy ? 2 : 4);
+    unsigned char * out = scaled->Bytes();
+
+    auto scaleTile = [&](int firstRow, int numRows){
+        std::vector<unsigned char> line(lineBytes);
+        std::vector<unsigned char> sourcePlanes[4];
+        std::vector<unsigned char> destPlanes[4];
+        for(int p=0;p<planes;p++){
+            bool half = uyvy && p > 0;
+            sourcePlanes[p].assign((half ? sourceWidth / 2 : sourceWidth) + kPlanePadding, 0);
+            destPlanes[p].resize(half ? width / 2 : width);
+        }
+        std::vector<const unsigned char *> rows(span);
+
+        for(int y=firstRow;y<firstRow+numRows;y++){
+            int field = fields ? y & 1 : 0;
+            int fieldLine = y / fieldCount;
+            const ScalerTable & table = *vertical[field];
+            int start = table.starts[fieldLine];
+            for(int k=0;k<span;k++){
+                rows[k] = in + ((long)(start + k) * fieldCount + field) * inRowBytes;
+            }
+            kernels.vertical(rows.data(), &table.weights[(size_t)fieldLine * table.taps], span, line.data(), lineBytes);
+
+            unsigned char * dest = out + (long)y * rowBytes;
+            if(uyvy){
+                SplitUyvy(line.data(), sourceWidth, sourcePlanes[0].data(), sourcePlanes[1].data(), sourcePlanes[2].data());
+                kernels.horizontal(sourcePlanes[0].data(), *luma, destPlanes[0].data(), width);
+                kernels.horizontal(sourcePlanes[1].data(), *chroma, destPlanes[1].data(), width / 2);
+                kernels.horizontal(sourcePlanes[2].data(), *chroma, destPlanes[2].data(), width / 2);
+                MergeUyvy(destPlanes[0].data(), destPlanes[1].data(), destPlanes[2].data(), width, dest);
+            } else {
+                for(int x=0;x<sourceWidth;x++){
+                    for(int p=0;p<4;p++){
+                        sourcePlanes[p][x] = line[x*4 + p];
+                    }
+                }
+                for(int p=0;p<4;p++){
+                    kernels.horizontal(sourcePlanes[p].data(), *luma, destPlanes[p].data(), width);
+                }
+                for(int x=0;x<width;x++){
+                    for(int p=0;p<4;p++){
+                        dest[x*4 + p] = destPlanes[p][x];
+                    }
+                }
+            }
+        }
+    };
+    ConversionPool::Shared().ParallelRows(height, ConversionPool::RowsPerTile(height, inRowBytes * fieldCount * span, rowBytes), scaleTile);
+
+    scaled->timestamps = frame->timestamps;
+    scaled->timecode = frame->timecode;
+    scaled->flags = frame->flags;
+    return scaled;
+}
+
+FrameRef PolyphaseScaler::ScaleToHeight(const FrameRef & frame, int height)
+{
+    if(!frame || frame->Height() <= height){
+        return frame;
+    }
+    int width = (int)lrint((double)frame->Width() * height / frame->Height()) & ~1;
+    FrameRef scaled = Scale(frame, width, height);
+    return scaled ? scaled : frame;
+}
@@ -0,0 +1,62 @@
+//
+//  PolyphaseScaler.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Separable polyphase resampling of UYVY and 8 bit ARGB/BGRA frames, used to bring HD
+//  inputs down to the PAL canvas once at capture time instead of in every consumer.
+//
+//  Each output row is filtered vertically from its source rows into one line, split
+//  into planes (Y, Cb, Cr for UYVY, one per channel for RGB) and filtered horizontally
+//  plane by plane. Weights are 14 bit fixed point and worked out once per (source,
+//  destination, filter) size pair, the table is shared by every input and thread.
+//  Rows are split across the ConversionPool.
+//
+//  Interlaced frames are scaled field by field, each field's lines only from its own
+//  lines and placed where they belong in the smaller frame, so the fields stay apart
+//  for the deinterlacer and the recording.
+//
+
+#ifndef POLYPHASESCALER_H
+#define POLYPHASESCALER_H
+
+#include <atomic>
+#include "VideoFrame.h"
+
+enum ScalerFilter {
+    ScalerFilterLanczos3 = 0,
+    ScalerFilterBicubic                 // Catmull-Rom, a little softer and fewer taps
+};
+
+class PolyphaseScaler {
+public:
+    PolyphaseScaler(FramePool * pool, ScalerFilter filter);
+    ~PolyphaseScaler();
+
+    // From the input's display mode. Upper or lower field first frames are scaled a field
+    // at a time, when both heights are even. Any thread
+    void SetFieldDominance(BMDFieldDominance dominance);
+
+    // A width x height copy of `frame` with its timestamps and timecode. The frame itself
+    // when it already has that size, empty for other formats or when no buffer could be
+    // had. width is rounded down to even for UYVY.
+    FrameRef Scale(const FrameRef & frame, int width, int height);
+
+    // Frames taller than `height` scaled down to it, keeping their aspect (1920x1080 to
+    // 1024x576 for PAL). Smaller frames and formats that can not be scaled pass through.
+    FrameRef ScaleToHeight(const FrameRef & frame, int height);
+
+    // "avx2", "sse2", "neon" or "scalar"
+    static const char * KernelName();
+
+private:
+    FramePool * pool;
+    ScalerFilter filter;
+    std::atomic<uint32_t> fieldDominance;
+
+    PolyphaseScaler(const PolyphaseScaler &);
+    PolyphaseScaler & operator=(const PolyphaseScaler &);
+};
+
+#endif
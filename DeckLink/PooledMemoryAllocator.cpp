@@ -0,0 +1,58 @@
+//
+//  PooledMemoryAllocator.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "PooledMemoryAllocator.h"
+
+PooledMemoryAllocator::PooledMemoryAllocator(unsigned cacheSize, bool useHugePages) : refCount(1), pool(cacheSize, useHugePages)
+{
+}
+
+PooledMemoryAllocator::~PooledMemoryAllocator()
+{
+}
+
+HRESULT PooledMemoryAllocator::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+    return E_NOINTERFACE;
+}
+
+ULONG PooledMemoryAllocator::AddRef()
+{
+    return ++refCount;
+}
+
+ULONG PooledMemoryAllocator::Release()
+{
+    int value = --refCount;
+    if(value == 0){
+        delete this;
+    }
+    return value;
+}
+
+HRESULT PooledMemoryAllocator::AllocateBuffer(uint32_t bufferSize, void **allocatedBuffer)
+{
+    *allocatedBuffer = pool.Acquire(bufferSize);
+    return *allocatedBuffer ? S_OK : E_OUTOFMEMORY;
+}
+
+HRESULT PooledMemoryAllocator::ReleaseBuffer(void *buffer)
+{
+    pool.Release(buffer);
+    return S_OK;
+}
+
+HRESULT PooledMemoryAllocator::Commit()
+{
+    return S_OK;
+}
+
+HRESULT PooledMemoryAllocator::Decommit()
+{
+    pool.Flush();
+    return S_OK;
+}
@@ -0,0 +1,44 @@
+//
+//  PooledMemoryAllocator.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  IDeckLinkMemoryAllocator handing the driver page aligned buffers from a BufferPool,
+//  modelled on PinnedMemoryAllocator in the LoopThroughWithOpenGLCompositing sample.
+//  Buffers the driver releases go back into the pool instead of being freed.
+//
+
+#ifndef POOLEDMEMORYALLOCATOR_H
+#define POOLEDMEMORYALLOCATOR_H
+
+#include <atomic>
+#include "DeckLinkAPI.h"
+#include "BufferPool.h"
+
+class PooledMemoryAllocator : public IDeckLinkMemoryAllocator
+{
+public:
+    PooledMemoryAllocator(unsigned cacheSize, bool useHugePages);
+
+    // IUnknown
+    virtual HRESULT     QueryInterface(REFIID iid, LPVOID *ppv);
+    virtual ULONG       AddRef();
+    virtual ULONG       Release();
+
+    // IDeckLinkMemoryAllocator
+    virtual HRESULT     AllocateBuffer(uint32_t bufferSize, void **allocatedBuffer);
+    virtual HRESULT     ReleaseBuffer(void *buffer);
+    virtual HRESULT     Commit();
+    virtual HRESULT     Decommit();
+
+    BufferPool & Pool() { return pool; }
+
+private:
+    virtual ~PooledMemoryAllocator();
+
+    std::atomic<int> refCount;
+    BufferPool pool;
+};
+
+#endif
@@ -0,0 +1,211 @@
+//
+//  PrerollBuffer.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "PrerollBuffer.h"
+
+#include <string.h>
+
+// Compressed UYVY is the luma plane followed by CbCr rows: one per field for every four
+// lines (lines 0+2 and 1+3 averaged), and one per line for the last lines of an odd sized
+// frame
+static size_t ChromaRows(int height)
+{
+    return (size_t)(height / 4) * 2 + height % 4;
+}
+
+static void Compress(const VideoFrame * frame, unsigned char * dest)
+{
+    int width = frame->Width();
+    int height = frame->Height();
+    long rowBytes = frame->RowBytes();
+    const unsigned char * src = frame->Bytes();
+
+    unsigned char * luma = dest;
+    for(int y=0;y<height;y++){
+        const unsigned char * row = src + y * rowBytes;
+        unsigned char * out = luma + (size_t)y * width;
+        for(int x=0;x<width;x++){
+            out[x] = row[x*2+1];
+        }
+    }
+
+    unsigned char * chroma = dest + (size_t)width * height;
+    int y = 0;
+    for(;y+4<=height;y+=4){
+        for(int field=0;field<2;field++){
+            const unsigned char * a = src + (y + field) * rowBytes;
+            const unsigned char * b = src + (y + field + 2) * rowBytes;
+            for(int x=0;x<width;x+=2){
+                chroma[x] = (a[x*2] + b[x*2] + 1) >> 1;
+                chroma[x+1] = (a[x*2+2] + b[x*2+2] + 1) >> 1;
+            }
+            chroma += width;
+        }
+    }
+    for(;y<height;y++){
+        const unsigned char * row = src + y * rowBytes;
+        for(int x=0;x<width;x+=2){
+            chroma[x] = row[x*2];
+            chroma[x+1] = row[x*2+2];
+        }
+        chroma += width;
+    }
+}
+
+static void Decompress(const unsigned char * src, VideoFrame * frame)
+{
+    int width = frame->Width();
+    int height = frame->Height();
+    long rowBytes = frame->RowBytes();
+    unsigned char * dest = frame->Bytes();
+
+    const unsigned char * chroma = src + (size_t)width * height;
+    for(int y=0;y<height;y++){
+        const unsigned char * luma = src + (size_t)y * width;
+        const unsigned char * cbcr;
+        if(y < height / 4 * 4){
+            cbcr = chroma + ((size_t)(y / 4) * 2 + y % 2) * width;
+        } else {
+            cbcr = chroma + (ChromaRows(height) - (height - y)) * width;
+        }
+        unsigned char * out = dest + y * rowBytes;
+        for(int x=0;x<width;x+=2){
+            out[x*2] = cbcr[x];
+            out[x*2+1] = luma[x];
+            out[x*2+2] = cbcr[x+1];
+            out[x*2+3] = luma[x+1];
+        }
+    }
+}
+
+PrerollBuffer::PrerollBuffer(FramePool * pool, double seconds, size_t maxBytes, bool compress)
+: pool(pool), buffers(4, false), seconds(seconds), maxBytes(maxBytes), compress(compress),
+  bytes(0), added(0), evicted(0), failed(0)
+{
+    pool->AddRef();
+}
+
+PrerollBuffer::~PrerollBuffer()
+{
+    Clear();
+    pool->Release();
+}
+
+void PrerollBuffer::Add(const FrameRef & frame)
+{
+    Entry entry;
+    entry.width = frame->Width();
+    entry.height = frame->Height();
+    entry.rowBytes = frame->RowBytes();
+    entry.pixelFormat = frame->PixelFormat();
+    entry.timestamps = frame->timestamps;
+    entry.timecode = frame->timecode;
+    entry.flags = frame->flags;
+    entry.compressed = compress && entry.pixelFormat == bmdFormat8BitYUV && entry.width % 2 == 0;
+    entry.size = entry.compressed ? (size_t)entry.width * (entry.height + ChromaRows(entry.height)) : frame->DataSize();
+
+    // Copied outside the lock, readers only wait for the list itself
+    entry.data = buffers.Acquire(entry.size);
+    if(entry.data){
+        if(entry.compressed){
+            Compress(frame.Get(), (unsigned char*)entry.data);
+        } else {
+            memcpy(entry.data, frame->Bytes(), entry.size);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if(!entry.data){
+        failed++;
+        return;
+    }
+    entries.push_back(entry);
+    bytes += entry.size;
+    added++;
+    Evict();
+}
+
+void PrerollBuffer::Evict()
+{
+    uint64_t window = (uint64_t)(seconds * 1e9);
+    uint64_t newest = entries.back().timestamps.arrivalTime;
+    while(!entries.empty() && (bytes > maxBytes || newest - entries.front().timestamps.arrivalTime > window)){
+        bytes -= entries.front().size;
+        buffers.Release(entries.front().data);
+        entries.pop_front();
+        evicted++;
+    }
+}
+
+FrameRef PrerollBuffer::Restore(const Entry & entry)
+{
+    FrameRef frame = pool->Acquire(entry.width, entry.height, entry.rowBytes, entry.pixelFormat);
+    if(!frame){
+        return frame;
+    }
+    if(entry.compressed){
+        Decompress((const unsigned char*)entry.data, frame.Get());
+    } else {
+        memcpy(frame->Bytes(), entry.data, entry.size);
+    }
+    frame->timestamps = entry.timestamps;
+    frame->timecode = entry.timecode;
+    frame->flags = entry.flags;
+    return frame;
+}
+
+std::vector<FrameTimestamps> PrerollBuffer::TimestampsBetween(uint64_t from, uint64_t to)
+{
+    std::vector<FrameTimestamps> timestamps;
+    std::lock_guard<std::mutex> guard(mutex);
+    for(size_t i=0;i<entries.size();i++){
+        uint64_t arrival = entries[i].timestamps.arrivalTime;
+        if(arrival >= to){
+            break;
+        }
+        if(arrival >= from){
+            timestamps.push_back(entries[i].timestamps);
+        }
+    }
+    return timestamps;
+}
+
+// Restored under the lock so Add() can not evict the entry while it is read, Add() waits
+// at most one frame's copy
+FrameRef PrerollBuffer::FrameArrivedAt(uint64_t arrivalTime)
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    for(size_t i=0;i<entries.size();i++){
+        if(entries[i].timestamps.arrivalTime == arrivalTime){
+            return Restore(entries[i]);
+        }
+    }
+    return FrameRef();
+}
+
+void PrerollBuffer::Clear()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    for(size_t i=0;i<entries.size();i++){
+        buffers.Release(entries[i].data);
+    }
+    entries.clear();
+    bytes = 0;
+}
+
+PrerollStats PrerollBuffer::Stats()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    PrerollStats stats;
+    stats.added = added;
+    stats.evicted = evicted;
+    stats.failed = failed;
+    stats.frames = entries.size();
+    stats.bytes = bytes;
+    stats.seconds = entries.empty() ? 0 : (entries.back().timestamps.arrivalTime - entries.front().timestamps.arrivalTime) / 1e9;
+    return stats;
+}
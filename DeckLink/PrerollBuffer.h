@@ -0,0 +1,93 @@
+//
+//  PrerollBuffer.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  The last few seconds of an input's frames, kept so a take can start before the
+//  record button was pressed. The processing thread adds every delegate frame and the
+//  oldest ones go once the buffer holds more than its seconds or its byte cap.
+//
+//  Frames are copied into the buffer's own memory rather than held, so the capture and
+//  frame pools do not run dry. Compressed UYVY keeps luma as it is and the chroma of
+//  every two lines of the same field averaged (4:2:0, interlaced), 3/4 of the size.
+//  Other formats are kept as they are.
+//
+
+#ifndef PREROLLBUFFER_H
+#define PREROLLBUFFER_H
+
+#include "VideoFrame.h"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+struct PrerollStats {
+    uint64_t added;
+    uint64_t evicted;
+    uint64_t failed;        // could not allocate, the frame was not kept
+    size_t frames;          // in the buffer now
+    size_t bytes;
+    double seconds;         // from the oldest frame to the newest
+};
+
+class PrerollBuffer {
+public:
+    // Frames handed out by FrameArrivedAt() come from `pool`
+    PrerollBuffer(FramePool * pool, double seconds, size_t maxBytes, bool compress);
+    ~PrerollBuffer();
+
+    // Processing thread. Copies the frame in and evicts what is too old or over the cap
+    void Add(const FrameRef & frame);
+
+    // Timestamps of the kept frames that arrived in [from, to) (MonotonicNanos()), oldest
+    // first. Cheap, the frames themselves are restored one at a time with FrameArrivedAt()
+    std::vector<FrameTimestamps> TimestampsBetween(uint64_t from, uint64_t to);
+
+    // The kept frame with this arrival time as a full frame from the pool, with its
+    // timestamps and timecode. Empty once it was evicted. Any thread
+    FrameRef FrameArrivedAt(uint64_t arrivalTime);
+
+    double Seconds() const { return seconds; }
+
+    // Drops everything, eg. after a format change
+    void Clear();
+
+    PrerollStats Stats();
+
+private:
+    struct Entry {
+        void * data;
+        size_t size;
+        bool compressed;
+        int width;
+        int height;
+        long rowBytes;
+        BMDPixelFormat pixelFormat;
+        FrameTimestamps timestamps;
+        FrameTimecode timecode;
+        BMDFrameFlags flags;
+    };
+
+    FrameRef Restore(const Entry & entry);
+    void Evict();
+
+    FramePool * pool;
+    BufferPool buffers;
+    double seconds;
+    size_t maxBytes;
+    bool compress;
+
+    std::mutex mutex;
+    std::deque<Entry> entries;
+    size_t bytes;
+    uint64_t added;
+    uint64_t evicted;
+    uint64_t failed;
+
+    PrerollBuffer(const PrerollBuffer &);
+    PrerollBuffer & operator=(const PrerollBuffer &);
+};
+
+#endif
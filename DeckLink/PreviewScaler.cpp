@@ -0,0 +1,290 @@
+//
+//  PreviewScaler.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "PreviewScaler.h"
+#include "YuvConverter.h"
+#include "ConversionPool.h"
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PREVIEW_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define PREVIEW_NEON 1
+#endif
+
+// Sums stay in 16 bits: a 1/8 box adds up 64 samples of at most 255
+
+// acc = a + b, or acc += a + b, byte by byte. Source rows come in pairs, every
+// factor is even
+static void AddRowPairScalar(const unsigned char * a, const unsigned char * b, uint16_t * acc, int bytes, bool first)
+{
+    for(int i=0;i<bytes;i++){
+        acc[i] = (first ? 0 : acc[i]) + a[i] + b[i];
+    }
+}
+
+// Summed UYVY at half the width: every two macropixels become one, their chroma
+// added up and each pixel pair's luma added up
+static void HalveScalar(const uint16_t * in, uint16_t * out, int macropixelsOut)
+{
+    for(int i=0;i<macropixelsOut;i++, in+=8, out+=4){
+        out[0] = in[0] + in[4];
+        out[1] = in[1] + in[3];
+        out[2] = in[2] + in[6];
+        out[3] = in[5] + in[7];
+    }
+}
+
+// The sums of `shift` bits worth of samples back to bytes, rounded
+static void NormalizeScalar(const uint16_t * sums, unsigned char * out, int count, int shift)
+{
+    int round = 1 << (shift - 1);
+    for(int i=0;i<count;i++){
+        out[i] = (sums[i] + round) >> shift;
+    }
+}
+
+#ifdef PREVIEW_X86
+
+static void AddRowPairSSE2(const unsigned char * a, const unsigned char * b, uint16_t * acc, int bytes, bool first)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        __m128i x = _mm_loadu_si128((const __m128i*)(a+i));
+        __m128i y = _mm_loadu_si128((const __m128i*)(b+i));
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero));
+        if(!first){
+            lo = _mm_add_epi16(lo, _mm_loadu_si128((const __m128i*)(acc+i)));
+            hi = _mm_add_epi16(hi, _mm_loadu_si128((const __m128i*)(acc+i+8)));
+        }
+        _mm_storeu_si128((__m128i*)(acc+i),   lo);
+        _mm_storeu_si128((__m128i*)(acc+i+8), hi);
+    }
+    AddRowPairScalar(a+i, b+i, acc+i, bytes-i, first);
+}
+
+// 4 macropixels in, 2 out. Sums before the last halving are at most 32 * 255, so
+// the signed packs never saturate
+static void HalveSSE2(const uint16_t * in, uint16_t * out, int macropixelsOut)
+{
+    const __m128i chromaMask = _mm_set1_epi32(0xFFFF);
+    const __m128i ones = _mm_set1_epi16(1);
+    int i = 0;
+    for(; i+2<=macropixelsOut; i+=2, in+=16, out+=8){
+        __m128i x = _mm_loadu_si128((const __m128i*)in);
+        __m128i y = _mm_loadu_si128((const __m128i*)(in+8));
+
+        // Y0..Y7, then adjacent pairs added
+        __m128i luma = _mm_madd_epi16(_mm_packs_epi32(_mm_srli_epi32(x, 16), _mm_srli_epi32(y, 16)), ones);
+        luma = _mm_packs_epi32(luma, luma);
+
+        // U0 V0 | U1 V1 | U2 V2 | U3 V3, then (U0 V0) + (U1 V1) and (U2 V2) + (U3 V3)
+        __m128i chroma = _mm_packs_epi32(_mm_and_si128(x, chromaMask), _mm_and_si128(y, chromaMask));
+        chroma = _mm_shuffle_epi32(chroma, _MM_SHUFFLE(3,1,2,0));
+        chroma = _mm_add_epi16(chroma, _mm_srli_si128(chroma, 8));
+
+        _mm_storeu_si128((__m128i*)out, _mm_unpacklo_epi16(chroma, luma));
+    }
+    HalveScalar(in, out, macropixelsOut-i);
+}
+
+static void NormalizeSSE2(const uint16_t * sums, unsigned char * out, int count, int shift)
+{
+    const __m128i round = _mm_set1_epi16((short)(1 << (shift - 1)));
+    const __m128i bits = _mm_cvtsi32_si128(shift);
+    int i = 0;
+    for(; i+16<=count; i+=16){
+        __m128i lo = _mm_srl_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(sums+i)), round), bits);
+        __m128i hi = _mm_srl_epi16(_mm_add_epi16(_mm_loadu_si128((const __m128i*)(sums+i+8)), round), bits);
+        _mm_storeu_si128((__m128i*)(out+i), _mm_packus_epi16(lo, hi));
+    }
+    NormalizeScalar(sums+i, out+i, count-i, shift);
+}
+
+__attribute__((target("avx2")))
+static void AddRowPairAVX2(const unsigned char * a, const unsigned char * b, uint16_t * acc, int bytes, bool first)
+{
+    int i = 0;
+    for(; i+32<=bytes; i+=32){
+        __m256i lo = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a+i))),
+                                      _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b+i))));
+        __m256i hi = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a+i+16))),
+                                      _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b+i+16))));
+        if(!first){
+            lo = _mm256_add_epi16(lo, _mm256_loadu_si256((const __m256i*)(acc+i)));
+            hi = _mm256_add_epi16(hi, _mm256_loadu_si256((const __m256i*)(acc+i+16)));
+        }
+        _mm256_storeu_si256((__m256i*)(acc+i),    lo);
+        _mm256_storeu_si256((__m256i*)(acc+i+16), hi);
+    }
+    AddRowPairSSE2(a+i, b+i, acc+i, bytes-i, first);
+}
+
+#endif
+
+#ifdef PREVIEW_NEON
+
+static void AddRowPairNEON(const unsigned char * a, const unsigned char * b, uint16_t * acc, int bytes, bool first)
+{
+    int i = 0;
+    for(; i+16<=bytes; i+=16){
+        uint8x16_t x = vld1q_u8(a+i);
+        uint8x16_t y = vld1q_u8(b+i);
+        uint16x8_t lo = vaddl_u8(vget_low_u8(x), vget_low_u8(y));
+        uint16x8_t hi = vaddl_u8(vget_high_u8(x), vget_high_u8(y));
+        if(!first){
+            lo = vaddq_u16(lo, vld1q_u16(acc+i));
+            hi = vaddq_u16(hi, vld1q_u16(acc+i+8));
+        }
+        vst1q_u16(acc+i, lo);
+        vst1q_u16(acc+i+8, hi);
+    }
+    AddRowPairScalar(a+i, b+i, acc+i, bytes-i, first);
+}
+
+#endif
+
+
+struct PreviewKernels {
+    void (*addRowPair)(const unsigned char * a, const unsigned char * b, uint16_t * acc, int bytes, bool first);
+    void (*halve)(const uint16_t * in, uint16_t * out, int macropixelsOut);
+    void (*normalize)(const uint16_t * sums, unsigned char * out, int count, int shift);
+    const char * name;
+};
+
+static PreviewKernels SelectKernels()
+{
+#ifdef PREVIEW_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        PreviewKernels kernels = { AddRowPairAVX2, HalveSSE2, NormalizeSSE2, "avx2" };
+        return kernels;
+    }
+    PreviewKernels kernels = { AddRowPairSSE2, HalveSSE2, NormalizeSSE2, "sse2" };
+#elif defined(PREVIEW_NEON)
+    PreviewKernels kernels = { AddRowPairNEON, HalveScalar, NormalizeScalar, "neon" };
+#else
+    PreviewKernels kernels = { AddRowPairScalar, HalveScalar, NormalizeScalar, "scalar" };
+#endif
+    return kernels;
+}
+
+static const PreviewKernels & Kernels()
+{
+    static const PreviewKernels kernels = SelectKernels();
+    return kernels;
+}
+
+const char * PreviewScalerKernelName()
+{
+    return Kernels().name;
+}
+
+static int Log2Factor(int factor)
+{
+    switch(factor){
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        default: return 0;
+    }
+}
+
+void UyvyToArgbDownscaleRows(const unsigned char * uyvy, long uyvyRowBytes, int width,
+                             unsigned char * argb, long argbRowBytes,
+                             int factor, PreviewFilter filter, int firstRow, int rows)
+{
+    int steps = Log2Factor(factor);
+    int outWidth = (width / factor) & ~1;
+    if(!steps || outWidth < 2){
+        return;
+    }
+
+    const PreviewKernels & kernels = Kernels();
+    UyvyToArgbRowFunc convert = UyvyToArgbRowKernel();
+
+    // Each output macropixel is `factor` source macropixels wide
+    int macropixelsOut = outWidth / 2;
+    int sourceBytes = macropixelsOut * factor * 4;
+    std::vector<uint16_t> sums(sourceBytes);
+    std::vector<unsigned char> line(macropixelsOut * 4);
+
+    for(int y=firstRow;y<firstRow+rows;y++){
+        const unsigned char * top = uyvy + (long)y * factor * uyvyRowBytes;
+        unsigned char * out = line.data();
+
+        if(filter == PreviewFilterBilinear && factor > 2){
+            // The two pixels either side of the block's center on the two middle rows,
+            // and the two macropixels they fall in for chroma
+            const unsigned char * row0 = top + (factor/2 - 1) * uyvyRowBytes;
+            const unsigned char * row1 = row0 + uyvyRowBytes;
+            for(int k=0;k<macropixelsOut;k++, out+=4){
+                int m = k * factor + factor/2 - 1;
+                int u = row0[4*m] + row0[4*m+4] + row1[4*m] + row1[4*m+4];
+                int v = row0[4*m+2] + row0[4*m+6] + row1[4*m+2] + row1[4*m+6];
+                // Luma of pixel p is at 2p + 1, the pixel pairs are centered on the
+                // two output pixels' blocks
+                int p = 2 * k * factor + factor/2 - 1;
+                int y0 = row0[2*p+1] + row0[2*p+3] + row1[2*p+1] + row1[2*p+3];
+                p += factor;
+                int y1 = row0[2*p+1] + row0[2*p+3] + row1[2*p+1] + row1[2*p+3];
+                out[0] = (u + 2) >> 2;
+                out[1] = (y0 + 2) >> 2;
+                out[2] = (v + 2) >> 2;
+                out[3] = (y1 + 2) >> 2;
+            }
+        } else {
+            for(int r=0;r<factor;r+=2){
+                kernels.addRowPair(top + r * uyvyRowBytes, top + (r+1) * uyvyRowBytes, sums.data(), sourceBytes, r == 0);
+            }
+            for(int s=steps, macropixels=macropixelsOut * factor / 2; s>0; s--, macropixels/=2){
+                kernels.halve(sums.data(), sums.data(), macropixels);
+            }
+
+            kernels.normalize(sums.data(), out, macropixelsOut * 4, 2 * steps);
+        }
+
+        convert(line.data(), argb + (long)y * argbRowBytes, outWidth);
+    }
+}
+
+FrameRef DownscaleToArgb(FramePool * pool, const FrameRef & frame, int factor, PreviewFilter filter)
+{
+    if(!frame || frame->PixelFormat() != bmdFormat8BitYUV || !Log2Factor(factor)){
+        return FrameRef();
+    }
+    int outWidth = (frame->Width() / factor) & ~1;
+    int outHeight = frame->Height() / factor;
+    if(outWidth < 2 || outHeight < 1){
+        return FrameRef();
+    }
+
+    FrameRef scaled = pool->Acquire(outWidth, outHeight, (long)outWidth*4, bmdFormat8BitARGB);
+    if(!scaled){
+        return FrameRef();
+    }
+
+    const unsigned char * in = frame->Bytes();
+    long inRowBytes = frame->RowBytes();
+    int width = frame->Width();
+    unsigned char * out = scaled->Bytes();
+    auto scaleTile = [&](int firstRow, int numRows){
+        UyvyToArgbDownscaleRows(in, inRowBytes, width, out, (long)outWidth * 4, factor, filter, firstRow, numRows);
+    };
+    ConversionPool::Shared().ParallelRows(outHeight, ConversionPool::RowsPerTile(outHeight, inRowBytes * factor, outWidth * 4), scaleTile);
+
+    scaled->timestamps = frame->timestamps;
+    scaled->timecode = frame->timecode;
+    scaled->flags = frame->flags;
+    return scaled;
+}
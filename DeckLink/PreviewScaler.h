@@ -0,0 +1,41 @@
+//
+//  PreviewScaler.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  UYVY -> ARGB at 1/2, 1/4 or 1/8 size in one pass, for the input previews. Each
+//  output row sums its source rows into a 16 bit line, halves that line down to the
+//  output width while it is still in L1 and converts it with the YuvConverter kernel,
+//  so a frame is read once and only the small ARGB image is written.
+//
+//  Box averages every source pixel of a block. Bilinear samples at the block's center,
+//  which only reads the 2x2 pixels around it and is the cheaper of the two at 1/4
+//  and 1/8. At 1/2 they are the same.
+//
+
+#ifndef PREVIEWSCALER_H
+#define PREVIEWSCALER_H
+
+#include "VideoFrame.h"
+
+enum PreviewFilter {
+    PreviewFilterBox = 0,
+    PreviewFilterBilinear
+};
+
+// Output rows [firstRow, firstRow + rows) of a `width` pixel wide UYVY image scaled
+// down by `factor` (2, 4 or 8), both pointers at the top of their image. The output
+// is (width / factor) & ~1 pixels wide
+void UyvyToArgbDownscaleRows(const unsigned char * uyvy, long uyvyRowBytes, int width,
+                             unsigned char * argb, long argbRowBytes,
+                             int factor, PreviewFilter filter, int firstRow, int rows);
+
+// Name of the row summing kernel ("avx2", "sse2", "neon" or "scalar")
+const char * PreviewScalerKernelName();
+
+// A downscaled ARGB copy of a UYVY frame from `pool`, with the frame's timestamps and
+// timecode. Empty for other formats, other factors or when no buffer could be had.
+FrameRef DownscaleToArgb(FramePool * pool, const FrameRef & frame, int factor, PreviewFilter filter);
+
+#endif
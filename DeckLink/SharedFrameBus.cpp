@@ -0,0 +1,306 @@
+//
+//  SharedFrameBus.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "SharedFrameBus.h"
+#include "VideoFrame.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The frame bus needs lock free 64 bit atomics to work across processes");
+
+static const uint32_t kBusMagic = 0x53484642;   // 'SHFB'
+static const uint32_t kBusVersion = 1;
+static const size_t kPageSize = 4096;
+
+static size_t RoundToPages(size_t size)
+{
+    return (size + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+static const SharedFrameSlot * SlotAt(const SharedFrameBusHeader * header, uint64_t sequence)
+{
+    return (const SharedFrameSlot *)(header + 1) + sequence % header->slotCount;
+}
+
+static const unsigned char * SlotData(const SharedFrameBusHeader * header, uint64_t sequence)
+{
+    return (const unsigned char *)header + header->dataOffset + (sequence % header->slotCount) * header->slotBytes;
+}
+
+//
+// Publisher
+//
+
+SharedFrameBus::SharedFrameBus(const char * name, unsigned slotCount) : slotCount(slotCount < 3 ? 3 : slotCount), header(NULL), mappedSize(0), sequence(0), published(0), failed(0)
+{
+    snprintf(this->name, sizeof(this->name), "%s", name);
+}
+
+SharedFrameBus::~SharedFrameBus()
+{
+    Unmap();
+}
+
+bool SharedFrameBus::Map(size_t frameBytes)
+{
+    size_t slotBytes = RoundToPages(frameBytes);
+    size_t dataOffset = RoundToPages(sizeof(SharedFrameBusHeader) + slotCount * sizeof(SharedFrameSlot));
+    size_t size = dataOffset + slotCount * slotBytes;
+
+    // A segment left behind by a crashed run is replaced, its readers see it retired
+    // only if it was still mapped, so they poll the name again on their own
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0){
+        fprintf(stderr, "SharedFrameBus: could not create %s: %s\n", name, strerror(errno));
+        return false;
+    }
+
+    if(ftruncate(fd, size) != 0){
+        fprintf(stderr, "SharedFrameBus: could not size %s to %zu bytes: %s\n", name, size, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    void * memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        fprintf(stderr, "SharedFrameBus: could not map %s: %s\n", name, strerror(errno));
+        shm_unlink(name);
+        return false;
+    }
+
+    header = (SharedFrameBusHeader *)memory;
+    header->magic = kBusMagic;
+    header->slotCount = slotCount;
+    header->slotBytes = slotBytes;
+    header->dataOffset = dataOffset;
+    header->publisherPid = getpid();
+    header->published.store(sequence, std::memory_order_relaxed);
+    header->retired.store(0, std::memory_order_relaxed);
+
+    // The version goes last, readers do not touch a segment before it is set
+    std::atomic_thread_fence(std::memory_order_release);
+    header->version = kBusVersion;
+
+    mappedSize = size;
+    return true;
+}
+
+void SharedFrameBus::Unmap()
+{
+    if(!header){
+        return;
+    }
+
+    // Readers that still have it mapped move on to the new segment under the same name
+    header->retired.store(1, std::memory_order_release);
+    munmap(header, mappedSize);
+    shm_unlink(name);
+
+    header = NULL;
+    mappedSize = 0;
+}
+
+bool SharedFrameBus::Publish(const VideoFrame & frame)
+{
+    size_t dataSize = frame.DataSize();
+
+    if(!header || dataSize > header->slotBytes){
+        Unmap();
+        if(!Map(dataSize)){
+            failed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    uint64_t next = sequence + 1;
+    SharedFrameSlot * slot = (SharedFrameSlot *)SlotAt(header, next);
+
+    uint64_t version = slot->version.load(std::memory_order_relaxed);
+    slot->version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->sequence = next;
+    slot->width = frame.Width();
+    slot->height = frame.Height();
+    slot->rowBytes = frame.RowBytes();
+    slot->pixelFormat = frame.PixelFormat();
+    slot->flags = frame.flags;
+    slot->dataSize = dataSize;
+    slot->streamTime = frame.timestamps.streamTime;
+    slot->streamDuration = frame.timestamps.streamDuration;
+    slot->timeScale = frame.timestamps.timeScale;
+    slot->hardwareTime = frame.timestamps.hardwareTime;
+    slot->hardwareDuration = frame.timestamps.hardwareDuration;
+    slot->arrivalTime = frame.timestamps.arrivalTime;
+    memcpy((void *)SlotData(header, next), frame.Bytes(), dataSize);
+
+    slot->version.store(version + 2, std::memory_order_release);
+    header->published.store(next, std::memory_order_release);
+
+    sequence = next;
+    published.store(next, std::memory_order_relaxed);
+    return true;
+}
+
+//
+// Reader
+//
+
+SharedFrameReader * SharedFrameReader::Attach(const char * name)
+{
+    SharedFrameReader * reader = new SharedFrameReader();
+    snprintf(reader->name, sizeof(reader->name), "%s", name);
+    if(!reader->Map()){
+        delete reader;
+        return NULL;
+    }
+
+    // Start at the newest frame rather than replaying the ring
+    uint64_t published = reader->header->published.load(std::memory_order_acquire);
+    reader->lastSequence = published > 0 ? published - 1 : 0;
+    return reader;
+}
+
+SharedFrameReader::~SharedFrameReader()
+{
+    Unmap();
+}
+
+bool SharedFrameReader::Map()
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0){
+        return false;
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SharedFrameBusHeader)){
+        close(fd);
+        return false;
+    }
+
+    void * memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        return false;
+    }
+
+    const SharedFrameBusHeader * mapped = (const SharedFrameBusHeader *)memory;
+    bool ready = mapped->version == kBusVersion;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(!ready || mapped->magic != kBusMagic || mapped->slotCount < 3 ||
+       mapped->dataOffset + mapped->slotCount * mapped->slotBytes > (uint64_t)info.st_size){
+        munmap(memory, info.st_size);
+        return false;
+    }
+
+    header = mapped;
+    mappedSize = info.st_size;
+    return true;
+}
+
+void SharedFrameReader::Unmap()
+{
+    if(header){
+        munmap((void *)header, mappedSize);
+        header = NULL;
+        mappedSize = 0;
+    }
+}
+
+bool SharedFrameReader::Next(SharedFrameView & view)
+{
+    if(!header || header->retired.load(std::memory_order_acquire)){
+        Unmap();
+        if(!Map()){
+            return false;
+        }
+    }
+
+    // A few tries, each one only fails because the publisher lapped this reader
+    for(int attempt = 0; attempt < 4; attempt++){
+        uint64_t published = header->published.load(std::memory_order_acquire);
+        if(published <= lastSequence){
+            return false;
+        }
+
+        // The slot after the newest one may be being written, everything older than
+        // slotCount - 2 frames back is fair game for the publisher
+        uint64_t wanted = lastSequence + 1;
+        uint64_t oldest = published > header->slotCount - 2 ? published - (header->slotCount - 2) : 1;
+        if(wanted < oldest){
+            skipped += oldest - wanted;
+            wanted = oldest;
+        }
+
+        const SharedFrameSlot * slot = SlotAt(header, wanted);
+        uint64_t version = slot->version.load(std::memory_order_acquire);
+        if(version & 1){
+            lastSequence = wanted;
+            skipped++;
+            continue;
+        }
+
+        view.sequence = slot->sequence;
+        view.width = slot->width;
+        view.height = slot->height;
+        view.rowBytes = (long)slot->rowBytes;
+        view.pixelFormat = slot->pixelFormat;
+        view.flags = slot->flags;
+        view.dataSize = (size_t)slot->dataSize;
+        view.streamTime = slot->streamTime;
+        view.streamDuration = slot->streamDuration;
+        view.timeScale = slot->timeScale;
+        view.hardwareTime = slot->hardwareTime;
+        view.hardwareDuration = slot->hardwareDuration;
+        view.arrivalTime = slot->arrivalTime;
+        view.bytes = SlotData(header, wanted);
+        view.slot = slot;
+        view.slotVersion = version;
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        lastSequence = wanted;
+        if(slot->version.load(std::memory_order_relaxed) != version || view.sequence != wanted || view.dataSize > header->slotBytes){
+            skipped++;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+bool SharedFrameReader::WaitNext(SharedFrameView & view, int timeoutMs)
+{
+    // Polled, there is no cross process wakeup that works on both OS X and Linux
+    // without a syscall per frame on the capture side
+    struct timespec pause = { 0, 500000 };
+    for(int waited = 0; ; waited++){
+        if(Next(view)){
+            return true;
+        }
+        if(waited >= timeoutMs * 2){
+            return false;
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
+bool SharedFrameReader::IsValid(const SharedFrameView & view) const
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot->version.load(std::memory_order_relaxed) == view.slotVersion;
+}
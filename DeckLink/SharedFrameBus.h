@@ -0,0 +1,148 @@
+//
+//  SharedFrameBus.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Captured frames in a POSIX shared memory ring, so recording, monitoring and analysis
+//  can run in their own processes while this one owns the DeckLink input. The publisher
+//  copies each frame into the ring once. Readers map it read only and use the pixels
+//  in place, so adding a reader costs no copy and cannot slow down the capture.
+//
+//  Every slot is a seqlock: its version is odd while the publisher writes it. A reader
+//  notes the version, uses the frame and checks the version again. If it changed, the
+//  reader was too slow and the slot was overwritten, and it drops that frame. Readers
+//  that fall behind skip ahead to the oldest frame that is still safe to read.
+//
+//  Header only for readers, it does not need the DeckLink or VideoFrame headers.
+//
+
+#ifndef SHAREDFRAMEBUS_H
+#define SHAREDFRAMEBUS_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+class VideoFrame;
+
+// Layout of the segment, shared by both sides
+struct SharedFrameBusHeader {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                slotCount;
+    uint32_t                reserved;
+    uint64_t                slotBytes;      // pixel bytes per slot
+    uint64_t                dataOffset;     // first slot's pixels, page aligned
+    std::atomic<uint64_t>   published;      // sequence of the newest complete frame, 0 before the first
+    std::atomic<uint32_t>   retired;        // set once the publisher replaced or removed the segment
+    int32_t                 publisherPid;
+};
+
+struct SharedFrameSlot {
+    std::atomic<uint64_t>   version;        // odd while the slot is written
+    uint64_t                sequence;
+    int32_t                 width;
+    int32_t                 height;
+    int64_t                 rowBytes;
+    uint32_t                pixelFormat;    // BMDPixelFormat
+    uint32_t                flags;          // BMDFrameFlags
+    uint64_t                dataSize;
+    int64_t                 streamTime;     // as in FrameTimestamps
+    int64_t                 streamDuration;
+    int64_t                 timeScale;
+    int64_t                 hardwareTime;
+    int64_t                 hardwareDuration;
+    uint64_t                arrivalTime;
+};
+
+// A frame as seen by a reader. The pixels stay in the ring, check IsValid() after using
+// them. Views are good until the reader's next call to Next().
+struct SharedFrameView {
+    uint64_t        sequence;
+    int             width;
+    int             height;
+    long            rowBytes;
+    uint32_t        pixelFormat;
+    uint32_t        flags;
+    size_t          dataSize;
+    const void *    bytes;
+    int64_t         streamTime;
+    int64_t         streamDuration;
+    int64_t         timeScale;
+    int64_t         hardwareTime;
+    int64_t         hardwareDuration;
+    uint64_t        arrivalTime;
+
+    const SharedFrameSlot * slot;
+    uint64_t        slotVersion;
+};
+
+// The capture side. Publish() is called from one thread only.
+class SharedFrameBus {
+public:
+    // `name` is a shm_open name such as "/sh-input-1", at most 31 characters on OS X
+    SharedFrameBus(const char * name, unsigned slotCount);
+    ~SharedFrameBus();
+
+    // Copies the frame into the next slot. The segment is created on the first frame
+    // and replaced by a bigger one when the frames grow, eg. after a format change.
+    bool Publish(const VideoFrame & frame);
+
+    // Safe to read from any thread
+    uint64_t Published() const { return published.load(std::memory_order_relaxed); }
+    uint64_t Failed() const { return failed.load(std::memory_order_relaxed); }
+
+private:
+    bool Map(size_t frameBytes);
+    void Unmap();
+
+    char name[32];
+    unsigned slotCount;
+    SharedFrameBusHeader * header;
+    size_t mappedSize;
+    uint64_t sequence;
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> failed;
+
+    SharedFrameBus(const SharedFrameBus &);
+    SharedFrameBus & operator=(const SharedFrameBus &);
+};
+
+// The consuming side, one per thread that reads frames
+class SharedFrameReader {
+public:
+    // NULL if nothing is published under `name`
+    static SharedFrameReader * Attach(const char * name);
+    ~SharedFrameReader();
+
+    // The oldest frame not read yet that is still safe to read, false if there is none.
+    // Follows the publisher to a new segment when the old one is retired.
+    bool Next(SharedFrameView & view);
+
+    // Like Next(), but polls for up to `timeoutMs` for a new frame
+    bool WaitNext(SharedFrameView & view, int timeoutMs);
+
+    // False if the frame was overwritten since Next() returned it, its pixels may be torn
+    bool IsValid(const SharedFrameView & view) const;
+
+    // Frames the reader fell too far behind on and never saw
+    uint64_t Skipped() const { return skipped; }
+
+private:
+    SharedFrameReader() : header(NULL), mappedSize(0), lastSequence(0), skipped(0) {}
+
+    bool Map();
+    void Unmap();
+
+    char name[32];
+    const SharedFrameBusHeader * header;
+    size_t mappedSize;
+    uint64_t lastSequence;
+    uint64_t skipped;
+
+    SharedFrameReader(const SharedFrameReader &);
+    SharedFrameReader & operator=(const SharedFrameReader &);
+};
+
+#endif
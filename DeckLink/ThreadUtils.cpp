@@ -0,0 +1,133 @@
+//
+//  ThreadUtils.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "ThreadUtils.h"
+
+#include <thread>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#include <mach/mach.h>
+#include <mach/thread_policy.h>
+#include <mach/mach_time.h>
+#else
+#include <time.h>
+#include <sched.h>
+#include <stdio.h>
+#endif
+
+int HardwareConcurrency()
+{
+    int n = (int)std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+size_t L2CacheSize()
+{
+    size_t size = 0;
+#ifdef __APPLE__
+    uint64_t value = 0;
+    size_t length = sizeof(value);
+    if(sysctlbyname("hw.l2cachesize", &value, &length, NULL, 0) == 0){
+        size = (size_t)value;
+    }
+#elif defined(_SC_LEVEL2_CACHE_SIZE)
+    long value = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if(value > 0){
+        size = (size_t)value;
+    }
+#endif
+    return size > 0 ? size : 256*1024;
+}
+
+uint64_t MonotonicNanos()
+{
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if(timebase.denom == 0){
+        mach_timebase_info(&timebase);
+    }
+    uint64_t ticks = mach_absolute_time();
+    return ticks / timebase.denom * timebase.numer + ticks % timebase.denom * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+bool SetCurrentThreadAffinity(int cpu)
+{
+#ifdef __APPLE__
+    thread_affinity_policy_data_t policy = { cpu + 1 };
+    // pthread's own port for the thread, unlike mach_thread_self() there is no send
+    // right to give back
+    return thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_AFFINITY_POLICY, (thread_policy_t)&policy, THREAD_AFFINITY_POLICY_COUNT) == KERN_SUCCESS;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % HardwareConcurrency(), &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+bool SetCurrentThreadPriority(int priority)
+{
+    if(priority < 1){
+        priority = 1;
+    } else if(priority > 99){
+        priority = 99;
+    }
+#ifdef __APPLE__
+    // Precedence is relative to the task's other threads, 0-63
+    thread_precedence_policy_data_t policy = { (integer_t)(priority * 63 / 99) };
+    return thread_policy_set(pthread_mach_thread_np(pthread_self()), THREAD_PRECEDENCE_POLICY, (thread_policy_t)&policy, THREAD_PRECEDENCE_POLICY_COUNT) == KERN_SUCCESS;
+#elif defined(__linux__)
+    struct sched_param param;
+    param.sched_priority = priority;
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#else
+    return false;
+#endif
+}
+
+uint64_t CurrentThreadCpuNanos()
+{
+#ifdef __APPLE__
+    thread_basic_info_data_t info;
+    mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+    kern_return_t result = thread_info(pthread_mach_thread_np(pthread_self()), THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+    if(result != KERN_SUCCESS){
+        return 0;
+    }
+    return ((uint64_t)info.user_time.seconds + info.system_time.seconds) * 1000000000ULL
+         + ((uint64_t)info.user_time.microseconds + info.system_time.microseconds) * 1000ULL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+int NumaNodeOfCpu(int cpu)
+{
+#ifdef __linux__
+    // The cpu's sysfs directory has a nodeN link on NUMA kernels
+    for(int node=0; node<64; node++){
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+        if(access(path, F_OK) == 0){
+            return node;
+        }
+    }
+#endif
+    return -1;
+}
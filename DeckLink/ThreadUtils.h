@@ -0,0 +1,40 @@
+//
+//  ThreadUtils.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Small platform helpers for the capture/conversion threads.
+//
+
+#ifndef THREADUTILS_H
+#define THREADUTILS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Number of logical cores, at least 1
+int HardwareConcurrency();
+
+// Size of the per core L2 cache in bytes, 256 KB if it can not be queried
+size_t L2CacheSize();
+
+// Monotonic clock in nanoseconds, for frame timestamps and timing
+uint64_t MonotonicNanos();
+
+// Binds the calling thread to `cpu`. On OS X this is an affinity tag hint, threads
+// with different tags are kept on different cores. Returns false if it was refused.
+bool SetCurrentThreadAffinity(int cpu);
+
+// Raises the calling thread above normal threads. priority is 1-99: SCHED_FIFO on Linux
+// (needs CAP_SYS_NICE or an rtprio limit), the precedence policy on OS X. Returns false
+// if it was refused.
+bool SetCurrentThreadPriority(int priority);
+
+// CPU time the calling thread has used, in nanoseconds
+uint64_t CurrentThreadCpuNanos();
+
+// NUMA node `cpu` belongs to, -1 if there is only one or it can not be told
+int NumaNodeOfCpu(int cpu);
+
+#endif
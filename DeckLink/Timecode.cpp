@@ -0,0 +1,333 @@
+//
+//  Timecode.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "Timecode.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+static const uint32_t kIndexMagic = 0x43544853;    // 'SHTC'
+static const uint32_t kIndexVersion = 1;
+
+static int FromBcd(uint32_t byte)
+{
+    int high = (byte >> 4) & 0xf;
+    int low = byte & 0xf;
+    return (high > 9 || low > 9) ? -1 : high * 10 + low;
+}
+
+static uint32_t ToBcd(int value)
+{
+    return (uint32_t)(((value / 10) << 4) | (value % 10));
+}
+
+// Frame numbers 0 and 1 (0-3 at 60) of every minute but each tenth are skipped
+static int DroppedPerMinute(int fps, uint32_t flags)
+{
+    return (flags & TIMECODE_DROP_FRAME) && fps % 30 == 0 ? fps / 15 : 0;
+}
+
+int64_t TimecodeToFrames(uint32_t bcd, int fps, uint32_t flags)
+{
+    int hours = FromBcd(bcd >> 24);
+    int minutes = FromBcd((bcd >> 16) & 0xff);
+    int seconds = FromBcd((bcd >> 8) & 0xff);
+    int frames = FromBcd(bcd & 0xff);
+    if(fps <= 0 || hours < 0 || minutes < 0 || minutes > 59 || seconds < 0 || seconds > 59 || frames < 0 || frames >= fps){
+        return -1;
+    }
+
+    int64_t totalMinutes = hours * 60 + minutes;
+    int64_t count = ((totalMinutes * 60) + seconds) * fps + frames;
+    return count - DroppedPerMinute(fps, flags) * (totalMinutes - totalMinutes / 10);
+}
+
+uint32_t TimecodeFromFrames(int64_t count, int fps, uint32_t flags)
+{
+    if(fps <= 0 || count < 0){
+        return 0;
+    }
+
+    int dropped = DroppedPerMinute(fps, flags);
+    if(dropped){
+        int64_t perTenMinutes = fps * 600 - dropped * 9;
+        int64_t perMinute = fps * 60 - dropped;
+        int64_t tens = count / perTenMinutes;
+        int64_t remainder = count % perTenMinutes;
+        count += dropped * 9 * tens;
+        if(remainder > dropped){
+            count += dropped * ((remainder - dropped) / perMinute);
+        }
+    }
+
+    int frames = (int)(count % fps);
+    int64_t totalSeconds = count / fps;
+    int hours = (int)((totalSeconds / 3600) % 24);
+    return (ToBcd(hours) << 24) | (ToBcd((int)(totalSeconds / 60 % 60)) << 16) | (ToBcd((int)(totalSeconds % 60)) << 8) | ToBcd(frames);
+}
+
+void TimecodeFormat(uint32_t bcd, uint32_t flags, char * out)
+{
+    snprintf(out, 12, "%02x:%02x:%02x%c%02x", bcd >> 24, (bcd >> 16) & 0xff, (bcd >> 8) & 0xff,
+             (flags & TIMECODE_DROP_FRAME) ? ';' : ':', bcd & 0xff);
+}
+
+bool TimecodeParse(const char * string, uint32_t * bcd, uint32_t * flags)
+{
+    unsigned fields[4];
+    char separators[3];
+    if(sscanf(string, "%2u%c%2u%c%2u%c%2u", &fields[0], &separators[0], &fields[1], &separators[1], &fields[2], &separators[2], &fields[3]) != 7){
+        return false;
+    }
+    for(int i=0;i<3;i++){
+        if(separators[i] != ':' && separators[i] != ';' && separators[i] != '.'){
+            return false;
+        }
+    }
+    if(fields[0] > 23 || fields[1] > 59 || fields[2] > 59 || fields[3] > 59){
+        return false;
+    }
+
+    *bcd = (ToBcd(fields[0]) << 24) | (ToBcd(fields[1]) << 16) | (ToBcd(fields[2]) << 8) | ToBcd(fields[3]);
+    *flags = (separators[2] == ';' || separators[2] == '.') ? TIMECODE_DROP_FRAME : 0;
+    return true;
+}
+
+int TimecodeFps(int64_t frameDuration, int64_t timeScale)
+{
+    if(frameDuration <= 0){
+        return 0;
+    }
+    return (int)((timeScale + frameDuration / 2) / frameDuration);
+}
+
+//
+// Index
+//
+
+namespace {
+
+// Frames at time, time + step, ... with timecode frames, frames + 1, ...
+struct TimecodeRun {
+    int64_t time;
+    int32_t step;
+    uint32_t count;
+    int32_t frames;
+    uint32_t flags;
+};
+
+struct TimecodeIndexHeader {
+    uint32_t magic;
+    uint32_t version;
+    int64_t timeScale;
+    int32_t fps;
+    uint32_t runCount;
+};
+
+}
+
+struct TimecodeIndex {
+    int64_t timeScale;
+    int fps;
+    std::vector<TimecodeRun> runs;
+
+    // For TimeOf(): runs by timecode, and the highest timecode any of them reach up to there
+    std::vector<uint32_t> byTimecode;
+    std::vector<int64_t> reachByTimecode;
+
+    void BuildTimecodeOrder(){
+        byTimecode.resize(runs.size());
+        for(size_t i=0;i<runs.size();i++){
+            byTimecode[i] = (uint32_t)i;
+        }
+        std::sort(byTimecode.begin(), byTimecode.end(), [this](uint32_t a, uint32_t b){
+            return runs[a].frames != runs[b].frames ? runs[a].frames < runs[b].frames : runs[a].time < runs[b].time;
+        });
+
+        reachByTimecode.resize(runs.size());
+        int64_t reach = -1;
+        for(size_t i=0;i<byTimecode.size();i++){
+            const TimecodeRun & run = runs[byTimecode[i]];
+            reach = std::max(reach, (int64_t)run.frames + run.count);
+            reachByTimecode[i] = reach;
+        }
+    }
+};
+
+TimecodeIndex * TimecodeIndexCreate(int64_t timeScale, int fps)
+{
+    TimecodeIndex * index = new TimecodeIndex();
+    index->timeScale = timeScale > 0 ? timeScale : 1;
+    index->fps = fps;
+    return index;
+}
+
+void TimecodeIndexAppend(TimecodeIndex * index, int64_t time, uint32_t bcd, uint32_t flags)
+{
+    int64_t frames = TimecodeToFrames(bcd, index->fps, flags);
+    if(frames < 0){
+        return;
+    }
+
+    if(!index->runs.empty()){
+        TimecodeRun & run = index->runs.back();
+        bool nextTimecode = frames == (int64_t)run.frames + run.count && flags == run.flags;
+        if(nextTimecode && run.count == 1 && time > run.time && time - run.time <= INT32_MAX){
+            run.step = (int32_t)(time - run.time);
+            run.count = 2;
+            return;
+        }
+        if(nextTimecode && run.count > 1 && time == run.time + (int64_t)run.step * run.count){
+            run.count++;
+            return;
+        }
+    }
+
+    TimecodeRun run = { time, 0, 1, (int32_t)frames, flags };
+    index->runs.push_back(run);
+}
+
+bool TimecodeIndexWrite(const TimecodeIndex * index, const char * path)
+{
+    FILE * file = fopen(path, "wb");
+    if(!file){
+        fprintf(stderr, "TimecodeIndex: could not create %s\n", path);
+        return false;
+    }
+
+    TimecodeIndexHeader header = { kIndexMagic, kIndexVersion, index->timeScale, index->fps, (uint32_t)index->runs.size() };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (index->runs.empty() || fwrite(&index->runs[0], sizeof(TimecodeRun), index->runs.size(), file) == index->runs.size());
+    written = fclose(file) == 0 && written;
+    if(!written){
+        fprintf(stderr, "TimecodeIndex: could not write %s\n", path);
+        remove(path);
+    }
+    return written;
+}
+
+TimecodeIndex * TimecodeIndexLoad(const char * path)
+{
+    FILE * file = fopen(path, "rb");
+    if(!file){
+        return NULL;
+    }
+
+    TimecodeIndexHeader header;
+    TimecodeIndex * index = NULL;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == kIndexMagic && header.version == kIndexVersion &&
+                 header.timeScale > 0 && header.fps > 0;
+
+    // The runs are all that follows the header, a count that does not match the file
+    // is a truncated or corrupt index and must not size the allocation
+    if(valid){
+        long end = -1;
+        if(fseek(file, 0, SEEK_END) == 0){
+            end = ftell(file);
+        }
+        valid = end >= (long)sizeof(header) &&
+                (uint64_t)header.runCount * sizeof(TimecodeRun) == (uint64_t)(end - (long)sizeof(header)) &&
+                fseek(file, sizeof(header), SEEK_SET) == 0;
+    }
+
+    if(valid){
+        index = TimecodeIndexCreate(header.timeScale, header.fps);
+        index->runs.resize(header.runCount);
+        if(header.runCount && fread(&index->runs[0], sizeof(TimecodeRun), header.runCount, file) != header.runCount){
+            delete index;
+            index = NULL;
+        }
+    }
+    fclose(file);
+
+    if(index){
+        index->BuildTimecodeOrder();
+    }
+    return index;
+}
+
+void TimecodeIndexFree(TimecodeIndex * index)
+{
+    delete index;
+}
+
+bool TimecodeIndexTimecodeAt(const TimecodeIndex * index, double seconds, uint32_t * bcd, uint32_t * flags)
+{
+    if(!index || index->runs.empty()){
+        return false;
+    }
+
+    // The last run starting at or before the time, and the frame in it being shown
+    int64_t time = (int64_t)floor(seconds * index->timeScale + 0.5);
+    std::vector<TimecodeRun>::const_iterator next = std::upper_bound(index->runs.begin(), index->runs.end(), time,
+                                                                       [](int64_t value, const TimecodeRun & run){ return value < run.time; });
+    if(next == index->runs.begin()){
+        return false;
+    }
+    const TimecodeRun & run = *(next - 1);
+    int64_t frame = run.step ? (time - run.time) / run.step : 0;
+    frame = std::min(frame, (int64_t)run.count - 1);
+
+    *bcd = TimecodeFromFrames(run.frames + frame, index->fps, run.flags);
+    *flags = run.flags;
+    return true;
+}
+
+bool TimecodeIndexTimeOf(const TimecodeIndex * index, uint32_t bcd, double * seconds)
+{
+    if(!index || index->runs.empty()){
+        return false;
+    }
+
+    int64_t frames = TimecodeToFrames(bcd, index->fps, index->runs[0].flags);
+    if(frames < 0){
+        return false;
+    }
+
+    // Runs starting at or before the timecode, walking back only as far as one of them
+    // can still reach it. If the timecode repeats, the earliest in the movie wins.
+    size_t end = std::upper_bound(index->byTimecode.begin(), index->byTimecode.end(), frames,
+                                  [index](int64_t value, uint32_t run){ return value < index->runs[run].frames; }) - index->byTimecode.begin();
+    bool found = false;
+    int64_t best = 0;
+    for(size_t i=end;i>0 && index->reachByTimecode[i-1] > frames;i--){
+        const TimecodeRun & run = index->runs[index->byTimecode[i-1]];
+        if(frames < (int64_t)run.frames + run.count){
+            int64_t time = run.time + (frames - run.frames) * (int64_t)run.step;
+            if(!found || time < best){
+                best = time;
+                found = true;
+            }
+        }
+    }
+
+    if(found){
+        *seconds = (double)best / index->timeScale;
+    }
+    return found;
+}
+
+bool TimecodeIndexRange(const TimecodeIndex * index, uint32_t * firstBcd, uint32_t * lastBcd, uint32_t * flags)
+{
+    if(!index || index->runs.empty()){
+        return false;
+    }
+    const TimecodeRun & first = index->runs.front();
+    const TimecodeRun & last = index->runs.back();
+    *firstBcd = TimecodeFromFrames(first.frames, index->fps, first.flags);
+    *lastBcd = TimecodeFromFrames((int64_t)last.frames + last.count - 1, index->fps, last.flags);
+    *flags = first.flags;
+    return true;
+}
+
+size_t TimecodeIndexRunCount(const TimecodeIndex * index)
+{
+    return index ? index->runs.size() : 0;
+}
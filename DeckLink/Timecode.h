@@ -0,0 +1,74 @@
+//
+//  Timecode.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Source timecode of captured frames, and the index recordings keep of it.
+//
+//  Frames carry timecode as the driver's packed BCD (0xHHMMSSFF) and flags, which costs
+//  nothing to copy. Converting to frame counts and strings is done here, off the capture
+//  thread.
+//
+//  A recording's index lives next to it as "<movie>.tc". It holds runs of frames whose
+//  timecode counts up by one while their presentation time moves by the same step,
+//  so a take without timecode breaks or dropped frames is a single 24 byte entry.
+//  Both directions, movie time to timecode and timecode to movie time, are binary
+//  searches over the runs.
+//
+//  Plain C, so the Objective-C bank items can look recordings up.
+//
+
+#ifndef TIMECODE_H
+#define TIMECODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TIMECODE_DROP_FRAME     1   // bmdTimecodeIsDropFrame
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Frames since 00:00:00:00 at the nominal rate (30 for 29.97), -1 for invalid BCD
+int64_t TimecodeToFrames(uint32_t bcd, int fps, uint32_t flags);
+uint32_t TimecodeFromFrames(int64_t frames, int fps, uint32_t flags);
+
+// "HH:MM:SS:FF", with ';' before the frames for drop frame. out holds at least 12 chars
+void TimecodeFormat(uint32_t bcd, uint32_t flags, char * out);
+
+// Accepts ':', ';' or '.' between the fields. False if it is not a timecode
+bool TimecodeParse(const char * string, uint32_t * bcd, uint32_t * flags);
+
+// Nominal timecode rate of a frame duration, eg. 30 for 1001/30000
+int TimecodeFps(int64_t frameDuration, int64_t timeScale);
+
+typedef struct TimecodeIndex TimecodeIndex;
+
+// Building an index while recording. Times are presentation times in `timeScale`
+TimecodeIndex * TimecodeIndexCreate(int64_t timeScale, int fps);
+void TimecodeIndexAppend(TimecodeIndex * index, int64_t time, uint32_t bcd, uint32_t flags);
+bool TimecodeIndexWrite(const TimecodeIndex * index, const char * path);
+
+// NULL if there is no readable index at path
+TimecodeIndex * TimecodeIndexLoad(const char * path);
+void TimecodeIndexFree(TimecodeIndex * index);
+
+// Timecode of the frame shown at `seconds` into the movie
+bool TimecodeIndexTimecodeAt(const TimecodeIndex * index, double seconds, uint32_t * bcd, uint32_t * flags);
+
+// Movie time of the first frame with this timecode
+bool TimecodeIndexTimeOf(const TimecodeIndex * index, uint32_t bcd, double * seconds);
+
+// The first and last timecode in the movie, by movie time
+bool TimecodeIndexRange(const TimecodeIndex * index, uint32_t * firstBcd, uint32_t * lastBcd, uint32_t * flags);
+
+size_t TimecodeIndexRunCount(const TimecodeIndex * index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+//
+//  V210.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "V210.h"
+#include "YuvConverter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define V210_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define V210_NEON 1
+#endif
+
+
+// Every 32 bit word holds three samples, in stream order the 12 samples of a group are
+//
+//   word 0: Cb0 Y0  Cr0    word 1: Y1  Cb1 Y2    word 2: Cr1 Y3  Cb2    word 3: Y4  Cr2 Y5
+//
+// which is exactly the UYVY byte order, so sample k of a row goes to byte k of UYVY.
+
+enum {
+    kGroupPixels    = 6,
+    kGroupBytes     = 16,
+    kDitherPeriod   = 24     // samples, two groups
+};
+
+long V210RowBytes(int width)
+{
+    return ((width + 47) / 48) * 128;
+}
+
+static inline uint32_t LoadWord(const unsigned char * p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 2x2 ordered dither, added before dropping the 2 low bits. Y follows the pixel
+// column, Cb and Cr the chroma column with opposite row phases so they do not line up.
+static void DitherPattern(int row, unsigned char dither[kDitherPeriod])
+{
+    static const unsigned char bayer[2][2] = { { 0, 2 }, { 3, 1 } };
+    int r = row & 1;
+    for(int k=0; k<kDitherPeriod; k++){
+        if(k & 1){
+            dither[k] = bayer[r][((k - 1) / 2) & 1];
+        } else if((k & 3) == 0){
+            dither[k] = bayer[r][(k / 4) & 1];
+        } else {
+            dither[k] = bayer[r ^ 1][((k - 2) / 4) & 1];
+        }
+    }
+}
+
+static inline unsigned char Downconvert(int sample, int dither)
+{
+    int value = (sample + dither) >> 2;
+    return value > 255 ? 255 : value;
+}
+
+// Scalar downconvert of the pixels from `x` (a multiple of 6) to `width`
+static void V210ToUyvyTail(const unsigned char * v210, unsigned char * uyvy, int x, int width, const unsigned char dither[kDitherPeriod])
+{
+    int samples = width * 2;
+    for(int k = x * 2; k < samples; k += 3){
+        uint32_t word = LoadWord(v210 + (k / 3) * 4);
+        for(int i=0; i<3 && k+i<samples; i++){
+            uyvy[k+i] = Downconvert((word >> (10*i)) & 0x3FF, dither[(k+i) % kDitherPeriod]);
+        }
+    }
+}
+
+void V210ToUyvyRowScalar(const unsigned char * v210, unsigned char * uyvy, int width, int row)
+{
+    unsigned char dither[kDitherPeriod];
+    DitherPattern(row, dither);
+    V210ToUyvyTail(v210, uyvy, 0, width, dither);
+}
+
+static void V210UnpackTail(const unsigned char * v210, uint16_t * y, uint16_t * cb, uint16_t * cr, int x, int width)
+{
+    v210 += (x / kGroupPixels) * kGroupBytes;
+    for(; x<width; x+=kGroupPixels, v210+=kGroupBytes){
+        uint16_t s[12];
+        for(int w=0; w<4; w++){
+            uint32_t word = LoadWord(v210 + 4*w);
+            s[3*w]   = word & 0x3FF;
+            s[3*w+1] = (word >> 10) & 0x3FF;
+            s[3*w+2] = (word >> 20) & 0x3FF;
+        }
+        for(int i=0; i<6 && x+i<width; i++){
+            y[x+i] = s[2*i+1];
+        }
+        for(int i=0; i<3 && x+2*i<width; i++){
+            cb[x/2+i] = s[4*i];
+            cr[x/2+i] = s[4*i+2];
+        }
+    }
+}
+
+void V210UnpackRowScalar(const unsigned char * v210, uint16_t * y, uint16_t * cb, uint16_t * cr, int width)
+{
+    V210UnpackTail(v210, y, cb, cr, 0, width);
+}
+
+#ifdef V210_X86
+
+// pshufb mask moving 16 bit sample s[i] of the source to 16 bit slot i, -1 leaves it zero
+static inline __m128i Shuffle16(int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7)
+{
+    const int s[8] = { s0, s1, s2, s3, s4, s5, s6, s7 };
+    char m[16];
+    for(int i=0; i<8; i++){
+        m[2*i]   = s[i] < 0 ? (char)0x80 : (char)(2*s[i]);
+        m[2*i+1] = s[i] < 0 ? (char)0x80 : (char)(2*s[i]+1);
+    }
+    return _mm_loadu_si128((const __m128i*)m);
+}
+
+// The three samples of each of the 4 words as 32 bit lanes: a = first, b = second, c = third
+static inline void SplitWords(const unsigned char * v210, __m128i & a, __m128i & b, __m128i & c)
+{
+    const __m128i mask = _mm_set1_epi32(0x3FF);
+    __m128i in = _mm_loadu_si128((const __m128i*)v210);
+    a = _mm_and_si128(in, mask);
+    b = _mm_and_si128(_mm_srli_epi32(in, 10), mask);
+    c = _mm_and_si128(_mm_srli_epi32(in, 20), mask);
+}
+
+// The SIMD loops store a few samples past their group, they only run while a whole
+// group follows, which is written after them, and leave the rest to the scalar tail.
+
+__attribute__((target("ssse3")))
+static void V210UnpackRowSSSE3(const unsigned char * v210, uint16_t * y, uint16_t * cb, uint16_t * cr, int width)
+{
+    // ab = a0 a1 a2 a3 b0 b1 b2 b3, cc = c0 c1 c2 c3 c0 c1 c2 c3
+    const __m128i yFromAB    = Shuffle16( 4,  1, -1,  6,  3, -1, -1, -1);
+    const __m128i yFromC     = Shuffle16(-1, -1,  1, -1, -1,  3, -1, -1);
+    const __m128i cbcrFromAB = Shuffle16( 0,  5, -1, -1, -1,  2,  7, -1);
+    const __m128i cbcrFromC  = Shuffle16(-1, -1,  2, -1,  0, -1, -1, -1);
+    int x = 0;
+
+    for(; x+2*kGroupPixels<=width; x+=kGroupPixels, v210+=kGroupBytes){
+        __m128i a, b, c;
+        SplitWords(v210, a, b, c);
+        __m128i ab = _mm_packs_epi32(a, b);
+        __m128i cc = _mm_packs_epi32(c, c);
+
+        __m128i yy   = _mm_or_si128(_mm_shuffle_epi8(ab, yFromAB), _mm_shuffle_epi8(cc, yFromC));
+        __m128i cbcr = _mm_or_si128(_mm_shuffle_epi8(ab, cbcrFromAB), _mm_shuffle_epi8(cc, cbcrFromC));
+
+        _mm_storeu_si128((__m128i*)(y + x), yy);
+        _mm_storel_epi64((__m128i*)(cb + x/2), cbcr);
+        _mm_storel_epi64((__m128i*)(cr + x/2), _mm_srli_si128(cbcr, 8));
+    }
+
+    V210UnpackTail(v210 - (x / kGroupPixels) * kGroupBytes, y, cb, cr, x, width);
+}
+
+__attribute__((target("ssse3")))
+static void V210ToUyvyRowSSSE3(const unsigned char * v210, unsigned char * uyvy, int width, int row)
+{
+    unsigned char dither[kDitherPeriod];
+    DitherPattern(row, dither);
+
+    // Dither for the a, b and c lanes of even and odd groups
+    __m128i da[2], db[2], dc[2];
+    for(int g=0; g<2; g++){
+        const unsigned char * d = dither + 12*g;
+        da[g] = _mm_setr_epi32(d[0], d[3], d[6], d[9]);
+        db[g] = _mm_setr_epi32(d[1], d[4], d[7], d[10]);
+        dc[g] = _mm_setr_epi32(d[2], d[5], d[8], d[11]);
+    }
+
+    // packus leaves a0-a3 b0-b3 c0-c3, interleave back to stream order
+    const __m128i order = _mm_setr_epi8(0, 4, 8, 1, 5, 9, 2, 6, 10, 3, 7, 11, -1, -1, -1, -1);
+    int x = 0;
+    int g = 0;
+
+    for(; x+2*kGroupPixels<=width; x+=kGroupPixels, v210+=kGroupBytes, g^=1){
+        __m128i a, b, c;
+        SplitWords(v210, a, b, c);
+        a = _mm_srli_epi32(_mm_add_epi32(a, da[g]), 2);
+        b = _mm_srli_epi32(_mm_add_epi32(b, db[g]), 2);
+        c = _mm_srli_epi32(_mm_add_epi32(c, dc[g]), 2);
+
+        // 1023 + 3 >> 2 is 256, the unsigned pack saturates it to 255
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, c));
+        _mm_storeu_si128((__m128i*)(uyvy + 2*x), _mm_shuffle_epi8(bytes, order));
+    }
+
+    V210ToUyvyTail(v210 - (x / kGroupPixels) * kGroupBytes, uyvy, x, width, dither);
+}
+
+#endif
+
+#ifdef V210_NEON
+
+static void V210ToUyvyRowNEON(const unsigned char * v210, unsigned char * uyvy, int width, int row)
+{
+    unsigned char dither[kDitherPeriod];
+    DitherPattern(row, dither);
+
+    // Two groups at a time, so lanes 0-3 are always an even group and 4-7 an odd one
+    uint32x4_t da[2], db[2], dc[2];
+    for(int g=0; g<2; g++){
+        const unsigned char * d = dither + 12*g;
+        const uint32_t av[4] = { d[0], d[3], d[6], d[9] };
+        const uint32_t bv[4] = { d[1], d[4], d[7], d[10] };
+        const uint32_t cv[4] = { d[2], d[5], d[8], d[11] };
+        da[g] = vld1q_u32(av);
+        db[g] = vld1q_u32(bv);
+        dc[g] = vld1q_u32(cv);
+    }
+    const uint32x4_t mask = vdupq_n_u32(0x3FF);
+    int x = 0;
+
+    for(; x+2*kGroupPixels<=width; x+=2*kGroupPixels, v210+=2*kGroupBytes){
+        uint16x4_t a[2], b[2], c[2];
+        for(int g=0; g<2; g++){
+            uint32x4_t in = vld1q_u32((const uint32_t*)(v210 + g*kGroupBytes));
+            a[g] = vqmovn_u32(vshrq_n_u32(vaddq_u32(vandq_u32(in, mask), da[g]), 2));
+            b[g] = vqmovn_u32(vshrq_n_u32(vaddq_u32(vandq_u32(vshrq_n_u32(in, 10), mask), db[g]), 2));
+            c[g] = vqmovn_u32(vshrq_n_u32(vaddq_u32(vandq_u32(vshrq_n_u32(in, 20), mask), dc[g]), 2));
+        }
+
+        // vst3 interleaves a, b, c back to stream order
+        uint8x8x3_t out = {{ vqmovn_u16(vcombine_u16(a[0], a[1])),
+                             vqmovn_u16(vcombine_u16(b[0], b[1])),
+                             vqmovn_u16(vcombine_u16(c[0], c[1])) }};
+        vst3_u8(uyvy + 2*x, out);
+    }
+
+    V210ToUyvyTail(v210 - (x / kGroupPixels) * kGroupBytes, uyvy, x, width, dither);
+}
+
+#endif
+
+
+struct V210Kernels {
+    V210UnpackRowFunc unpack;
+    V210ToUyvyRowFunc toUyvy;
+    const char * name;
+};
+
+static V210Kernels SelectKernels()
+{
+#ifdef V210_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("ssse3")){
+        V210Kernels kernels = { V210UnpackRowSSSE3, V210ToUyvyRowSSSE3, "ssse3" };
+        return kernels;
+    }
+#elif defined(V210_NEON)
+    V210Kernels kernels = { V210UnpackRowScalar, V210ToUyvyRowNEON, "neon" };
+    return kernels;
+#endif
+    V210Kernels scalar = { V210UnpackRowScalar, V210ToUyvyRowScalar, "scalar" };
+    return scalar;
+}
+
+static const V210Kernels & Kernels()
+{
+    static const V210Kernels kernels = SelectKernels();
+    return kernels;
+}
+
+V210UnpackRowFunc V210UnpackRowKernel()
+{
+    return Kernels().unpack;
+}
+
+V210ToUyvyRowFunc V210ToUyvyRowKernel()
+{
+    return Kernels().toUyvy;
+}
+
+const char * V210KernelName()
+{
+    return Kernels().name;
+}
+
+void V210ToArgbRows(const unsigned char * v210, long v210RowBytes, unsigned char * argb, long argbRowBytes, int width, int firstRow, int rows)
+{
+    // Goes through a small UYVY buffer that stays in L1, the chunk is a multiple of
+    // two groups so every chunk starts on the same dither phase
+    enum { kChunkPixels = 16 * 2 * kGroupPixels };
+    unsigned char uyvy[kChunkPixels * 2];
+
+    V210ToUyvyRowFunc downconvert = V210ToUyvyRowKernel();
+    UyvyToArgbRowFunc convert = UyvyToArgbRowKernel();
+
+    for(int i=0; i<rows; i++){
+        const unsigned char * in = v210 + i*v210RowBytes;
+        unsigned char * out = argb + i*argbRowBytes;
+        for(int x=0; x<width; x+=kChunkPixels){
+            int n = width - x < kChunkPixels ? width - x : kChunkPixels;
+            downconvert(in + (x / kGroupPixels) * kGroupBytes, uyvy, n, firstRow + i);
+            convert(uyvy, out + (long)x*4, n);
+        }
+    }
+}
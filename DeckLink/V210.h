@@ -0,0 +1,44 @@
+//
+//  V210.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  10 bit 4:2:2 (bmdFormat10BitYUV, 'v210') kernels. v210 stores 6 pixels in four
+//  little endian 32 bit words of three 10 bit samples each, in the same Cb Y Cr Y
+//  order as UYVY, and pads every row to 48 pixels (128 bytes).
+//
+//  Unpacking to 16 bit planar Y/Cb/Cr uses SSSE3 when the CPU has it, the dithered
+//  8 bit downconvert for previews uses SSSE3 or NEON.
+//
+
+#ifndef V210_H
+#define V210_H
+
+#include <stdint.h>
+
+// Bytes per row of a v210 frame `width` pixels wide
+long V210RowBytes(int width);
+
+// One row of `width` pixels to 16 bit planar, Y gets `width` samples, Cb and Cr (width+1)/2
+typedef void (*V210UnpackRowFunc)(const unsigned char * v210, uint16_t * y, uint16_t * cb, uint16_t * cr, int width);
+
+// One row to 8 bit UYVY with 2x2 ordered dithering, `row` picks the dither phase
+typedef void (*V210ToUyvyRowFunc)(const unsigned char * v210, unsigned char * uyvy, int width, int row);
+
+// Best kernels for this CPU, resolved on first call
+V210UnpackRowFunc V210UnpackRowKernel();
+V210ToUyvyRowFunc V210ToUyvyRowKernel();
+
+// Name of the kernels in use ("ssse3", "neon" or "scalar")
+const char * V210KernelName();
+
+// Plain C versions, also used for the tail of rows
+void V210UnpackRowScalar(const unsigned char * v210, uint16_t * y, uint16_t * cb, uint16_t * cr, int width);
+void V210ToUyvyRowScalar(const unsigned char * v210, unsigned char * uyvy, int width, int row);
+
+// Downconverts and converts `rows` rows to ARGB for previews. `firstRow` is the row
+// index of the first one in the frame, so tiles of the same frame dither alike.
+void V210ToArgbRows(const unsigned char * v210, long v210RowBytes, unsigned char * argb, long argbRowBytes, int width, int firstRow, int rows);
+
+#endif
@@ -0,0 +1,206 @@
+//
+//  VideoFrame.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "VideoFrame.h"
+#include "YuvConverter.h"
+#include "V210.h"
+#include "ConversionPool.h"
+
+#include <string.h>
+
+void VideoFrame::AddRef()
+{
+    refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void VideoFrame::Release()
+{
+    if(refCount.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        pool->Recycle(this);
+    }
+}
+
+FrameRef VideoFrame::Argb()
+{
+    if(pixelFormat == bmdFormat8BitARGB){
+        AddRef();
+        return FrameRef::Adopt(this);
+    }
+    if(pixelFormat != bmdFormat8BitYUV && pixelFormat != bmdFormat10BitYUV){
+        return FrameRef();
+    }
+
+    // Consumers on different threads may ask at the same time, only the first converts
+    std::lock_guard<std::mutex> lock(argbMutex);
+    if(!argb){
+        FrameRef converted = pool->Acquire(width, height, (long)width*4, bmdFormat8BitARGB);
+        if(!converted){
+            return FrameRef();
+        }
+
+        const unsigned char * in = bytes;
+        unsigned char * out = converted->Bytes();
+        int inRowBytes = (int)rowBytes;
+        int w = width;
+        bool tenBit = pixelFormat == bmdFormat10BitYUV;
+        auto convertTile = [&](int firstRow, int numRows){
+            if(tenBit){
+                // dithered down to 8 bit first, the ARGB is only for previews
+                V210ToArgbRows(in + (long)firstRow*inRowBytes, inRowBytes, out + (long)firstRow*w*4, w*4, w, firstRow, numRows);
+            } else {
+                UyvyToArgbRows(in + (long)firstRow*inRowBytes, inRowBytes, out + (long)firstRow*w*4, w*4, w, numRows);
+            }
+        };
+        ConversionPool::Shared().ParallelRows(height, ConversionPool::RowsPerTile(height, inRowBytes, w*4), convertTile);
+
+        converted->timestamps = timestamps;
+        converted->timecode = timecode;
+        converted->flags = flags;
+        argb = converted.Detach();
+    }
+    argb->AddRef();
+    return FrameRef::Adopt(argb);
+}
+
+
+FramePool::FramePool(unsigned cacheSize, bool useHugePages) : refCount(1), buffers(cacheSize, useHugePages), cacheSize(cacheSize)
+{
+}
+
+FramePool::~FramePool()
+{
+    for(size_t i=0;i<freeFrames.size();i++){
+        delete freeFrames[i];
+    }
+}
+
+void FramePool::AddRef()
+{
+    refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FramePool::Release()
+{
+    if(refCount.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        delete this;
+    }
+}
+
+FrameRef FramePool::Acquire(int width, int height, long rowBytes, BMDPixelFormat pixelFormat)
+{
+    unsigned char * bytes = (unsigned char *)buffers.Acquire((size_t)rowBytes * height);
+    if(!bytes){
+        return FrameRef();
+    }
+
+    VideoFrame * frame = TakeFrameObject();
+    frame->pool = this;
+    frame->bytes = bytes;
+    frame->width = width;
+    frame->height = height;
+    frame->rowBytes = rowBytes;
+    frame->pixelFormat = pixelFormat;
+    frame->flags = bmdFrameFlagDefault;
+    memset(&frame->timestamps, 0, sizeof(frame->timestamps));
+    memset(&frame->timecode, 0, sizeof(frame->timecode));
+    frame->refCount.store(1, std::memory_order_relaxed);
+
+    AddRef();
+    return FrameRef::Adopt(frame);
+}
+
+FrameRef FramePool::Wrap(IDeckLinkVideoFrame * videoFrame)
+{
+    unsigned char * bytes = NULL;
+    if(videoFrame->GetBytes((void**)&bytes) != S_OK || !bytes){
+        return FrameRef();
+    }
+    videoFrame->AddRef();
+
+    VideoFrame * frame = TakeFrameObject();
+    frame->pool = this;
+    frame->source = videoFrame;
+    frame->bytes = bytes;
+    frame->width = (int)videoFrame->GetWidth();
+    frame->height = (int)videoFrame->GetHeight();
+    frame->rowBytes = videoFrame->GetRowBytes();
+    frame->pixelFormat = videoFrame->GetPixelFormat();
+    frame->flags = videoFrame->GetFlags();
+    memset(&frame->timestamps, 0, sizeof(frame->timestamps));
+    memset(&frame->timecode, 0, sizeof(frame->timecode));
+    frame->refCount.store(1, std::memory_order_relaxed);
+
+    AddRef();
+    return FrameRef::Adopt(frame);
+}
+
+FrameRef FramePool::Copy(const FrameRef & source)
+{
+    FrameRef frame = Acquire(source->Width(), source->Height(), source->RowBytes(), source->PixelFormat());
+    if(!frame){
+        return frame;
+    }
+    memcpy(frame->Bytes(), source->Bytes(), source->DataSize());
+    frame->timestamps = source->timestamps;
+    frame->timecode = source->timecode;
+    frame->flags = source->flags;
+    return frame;
+}
+
+void FramePool::Flush()
+{
+    buffers.Flush();
+}
+
+void FramePool::SetNumaNode(int node)
+{
+    buffers.SetNumaNode(node);
+}
+
+VideoFrame * FramePool::TakeFrameObject()
+{
+    VideoFrame * frame = NULL;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!freeFrames.empty()){
+            frame = freeFrames.back();
+            freeFrames.pop_back();
+        }
+    }
+    if(!frame){
+        frame = new VideoFrame();
+    }
+    return frame;
+}
+
+void FramePool::Recycle(VideoFrame * frame)
+{
+    if(frame->source){
+        frame->source->Release();
+        frame->source = NULL;
+    } else {
+        buffers.Release(frame->bytes);
+    }
+    frame->bytes = NULL;
+
+    if(frame->argb){
+        frame->argb->Release();
+        frame->argb = NULL;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(freeFrames.size() < cacheSize){
+            freeFrames.push_back(frame);
+            frame = NULL;
+        }
+    }
+    delete frame;
+
+    // Drop the reference the frame held on us, this may delete the pool
+    Release();
+}
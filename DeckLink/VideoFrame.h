@@ -0,0 +1,187 @@
+//
+//  VideoFrame.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Reference counted frame shared by capture, mixer, recorder and playout. A frame
+//  carries its pixels, layout and timestamps, and goes back to its FramePool once the
+//  last FrameRef (or CVPixelBuffer wrapping it) lets go, so consumers never see a
+//  buffer that is being overwritten by the next frame.
+//
+//  A frame either owns a buffer from its pool, or wraps a driver frame as is (native
+//  UYVY or v210), in which case Argb() converts it for the consumers that need RGB.
+//
+
+#ifndef VIDEOFRAME_H
+#define VIDEOFRAME_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+#include "DeckLinkAPI.h"
+#include "BufferPool.h"
+
+class FramePool;
+class FrameRef;
+
+struct FrameTimestamps {
+    BMDTimeValue    streamTime;         // GetStreamTime, in timeScale units
+    BMDTimeValue    streamDuration;
+    BMDTimeScale    timeScale;
+    BMDTimeValue    hardwareTime;       // GetHardwareReferenceTimestamp, in timeScale units
+    BMDTimeValue    hardwareDuration;
+    uint64_t        arrivalTime;        // MonotonicNanos() when the driver callback got the frame
+    int64_t         audioPosition;      // the frame's first 48 kHz sample on the stream clock, see AudioRing
+    int64_t         audioSamples;       // sample frames up to the next frame's audioPosition
+};
+
+// Source timecode as the driver reports it, formatting and counting are in Timecode.h
+struct FrameTimecode {
+    BMDTimecodeFormat   format;         // where it came from, 0 if the frame has none
+    BMDTimecodeBCD      bcd;            // 0xHHMMSSFF
+    BMDTimecodeFlags    flags;          // bmdTimecodeIsDropFrame
+    BMDTimecodeUserBits userBits;
+};
+
+class VideoFrame {
+public:
+    int             Width() const       { return width; }
+    int             Height() const      { return height; }
+    long            RowBytes() const    { return rowBytes; }
+    BMDPixelFormat  PixelFormat() const { return pixelFormat; }
+    unsigned char * Bytes() const       { return bytes; }
+    size_t          DataSize() const    { return (size_t)rowBytes * height; }
+    // The pixels are the driver's, which has only so many capture buffers
+    bool            WrapsDriverFrame() const { return source != NULL; }
+
+    FrameTimestamps timestamps;
+    FrameTimecode   timecode;
+    BMDFrameFlags   flags;
+
+    void AddRef();
+    void Release();
+
+    // This frame as 8 bit ARGB. Other formats are converted on first use and the
+    // result is kept with the frame, so it is converted at most once however many
+    // consumers ask. Empty if the format can not be converted.
+    FrameRef Argb();
+
+private:
+    friend class FramePool;
+
+    VideoFrame() : refCount(0), pool(NULL), bytes(NULL), source(NULL), argb(NULL) {}
+    ~VideoFrame() {}
+
+    std::atomic<int> refCount;
+    FramePool *     pool;
+    unsigned char * bytes;
+    IDeckLinkVideoFrame * source;   // wrapped driver frame, bytes point into it
+    VideoFrame *    argb;           // cached Argb() conversion
+    std::mutex      argbMutex;
+    int             width;
+    int             height;
+    long            rowBytes;
+    BMDPixelFormat  pixelFormat;
+};
+
+// Owning handle to a VideoFrame. Copying adds a reference, moving transfers it.
+class FrameRef {
+public:
+    FrameRef() : frame(NULL) {}
+    FrameRef(const FrameRef & other) : frame(other.frame) { if(frame) frame->AddRef(); }
+    FrameRef(FrameRef && other) : frame(other.frame) { other.frame = NULL; }
+    ~FrameRef() { if(frame) frame->Release(); }
+
+    FrameRef & operator=(const FrameRef & other){
+        if(other.frame) other.frame->AddRef();
+        if(frame) frame->Release();
+        frame = other.frame;
+        return *this;
+    }
+
+    FrameRef & operator=(FrameRef && other){
+        if(this != &other){
+            if(frame) frame->Release();
+            frame = other.frame;
+            other.frame = NULL;
+        }
+        return *this;
+    }
+
+    // Takes over a reference the caller already holds
+    static FrameRef Adopt(VideoFrame * frame){
+        FrameRef ref;
+        ref.frame = frame;
+        return ref;
+    }
+
+    // Gives up our reference without releasing it, eg. to hand it to a CVPixelBuffer
+    VideoFrame * Detach(){
+        VideoFrame * f = frame;
+        frame = NULL;
+        return f;
+    }
+
+    void Reset(){
+        if(frame) frame->Release();
+        frame = NULL;
+    }
+
+    VideoFrame * Get() const        { return frame; }
+    VideoFrame * operator->() const { return frame; }
+    VideoFrame & operator*() const  { return *frame; }
+    explicit operator bool() const  { return frame != NULL; }
+
+private:
+    VideoFrame * frame;
+};
+
+// Hands out frames backed by a BufferPool and recycles both the frame objects and
+// their pixel buffers. The pool is reference counted as well, every frame out holds
+// a reference, so the owner can Release() it while frames are still in flight.
+class FramePool {
+public:
+    FramePool(unsigned cacheSize, bool useHugePages);
+
+    void AddRef();
+    void Release();
+
+    // Returns a frame with uninitialised pixels and zeroed timestamps, or an empty
+    // FrameRef if the memory could not be allocated
+    FrameRef Acquire(int width, int height, long rowBytes, BMDPixelFormat pixelFormat);
+
+    // Returns a frame using the driver frame's memory directly, no copy. The driver
+    // frame is AddRef'd and released again when the frame is recycled.
+    FrameRef Wrap(IDeckLinkVideoFrame * videoFrame);
+
+    // A frame of this pool with a copy of `frame`'s pixels, timestamps and timecode, for
+    // holding on to a wrapped driver frame longer than the driver can spare it
+    FrameRef Copy(const FrameRef & frame);
+
+    // Frees the cached buffers, eg. after a format change. Frames out are unaffected.
+    void Flush();
+
+    // See BufferPool::SetNumaNode
+    void SetNumaNode(int node);
+
+private:
+    friend class VideoFrame;
+    ~FramePool();
+
+    VideoFrame * TakeFrameObject();
+    void Recycle(VideoFrame * frame);
+
+    std::atomic<int> refCount;
+    BufferPool buffers;
+    std::mutex mutex;
+    std::vector<VideoFrame*> freeFrames;
+    unsigned cacheSize;
+
+    FramePool(const FramePool &);
+    FramePool & operator=(const FramePool &);
+};
+
+#endif
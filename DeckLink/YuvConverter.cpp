@@ -0,0 +1,286 @@
+//
+//  YuvConverter.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include "YuvConverter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUV_X86 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define YUV_NEON 1
+#endif
+
+
+// Same BT.601 formulas as documented in DecklinkCallback.mm, in 6 bit fixed point
+// so every intermediate fits in a signed 16 bit SIMD lane:
+//
+// R = 1.164(Y - 16) + 1.793(Cr - 128)      ->  (75(Y - 16) + 115(Cr - 128) + 32) >> 6
+// G = 1.164(Y - 16) - 0.534(Cr - 128)
+//                   - 0.213(Cb - 128)      ->  (75(Y - 16) -  34(Cr - 128) - 14(Cb - 128) + 32) >> 6
+// B = 1.164(Y - 16) + 2.115(Cb - 128)      ->  (75(Y - 16) + 135(Cb - 128) + 32) >> 6
+//
+// Only the blue sum can leave the 16 bit range, and only above 255 << 6, so the
+// saturating adds in the SIMD kernels give the same bytes as the scalar version.
+
+enum {
+    kYScale     = 75,
+    kVR         = 115,
+    kVG         = 34,
+    kUG         = 14,
+    kUB         = 135,
+    kRound      = 32,
+    kShift      = 6
+};
+
+static inline unsigned char ClampShifted(int value)
+{
+    value >>= kShift;
+    if(value > 255) return 255;
+    if(value < 0)   return 0;
+    return value;
+}
+
+void UyvyToArgbRowScalar(const unsigned char * uyvy, unsigned char * argb, int width)
+{
+    // 2 pixels share one U and V sample
+    int i = 0;
+    for(; i+1<width; i+=2, uyvy+=4, argb+=8){
+        int uu = uyvy[0] - 128;
+        int vv = uyvy[2] - 128;
+
+        int vr = vv * kVR;
+        int ug_plus_vg = uu * kUG + vv * kVG;
+        int ub = uu * kUB;
+
+        int yy = (uyvy[1] - 16) * kYScale + kRound;
+        argb[0] = 255;
+        argb[1] = ClampShifted(yy + vr);
+        argb[2] = ClampShifted(yy - ug_plus_vg);
+        argb[3] = ClampShifted(yy + ub);
+
+        yy = (uyvy[3] - 16) * kYScale + kRound;
+        argb[4] = 255;
+        argb[5] = ClampShifted(yy + vr);
+        argb[6] = ClampShifted(yy - ug_plus_vg);
+        argb[7] = ClampShifted(yy + ub);
+    }
+
+    // Odd widths end in half a macropixel, its second luma sample is padding
+    if(i < width){
+        int uu = uyvy[0] - 128;
+        int vv = uyvy[2] - 128;
+        int yy = (uyvy[1] - 16) * kYScale + kRound;
+        argb[0] = 255;
+        argb[1] = ClampShifted(yy + vv * kVR);
+        argb[2] = ClampShifted(yy - (uu * kUG + vv * kVG));
+        argb[3] = ClampShifted(yy + uu * kUB);
+    }
+}
+
+#ifdef YUV_X86
+
+// 8 UYVY pixels -> R, G and B as 16 bit lanes
+static inline void ConvertSSE2(__m128i uyvy, __m128i & r, __m128i & g, __m128i & b)
+{
+    __m128i y  = _mm_srli_epi16(uyvy, 8);
+    __m128i uv = _mm_and_si128(uyvy, _mm_set1_epi16(0x00FF));
+
+    // Duplicate each chroma sample to both pixels of its macropixel
+    __m128i u = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+    __m128i v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+
+    y = _mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y, _mm_set1_epi16(16)), _mm_set1_epi16(kYScale)), _mm_set1_epi16(kRound));
+    u = _mm_sub_epi16(u, _mm_set1_epi16(128));
+    v = _mm_sub_epi16(v, _mm_set1_epi16(128));
+
+    r = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(v, _mm_set1_epi16(kVR))), kShift);
+    g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(kUG))), _mm_mullo_epi16(v, _mm_set1_epi16(kVG))), kShift);
+    b = _mm_srai_epi16(_mm_adds_epi16(y, _mm_mullo_epi16(u, _mm_set1_epi16(kUB))), kShift);
+}
+
+static void UyvyToArgbRowSSE2(const unsigned char * uyvy, unsigned char * argb, int width)
+{
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+    int x = 0;
+
+    for(; x+16<=width; x+=16, uyvy+=32, argb+=64){
+        __m128i r0, g0, b0, r1, g1, b1;
+        ConvertSSE2(_mm_loadu_si128((const __m128i*)uyvy), r0, g0, b0);
+        ConvertSSE2(_mm_loadu_si128((const __m128i*)(uyvy+16)), r1, g1, b1);
+
+        __m128i r = _mm_packus_epi16(r0, r1);
+        __m128i g = _mm_packus_epi16(g0, g1);
+        __m128i b = _mm_packus_epi16(b0, b1);
+
+        __m128i arLo = _mm_unpacklo_epi8(alpha, r);
+        __m128i arHi = _mm_unpackhi_epi8(alpha, r);
+        __m128i gbLo = _mm_unpacklo_epi8(g, b);
+        __m128i gbHi = _mm_unpackhi_epi8(g, b);
+
+        _mm_storeu_si128((__m128i*)argb,      _mm_unpacklo_epi16(arLo, gbLo));
+        _mm_storeu_si128((__m128i*)(argb+16), _mm_unpackhi_epi16(arLo, gbLo));
+        _mm_storeu_si128((__m128i*)(argb+32), _mm_unpacklo_epi16(arHi, gbHi));
+        _mm_storeu_si128((__m128i*)(argb+48), _mm_unpackhi_epi16(arHi, gbHi));
+    }
+
+    UyvyToArgbRowScalar(uyvy, argb, width - x);
+}
+
+__attribute__((target("avx2")))
+static void UyvyToArgbRowAVX2(const unsigned char * uyvy, unsigned char * argb, int width)
+{
+    const __m256i alpha  = _mm256_set1_epi8((char)0xFF);
+    const __m256i mask   = _mm256_set1_epi16(0x00FF);
+    const __m256i y16    = _mm256_set1_epi16(16);
+    const __m256i c128   = _mm256_set1_epi16(128);
+    const __m256i yScale = _mm256_set1_epi16(kYScale);
+    const __m256i round  = _mm256_set1_epi16(kRound);
+    const __m256i vr     = _mm256_set1_epi16(kVR);
+    const __m256i vg     = _mm256_set1_epi16(kVG);
+    const __m256i ug     = _mm256_set1_epi16(kUG);
+    const __m256i ub     = _mm256_set1_epi16(kUB);
+    int x = 0;
+
+    for(; x+32<=width; x+=32, uyvy+=64, argb+=128){
+        __m256i r[2], g[2], b[2];
+
+        for(int k=0; k<2; k++){
+            __m256i in = _mm256_loadu_si256((const __m256i*)(uyvy + 32*k));
+            __m256i y  = _mm256_srli_epi16(in, 8);
+            __m256i uv = _mm256_and_si256(in, mask);
+            __m256i u  = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+            __m256i v  = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+
+            y = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(y, y16), yScale), round);
+            u = _mm256_sub_epi16(u, c128);
+            v = _mm256_sub_epi16(v, c128);
+
+            r[k] = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(v, vr)), kShift);
+            g[k] = _mm256_srai_epi16(_mm256_subs_epi16(_mm256_subs_epi16(y, _mm256_mullo_epi16(u, ug)), _mm256_mullo_epi16(v, vg)), kShift);
+            b[k] = _mm256_srai_epi16(_mm256_adds_epi16(y, _mm256_mullo_epi16(u, ub)), kShift);
+        }
+
+        // pack/unpack work per 128 bit lane, so pixels come out as
+        // [0-3 | 8-11], [4-7 | 12-15], ... and need a final lane permute
+        __m256i r8 = _mm256_packus_epi16(r[0], r[1]);
+        __m256i g8 = _mm256_packus_epi16(g[0], g[1]);
+        __m256i b8 = _mm256_packus_epi16(b[0], b[1]);
+
+        __m256i arLo = _mm256_unpacklo_epi8(alpha, r8);
+        __m256i arHi = _mm256_unpackhi_epi8(alpha, r8);
+        __m256i gbLo = _mm256_unpacklo_epi8(g8, b8);
+        __m256i gbHi = _mm256_unpackhi_epi8(g8, b8);
+
+        __m256i p0 = _mm256_unpacklo_epi16(arLo, gbLo);
+        __m256i p1 = _mm256_unpackhi_epi16(arLo, gbLo);
+        __m256i p2 = _mm256_unpacklo_epi16(arHi, gbHi);
+        __m256i p3 = _mm256_unpackhi_epi16(arHi, gbHi);
+
+        _mm256_storeu_si256((__m256i*)argb,       _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256((__m256i*)(argb+32),  _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256((__m256i*)(argb+64),  _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256((__m256i*)(argb+96),  _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+
+    UyvyToArgbRowSSE2(uyvy, argb, width - x);
+}
+
+#endif
+
+#ifdef YUV_NEON
+
+static void UyvyToArgbRowNEON(const unsigned char * uyvy, unsigned char * argb, int width)
+{
+    const int16x8_t y16    = vdupq_n_s16(16);
+    const int16x8_t c128   = vdupq_n_s16(128);
+    const int16x8_t round  = vdupq_n_s16(kRound);
+    const uint8x8_t alpha  = vdup_n_u8(255);
+    int x = 0;
+
+    for(; x+16<=width; x+=16, uyvy+=32, argb+=64){
+        // val[0] = U, val[1] = Y even, val[2] = V, val[3] = Y odd
+        uint8x8x4_t in = vld4_u8(uyvy);
+
+        int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[0])), c128);
+        int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(in.val[2])), c128);
+
+        int16x8_t vr = vmulq_n_s16(v, kVR);
+        int16x8_t ug_plus_vg = vaddq_s16(vmulq_n_s16(u, kUG), vmulq_n_s16(v, kVG));
+        int16x8_t ub = vmulq_n_s16(u, kUB);
+
+        uint8x8_t r[2], g[2], b[2];
+        for(int k=0; k<2; k++){
+            int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(in.val[k == 0 ? 1 : 3]));
+            y = vaddq_s16(vmulq_n_s16(vsubq_s16(y, y16), kYScale), round);
+
+            r[k] = vqshrun_n_s16(vqaddq_s16(y, vr), kShift);
+            g[k] = vqshrun_n_s16(vqsubq_s16(y, ug_plus_vg), kShift);
+            b[k] = vqshrun_n_s16(vqaddq_s16(y, ub), kShift);
+        }
+
+        uint8x8x2_t rz = vzip_u8(r[0], r[1]);
+        uint8x8x2_t gz = vzip_u8(g[0], g[1]);
+        uint8x8x2_t bz = vzip_u8(b[0], b[1]);
+
+        uint8x8x4_t out0 = {{ alpha, rz.val[0], gz.val[0], bz.val[0] }};
+        uint8x8x4_t out1 = {{ alpha, rz.val[1], gz.val[1], bz.val[1] }};
+        vst4_u8(argb, out0);
+        vst4_u8(argb+32, out1);
+    }
+
+    UyvyToArgbRowScalar(uyvy, argb, width - x);
+}
+
+#endif
+
+
+struct UyvyToArgbKernel {
+    UyvyToArgbRowFunc func;
+    const char * name;
+};
+
+static UyvyToArgbKernel SelectKernel()
+{
+#ifdef YUV_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        UyvyToArgbKernel kernel = { UyvyToArgbRowAVX2, "avx2" };
+        return kernel;
+    }
+    UyvyToArgbKernel kernel = { UyvyToArgbRowSSE2, "sse2" };
+#elif defined(YUV_NEON)
+    UyvyToArgbKernel kernel = { UyvyToArgbRowNEON, "neon" };
+#else
+    UyvyToArgbKernel kernel = { UyvyToArgbRowScalar, "scalar" };
+#endif
+    return kernel;
+}
+
+static const UyvyToArgbKernel & Kernel()
+{
+    static const UyvyToArgbKernel kernel = SelectKernel();
+    return kernel;
+}
+
+UyvyToArgbRowFunc UyvyToArgbRowKernel()
+{
+    return Kernel().func;
+}
+
+const char * UyvyToArgbKernelName()
+{
+    return Kernel().name;
+}
+
+void UyvyToArgbRows(const unsigned char * uyvy, int uyvyRowBytes, unsigned char * argb, int argbRowBytes, int width, int rows)
+{
+    UyvyToArgbRowFunc convert = UyvyToArgbRowKernel();
+    for(int i=0; i<rows; i++){
+        convert(uyvy + (long)i*uyvyRowBytes, argb + (long)i*argbRowBytes, width);
+    }
+}
@@ -0,0 +1,29 @@
+//
+//  YuvConverter.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Fixed point UYVY 4:2:2 -> ARGB conversion with SSE2 / AVX2 / NEON kernels.
+//  The kernel is picked once at runtime from what the CPU supports.
+//
+
+#ifndef YUVCONVERTER_H
+#define YUVCONVERTER_H
+
+// Converts one row of `width` UYVY pixels into `width` 32 bit ARGB pixels
+typedef void (*UyvyToArgbRowFunc)(const unsigned char * uyvy, unsigned char * argb, int width);
+
+// Best kernel for this CPU, resolved on first call
+UyvyToArgbRowFunc UyvyToArgbRowKernel();
+
+// Name of the kernel returned by UyvyToArgbRowKernel() ("avx2", "sse2", "neon" or "scalar")
+const char * UyvyToArgbKernelName();
+
+// Plain C version, also used for the tail of rows that are not a multiple of 16 pixels
+void UyvyToArgbRowScalar(const unsigned char * uyvy, unsigned char * argb, int width);
+
+// Converts `rows` rows starting at the given pointers
+void UyvyToArgbRows(const unsigned char * uyvy, int uyvyRowBytes, unsigned char * argb, int argbRowBytes, int width, int rows);
+
+#endif
@@ -28,6 +28,10 @@ extern MIDIReceiver * globalMidi;
 
 @property BOOL deinterlace;
 
+// With deinterlace on: 0 uses the CIKernel on the output, 1 bob, 2 blend and 3 motion
+// adaptive deinterlace every input on the CPU before it gets here (see Deinterlacer.h)
+@property int deinterlaceMode;
+
 
 -(void)makeDefaults;
 
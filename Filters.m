@@ -8,6 +8,7 @@
 
 #import "Filters.h"
 #import "QLabController.h"
+#import "Deinterlacer.h"
 
 @interface Filters ()
 
@@ -24,6 +25,7 @@
 
 @implementation Filters
 static void *UpdateFiltersContext = &UpdateFiltersContext;
+static void *DeinterlaceModeContext = &DeinterlaceModeContext;
 
 -(NSString*)name {
     return @"Filters";
@@ -63,6 +65,12 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
         for(CIFilter * filter in self.allFilters){
             [self observeFilter:filter];
         }
+        
+        // Added last so the CIFilter bindings keep their MIDI numbers
+        [globalMidi addBindingTo:self path:@"deinterlaceMode" channel:1 number:num++ rangeMin:0 rangeLength:DeinterlaceModeMotionAdaptive];
+        
+        [self addObserver:self forKeyPath:@"deinterlace" options:NSKeyValueObservingOptionInitial context:DeinterlaceModeContext];
+        [self addObserver:self forKeyPath:@"deinterlaceMode" options:0 context:DeinterlaceModeContext];
       
 
     }
@@ -99,6 +107,16 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
         [self willChangeValueForKey:@"filters"];
         [self didChangeValueForKey:@"filters"];
     }
+    if(context == DeinterlaceModeContext){
+        DeinterlacerSetMode(self.deinterlace ? [self cpuDeinterlaceMode] : DeinterlaceModeOff);
+    }
+}
+
+-(DeinterlaceMode)cpuDeinterlaceMode{
+    if(self.deinterlaceMode < DeinterlaceModeOff || self.deinterlaceMode > DeinterlaceModeMotionAdaptive){
+        return DeinterlaceModeOff;
+    }
+    return (DeinterlaceMode)self.deinterlaceMode;
 }
 
 -(NSArray *)filters{
@@ -106,7 +124,8 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
     
     NSMutableArray * arr = [NSMutableArray array];
     
-    if(self.deinterlace){
+    // The inputs are already deinterlaced when a CPU mode is picked
+    if(self.deinterlace && [self cpuDeinterlaceMode] == DeinterlaceModeOff){
         [arr addObject:self.deinterlaceFilter];
     }
     
@@ -116,7 +135,7 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
 }
 
 +(NSSet *)keyPathsForValuesAffectingFilters{
-    return [NSSet setWithObjects:@"deinterlace", nil];
+    return [NSSet setWithObjects:@"deinterlace", @"deinterlaceMode", nil];
 }
 
 -(void)makeDefaults{
@@ -125,6 +144,7 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
     }
 
     self.deinterlace = YES;
+    self.deinterlaceMode = 0;
     
     self.transformX = 0;
     self.transformY = 0;
@@ -177,6 +197,7 @@ static void *UpdateFiltersContext = &UpdateFiltersContext;
     [b addObject:@{QName : [NSString stringWithFormat:@"TransformY: %.2f", self.transformY], QPath: @"transformY"}];
     [b addObject:@{QName : [NSString stringWithFormat:@"TransformScale: %.2f", self.transformScale], QPath: @"transformScale"}];
     [b addObject:@{QName : [NSString stringWithFormat:@"Deinterlace: %i", self.deinterlace], QPath: @"deinterlace"}];
+    [b addObject:@{QName : [NSString stringWithFormat:@"DeinterlaceMode: %i", self.deinterlaceMode], QPath: @"deinterlaceMode"}];
 
     
     NSString * title = [NSString stringWithFormat:@"Set filters"];
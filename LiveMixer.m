@@ -9,6 +9,7 @@
 #import "LiveMixer.h"
 #import "CoreImageViewer.h"
 #import "QLabController.h"
+#import "CIImage+LatencyTrace.h"
 
 @interface LiveMixer ()
 @property float transitionTime;
@@ -126,6 +127,9 @@
         _outputImage = [self.dissolveFilter valueForKey:@"outputImage"];
     }
     
+    [_outputImage copyLatencyTagFrom:[self input:self.selectedInput]];
+    [_outputImage recordLatencyStage:LatencyStageComposite];
+    
     return _outputImage;
 }
 
@@ -0,0 +1,101 @@
+//
+//  RecorderSession.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  One take's AVAssetWriter and the file it writes. Each RecorderTrack keeps a session
+//  started and waiting, so a take begins on the next frame after record is pressed, and
+//  hands finished sessions to the background to be closed and moved into their bank
+//  while the next take is already writing.
+//
+//  The encoders write their cache files as AVFoundation sees fit. The rest of the disk
+//  work, closing movies and moving them into banks, goes through one saver queue for
+//  all inputs, so takes ending together are written out one after the other in large
+//  sequential chunks instead of interleaved.
+//
+//  A session's frames are appended on its track's writer thread, everything else is
+//  safe from any thread.
+//
+
+#import <Foundation/Foundation.h>
+#import <AVFoundation/AVFoundation.h>
+#import "BlackMagicItem.h"
+#import "Timecode.h"
+
+@class RecorderSession;
+
+// A frame queued for the writer thread, holding its own reference on the frame and buffer.
+// Pre-roll frames come without either, the writer restores them from `preroll` by their
+// arrival time and wraps them for `item`
+struct PendingFrame {
+    FrameRef frame;
+    CVPixelBufferRef buffer;
+    PrerollBuffer * preroll;
+    uint64_t arrivalTime;
+    BlackMagicItem * item;
+    RecorderSession * session;
+    AudioRing * audioRing;
+    int64_t time;
+    int64_t timeScale;
+    int64_t frameDuration;
+};
+
+// A new PendingFrame for `session`, counted by its -waitForQueuedFrames: until discarded
+PendingFrame * CreatePendingFrame(RecorderSession * session);
+void DiscardPendingFrame(PendingFrame * pending);
+
+@interface RecorderSession : NSObject
+
+// Sessions are started on the one and finished and saved on the other, each one at a
+// time across all inputs
++(dispatch_queue_t) prepareQueue;
++(dispatch_queue_t) saverQueue;
+
+// Video of `size` in `pixelFormat`, and the audio of audioRing's layout when not NULL
+-(id) initWithSize:(NSSize)size pixelFormat:(OSType)pixelFormat audioRing:(AudioRing*)audioRing;
+
+// Creates the writer on a new cache file and starts it. Blocks, call it off the main
+// thread. NO if the writer could not be started
+-(BOOL) start;
+
+@property (readonly) NSSize size;
+@property (readonly) OSType pixelFormat;
+@property (readonly) NSString * path;
+@property (readonly) BOOL ready;
+@property (readonly) BOOL failed;
+
+// Writer thread. Gives the encoder at most waitNanos to take the frame before dropping it.
+// YES when this frame found the writer failed, the take can not be saved then
+-(BOOL) writePendingFrame:(PendingFrame*)pending waitNanos:(uint64_t)waitNanos;
+
+// Waits until the writer thread is done with every frame queued for this session
+-(BOOL) waitForQueuedFrames:(uint64_t)timeoutNanos;
+
+// Keeps the writer thread off the movie from now on: waits for the frame being
+// appended, if any, and the frames still queued are dropped. For a take that did not
+// finish writing in time, before it is cancelled
+-(void) abandon;
+
+// Closes the movie. Blocks until it is written, NO if it could not be
+-(BOOL) finish;
+
+// Stops writing and removes the file
+-(void) cancel;
+
+// Saver queue. Puts the finished movie and its timecode index in place of `path` and
+// `path`.tc. They are moved next to it first (copied when the cache is on another
+// volume) and then renamed over it, so `path` always has either its old take or all
+// of the new one. The index is removed if the take had no timecode
+-(BOOL) saveToPath:(NSString*)path;
+
+// Source timecode of the appended frames, NULL if they had none. The session keeps
+// ownership
+-(TimecodeIndex*) timecodes;
+
+// Frames appended, and dropped because the encoder did not take them in time, the
+// append failed or a pre-roll frame was evicted before it could be restored
+-(uint64_t) appended;
+-(NSString*) statistics;
+
+@end
@@ -0,0 +1,423 @@
+//
+//  RecorderSession.mm
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#import "RecorderSession.h"
+#import "LatencyTrace.h"
+#import "ThreadUtils.h"
+
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+PendingFrame * CreatePendingFrame(RecorderSession * session){
+    PendingFrame * pending = new PendingFrame;
+    pending->buffer = NULL;
+    pending->preroll = NULL;
+    pending->arrivalTime = 0;
+    pending->session = session;
+    pending->audioRing = NULL;
+    dispatch_group_enter(session->queuedFrames);
+    return pending;
+}
+
+void DiscardPendingFrame(PendingFrame * pending){
+    dispatch_group_leave(pending->session->queuedFrames);
+    CVPixelBufferRelease(pending->buffer);
+    delete pending;
+}
+
+@interface RecorderSession (){
+@public
+    dispatch_group_t queuedFrames;
+
+@private
+    AudioRing * audioRing;
+    // Format of the audio track, NULL when recording without audio
+    CMAudioFormatDescriptionRef audioFormat;
+    // Audio position that goes at the start of the movie, -1 before the first frame's
+    // audio. Moved when the input restarts, see appendAudioForFrame:time:ring:
+    int64_t audioStartPosition;
+    // Where the audio appended so far ends, in samples into the movie
+    int64_t audioEndTime;
+    TimecodeIndex * timecodeIndex;
+
+    std::atomic<bool> writerFailed;
+    // Held by the writer thread while it works on a frame, see -abandon
+    std::mutex writeMutex;
+    std::atomic<bool> abandoned;
+    std::atomic<uint64_t> appended;
+    std::atomic<uint64_t> writerDrops;
+    std::atomic<uint64_t> appendFailures;
+    std::atomic<uint64_t> prerollMisses;
+}
+
+@property AVAssetWriter *videoWriter;
+@property AVAssetWriterInput* videoWriterInput;
+@property AVAssetWriterInputPixelBufferAdaptor *adaptor;
+@property AVAssetWriterInput* audioWriterInput;
+@property (readwrite) NSString * path;
+@property (readwrite) BOOL ready;
+
+@end
+
+@implementation RecorderSession
+
++(dispatch_queue_t) prepareQueue{
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("com.halfdanj.recorder.prepare", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
++(dispatch_queue_t) saverQueue{
+    static dispatch_queue_t queue;
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        queue = dispatch_queue_create("com.halfdanj.recorder.saver", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+-(id) initWithSize:(NSSize)size pixelFormat:(OSType)pixelFormat audioRing:(AudioRing*)ring{
+    self = [super init];
+    if(self){
+        _size = size;
+        _pixelFormat = pixelFormat;
+        audioRing = ring;
+        audioStartPosition = -1;
+        audioEndTime = 0;
+        queuedFrames = dispatch_group_create();
+        writerFailed = false;
+        abandoned = false;
+        appended = writerDrops = appendFailures = prerollMisses = 0;
+    }
+    return self;
+}
+
+-(void) dealloc{
+    if(audioFormat){
+        CFRelease(audioFormat);
+    }
+    TimecodeIndexFree(timecodeIndex);
+}
+
+// Every session gets its own cache file, the previous take's may still be finishing
+-(BOOL) start{
+    static std::atomic<int> sessionCount(0);
+    self.path = [[NSString stringWithFormat:@"~/Movies/_cache%i.mov", ++sessionCount] stringByExpandingTildeInPath];
+
+    NSError *error = nil;
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+
+    self.videoWriter = [[AVAssetWriter alloc] initWithURL:
+                        [NSURL fileURLWithPath:self.path] fileType:AVFileTypeQuickTimeMovie
+                                                    error:&error];
+    if(!self.videoWriter){
+        NSLog(@"Could not create a writer for %@: %@", self.path, error);
+        return NO;
+    }
+
+    NSDictionary *videoSettings = [NSDictionary dictionaryWithObjectsAndKeys:
+                                   AVVideoCodecH264, AVVideoCodecKey,
+                                   [NSNumber numberWithInt:self.size.width], AVVideoWidthKey,
+                                   [NSNumber numberWithInt:self.size.height], AVVideoHeightKey,
+                                   nil];
+
+    self.videoWriterInput = [AVAssetWriterInput
+                             assetWriterInputWithMediaType:AVMediaTypeVideo
+                             outputSettings:videoSettings];
+
+    self.adaptor = [AVAssetWriterInputPixelBufferAdaptor
+                    assetWriterInputPixelBufferAdaptorWithAssetWriterInput:self.videoWriterInput
+                    sourcePixelBufferAttributes:@{(NSString*)kCVPixelBufferPixelFormatTypeKey:[NSNumber numberWithInt:self.pixelFormat]}];
+
+    NSParameterAssert(self.videoWriterInput);
+    NSParameterAssert([self.videoWriter canAddInput:self.videoWriterInput]);
+    self.videoWriterInput.expectsMediaDataInRealTime = YES;
+    self.adaptor.assetWriterInput.expectsMediaDataInRealTime = YES;
+    [self.videoWriter addInput:self.videoWriterInput];
+
+    // Uncompressed PCM in the input's own layout when it captures audio
+    if(audioRing){
+        AudioStreamBasicDescription description = {0};
+        description.mSampleRate = bmdAudioSampleRate48kHz;
+        description.mFormatID = kAudioFormatLinearPCM;
+        description.mFormatFlags = kAudioFormatFlagIsSignedInteger | kAudioFormatFlagIsPacked;
+        description.mBytesPerPacket = (UInt32)audioRing->FrameBytes();
+        description.mFramesPerPacket = 1;
+        description.mBytesPerFrame = (UInt32)audioRing->FrameBytes();
+        description.mChannelsPerFrame = audioRing->Channels();
+        description.mBitsPerChannel = audioRing->SampleBytes() * 8;
+
+        AudioChannelLayout layout = {0};
+        layout.mChannelLayoutTag = kAudioChannelLayoutTag_DiscreteInOrder | audioRing->Channels();
+
+        NSDictionary * audioSettings = @{AVFormatIDKey: @(kAudioFormatLinearPCM),
+                                         AVSampleRateKey: @(bmdAudioSampleRate48kHz),
+                                         AVNumberOfChannelsKey: @(audioRing->Channels()),
+                                         AVLinearPCMBitDepthKey: @(audioRing->SampleBytes() * 8),
+                                         AVLinearPCMIsFloatKey: @NO,
+                                         AVLinearPCMIsBigEndianKey: @NO,
+                                         AVLinearPCMIsNonInterleaved: @NO,
+                                         AVChannelLayoutKey: [NSData dataWithBytes:&layout length:sizeof(layout)]};
+
+        AVAssetWriterInput * audioInput = [AVAssetWriterInput assetWriterInputWithMediaType:AVMediaTypeAudio outputSettings:audioSettings];
+        audioInput.expectsMediaDataInRealTime = YES;
+        if([self.videoWriter canAddInput:audioInput] &&
+           CMAudioFormatDescriptionCreate(kCFAllocatorDefault, &description, sizeof(layout), &layout, 0, NULL, NULL, &audioFormat) == noErr){
+            [self.videoWriter addInput:audioInput];
+            self.audioWriterInput = audioInput;
+        } else {
+            NSLog(@"Could not add an audio track, recording without audio");
+        }
+    }
+
+    //Start a session:
+    if(![self.videoWriter startWriting]){
+        NSLog(@"Could not start writing %@",self.videoWriter.error);
+        return NO;
+    }
+    [self.videoWriter startSessionAtSourceTime:kCMTimeZero];
+
+    // The encoder takes a moment to come up, the session is kept waiting meanwhile
+    // rather than the first frames of a take
+    [NSThread sleepForTimeInterval:0.2];
+    self.ready = YES;
+    return YES;
+}
+
+-(BOOL) failed{
+    return writerFailed;
+}
+
+// The encoder is given waitNanos to take a frame, after that the frame is dropped. A
+// failed append only loses that frame; if the writer itself failed the take is lost
+-(BOOL) writePendingFrame:(PendingFrame*)pending waitNanos:(uint64_t)waitNanos{
+    std::lock_guard<std::mutex> guard(writeMutex);
+    if(abandoned){
+        writerDrops++;
+        return NO;
+    }
+    if(pending->preroll){
+        pending->frame = pending->preroll->FrameArrivedAt(pending->arrivalTime);
+        pending->buffer = pending->frame ? [pending->item createCVImageBufferFromFrame:pending->frame] : NULL;
+        if(!pending->buffer){
+            prerollMisses++;
+            return NO;
+        }
+    }
+
+    uint64_t waitStart = MonotonicNanos();
+    while(!self.videoWriterInput.readyForMoreMediaData && self.videoWriter.status == AVAssetWriterStatusWriting){
+        if(MonotonicNanos() - waitStart > waitNanos){
+            break;
+        }
+        usleep(1000);
+    }
+    if(!self.videoWriterInput.readyForMoreMediaData){
+        writerDrops++;
+        return NO;
+    }
+
+    CMTime presentationTime = CMTimeMake(pending->time, (int32_t)pending->timeScale);
+    if(![self.adaptor appendPixelBuffer:pending->buffer withPresentationTime:presentationTime]){
+        appendFailures++;
+        if(self.videoWriter.status == AVAssetWriterStatusFailed && !writerFailed.exchange(true)){
+            NSLog(@"Recording failed, the take will not be saved: %@", self.videoWriter.error);
+            return YES;
+        }
+        return NO;
+    }
+    appended++;
+    if(!pending->preroll){
+        LatencyTraceRecord(LatencyStageAppend, pending->frame->timestamps.arrivalTime);
+    }
+
+    const FrameRef & frame = pending->frame;
+    if(frame->timecode.format){
+        if(!timecodeIndex){
+            timecodeIndex = TimecodeIndexCreate(presentationTime.timescale, TimecodeFps(pending->frameDuration, pending->timeScale));
+        }
+        TimecodeIndexAppend(timecodeIndex, presentationTime.value, frame->timecode.bcd, frame->timecode.flags);
+    }
+    if(self.audioWriterInput){
+        [self appendAudioForFrame:frame time:presentationTime ring:pending->audioRing];
+    }
+    return NO;
+}
+
+// Appends exactly the samples that belong to the frame, so the audio track runs on the
+// input's own clock. Samples that are missing from the ring are recorded as silence.
+// The input sizes its ring for the pre-roll and the write queue, so they are only
+// missing if the input was, or if the ring was configured shorter than the take's lag.
+// The audio is anchored to the first frame's `time` in the movie, and again to the
+// frame's time when the input was restarted and its stream time went back, the same
+// way the take's video continues after it.
+-(void) appendAudioForFrame:(const FrameRef &)frame time:(CMTime)time ring:(AudioRing*)ring{
+    const FrameTimestamps & timestamps = frame->timestamps;
+    if(!ring || !audioFormat || timestamps.audioSamples <= 0){
+        return;
+    }
+
+    const AudioStreamBasicDescription * format = CMAudioFormatDescriptionGetStreamBasicDescription(audioFormat);
+    if(format->mChannelsPerFrame != (UInt32)ring->Channels() || format->mBytesPerFrame != ring->FrameBytes()){
+        return;
+    }
+
+    if(audioStartPosition < 0 || timestamps.audioPosition - audioStartPosition < audioEndTime){
+        int64_t frameAudioTime = time.value * bmdAudioSampleRate48kHz / time.timescale;
+        audioStartPosition = timestamps.audioPosition - MAX(frameAudioTime, audioEndTime);
+    }
+    if(!self.audioWriterInput.readyForMoreMediaData){
+        return;
+    }
+
+    size_t samples = (size_t)timestamps.audioSamples;
+    size_t bytes = samples * ring->FrameBytes();
+    CMBlockBufferRef block = NULL;
+    if(CMBlockBufferCreateWithMemoryBlock(kCFAllocatorDefault, NULL, bytes, kCFAllocatorDefault, NULL, 0, bytes, kCMBlockBufferAssureMemoryNowFlag, &block) != kCMBlockBufferNoErr){
+        return;
+    }
+
+    char * data = NULL;
+    CMBlockBufferGetDataPointer(block, 0, NULL, NULL, &data);
+    if(!ring->Read(timestamps.audioPosition, samples, data)){
+        memset(data, 0, bytes);
+    }
+
+    CMSampleBufferRef sampleBuffer = NULL;
+    int64_t audioTime = timestamps.audioPosition - audioStartPosition;
+    if(CMAudioSampleBufferCreateWithPacketDescriptions(kCFAllocatorDefault, block, true, NULL, NULL, audioFormat, samples, CMTimeMake(audioTime, bmdAudioSampleRate48kHz), NULL, &sampleBuffer) == noErr){
+        if([self.audioWriterInput appendSampleBuffer:sampleBuffer]){
+            audioEndTime = audioTime + samples;
+        } else {
+            NSLog(@"Could not append audio %@", self.videoWriter.error);
+        }
+        CFRelease(sampleBuffer);
+    }
+    CFRelease(block);
+}
+
+-(BOOL) waitForQueuedFrames:(uint64_t)timeoutNanos{
+    return dispatch_group_wait(queuedFrames, dispatch_time(DISPATCH_TIME_NOW, timeoutNanos)) == 0;
+}
+
+-(void) abandon{
+    abandoned = true;
+    std::lock_guard<std::mutex> guard(writeMutex);
+}
+
+-(BOOL) finish{
+    if(!self.ready){
+        return NO;
+    }
+    [self.videoWriterInput markAsFinished];
+    [self.audioWriterInput markAsFinished];
+    if(![self.videoWriter finishWriting]){
+        NSLog(@"Could not finish %@: %@", self.path, self.videoWriter.error);
+        return NO;
+    }
+    return YES;
+}
+
+-(void) cancel{
+    if(self.videoWriter.status == AVAssetWriterStatusWriting){
+        [self.videoWriter cancelWriting];
+    }
+    [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+}
+
+// 8 MB at a time around the page cache, for moving takes to another volume
+static bool CopyFileInChunks(const char * source, const char * dest){
+    int in = open(source, O_RDONLY);
+    if(in < 0){
+        return false;
+    }
+    int out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0){
+        close(in);
+        return false;
+    }
+#ifdef F_NOCACHE
+    fcntl(in, F_NOCACHE, 1);
+    fcntl(out, F_NOCACHE, 1);
+#endif
+
+    const size_t chunkSize = 8 << 20;
+    char * chunk = (char*)malloc(chunkSize);
+    bool ok = chunk != NULL;
+    while(ok){
+        ssize_t bytes = read(in, chunk, chunkSize);
+        if(bytes <= 0){
+            ok = bytes == 0;
+            break;
+        }
+        for(ssize_t written = 0; ok && written < bytes; ){
+            ssize_t n = write(out, chunk + written, bytes - written);
+            ok = n > 0;
+            written += n;
+        }
+    }
+    free(chunk);
+    close(in);
+    if(close(out) != 0){
+        ok = false;
+    }
+    return ok;
+}
+
+-(BOOL) saveToPath:(NSString*)path{
+    NSFileManager * fileManager = [NSFileManager defaultManager];
+    NSString * partialPath = [path stringByAppendingString:@".partial"];
+
+    if(rename([self.path fileSystemRepresentation], [partialPath fileSystemRepresentation]) != 0){
+        if(errno != EXDEV || !CopyFileInChunks([self.path fileSystemRepresentation], [partialPath fileSystemRepresentation])){
+            NSLog(@"Error moving %@ to %@: %s", self.path, partialPath, strerror(errno));
+            [fileManager removeItemAtPath:partialPath error:nil];
+            return NO;
+        }
+        [fileManager removeItemAtPath:self.path error:nil];
+    }
+    if(rename([partialPath fileSystemRepresentation], [path fileSystemRepresentation]) != 0){
+        NSLog(@"Could not replace %@: %s", path, strerror(errno));
+        [fileManager removeItemAtPath:partialPath error:nil];
+        return NO;
+    }
+
+    NSString * indexPath = [path stringByAppendingPathExtension:@"tc"];
+    NSString * partialIndexPath = [indexPath stringByAppendingString:@".partial"];
+    if(!timecodeIndex){
+        [fileManager removeItemAtPath:indexPath error:nil];
+    } else if(!TimecodeIndexWrite(timecodeIndex, [partialIndexPath fileSystemRepresentation]) ||
+              rename([partialIndexPath fileSystemRepresentation], [indexPath fileSystemRepresentation]) != 0){
+        NSLog(@"Could not write the timecode index %@", indexPath);
+        [fileManager removeItemAtPath:partialIndexPath error:nil];
+        [fileManager removeItemAtPath:indexPath error:nil];
+    }
+    return YES;
+}
+
+-(TimecodeIndex*) timecodes{
+    return timecodeIndex;
+}
+
+-(uint64_t) appended{
+    return appended;
+}
+
+-(NSString*) statistics{
+    return [NSString stringWithFormat:@"appended %llu encoder not ready %llu failed %llu pre-roll evicted %llu",
+            appended.load(), writerDrops.load(), appendFailures.load(), prerollMisses.load()];
+}
+
+@end
@@ -0,0 +1,59 @@
+//
+//  RecorderTrack.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Recording of one input: its takes' timing, the queue to its own writer thread and the
+//  sessions the takes are written to. The VideoBankRecorder has a track per input and
+//  starts one or several of them at once.
+//
+//  A take starts at a given moment rather than on whichever frame comes next. The moment
+//  is put on the card's hardware reference clock, and the take begins with the first
+//  frame captured at or after it, from the pre-roll if it is that far back. Tracks
+//  started together therefore begin on the frame captured at the same time, whichever
+//  input's processing runs ahead.
+//
+//  Finished takes are closed and moved into their bank on the saver queue shared by all
+//  tracks, see RecorderSession.
+//
+
+#import <Foundation/Foundation.h>
+#import "BlackMagicItem.h"
+#import "VideoBankItem.h"
+
+@class VideoBankRecorder;
+
+@interface RecorderTrack : NSObject
+
+// queueSeconds of frames can wait for the writer, on top of the input's pre-roll
+-(id) initWithItem:(BlackMagicItem*)item recorder:(VideoBankRecorder*)recorder queueSeconds:(double)queueSeconds;
+
+@property (readonly) BlackMagicItem * item;
+
+// A session is started and waiting for the next take
+@property (readonly) BOOL ready;
+@property (readonly) BOOL recording;
+
+// Time into the current take, for display. Changes on the main thread
+@property (readonly) NSString * timeString;
+
+// Starts a take with the frame captured at startNanos (MonotonicNanos()) or the first
+// one after it. startNanos can be up to the input's pre-roll in the past
+-(void) startTakeAt:(uint64_t)startNanos;
+
+// Ends the take and hands it to the saver queue, which moves it into `bank` if `save`,
+// or throws it away
+-(void) stopTakeSavingTo:(VideoBankItem*)bank save:(BOOL)save;
+
+// Recorder's delegate callback for this track's input, on the input's recorder queue
+-(void) newFrame:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer;
+
+// Depth and high water mark of the write queue, and this take's appended and dropped frames
+-(NSString*) writerStatistics;
+
+// Stops the writer thread and waits for it to exit, frames still queued are thrown away.
+// Nothing is recorded after this, the track can go once it returns
+-(void) stop;
+
+@end
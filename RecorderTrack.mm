@@ -0,0 +1,460 @@
+//
+//  RecorderTrack.mm
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#import "RecorderTrack.h"
+#import "RecorderSession.h"
+#import "VideoBankRecorder.h"
+#import "NSString+Timecode.h"
+#import "ThreadUtils.h"
+#import "FrameRing.h"
+
+#include <atomic>
+
+@interface RecorderTrack (){
+    // The take's state below is set up and read out by start and stop on the main thread
+    // and updated for each frame on the recorder queue, both under `lock`
+
+    // Frames are timed by their stream time relative to the take's first frame, in the
+    // input's own time scale. takeStartTime is -1 before the first frame
+    int64_t takeStartTime;
+    int64_t takeTimeScale;
+    int64_t takeFrameDuration;
+    int64_t lastFrameTime;
+
+    // The moment the take starts at, on the host clock and, when the input can tell, on
+    // the card's hardware reference clock in startTimeScale units
+    uint64_t startNanos;
+    BMDTimeValue startHardwareTime;
+    BMDTimeScale startTimeScale;
+    bool startOnHardwareClock;
+
+    // For the end of take log: frames appended, frames missing from the stream (left as
+    // gaps in the movie), runs of them, and frames that could not be placed
+    uint64_t takeFrames;
+    uint64_t takeDroppedFrames;
+    uint64_t takeGaps;
+    uint64_t takeRejectedFrames;
+
+    // Frames on their way to the writer thread, "recorderQueueSeconds" (default 2) of
+    // them at up to 60 fps plus the pre-roll. Full means the frame is dropped, never the
+    // take. A take's last frames may still be queued when the next take starts, each
+    // frame carries the session it goes to
+    FrameRing<PendingFrame*> * writeRing;
+    dispatch_semaphore_t writeSemaphore;
+    uint64_t writeQueueNanos;
+    // Native frames are copied in here before they are queued, the card only has a few
+    // capture buffers and the queue holds seconds of frames
+    FramePool * writePool;
+    // Set by -stop, the writer thread signals writerExited on its way out
+    std::atomic<bool> writerStopping;
+    dispatch_semaphore_t writerExited;
+
+    // Per take: deepest the queue got, frames dropped because it was full, and frames
+    // queued from the pre-roll. The writer's own counts are in the take's session
+    std::atomic<uint64_t> takeQueueHighWater;
+    std::atomic<uint64_t> takeQueueDrops;
+    uint64_t takePrerollFrames;
+}
+
+@property (weak) VideoBankRecorder * recorder;
+@property (readwrite) BlackMagicItem * item;
+@property (readwrite) NSString * timeString;
+@property (readwrite) BOOL recording;
+
+// Started in the background and waiting for the next take, nil while none is being
+// prepared
+@property RecorderSession * standbySession;
+// The session the current take writes to, nil until the take's first frame claims the
+// standby
+@property RecorderSession * takeSession;
+
+// Waits for a take's frames to be written before it goes to the shared saver queue
+@property dispatch_queue_t finishQueue;
+@property NSRecursiveLock * lock;
+
+@end
+
+@implementation RecorderTrack
+
+-(id) initWithItem:(BlackMagicItem*)item recorder:(VideoBankRecorder*)recorder queueSeconds:(double)queueSeconds{
+    self = [super init];
+    if(self){
+        self.item = item;
+        self.recorder = recorder;
+        self.lock = [[NSRecursiveLock alloc] init];
+        self.finishQueue = dispatch_queue_create("com.halfdanj.recorder.finish", DISPATCH_QUEUE_SERIAL);
+        takeStartTime = -1;
+
+        // The queue also takes the whole pre-roll at once when a take starts
+        PrerollBuffer * preroll = item.callback->preroll.load();
+        double prerollSeconds = preroll ? preroll->Seconds() : 0;
+        writeQueueNanos = (uint64_t)(queueSeconds * 1e9);
+        writeRing = new FrameRing<PendingFrame*>((size_t)((queueSeconds + prerollSeconds) * 60) + 1, FrameRingDropNewest, DiscardPendingFrame);
+        writeSemaphore = dispatch_semaphore_create(0);
+        writePool = new FramePool(8, false);
+        writerStopping = false;
+        writerExited = dispatch_semaphore_create(0);
+
+        NSThread * writerThread = [[NSThread alloc] initWithTarget:self selector:@selector(writerLoop) object:nil];
+        writerThread.name = [NSString stringWithFormat:@"com.halfdanj.recorder.writer%i", item.index+1];
+        [writerThread start];
+
+        [self.lock lock];
+        [self prepareStandby];
+        [self.lock unlock];
+    }
+    return self;
+}
+
+// Only after -stop, the writer thread holds on to the track until then. The ring throws
+// away whatever was queued after the writer's last pass
+-(void) dealloc{
+    delete writeRing;
+    writePool->Release();
+}
+
+-(void) stop{
+    if(writerStopping.exchange(true)){
+        return;
+    }
+    dispatch_semaphore_signal(writeSemaphore);
+    dispatch_semaphore_wait(writerExited, DISPATCH_TIME_FOREVER);
+}
+
+-(BOOL) ready{
+    return self.standbySession.ready;
+}
+
+-(void) startTakeAt:(uint64_t)start{
+    [self.lock lock];
+    if(self.recording){
+        [self.lock unlock];
+        return;
+    }
+    startNanos = start;
+    startTimeScale = self.item.callback->frameTimeScale;
+    startOnHardwareClock = self.item.callback->HardwareTimeAt(start, startTimeScale, startHardwareTime);
+
+    self.timeString = @"";
+    takeStartTime = -1;
+    takePrerollFrames = 0;
+    takeFrames = takeDroppedFrames = takeGaps = takeRejectedFrames = 0;
+    takeQueueHighWater = takeQueueDrops = 0;
+    self.recording = YES;
+    [self.lock unlock];
+}
+
+-(void) stopTakeSavingTo:(VideoBankItem*)bank save:(BOOL)save{
+    [self.lock lock];
+    BOOL wasRecording = self.recording;
+    RecorderSession * session = self.takeSession;
+    self.takeSession = nil;
+    self.recording = NO;
+    NSString * summary = [NSString stringWithFormat:@"input %i %llu frames at %lld/%lld, %llu dropped in %llu gaps, %llu rejected, queue high water %llu full %llu, pre-roll %llu",
+                          self.item.index+1, takeFrames, takeTimeScale, takeFrameDuration, takeDroppedFrames, takeGaps, takeRejectedFrames,
+                          takeQueueHighWater.load(), takeQueueDrops.load(), takePrerollFrames];
+    [self.lock unlock];
+
+    if(!session){
+        if(wasRecording){
+            NSLog(@"Input %i: the take ended before a recording session was ready, nothing was recorded", self.item.index+1);
+        }
+        return;
+    }
+
+    // The writer thread is done with the take after waiting, at most a queue's length of
+    // time plus a second. The next take can start meanwhile on its own session
+    int input = self.item.index+1;
+    dispatch_async(self.finishQueue, ^{
+        BOOL written = [session waitForQueuedFrames:writeQueueNanos * 2 + 1000000000ULL];
+        NSLog(@"Take: %@, writer %@", summary, [session statistics]);
+
+        // Still writing after that, the encoder is stuck. The writer is kept off the movie
+        // before it is cancelled, finishing it now could race the append in progress
+        if(!written){
+            [session abandon];
+            [session cancel];
+            NSLog(@"Input %i: the take was still being written after the queue's time, it will not be saved", input);
+            VideoBankRecorder * recorder = self.recorder;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                recorder.error = YES;
+            });
+            return;
+        }
+
+        // The frames written can not be used, the file goes
+        if(!save || !bank || session.failed || ![session appended]){
+            [session cancel];
+            return;
+        }
+
+        __block BOOL saved = NO;
+        dispatch_sync([RecorderSession saverQueue], ^{
+            saved = [session finish] && [session saveToPath:[bank.path stringByExpandingTildeInPath]];
+            if(!saved){
+                [session cancel];
+            }
+        });
+        if(saved){
+            VideoBankRecorder * recorder = self.recorder;
+            [recorder willChangeValueForKey:@"recordings"];
+            [bank loadBankFromDrive];
+            [recorder didChangeValueForKey:@"recordings"];
+        }
+    });
+}
+
+// Holds the lock for the frame, so a take can not start or stop halfway through it
+-(void) newFrame:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer{
+    if(writerStopping){
+        return;
+    }
+    [self.lock lock];
+    [self queueFrameForTake:frame buffer:buffer];
+    [self.lock unlock];
+}
+
+-(void) queueFrameForTake:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer{
+    RecorderSession * session = [self sessionForTake];
+    if(!session){
+        return;
+    }
+
+    // The take's first frame is the one captured at its start. Whatever the input kept
+    // from between then and this frame goes first, restored on the writer thread
+    if(takeStartTime < 0){
+        if(![self frameIsInTake:frame->timestamps]){
+            return;
+        }
+        PrerollBuffer * preroll = self.item.callback->preroll.load();
+        if(preroll){
+            uint64_t from = startNanos > 100000000 ? startNanos - 100000000 : 0;
+            std::vector<FrameTimestamps> earlier = preroll->TimestampsBetween(from, frame->timestamps.arrivalTime);
+            for(size_t i=0;i<earlier.size();i++){
+                if(![self frameIsInTake:earlier[i]]){
+                    continue;
+                }
+                PendingFrame * pending = CreatePendingFrame(session);
+                pending->preroll = preroll;
+                pending->arrivalTime = earlier[i].arrivalTime;
+                pending->item = self.item;
+                if([self queueFrame:pending timestamps:earlier[i]]){
+                    takePrerollFrames++;
+                }
+            }
+        }
+    }
+
+    PendingFrame * pending = CreatePendingFrame(session);
+    if(frame->WrapsDriverFrame()){
+        pending->frame = writePool->Copy(frame);
+        pending->buffer = pending->frame ? [self.item createCVImageBufferFromFrame:pending->frame] : NULL;
+        if(!pending->buffer){
+            // No memory for the copy, dropped like a frame that finds the queue full
+            takeQueueDrops++;
+            DiscardPendingFrame(pending);
+            return;
+        }
+    } else {
+        pending->frame = frame;
+        pending->buffer = CVPixelBufferRetain(buffer);
+    }
+    pending->arrivalTime = frame->timestamps.arrivalTime;
+    [self queueFrame:pending timestamps:frame->timestamps];
+}
+
+// Captured at or after the take's start: the frame's span on the hardware clock reaches
+// past it, or it arrived after it when the hardware clock can not be used
+-(BOOL) frameIsInTake:(const FrameTimestamps &)timestamps{
+    if(startOnHardwareClock && timestamps.timeScale == startTimeScale && timestamps.hardwareTime > 0){
+        return timestamps.hardwareTime + timestamps.hardwareDuration > startHardwareTime;
+    }
+    return timestamps.arrivalTime >= startNanos;
+}
+
+// The current take's session. The take's first frame claims the standby session, which
+// is then replaced in the background; nil while not recording or the standby is not
+// started yet, the pre-roll covers the frames until then
+-(RecorderSession*) sessionForTake{
+    [self.lock lock];
+    RecorderSession * session = self.takeSession;
+    if(!session && self.recording){
+        RecorderSession * standby = self.standbySession;
+        if(!standby){
+            [self prepareStandby];
+        } else if(standby.ready){
+            // Sized for the input as it was when the session was started, start over
+            // if it has changed since
+            if(NSEqualSizes(standby.size, [self recordingSize]) && standby.pixelFormat == [self recordingPixelFormat]){
+                session = standby;
+                self.takeSession = session;
+            } else {
+                dispatch_async([RecorderSession prepareQueue], ^{
+                    [standby cancel];
+                });
+            }
+            [self prepareStandby];
+        }
+    }
+    [self.lock unlock];
+    return session;
+}
+
+// Call with the lock held. Starts a new session for the next take in the background
+-(void) prepareStandby{
+    AudioRing * audioRing = self.item.callback ? self.item.callback->audioRing : NULL;
+    RecorderSession * session = [[RecorderSession alloc] initWithSize:[self recordingSize] pixelFormat:[self recordingPixelFormat] audioRing:audioRing];
+    self.standbySession = session;
+
+    dispatch_async([RecorderSession prepareQueue], ^{
+        BOOL started = [session start];
+        if(!started){
+            [session cancel];
+            [self.lock lock];
+            if(self.standbySession == session){
+                self.standbySession = nil;
+            }
+            [self.lock unlock];
+        }
+        VideoBankRecorder * recorder = self.recorder;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [recorder updateReadyToRecord];
+        });
+    });
+}
+
+-(NSSize) recordingSize{
+    NSSize size = self.item.size;
+    if(size.width == 0){
+        size = NSMakeSize(720, 576);
+    }
+
+    if(self.recorder.recordPal && size.width > 720){
+        float aspect = size.width/size.height;
+        size.width = 576*aspect;
+        size.height = 576.0;
+    }
+    return size;
+}
+
+// In native YUV mode the frames come straight from the card as 2vuy (UYVY) or
+// v210 when capturing 10 bit, which the encoder takes as is
+-(OSType) recordingPixelFormat{
+    NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+    OSType sourcePixelFormat = kCVPixelFormatType_32ARGB;
+    if([defaults boolForKey:@"nativeYuvCapture"]){
+        sourcePixelFormat = [defaults boolForKey:@"captureTenBit"] ? kCVPixelFormatType_422YpCbCr10 : kCVPixelFormatType_422YpCbCr8;
+    }
+    return sourcePixelFormat;
+}
+
+// Call with the lock held. Times the frame in the take and hands it to the writer
+// thread. A frame that does not fit in the queue is dropped and its time stays a gap in
+// the movie
+-(BOOL) queueFrame:(PendingFrame*)pending timestamps:(const FrameTimestamps &)timestamps{
+    int64_t frameTime = [self presentationTimeForTimestamps:timestamps];
+    if(frameTime < 0){
+        DiscardPendingFrame(pending);
+        return NO;
+    }
+    lastFrameTime = frameTime;
+    takeFrames++;
+
+    NSString * timeString = [NSString stringWithTimecode:(double)frameTime / takeTimeScale];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.timeString = timeString;
+    });
+
+    pending->audioRing = self.item.callback->audioRing;
+    pending->time = frameTime;
+    pending->timeScale = takeTimeScale;
+    pending->frameDuration = takeFrameDuration;
+    if(!writeRing->Push(pending)){
+        takeQueueDrops++;
+        return NO;
+    }
+    uint64_t depth = writeRing->Depth();
+    if(depth > takeQueueHighWater){
+        takeQueueHighWater = depth;
+    }
+    dispatch_semaphore_signal(writeSemaphore);
+    return YES;
+}
+
+-(void) writerLoop{
+    while(!writerStopping){
+        dispatch_semaphore_wait(writeSemaphore, dispatch_time(DISPATCH_TIME_NOW, 100 * NSEC_PER_MSEC));
+
+        PendingFrame * pending;
+        while(writeRing->Pop(pending)){
+            // Once stopping, the rest of the queue is only let go of
+            if(!writerStopping){
+                @autoreleasepool {
+                    if([pending->session writePendingFrame:pending waitNanos:writeQueueNanos]){
+                        VideoBankRecorder * recorder = self.recorder;
+                        dispatch_async(dispatch_get_main_queue(), ^{
+                            recorder.error = YES;
+                        });
+                    }
+                }
+            }
+            writeRing->MarkProcessed();
+            DiscardPendingFrame(pending);
+        }
+    }
+    dispatch_semaphore_signal(writerExited);
+}
+
+-(NSString *)writerStatistics{
+    FrameRingStats stats = writeRing->Stats();
+    [self.lock lock];
+    RecorderSession * session = self.takeSession;
+    uint64_t prerollFrames = takePrerollFrames;
+    [self.lock unlock];
+    return [NSString stringWithFormat:@"queued %lu/%lu high water %llu queue full %llu pre-roll %llu %@",
+            stats.depth, stats.capacity, takeQueueHighWater.load(), takeQueueDrops.load(), prerollFrames,
+            session ? [session statistics] : @"no take"];
+}
+
+// The frame's time in the take, in takeTimeScale units, or -1 if it can not go in the
+// movie. Frames missing between this one and the last appended one are counted, their
+// time is left empty so the movie keeps the input's cadence. Stream time going back
+// (the input was restarted) continues the take right after the last frame; a different
+// time scale means another frame rate, which the take can not hold. Call with the lock held.
+-(int64_t) presentationTimeForTimestamps:(const FrameTimestamps &)timestamps{
+    if(timestamps.streamDuration <= 0){
+        takeRejectedFrames++;
+        return -1;
+    }
+
+    if(takeStartTime < 0){
+        takeStartTime = timestamps.streamTime;
+        takeTimeScale = timestamps.timeScale;
+        takeFrameDuration = timestamps.streamDuration;
+        lastFrameTime = -1;
+    }
+    if(timestamps.timeScale != takeTimeScale || timestamps.streamDuration != takeFrameDuration){
+        takeRejectedFrames++;
+        return -1;
+    }
+
+    int64_t frameTime = timestamps.streamTime - takeStartTime;
+    if(lastFrameTime < 0 && frameTime < 0){
+        takeStartTime = timestamps.streamTime;
+        frameTime = 0;
+    } else if(lastFrameTime >= 0 && frameTime <= lastFrameTime){
+        takeStartTime = timestamps.streamTime - (lastFrameTime + takeFrameDuration);
+        frameTime = lastFrameTime + takeFrameDuration;
+    }
+    if(lastFrameTime >= 0 && frameTime > lastFrameTime + takeFrameDuration){
+        takeDroppedFrames += (frameTime - lastFrameTime) / takeFrameDuration - 1;
+        takeGaps++;
+    }
+    return frameTime;
+}
+
+@end
@@ -29,4 +29,7 @@ extern MIDIReceiver * globalMidi;
 
 - (id)initWithNumberBanks:(int)banks;
 
+// The first bank whose recording contains the source timecode, and where in it
+-(VideoBankItem*) bankWithTimecode:(NSString*)timecode time:(double*)seconds;
+
 @end
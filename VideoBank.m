@@ -125,12 +125,25 @@ static void *SelectionContext = &SelectionContext;
         NSFileManager * fileManager = [NSFileManager defaultManager];
         [fileManager copyItemAtPath:fromPath toPath:toPath error:nil];
         
+        // The timecode index goes along, or the copy would keep the old bank's
+        [fileManager removeItemAtPath:[toPath stringByAppendingPathExtension:@"tc"] error:nil];
+        [fileManager copyItemAtPath:[fromPath stringByAppendingPathExtension:@"tc"] toPath:[toPath stringByAppendingPathExtension:@"tc"] error:nil];
+        
         [toObject loadBankFromDrive];
 //        [fileManager removeItemAtPath:path error:&error];
         
     }
 }
 
+-(VideoBankItem *)bankWithTimecode:(NSString *)timecode time:(double *)seconds{
+    for(VideoBankItem * item in self.content){
+        if([item time:seconds forTimecode:timecode]){
+            return item;
+        }
+    }
+    return nil;
+}
+
 -(void)defaultsAll{
     for(VideoBankItem * item in self.content){
         if(item.loaded){
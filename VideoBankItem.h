@@ -60,4 +60,13 @@
 -(void) loadBankFromPath:(NSString*)path;
 -(CALayer*) loadMask:(int)num;
 
+// Source timecode, from the index the recorder writes next to the movie ("<path>.tc").
+// Lookups are binary searches, banks without an index have no timecode.
+@property (readonly) BOOL hasTimecode;
+-(NSString*) timecodeAtTime:(double)seconds;
+-(BOOL) time:(double*)seconds forTimecode:(NSString*)timecode;
+
+// Trims the bank to start at inTimecode and end before outTimecode, either may be nil
+-(BOOL) trimFromTimecode:(NSString*)inTimecode toTimecode:(NSString*)outTimecode;
+
 @end
@@ -9,8 +9,11 @@
 #import "VideoBankItem.h"
 #import "NSString+Timecode.h"
 #import "QLabController.h"
+#import "Timecode.h"
 
-@interface VideoBankItem ()
+@interface VideoBankItem (){
+    TimecodeIndex * timecodeIndex;
+}
 
 @property AVPlayer * avPreviewPlayer;
 
@@ -68,6 +71,10 @@ static void *MaskContext = &MaskContext;
     return layer;
 }
 
+-(void)dealloc{
+    TimecodeIndexFree(timecodeIndex);
+}
+
 -(void)loadBankFromDrive{
     [self loadBankFromPath:self.path ];
     NSLog(@"Load %@",self.path);
@@ -83,6 +90,11 @@ static void *MaskContext = &MaskContext;
     self.avPreviewPlayer = [AVPlayer playerWithPlayerItem:self.avPlayerItemOriginal];
     self.loaded = NO;
     
+    [self willChangeValueForKey:@"hasTimecode"];
+    TimecodeIndexFree(timecodeIndex);
+    timecodeIndex = TimecodeIndexLoad([[[path stringByExpandingTildeInPath] stringByAppendingPathExtension:@"tc"] fileSystemRepresentation]);
+    [self didChangeValueForKey:@"hasTimecode"];
+    
 }
 
 -(void)clear{
@@ -90,7 +102,13 @@ static void *MaskContext = &MaskContext;
         self.loaded = NO;
         self.thumbnail = nil;
         [[NSFileManager defaultManager] removeItemAtPath:self.path error:nil];
+        [[NSFileManager defaultManager] removeItemAtPath:[self.path stringByAppendingPathExtension:@"tc"] error:nil];
         self.avPlayerItemOriginal = nil;
+        
+        [self willChangeValueForKey:@"hasTimecode"];
+        TimecodeIndexFree(timecodeIndex);
+        timecodeIndex = NULL;
+        [self didChangeValueForKey:@"hasTimecode"];
     }
     
 }
@@ -222,6 +240,41 @@ static void *MaskContext = &MaskContext;
     _manualPath = path;
 }
 
+-(BOOL)hasTimecode{
+    return timecodeIndex != NULL;
+}
+
+-(NSString *)timecodeAtTime:(double)seconds{
+    uint32_t bcd, flags;
+    if(!TimecodeIndexTimecodeAt(timecodeIndex, seconds, &bcd, &flags)){
+        return nil;
+    }
+    char string[12];
+    TimecodeFormat(bcd, flags, string);
+    return [NSString stringWithUTF8String:string];
+}
+
+-(BOOL)time:(double *)seconds forTimecode:(NSString *)timecode{
+    uint32_t bcd, flags;
+    if(!timecode || !TimecodeParse([timecode UTF8String], &bcd, &flags)){
+        return NO;
+    }
+    return TimecodeIndexTimeOf(timecodeIndex, bcd, seconds);
+}
+
+-(BOOL)trimFromTimecode:(NSString *)inTimecode toTimecode:(NSString *)outTimecode{
+    double inSeconds = 0, outSeconds = 0;
+    if((inTimecode && ![self time:&inSeconds forTimecode:inTimecode]) || (outTimecode && ![self time:&outSeconds forTimecode:outTimecode])){
+        return NO;
+    }
+    if(outTimecode && outSeconds <= inSeconds){
+        return NO;
+    }
+    self.inTime = inTimecode ? @(inSeconds) : nil;
+    self.outTime = outTimecode ? @(outSeconds) : nil;
+    return YES;
+}
+
 -(NSSize)size{
     return self.avPlayerItemOriginal.presentationSize;
 }
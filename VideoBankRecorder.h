@@ -20,6 +20,9 @@ extern MIDIReceiver * globalMidi;
 @property int deviceIndex;
 @property BOOL recordPal;
 @property BOOL record;
+// Record every input at once, input n into the bank n-1 places after bankIndex. The
+// takes all start with the frames captured at the same moment
+@property BOOL recordAllInputs;
 @property BOOL readyToRecord;
 @property (readonly) BOOL canRecord;
 @property NSString * timeString;
@@ -34,6 +37,13 @@ extern MIDIReceiver * globalMidi;
 
 
 -(id)initWithBlackmagicItems:(NSArray*)items bank:(VideoBank*)bank;
--(void)newFrameWithBufer:(CVPixelBufferRef)buffer image:(CIImage *)image item:(BlackMagicItem*)bmItem;
+-(void)newFrame:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer item:(BlackMagicItem*)bmItem;
+
+// Depth and high water mark of the write queues, and this take's appended and dropped
+// frames, for every input recording
+-(NSString*) writerStatistics;
+
+// Main thread, when an input's next recording session has been started
+-(void) updateReadyToRecord;
 
 @end
@@ -7,22 +7,19 @@
 //
 
 #import "VideoBankRecorder.h"
-#import "NSString+Timecode.h"
+#import "RecorderTrack.h"
 #import "QLabController.h"
+#import "ThreadUtils.h"
 
 @interface VideoBankRecorder ()
 
 @property BlackMagicItem * deviceItem;
 @property NSArray * blackmagicItems;
-@property NSTimeInterval startRecordTime;
 
-@property AVAssetWriter *videoWriter;
-@property AVAssetWriterInput* videoWriterInput ;
-@property AVAssetWriterInputPixelBufferAdaptor *adaptor;
-
-@property dispatch_queue_t assetWriterQueue;
-
-@property NSRecursiveLock * lock;
+// A track per input, in the order of blackmagicItems
+@property NSArray * tracks;
+// The tracks recording the current take, empty between takes
+@property NSArray * recordingTracks;
 
 
 @end
@@ -44,23 +41,31 @@ static void *LabelContext = &LabelContext;
         self.blackmagicItems = items;
         self.videoBank = bank;
         self.deviceIndex = -1;
-        self.readyToRecord = YES;
+        self.readyToRecord = NO;
+        self.recordingTracks = @[];
+        
+        // Every input gets its track and sends its frames here, the tracks that are not
+        // recording ignore them
+        NSUserDefaults * defaults = [NSUserDefaults standardUserDefaults];
+        double queueSeconds = [defaults objectForKey:@"recorderQueueSeconds"] ? [defaults doubleForKey:@"recorderQueueSeconds"] : 2;
+        NSMutableArray * tracks = [NSMutableArray arrayWithCapacity:items.count];
+        for(BlackMagicItem * item in items){
+            [tracks addObject:[[RecorderTrack alloc] initWithItem:item recorder:self queueSeconds:queueSeconds]];
+            item.delegate = self;
+        }
+        self.tracks = tracks;
         
         [self addObserver:self forKeyPath:@"deviceIndex" options:0 context:DeviceIndexContext];
         [self addObserver:self forKeyPath:@"record" options:0 context:RecordContext];
         
         [self addObserver:self forKeyPath:@"bankIndex" options:0 context:LabelContext];
         [self addObserver:self forKeyPath:@"record" options:0 context:LabelContext];
+        [self addObserver:self forKeyPath:@"recordAllInputs" options:0 context:LabelContext];
         
         self.bankIndex = 0;
         self.deviceIndex = 0;
         self.recordPal = YES;
         
-        self.lock = [[NSRecursiveLock alloc] init];
-        
-        self.assetWriterQueue = dispatch_queue_create("AssetWriterQueue", DISPATCH_QUEUE_SERIAL);
-        [self prepareRecording];
-        
         
         int num = 20;
                 [globalMidi addBindingPitchTo:self path:@"bankIndex" channel:4 rangeMin:-8192 rangeLength:128*128];
@@ -74,130 +79,120 @@ static void *LabelContext = &LabelContext;
     return self;
 }
 
+// The tracks' writer threads keep them alive, they are stopped with the recorder
+-(void)dealloc{
+    for(RecorderTrack * track in self.tracks){
+        [track stop];
+    }
+}
 
--(void)newFrameWithBufer:(CVPixelBufferRef)buffer image:(CIImage *)image item:(BlackMagicItem*)bmItem{
+-(void)newFrame:(const FrameRef &)frame buffer:(CVPixelBufferRef)buffer item:(BlackMagicItem*)bmItem{
+    RecorderTrack * track = [self trackForItem:bmItem];
+    if(!track.recording){
+        return;
+    }
+    [track newFrame:frame buffer:buffer];
     
-    if(self.record && self.readyToRecord){
-        if(!self.startRecordTime){
-            self.startRecordTime = [NSDate timeIntervalSinceReferenceDate];
+    // Bound to the UI, so set on the main thread, after the track's own time it queued there
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if(track == self.recordingTracks.firstObject){
+            self.timeString = track.timeString;
         }
-        NSTimeInterval time = [NSDate timeIntervalSinceReferenceDate];
-        
-        //  dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0ul), ^{
-        NSTimeInterval diffTime = time - self.startRecordTime;
-        
-        self.timeString = [NSString stringWithTimecode:diffTime];
-        
-        int frameCount = diffTime*250.0;
-        
-        __block BOOL append_ok = NO;
-        int j = 0;
-        // self.adaptor.assetWriterInput
-        //        NSLog(@"%ld",self.videoWriter.status);
-        if (self.videoWriterInput.readyForMoreMediaData)
-        {
-            //                    printf("appending %d attemp %d\n", frameCount, j);
-            CMTime frameTime = CMTimeMake(frameCount,(int32_t) 250.0);
-            
-            
-            //   dispatch_sync(self.assetWriterQueue, ^{
-            //   [self.lock lock];
-            //   while(!self.adaptor.assetWriterInput.readyForMoreMediaData) {}
-            //CVPixelBufferPoolCreatePixelBuffer (NULL, self.adaptor.pixelBufferPool, &buffer);
-            
-            append_ok = [self.adaptor appendPixelBuffer:buffer withPresentationTime:frameTime];
-            
-            //   while(!self.adaptor.assetWriterInput.readyForMoreMediaData) {}
-            
-            //    [self.lock unlock];
-            //   });
-            
-            
-            //if(buffer)
-            //  CVBufferRelease(buffer);
-            //[NSThread sleepForTimeInterval:0.035];
+    });
+}
+
+-(RecorderTrack*) trackForItem:(BlackMagicItem*)item{
+    NSUInteger index = [self.blackmagicItems indexOfObject:item];
+    return index != NSNotFound ? self.tracks[index] : nil;
+}
+
+// The bank a track records into: the selected bank, or with recordAllInputs the bank as
+// many places after it as the track's input is after the first. nil past the last bank
+-(VideoBankItem*) bankForTrack:(RecorderTrack*)track{
+    NSUInteger index = self.bankIndex;
+    if(self.recordAllInputs){
+        index += [self.tracks indexOfObject:track];
+    }
+    NSArray * items = self.videoBank.content;
+    return index < items.count ? items[index] : nil;
+}
+
+// The selected input, or every input that has an unlocked bank to go to
+-(NSArray*) tracksToRecord{
+    if(!self.recordAllInputs){
+        if(self.deviceIndex >= 0 && self.deviceIndex < self.tracks.count){
+            return @[self.tracks[self.deviceIndex]];
         }
-        else
-        {
-            printf("adaptor not ready %d, %d\n", frameCount, j);
-            // [NSThread sleepForTimeInterval:0.1];
+        return @[];
+    }
+    NSMutableArray * tracks = [NSMutableArray array];
+    for(RecorderTrack * track in self.tracks){
+        VideoBankItem * bank = [self bankForTrack:track];
+        if(bank && !bank.locked){
+            [tracks addObject:track];
         }
-        j++;
-        //}
-        if (!append_ok) {
-            NSLog(@"%@",self.videoWriter.error);
-            printf("error appending image %d times %d\n", frameCount, j);
-            self.error = YES;
-            self.record = NO;
+    }
+    return tracks;
+}
 
+// All tracks are started at the same moment, as far back as the shortest pre-roll among
+// them reaches, so their takes begin with the frames captured at the same time
+-(void) startTakes{
+    NSArray * tracks = [self tracksToRecord];
+    double preroll = -1;
+    for(RecorderTrack * track in tracks){
+        PrerollBuffer * buffer = track.item.callback->preroll.load();
+        double seconds = buffer ? buffer->Seconds() : 0;
+        if(preroll < 0 || seconds < preroll){
+            preroll = seconds;
         }
-        
-        // });
-        
     }
+    uint64_t now = MonotonicNanos();
+    uint64_t back = preroll > 0 ? (uint64_t)(preroll * 1e9) : 0;
+    uint64_t start = now > back ? now - back : 0;
+    
+    self.timeString = @"";
+    for(RecorderTrack * track in tracks){
+        [track startTakeAt:start];
+    }
+    self.recordingTracks = tracks;
 }
 
-
--(void) prepareRecording {
-    self.readyToRecord = NO;
-    self.timeString = @"";
-    NSError *error = nil;
-    
-    //                self.recordingIndex ++;
-    //              [[NSUserDefaults standardUserDefaults] setInteger:self.recordingIndex forKey:@"recordingIndex"];
-    
-    NSString * path = [@"~/Movies/_cache.mov" stringByExpandingTildeInPath];
-    NSFileManager * fileManager = [NSFileManager defaultManager];
-    [fileManager removeItemAtPath:path error:&error];
-    
-    self.videoWriter = [[AVAssetWriter alloc] initWithURL:
-                        [NSURL fileURLWithPath:path] fileType:AVFileTypeQuickTimeMovie
-                                                    error:&error];
-    NSParameterAssert(self.videoWriter);
-    
-    NSSize size = self.deviceItem.size;
-    if(size.width == 0){
-        size = NSMakeSize(720, 576);
+// Each take is finished in the background, the next ones can start right away on
+// their own sessions
+-(void) stopTakes{
+    NSArray * tracks = self.recordingTracks;
+    self.recordingTracks = @[];
+    for(RecorderTrack * track in tracks){
+        VideoBankItem * bank = [self bankForTrack:track];
+        BOOL save = bank && !bank.locked && !self.error;
+        [track stopTakeSavingTo:bank save:save];
     }
+}
 
-    if(self.recordPal && size.width > 720){
-        float aspect = size.width/size.height;
-        size.width = 576*aspect;
-        size.height = 576.0;
+// Main thread. Ready when every input that would record has a session waiting
+-(void) updateReadyToRecord{
+    NSArray * tracks = [self tracksToRecord];
+    BOOL ready = tracks.count > 0;
+    for(RecorderTrack * track in tracks){
+        ready = ready && track.ready;
     }
     
-    NSDictionary *videoSettings = [NSDictionary dictionaryWithObjectsAndKeys:
-                                   AVVideoCodecH264, AVVideoCodecKey,
-                                   [NSNumber numberWithInt:size.width], AVVideoWidthKey,
-                                   [NSNumber numberWithInt:size.height], AVVideoHeightKey,
-                                   nil];
-    
-    self.videoWriterInput = [AVAssetWriterInput
-                             assetWriterInputWithMediaType:AVMediaTypeVideo
-                             outputSettings:videoSettings];
-    
-    
-    self.adaptor = [AVAssetWriterInputPixelBufferAdaptor
-                    assetWriterInputPixelBufferAdaptorWithAssetWriterInput:self.videoWriterInput
-                    sourcePixelBufferAttributes:@{(NSString*)kCVPixelBufferPixelFormatTypeKey:[NSNumber numberWithInt:kCVPixelFormatType_32ARGB]}];
-    
-    NSParameterAssert(self.videoWriterInput);
-    NSParameterAssert([self.videoWriter canAddInput:self.videoWriterInput]);
-    self.videoWriterInput.expectsMediaDataInRealTime = YES;
-    self.adaptor.assetWriterInput.expectsMediaDataInRealTime = YES;
-    [self.videoWriter addInput:self.videoWriterInput];
-    
-    //Start a session:
-    if(![self.videoWriter startWriting]){
-        NSLog(@"Could not start writing %@",self.videoWriter.error);
+    if(ready != self.readyToRecord){
+        self.readyToRecord = ready;
+        if(ready){
+            NSLog(@"Ready to record");
+        }
     }
-    [self.videoWriter startSessionAtSourceTime:kCMTimeZero];
-    
-    dispatch_async(dispatch_queue_create("waiter", 0), ^{
-        [NSThread sleepForTimeInterval:0.2];
-        self.readyToRecord = YES;
-        NSLog(@"Ready to record");
-    });
+}
+
+-(NSString *)writerStatistics{
+    NSArray * tracks = self.recordingTracks.count ? self.recordingTracks : [self tracksToRecord];
+    NSMutableArray * statistics = [NSMutableArray arrayWithCapacity:tracks.count];
+    for(RecorderTrack * track in tracks){
+        [statistics addObject:[NSString stringWithFormat:@"input %i %@", track.item.index+1, [track writerStatistics]]];
+    }
+    return [statistics componentsJoinedByString:@"; "];
 }
 
 -(void)observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object change:(NSDictionary *)change context:(void *)context{
@@ -207,70 +202,32 @@ static void *LabelContext = &LabelContext;
             item.recordLabel = 0;
         }
         
-        NSArray * items = self.videoBank.content;
-        if(self.bankIndex < items.count){
-            VideoBankItem * item = items[self.bankIndex];
+        for(RecorderTrack * track in [self tracksToRecord]){
+            VideoBankItem * item = [self bankForTrack:track];
             if(self.record){
                 item.recordLabel = 2;
             } else {
                 item.recordLabel = 1;
             }
-            
         }
+        [self updateReadyToRecord];
     }
     if(context == RecordContext){
-        self.startRecordTime = nil;
-        
-        if(!self.record && [self canRecord] && !self.error){
-            dispatch_queue_t queue = dispatch_queue_create("saver", 0);
-            dispatch_async(queue, ^{
-                [self willChangeValueForKey:@"recordings"];
-                
-                [self.videoWriterInput markAsFinished];
-                [self.videoWriter finishWriting];
-                
-                NSArray * items = self.videoBank.content;
-                if(self.bankIndex < items.count){
-                    VideoBankItem * item = items[self.bankIndex];
-                    NSString * path = item.path;
-                    
-                    NSError * error;
-                    [[NSFileManager defaultManager] removeItemAtPath:[path stringByExpandingTildeInPath] error:nil];
-                    [[NSFileManager defaultManager] moveItemAtPath:[@"~/Movies/_cache.mov" stringByExpandingTildeInPath] toPath:[path stringByExpandingTildeInPath] error:&error];
-                    if(error){
-                        NSLog(@"Error moving file %@",error);
-                    }
-                    
-                    [item loadBankFromDrive];
-                    
-                }
-                
-                self.readyToRecord = YES;
-                [self didChangeValueForKey:@"recordings"];
-                
-              //  [self performSelector:@selector(prepareRecording) withObject:nil afterDelay:2];
-                
-                   [self prepareRecording];
-                
-
-            });
-            
+        // Switching record on again during a take leaves the take alone
+        if(self.record && self.recordingTracks.count == 0){
+            [self startTakes];
+        } else if(!self.record){
+            [self stopTakes];
         }
         self.error = NO;
     }
     
     if(context == DeviceIndexContext){
-        if(self.deviceItem){
-            self.deviceItem.delegate = nil;
-        }
-        
         if(self.deviceIndex < self.blackmagicItems.count && self.deviceIndex >= 0){
             self.deviceItem = self.blackmagicItems[self.deviceIndex];
-            self.deviceItem.delegate = self;
         }
         
-        
-      //  [self prepareRecording];
+        [self updateReadyToRecord];
     }
 }
 
@@ -300,10 +257,14 @@ static void *LabelContext = &LabelContext;
     @{QName : [NSString stringWithFormat:@"Bank Selection: %02i",self.bankIndex], QPath: @"bankIndex"},
     @{QName : [NSString stringWithFormat:@"Device Selection: %i",self.deviceIndex], QPath: @"deviceIndex"},
     @{QName : [NSString stringWithFormat:@"Record Pal: %i",self.recordPal], QPath: @"recordPal"},
+    @{QName : [NSString stringWithFormat:@"Record All Inputs: %i",self.recordAllInputs], QPath: @"recordAllInputs"},
     @{QName : [NSString stringWithFormat:@"Record: Yes"], QPath: @"record", QValue: @(1)},
     ];
     
     NSString * title = [NSString stringWithFormat:@"Start Record bank #%02i Cam %i",self.bankIndex, self.deviceIndex+1];
+    if(self.recordAllInputs){
+        title = [NSString stringWithFormat:@"Start Record bank #%02i All Cams",self.bankIndex];
+    }
 
     [QLabController createCues:cues groupTitle:title sender:self];
 }
@@ -0,0 +1,859 @@
+//
+//  CaptureDaemon.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Headless capture of N inputs to raw files. Unlike the Capture sample nothing is
+//  written from the driver callback: the callbacks only enqueue the frames, and one
+//  I/O thread copies them into large aligned buffers and writes those out.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "DeckLinkAPI.h"
+#include "CaptureDaemon.h"
+
+static const size_t		kDirectAlignment = 4096;
+
+static std::atomic<bool>		g_ioRunning(true);
+static sem_t					g_ioSemaphore;
+
+static uint64_t MonotonicNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void SetRealtimePriority(int priority, const char* who)
+{
+	struct sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = priority;
+
+	int result = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (result != 0)
+		fprintf(stderr, "Could not set SCHED_FIFO priority %d for %s: %s\n", priority, who, strerror(result));
+}
+
+//
+// FrameQueue
+//
+
+FrameQueue::FrameQueue(unsigned minCapacity) : m_head(0), m_tail(0)
+{
+	unsigned capacity = 2;
+	while (capacity < minCapacity)
+		capacity <<= 1;
+
+	m_slots.resize(capacity);
+	m_mask = capacity - 1;
+}
+
+bool FrameQueue::Push(const QueuedFrame& item)
+{
+	unsigned tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+		return false;
+
+	m_slots[tail & m_mask] = item;
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+bool FrameQueue::Pop(QueuedFrame& item)
+{
+	unsigned head = m_head.load(std::memory_order_relaxed);
+	if (head == m_tail.load(std::memory_order_acquire))
+		return false;
+
+	item = m_slots[head & m_mask];
+	m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+unsigned FrameQueue::Depth()
+{
+	return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+}
+
+//
+// StreamWriter
+//
+
+StreamWriter::StreamWriter(const char* prefix, int index, size_t bufferSize, bool direct, uint64_t rotateBytes) :
+	m_prefix(prefix), m_index(index), m_sequence(0), m_fd(-1), m_direct(direct), m_buffer(NULL),
+	m_fill(0), m_fileBytes(0), m_rotateBytes(rotateBytes),
+	m_bytesWritten(0), m_writes(0), m_writeErrors(0), m_maxWriteNanos(0)
+{
+	// Whole pages, so every full buffer write stays aligned for O_DIRECT
+	m_bufferSize = (bufferSize + kDirectAlignment - 1) & ~(kDirectAlignment - 1);
+	if (posix_memalign((void**)&m_buffer, kDirectAlignment, m_bufferSize) != 0)
+		m_buffer = NULL;
+}
+
+StreamWriter::~StreamWriter()
+{
+	Close();
+	free(m_buffer);
+}
+
+bool StreamWriter::Open()
+{
+	char path[1024];
+	snprintf(path, sizeof(path), "%s-%d-%03d.raw", m_prefix, m_index + 1, m_sequence++);
+
+	int flags = O_WRONLY|O_CREAT|O_TRUNC;
+	if (m_direct)
+	{
+		m_fd = open(path, flags|O_DIRECT, 0664);
+		if (m_fd < 0 && errno == EINVAL)
+		{
+			fprintf(stderr, "O_DIRECT is not supported for \"%s\", using buffered writes\n", path);
+			m_direct = false;
+		}
+	}
+	if (m_fd < 0)
+		m_fd = open(path, flags, 0664);
+
+	if (m_fd < 0)
+	{
+		fprintf(stderr, "Could not open video output file \"%s\": %s\n", path, strerror(errno));
+		return false;
+	}
+
+	m_fileBytes = 0;
+	return true;
+}
+
+void StreamWriter::Write(const char* bytes, size_t size)
+{
+	uint64_t start = MonotonicNanos();
+
+	while (size > 0)
+	{
+		ssize_t result = write(m_fd, bytes, size);
+		if (result < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			// Keep capturing, the frames in this buffer are lost
+			fprintf(stderr, "Write to input %d output failed: %s\n", m_index + 1, strerror(errno));
+			m_writeErrors++;
+			break;
+		}
+		bytes += result;
+		size -= result;
+		m_fileBytes += result;
+		m_bytesWritten += result;
+	}
+	m_writes++;
+
+	uint64_t elapsed = MonotonicNanos() - start;
+	uint64_t previous = m_maxWriteNanos.load();
+	while (elapsed > previous && !m_maxWriteNanos.compare_exchange_weak(previous, elapsed))
+		;
+}
+
+// Writes what is left in the buffer and closes the file. The unaligned tail of the
+// last page can not go through O_DIRECT, so the flag is dropped for that one write.
+void StreamWriter::FinishFile()
+{
+	if (m_fd < 0)
+		return;
+
+	size_t aligned = m_direct ? (m_fill & ~(kDirectAlignment - 1)) : m_fill;
+	if (aligned > 0)
+		Write(m_buffer, aligned);
+
+	if (m_fill > aligned)
+	{
+		fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+		Write(m_buffer + aligned, m_fill - aligned);
+	}
+
+	m_fill = 0;
+	close(m_fd);
+	m_fd = -1;
+}
+
+bool StreamWriter::AppendFrame(const void* bytes, size_t size)
+{
+	if (!m_buffer)
+		return false;
+	if (m_fd < 0 && !Open())
+		return false;
+
+	const char* src = (const char*)bytes;
+	while (size > 0)
+	{
+		size_t chunk = m_bufferSize - m_fill;
+		if (chunk > size)
+			chunk = size;
+
+		memcpy(m_buffer + m_fill, src, chunk);
+		m_fill += chunk;
+		src += chunk;
+		size -= chunk;
+
+		if (m_fill == m_bufferSize)
+		{
+			Write(m_buffer, m_fill);
+			m_fill = 0;
+		}
+	}
+
+	if (m_rotateBytes > 0 && m_fileBytes + m_fill >= m_rotateBytes)
+		FinishFile();
+
+	return true;
+}
+
+void StreamWriter::Close()
+{
+	FinishFile();
+}
+
+//
+// DaemonInput
+//
+
+DaemonInput::DaemonInput(int index, unsigned queueSize, int realtimePriority, sem_t* ioSemaphore) :
+	index(index), queue(queueSize), writer(NULL), deckLinkInput(NULL),
+	received(0), noSignal(0), dropped(0), written(0), maxDepth(0),
+	m_refCount(1), m_realtimePriority(realtimePriority), m_threadConfigured(false), m_ioSemaphore(ioSemaphore)
+{
+}
+
+DaemonInput::~DaemonInput()
+{
+	delete writer;
+}
+
+ULONG DaemonInput::AddRef(void)
+{
+	return ++m_refCount;
+}
+
+ULONG DaemonInput::Release(void)
+{
+	ULONG count = --m_refCount;
+	if (count == 0)
+		delete this;
+	return count;
+}
+
+HRESULT DaemonInput::VideoInputFormatChanged(BMDVideoInputFormatChangedEvents events, IDeckLinkDisplayMode *mode, BMDDetectedVideoInputFormatFlags)
+{
+	return S_OK;
+}
+
+HRESULT DaemonInput::VideoInputFrameArrived(IDeckLinkVideoInputFrame* videoFrame, IDeckLinkAudioInputPacket* audioFrame)
+{
+	if (m_realtimePriority > 0 && (!m_threadConfigured || !pthread_equal(m_configuredThread, pthread_self())))
+	{
+		SetRealtimePriority(m_realtimePriority, "the capture callback");
+		m_configuredThread = pthread_self();
+		m_threadConfigured = true;
+	}
+
+	if (videoFrame)
+		Enqueue(videoFrame);
+
+	return S_OK;
+}
+
+void DaemonInput::Enqueue(IDeckLinkVideoInputFrame* videoFrame)
+{
+	received++;
+
+	if (videoFrame->GetFlags() & bmdFrameHasNoInputSource)
+	{
+		noSignal++;
+		return;
+	}
+
+	QueuedFrame item = { videoFrame, MonotonicNanos() };
+	videoFrame->AddRef();
+	if (!queue.Push(item))
+	{
+		// The I/O thread is behind, drop this frame rather than stall the driver
+		videoFrame->Release();
+		dropped++;
+		return;
+	}
+
+	unsigned depth = queue.Depth();
+	if (depth > maxDepth.load(std::memory_order_relaxed))
+		maxDepth = depth;
+
+	sem_post(m_ioSemaphore);
+}
+
+//
+// SyntheticSource
+//
+
+class SyntheticFrame : public IDeckLinkVideoInputFrame
+{
+public:
+	SyntheticFrame(long width, long height) : m_refCount(1), m_width(width), m_height(height), m_frameTime(0), m_frameDuration(0), m_timeScale(1)
+	{
+		m_rowBytes = width * 2;
+		if (posix_memalign(&m_bytes, kDirectAlignment, m_rowBytes * height) != 0)
+			m_bytes = NULL;
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return ++m_refCount; }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = --m_refCount;
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual long GetWidth(void) { return m_width; }
+	virtual long GetHeight(void) { return m_height; }
+	virtual long GetRowBytes(void) { return m_rowBytes; }
+	virtual BMDPixelFormat GetPixelFormat(void) { return bmdFormat8BitYUV; }
+	virtual BMDFrameFlags GetFlags(void) { return m_bytes ? bmdFrameFlagDefault : bmdFrameHasNoInputSource; }
+	virtual HRESULT GetBytes(void **buffer) { *buffer = m_bytes; return m_bytes ? S_OK : E_FAIL; }
+	virtual HRESULT GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode) { return S_FALSE; }
+	virtual HRESULT GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary) { return S_FALSE; }
+
+	virtual HRESULT GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = m_frameTime * timeScale / m_timeScale;
+		*frameDuration = m_frameDuration * timeScale / m_timeScale;
+		return S_OK;
+	}
+
+	virtual HRESULT GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration)
+	{
+		return GetStreamTime(frameTime, frameDuration, timeScale);
+	}
+
+	// Grey frame with a bar moving one column per frame
+	void Render(uint64_t frameNumber, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+	{
+		m_frameTime = frameNumber * frameDuration;
+		m_frameDuration = frameDuration;
+		m_timeScale = timeScale;
+
+		unsigned char* bytes = (unsigned char*)m_bytes;
+		if (!bytes)
+			return;
+
+		long bar = (frameNumber * 2) % m_width & ~1L;
+		for (long y = 0; y < m_height; y++)
+		{
+			unsigned char* row = bytes + y * m_rowBytes;
+			for (long x = 0; x < m_width; x += 2)
+			{
+				unsigned char luma = (x >= bar && x < bar + 16) ? 235 : 128;
+				row[x*2+0] = 128;
+				row[x*2+1] = luma;
+				row[x*2+2] = 128;
+				row[x*2+3] = luma;
+			}
+		}
+	}
+
+	// Only the source holds a reference, so the frame is not queued anywhere
+	bool IsIdle() { return m_refCount.load() == 1; }
+
+private:
+	~SyntheticFrame() { free(m_bytes); }
+
+	std::atomic<ULONG>	m_refCount;
+	long				m_width;
+	long				m_height;
+	long				m_rowBytes;
+	void*				m_bytes;
+	BMDTimeValue		m_frameTime;
+	BMDTimeValue		m_frameDuration;
+	BMDTimeScale		m_timeScale;
+};
+
+SyntheticSource::SyntheticSource(DaemonInput* input, long width, long height, double frameRate, int realtimePriority) :
+	m_input(input), m_width(width), m_height(height), m_frameRate(frameRate), m_realtimePriority(realtimePriority),
+	m_started(false), m_running(false)
+{
+	// Like the driver, a few more frames than can be in flight at once
+	for (unsigned i = 0; i < input->queue.Capacity() + 2; i++)
+		m_frames.push_back(new SyntheticFrame(width, height));
+}
+
+SyntheticSource::~SyntheticSource()
+{
+	Stop();
+	for (size_t i = 0; i < m_frames.size(); i++)
+		m_frames[i]->Release();
+}
+
+bool SyntheticSource::Start()
+{
+	m_running = true;
+	if (pthread_create(&m_thread, NULL, ThreadFunc, this) != 0)
+	{
+		m_running = false;
+		return false;
+	}
+	m_started = true;
+	return true;
+}
+
+void SyntheticSource::Stop()
+{
+	m_running = false;
+	if (m_started)
+	{
+		pthread_join(m_thread, NULL);
+		m_started = false;
+	}
+}
+
+void* SyntheticSource::ThreadFunc(void* arg)
+{
+	((SyntheticSource*)arg)->Run();
+	return NULL;
+}
+
+void SyntheticSource::Run()
+{
+	if (m_realtimePriority > 0)
+		SetRealtimePriority(m_realtimePriority, "the synthetic source");
+
+	const BMDTimeScale timeScale = 1000000;
+	const BMDTimeValue frameDuration = (BMDTimeValue)(timeScale / m_frameRate + 0.5);
+	uint64_t frameNumber = 0;
+
+	struct timespec next;
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (m_running)
+	{
+		next.tv_nsec += frameDuration * 1000;
+		while (next.tv_nsec >= 1000000000L)
+		{
+			next.tv_nsec -= 1000000000L;
+			next.tv_sec++;
+		}
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+		// A frame still queued can not be reused, the driver would drop here as well
+		SyntheticFrame* frame = NULL;
+		for (size_t i = 0; i < m_frames.size() && !frame; i++)
+		{
+			if (((SyntheticFrame*)m_frames[i])->IsIdle())
+				frame = (SyntheticFrame*)m_frames[i];
+		}
+
+		if (frame)
+		{
+			frame->Render(frameNumber, frameDuration, timeScale);
+			m_input->Enqueue(frame);
+		}
+		else
+		{
+			m_input->received++;
+			m_input->dropped++;
+		}
+		frameNumber++;
+	}
+}
+
+//
+// I/O thread
+//
+
+static void* IoThreadFunc(void* arg)
+{
+	std::vector<DaemonInput*>& inputs = *(std::vector<DaemonInput*>*)arg;
+
+	for (;;)
+	{
+		struct timespec timeout;
+		clock_gettime(CLOCK_REALTIME, &timeout);
+		timeout.tv_nsec += 100000000L;
+		if (timeout.tv_nsec >= 1000000000L)
+		{
+			timeout.tv_nsec -= 1000000000L;
+			timeout.tv_sec++;
+		}
+		sem_timedwait(&g_ioSemaphore, &timeout);
+
+		bool idle = true;
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			DaemonInput* input = inputs[i];
+			QueuedFrame item;
+			while (input->queue.Pop(item))
+			{
+				idle = false;
+				if (input->writer)
+				{
+					void* bytes = NULL;
+					item.frame->GetBytes(&bytes);
+					input->writer->AppendFrame(bytes, item.frame->GetRowBytes() * item.frame->GetHeight());
+				}
+				item.frame->Release();
+				input->written++;
+			}
+		}
+
+		// Drain the queues before stopping
+		if (idle && !g_ioRunning)
+			break;
+	}
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		if (inputs[i]->writer)
+			inputs[i]->writer->Close();
+	}
+	return NULL;
+}
+
+//
+// Main
+//
+
+int usage(int status)
+{
+	fprintf(stderr,
+		"Usage: CaptureDaemon -m <mode id> [OPTIONS]\n"
+		"\n"
+		"    -m <mode id>         Display mode index, as listed by the Capture sample\n"
+		"    -p <pixelformat>\n"
+		"         0:  8 bit YUV (4:2:2) (default)\n"
+		"         1:  10 bit YUV (4:2:2)\n"
+		"         2:  10 bit RGB (4:4:4)\n"
+		"    -d <inputs>          Number of inputs to capture (default is all)\n"
+		"    -f <prefix>          Write raw video to <prefix>-<input>-<sequence>.raw\n"
+		"    -r <megabytes>       Start a new file after this many megabytes (default is never)\n"
+		"    -b <megabytes>       Size of the coalesced writes (default is 8)\n"
+		"    -D                   Write with O_DIRECT, bypassing the page cache\n"
+		"    -q <frames>          Frames queued per input before dropping (default is 16)\n"
+		"    -P <priority>        SCHED_FIFO priority for the capture callbacks (default is off)\n"
+		"    -t <seconds>         Stop after this many seconds (default is until SIGINT/SIGTERM)\n"
+		"    -S                   Use the synthetic source even if DeckLink cards are present\n"
+		"    -g <w>x<h>@<fps>     Synthetic frame size and rate, the width must be even (default is 1920x1080@25)\n"
+		"\n"
+		"Without the DeckLink library the synthetic source is used, eg. to measure disk throughput:\n"
+		"\n"
+		"    CaptureDaemon -S -d 3 -f /data/take -D -r 4096 -t 60\n"
+	);
+
+	exit(status);
+}
+
+static bool StartDeckLinkInput(IDeckLink* deckLink, DaemonInput* input, int modeIndex, BMDPixelFormat pixelFormat)
+{
+	IDeckLinkDisplayModeIterator*	displayModeIterator = NULL;
+	IDeckLinkDisplayMode*			displayMode = NULL;
+	BMDDisplayMode					selectedDisplayMode = bmdModeNTSC;
+	int								displayModeCount = 0;
+	bool							foundDisplayMode = false;
+
+	if (deckLink->QueryInterface(IID_IDeckLinkInput, (void**)&input->deckLinkInput) != S_OK)
+	{
+		fprintf(stderr, "Input %d has no IDeckLinkInput\n", input->index + 1);
+		return false;
+	}
+
+	if (input->deckLinkInput->GetDisplayModeIterator(&displayModeIterator) != S_OK)
+		return false;
+
+	while (displayModeIterator->Next(&displayMode) == S_OK)
+	{
+		if (modeIndex == displayModeCount)
+		{
+			foundDisplayMode = true;
+			selectedDisplayMode = displayMode->GetDisplayMode();
+		}
+		displayModeCount++;
+		displayMode->Release();
+	}
+	displayModeIterator->Release();
+
+	if (!foundDisplayMode)
+	{
+		fprintf(stderr, "Invalid mode %d specified for input %d\n", modeIndex, input->index + 1);
+		return false;
+	}
+
+	input->deckLinkInput->SetCallback(input);
+
+	if (input->deckLinkInput->EnableVideoInput(selectedDisplayMode, pixelFormat, bmdVideoInputFlagDefault) != S_OK)
+	{
+		fprintf(stderr, "Failed to enable video input %d. Is another application using the card?\n", input->index + 1);
+		return false;
+	}
+
+	if (input->deckLinkInput->StartStreams() != S_OK)
+	{
+		fprintf(stderr, "Failed to start input %d\n", input->index + 1);
+		return false;
+	}
+	return true;
+}
+
+static void PrintStats(std::vector<DaemonInput*>& inputs, double seconds, std::vector<uint64_t>& lastBytes)
+{
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		DaemonInput* input = inputs[i];
+		uint64_t bytes = input->writer ? input->writer->BytesWritten() : 0;
+		double maxWriteMs = input->writer ? input->writer->MaxWriteNanos() / 1e6 : 0;
+
+		fprintf(stderr, "input %d: received %llu written %llu dropped %llu no signal %llu queue %u/%u (max %u) %.1f MB/s max write %.1f ms%s\n",
+			input->index + 1,
+			(unsigned long long)input->received, (unsigned long long)input->written,
+			(unsigned long long)input->dropped, (unsigned long long)input->noSignal,
+			input->queue.Depth(), input->queue.Capacity(), input->maxDepth.load(),
+			(bytes - lastBytes[i]) / seconds / (1024.0 * 1024.0), maxWriteMs,
+			input->writer && input->writer->WriteErrors() ? " WRITE ERRORS" : "");
+
+		lastBytes[i] = bytes;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	IDeckLinkIterator*				deckLinkIterator = NULL;
+	std::vector<IDeckLink*>			deckLinks;
+	std::vector<DaemonInput*>		inputs;
+	std::vector<SyntheticSource*>	sources;
+	BMDPixelFormat					pixelFormat = bmdFormat8BitYUV;
+	const char*						outputPrefix = NULL;
+	int								modeIndex = -1;
+	int								numInputs = -1;
+	int								realtimePriority = 0;
+	unsigned						queueSize = 16;
+	size_t							bufferSize = 8 << 20;
+	uint64_t						rotateBytes = 0;
+	bool							direct = false;
+	bool							synthetic = false;
+	long							syntheticWidth = 1920;
+	long							syntheticHeight = 1080;
+	double							syntheticRate = 25;
+	int								duration = 0;
+	int								exitStatus = 1;
+	int								ch;
+	pthread_t						ioThread;
+	bool							ioStarted = false;
+	sigset_t						signals;
+
+	while ((ch = getopt(argc, argv, "?hm:p:d:f:r:b:Dq:P:t:Sg:")) != -1)
+	{
+		switch (ch)
+		{
+			case 'm':
+				modeIndex = atoi(optarg);
+				break;
+			case 'p':
+				switch(atoi(optarg))
+				{
+					case 0: pixelFormat = bmdFormat8BitYUV; break;
+					case 1: pixelFormat = bmdFormat10BitYUV; break;
+					case 2: pixelFormat = bmdFormat10BitRGB; break;
+					default:
+						fprintf(stderr, "Invalid argument: Pixel format %d is not valid\n", atoi(optarg));
+						return 1;
+				}
+				break;
+			case 'd':
+				numInputs = atoi(optarg);
+				break;
+			case 'f':
+				outputPrefix = optarg;
+				break;
+			case 'r':
+				rotateBytes = (uint64_t)atol(optarg) << 20;
+				break;
+			case 'b':
+				bufferSize = (size_t)atol(optarg) << 20;
+				break;
+			case 'D':
+				direct = true;
+				break;
+			case 'q':
+				queueSize = atoi(optarg);
+				break;
+			case 'P':
+				realtimePriority = atoi(optarg);
+				break;
+			case 't':
+				duration = atoi(optarg);
+				break;
+			case 'S':
+				synthetic = true;
+				break;
+			case 'g':
+				// UYVY carries a pixel pair per 4 bytes, so the width has to be even
+				if (sscanf(optarg, "%ldx%ld@%lf", &syntheticWidth, &syntheticHeight, &syntheticRate) != 3 ||
+					syntheticWidth < 2 || (syntheticWidth & 1) || syntheticHeight < 1 || syntheticRate <= 0)
+				{
+					fprintf(stderr, "Invalid argument: Synthetic format \"%s\" is invalid\n", optarg);
+					return 1;
+				}
+				break;
+			case '?':
+			case 'h':
+				usage(0);
+		}
+	}
+
+	if (bufferSize == 0 || queueSize == 0)
+		usage(1);
+
+	// Signals are taken by sigtimedwait below, block them before any thread starts
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	sem_init(&g_ioSemaphore, 0, 0);
+
+	if (!synthetic)
+	{
+		deckLinkIterator = CreateDeckLinkIteratorInstance();
+		if (deckLinkIterator)
+		{
+			IDeckLink* deckLink = NULL;
+			while ((numInputs < 0 || (int)deckLinks.size() < numInputs) && deckLinkIterator->Next(&deckLink) == S_OK)
+				deckLinks.push_back(deckLink);
+		}
+
+		if (deckLinks.empty())
+		{
+			fprintf(stderr, "No DeckLink cards found, using the synthetic source\n");
+			synthetic = true;
+		}
+		else if (modeIndex < 0)
+		{
+			fprintf(stderr, "No video mode specified\n");
+			usage(1);
+		}
+	}
+
+	if (synthetic && numInputs < 0)
+		numInputs = 1;
+
+	int count = synthetic ? numInputs : (int)deckLinks.size();
+	for (int i = 0; i < count; i++)
+	{
+		DaemonInput* input = new DaemonInput(i, queueSize, realtimePriority, &g_ioSemaphore);
+		if (outputPrefix)
+			input->writer = new StreamWriter(outputPrefix, i, bufferSize, direct, rotateBytes);
+		inputs.push_back(input);
+	}
+
+	if (pthread_create(&ioThread, NULL, IoThreadFunc, &inputs) != 0)
+	{
+		fprintf(stderr, "Could not start the I/O thread\n");
+		goto bail;
+	}
+	ioStarted = true;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (synthetic)
+		{
+			SyntheticSource* source = new SyntheticSource(inputs[i], syntheticWidth, syntheticHeight, syntheticRate, realtimePriority);
+			sources.push_back(source);
+			if (!source->Start())
+			{
+				fprintf(stderr, "Could not start the synthetic source for input %d\n", i + 1);
+				goto bail;
+			}
+		}
+		else if (!StartDeckLinkInput(deckLinks[i], inputs[i], modeIndex, pixelFormat))
+		{
+			goto bail;
+		}
+	}
+
+	fprintf(stderr, "Capturing %d %s input%s%s\n", count, synthetic ? "synthetic" : "DeckLink", count == 1 ? "" : "s",
+		outputPrefix ? "" : ", not writing (no -f)");
+
+	// All Okay.
+	exitStatus = 0;
+
+	// Print statistics every second until a signal or the duration is up
+	{
+		std::vector<uint64_t> lastBytes(inputs.size(), 0);
+		uint64_t start = MonotonicNanos();
+		uint64_t last = start;
+
+		for (;;)
+		{
+			struct timespec timeout = { 1, 0 };
+			int sig = sigtimedwait(&signals, NULL, &timeout);
+
+			uint64_t now = MonotonicNanos();
+			PrintStats(inputs, (now - last) / 1e9, lastBytes);
+			last = now;
+
+			if (sig == SIGINT || sig == SIGTERM)
+				break;
+			if (duration > 0 && now - start >= (uint64_t)duration * 1000000000ULL)
+				break;
+		}
+	}
+	fprintf(stderr, "Stopping Capture\n");
+
+bail:
+
+	for (size_t i = 0; i < sources.size(); i++)
+		sources[i]->Stop();
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		if (inputs[i]->deckLinkInput)
+		{
+			inputs[i]->deckLinkInput->StopStreams();
+			inputs[i]->deckLinkInput->SetCallback(NULL);
+		}
+	}
+
+	if (ioStarted)
+	{
+		g_ioRunning = false;
+		sem_post(&g_ioSemaphore);
+		pthread_join(ioThread, NULL);
+	}
+
+	for (size_t i = 0; i < sources.size(); i++)
+		delete sources[i];
+
+	for (size_t i = 0; i < inputs.size(); i++)
+	{
+		if (inputs[i]->deckLinkInput)
+			inputs[i]->deckLinkInput->Release();
+		inputs[i]->Release();
+	}
+
+	for (size_t i = 0; i < deckLinks.size(); i++)
+		deckLinks[i]->Release();
+
+	if (deckLinkIterator != NULL)
+		deckLinkIterator->Release();
+
+	sem_destroy(&g_ioSemaphore);
+
+	return exitStatus;
+}
@@ -0,0 +1,146 @@
+//
+//  CaptureDaemon.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#ifndef __CAPTURE_DAEMON_H__
+#define __CAPTURE_DAEMON_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <atomic>
+#include <vector>
+
+#include "DeckLinkAPI.h"
+
+// A frame on its way from a capture callback to the I/O thread. The frame is
+// AddRef'd by the callback and released by the I/O thread once it is copied.
+struct QueuedFrame
+{
+	IDeckLinkVideoInputFrame*	frame;
+	uint64_t					arrivalTime;
+};
+
+// Bounded single producer / single consumer ring, the producer never blocks
+class FrameQueue
+{
+public:
+	FrameQueue(unsigned minCapacity);
+
+	bool		Push(const QueuedFrame& item);
+	bool		Pop(QueuedFrame& item);
+	unsigned	Depth();
+	unsigned	Capacity() { return m_mask + 1; }
+
+private:
+	std::vector<QueuedFrame>	m_slots;
+	unsigned					m_mask;
+	alignas(64) std::atomic<unsigned>	m_head;		// next slot to pop
+	alignas(64) std::atomic<unsigned>	m_tail;		// next slot to push
+};
+
+// Coalesces frames into a large aligned buffer and writes it out in one go,
+// optionally with O_DIRECT and starting a new file every rotateBytes
+class StreamWriter
+{
+public:
+	StreamWriter(const char* prefix, int index, size_t bufferSize, bool direct, uint64_t rotateBytes);
+	~StreamWriter();
+
+	// Copies a whole frame, files are only rotated between frames
+	bool		AppendFrame(const void* bytes, size_t size);
+	void		Close();
+
+	uint64_t	BytesWritten() { return m_bytesWritten; }
+	uint64_t	Writes() { return m_writes; }
+	uint64_t	WriteErrors() { return m_writeErrors; }
+	uint64_t	MaxWriteNanos() { return m_maxWriteNanos.exchange(0); }
+
+private:
+	bool		Open();
+	void		FinishFile();
+	void		Write(const char* bytes, size_t size);
+
+	const char*		m_prefix;
+	int				m_index;
+	int				m_sequence;
+	int				m_fd;
+	bool			m_direct;
+	char*			m_buffer;
+	size_t			m_bufferSize;
+	size_t			m_fill;
+	uint64_t		m_fileBytes;
+	uint64_t		m_rotateBytes;
+
+	std::atomic<uint64_t>	m_bytesWritten;
+	std::atomic<uint64_t>	m_writes;
+	std::atomic<uint64_t>	m_writeErrors;
+	std::atomic<uint64_t>	m_maxWriteNanos;
+};
+
+// One capture input. VideoInputFrameArrived runs on the driver's thread, which is
+// raised to real-time priority on the first call, and does nothing but enqueue.
+class DaemonInput : public IDeckLinkInputCallback
+{
+public:
+	DaemonInput(int index, unsigned queueSize, int realtimePriority, sem_t* ioSemaphore);
+	~DaemonInput();
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void);
+	virtual ULONG STDMETHODCALLTYPE Release(void);
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFormatChanged(BMDVideoInputFormatChangedEvents, IDeckLinkDisplayMode*, BMDDetectedVideoInputFormatFlags);
+	virtual HRESULT STDMETHODCALLTYPE VideoInputFrameArrived(IDeckLinkVideoInputFrame*, IDeckLinkAudioInputPacket*);
+
+	// Also used by the synthetic source
+	void		Enqueue(IDeckLinkVideoInputFrame* videoFrame);
+
+	int					index;
+	FrameQueue			queue;
+	StreamWriter*		writer;
+	IDeckLinkInput*		deckLinkInput;
+
+	std::atomic<uint64_t>	received;
+	std::atomic<uint64_t>	noSignal;
+	std::atomic<uint64_t>	dropped;
+	std::atomic<uint64_t>	written;
+	std::atomic<unsigned>	maxDepth;
+
+private:
+	std::atomic<ULONG>	m_refCount;
+	int					m_realtimePriority;
+	pthread_t			m_configuredThread;
+	bool				m_threadConfigured;
+	sem_t*				m_ioSemaphore;
+};
+
+// Stands in for a card when there is no DeckLink library, producing UYVY frames
+// at a fixed rate from its own real-time thread
+class SyntheticSource
+{
+public:
+	SyntheticSource(DaemonInput* input, long width, long height, double frameRate, int realtimePriority);
+	~SyntheticSource();
+
+	bool		Start();
+	void		Stop();
+
+private:
+	static void*	ThreadFunc(void* arg);
+	void			Run();
+
+	DaemonInput*				m_input;
+	long						m_width;
+	long						m_height;
+	double						m_frameRate;
+	int							m_realtimePriority;
+	std::vector<IDeckLinkVideoInputFrame*>	m_frames;
+	pthread_t					m_thread;
+	bool						m_started;
+	std::atomic<bool>			m_running;
+};
+
+#endif
@@ -0,0 +1,334 @@
+//
+//  ConvertBench.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Times the app's capture format conversions on one thread at PAL and 1080 frame
+//  sizes. UYVY -> ARGB is run through the lookup tables DecklinkCallback used to build,
+//  the plain C fixed point version and the SIMD kernel picked for this CPU. The v210
+//  unpack and 8 bit downconvert are run as plain C and as the picked kernels,
+//  and the whole v210 -> ARGB preview path once. Every kernel's output is checked
+//  against the plain C one (odd widths included) before anything is timed.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "YuvConverter.h"
+#include "V210.h"
+
+struct FrameSize
+{
+	const char*		name;
+	int				width;
+	int				height;
+};
+
+static const FrameSize kFrameSizes[] =
+{
+	{ "PAL",	720,	576 },
+	{ "1080",	1920,	1080 }
+};
+
+static uint64_t NowNanos()
+{
+	struct timespec		now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Video range noise, the same every run
+static void FillNoise(uint8_t* bytes, size_t size)
+{
+	uint32_t	state = 12345;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		state = state * 1664525 + 1013904223;
+		bytes[i] = 16 + (state >> 24) % 220;
+	}
+}
+
+// The 16 MB tables and per-pixel loop DecklinkCallback used before the fixed point
+// kernels, kept here as the baseline
+class LookupConverter
+{
+public:
+	LookupConverter() : red(256 * 256), blue(256 * 256), green(256 * 256 * 256)
+	{
+		for (int v = 0; v < 256; v++)
+			for (int y = 0; y < 256; y++)
+				red[v * 256 + y] = Clamp(((y << 8) + (v - 128) * 359) >> 8);
+
+		for (int u = 0; u < 256; u++)
+			for (int y = 0; y < 256; y++)
+				blue[u * 256 + y] = Clamp(((y << 8) + (u - 128) * 454) >> 8);
+
+		for (int u = 0; u < 256; u++)
+			for (int v = 0; v < 256; v++)
+				for (int y = 0; y < 256; y++)
+					green[(u * 256 + v) * 256 + y] = Clamp(((y << 8) - ((u - 128) * 88 + (v - 128) * 183)) >> 8);
+	}
+
+	void ConvertRow(const uint8_t* uyvy, uint8_t* argb, int width)
+	{
+		for (int i = 0; i + 1 < width; i += 2, uyvy += 4, argb += 8)
+		{
+			const uint8_t*	r = &red[uyvy[2] * 256];
+			const uint8_t*	g = &green[(uyvy[0] * 256 + uyvy[2]) * 256];
+			const uint8_t*	b = &blue[uyvy[0] * 256];
+
+			argb[0] = 255;
+			argb[1] = r[uyvy[1]];
+			argb[2] = g[uyvy[1]];
+			argb[3] = b[uyvy[1]];
+			argb[4] = 255;
+			argb[5] = r[uyvy[3]];
+			argb[6] = g[uyvy[3]];
+			argb[7] = b[uyvy[3]];
+		}
+	}
+
+private:
+	static uint8_t Clamp(int value)
+	{
+		return value > 255 ? 255 : (value < 0 ? 0 : value);
+	}
+
+	std::vector<uint8_t>	red;
+	std::vector<uint8_t>	blue;
+	std::vector<uint8_t>	green;
+};
+
+static LookupConverter*		gLookupConverter = NULL;
+
+static void LookupRow(const uint8_t* uyvy, uint8_t* argb, int width)
+{
+	gLookupConverter->ConvertRow(uyvy, argb, width);
+}
+
+// Runs `convertFrame` `iterations` times, prints ms per frame and MB/s of the frame's
+// `inputBytes`
+template <typename ConvertFrame>
+static void TimeFrames(const char* name, int iterations, size_t inputBytes, ConvertFrame convertFrame)
+{
+	// One untimed pass so the tables and buffers are faulted in
+	convertFrame();
+
+	uint64_t	start = NowNanos();
+	for (int i = 0; i < iterations; i++)
+		convertFrame();
+	uint64_t	elapsed = NowNanos() - start;
+
+	double		msPerFrame = elapsed / 1e6 / iterations;
+	double		megabytes = (double)inputBytes * iterations / 1e6;
+	printf("  %-14s %8.3f ms/frame %9.0f MB/s\n", name, msPerFrame, megabytes / (elapsed / 1e9));
+}
+
+static void TimeUyvyToArgb(const char* name, UyvyToArgbRowFunc convert, const FrameSize& size, int iterations, const uint8_t* uyvy, long uyvyRowBytes, uint8_t* argb, long argbRowBytes)
+{
+	TimeFrames(name, iterations, uyvyRowBytes * size.height, [&]() {
+		for (int row = 0; row < size.height; row++)
+			convert(uyvy + row * uyvyRowBytes, argb + row * argbRowBytes, size.width);
+	});
+}
+
+// Planar 16 bit rows, as the v210 unpack kernel writes them
+struct PlanarFrame
+{
+	PlanarFrame(const FrameSize& size) : width(size.width), chromaWidth((size.width + 1) / 2),
+		y((size_t)width * size.height), cb((size_t)chromaWidth * size.height), cr((size_t)chromaWidth * size.height)
+	{
+	}
+
+	uint16_t* Y(int row)	{ return &y[(size_t)row * width]; }
+	uint16_t* Cb(int row)	{ return &cb[(size_t)row * chromaWidth]; }
+	uint16_t* Cr(int row)	{ return &cr[(size_t)row * chromaWidth]; }
+
+	int						width;
+	int						chromaWidth;
+	std::vector<uint16_t>	y;
+	std::vector<uint16_t>	cb;
+	std::vector<uint16_t>	cr;
+};
+
+static void TimeV210(const char* name, V210UnpackRowFunc unpack, V210ToUyvyRowFunc toUyvy, const FrameSize& size, int iterations, uint8_t* v210, long v210RowBytes, PlanarFrame& planar, uint8_t* uyvy, long uyvyRowBytes)
+{
+	char	label[32];
+
+	snprintf(label, sizeof(label), "unpack %s", name);
+	TimeFrames(label, iterations, v210RowBytes * size.height, [&]() {
+		for (int row = 0; row < size.height; row++)
+			unpack(v210 + row * v210RowBytes, planar.Y(row), planar.Cb(row), planar.Cr(row), size.width);
+	});
+
+	snprintf(label, sizeof(label), "uyvy %s", name);
+	TimeFrames(label, iterations, v210RowBytes * size.height, [&]() {
+		for (int row = 0; row < size.height; row++)
+			toUyvy(v210 + row * v210RowBytes, uyvy + row * uyvyRowBytes, size.width, row);
+	});
+}
+
+// Kernel against plain C on widths around the SIMD block sizes, false on the first difference
+static bool CheckUyvyKernel(UyvyToArgbRowFunc kernel)
+{
+	std::vector<uint8_t>	in(2 * 1928 + 4);
+	std::vector<uint8_t>	expected(4 * 1928);
+	std::vector<uint8_t>	converted(4 * 1928);
+
+	FillNoise(&in[0], in.size());
+	for (int width = 1; width <= 1928; width++)
+	{
+		if (width > 70 && width != 719 && width != 720 && width < 1915)
+			continue;
+
+		memset(&expected[0], 0, expected.size());
+		memset(&converted[0], 0, converted.size());
+		UyvyToArgbRowScalar(&in[0], &expected[0], width);
+		kernel(&in[0], &converted[0], width);
+		if (memcmp(&expected[0], &converted[0], expected.size()) != 0)
+		{
+			fprintf(stderr, "%s differs from scalar at width %d\n", UyvyToArgbKernelName(), width);
+			return false;
+		}
+		if (expected[(width - 1) * 4] != 255)
+		{
+			fprintf(stderr, "last pixel not converted at width %d\n", width);
+			return false;
+		}
+	}
+	return true;
+}
+
+// v210 kernels against plain C on widths around the group and block sizes, false on
+// the first difference
+static bool CheckV210Kernels()
+{
+	const int				maxWidth = 1928;
+	long					v210RowBytes = V210RowBytes(maxWidth);
+	std::vector<uint8_t>	v210(v210RowBytes);
+	std::vector<uint16_t>	y[2], cb[2], cr[2];
+	std::vector<uint8_t>	uyvy[2];
+
+	for (int k = 0; k < 2; k++)
+	{
+		y[k].resize(maxWidth);
+		cb[k].resize(maxWidth / 2);
+		cr[k].resize(maxWidth / 2);
+		uyvy[k].resize(maxWidth * 2);
+	}
+
+	// Every sample in 10 bit range
+	FillNoise(&v210[0], v210.size());
+	for (long i = 3; i < v210RowBytes; i += 4)
+		v210[i] &= 0x3F;
+
+	for (int width = 1; width <= maxWidth; width++)
+	{
+		if (width > 100 && width != 719 && width != 720 && width < 1915)
+			continue;
+
+		for (int k = 0; k < 2; k++)
+		{
+			std::fill(y[k].begin(), y[k].end(), 0);
+			std::fill(cb[k].begin(), cb[k].end(), 0);
+			std::fill(cr[k].begin(), cr[k].end(), 0);
+			std::fill(uyvy[k].begin(), uyvy[k].end(), 0);
+		}
+
+		V210UnpackRowScalar(&v210[0], &y[0][0], &cb[0][0], &cr[0][0], width);
+		V210UnpackRowKernel()(&v210[0], &y[1][0], &cb[1][0], &cr[1][0], width);
+		V210ToUyvyRowScalar(&v210[0], &uyvy[0][0], width, width);
+		V210ToUyvyRowKernel()(&v210[0], &uyvy[1][0], width, width);
+
+		if (y[0] != y[1] || cb[0] != cb[1] || cr[0] != cr[1] || uyvy[0] != uyvy[1])
+		{
+			fprintf(stderr, "v210 %s differs from scalar at width %d\n", V210KernelName(), width);
+			return false;
+		}
+	}
+	return true;
+}
+
+int usage(int status)
+{
+	fprintf(stderr,
+		"Usage: ConvertBench [OPTIONS]\n"
+		"\n"
+		"    -n <frames>          Frames converted per measurement (default 200)\n"
+		"\n"
+		"Exits with 1 if a SIMD kernel's output differs from the plain C version.\n"
+	);
+
+	exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+	int			iterations = 200;
+	int			ch;
+
+	while ((ch = getopt(argc, argv, "?hn:")) != -1)
+	{
+		switch (ch)
+		{
+			case 'n':
+				iterations = atoi(optarg);
+				break;
+			case '?':
+			case 'h':
+				usage(0);
+		}
+	}
+
+	if (iterations < 1)
+		usage(1);
+
+	if (!CheckUyvyKernel(UyvyToArgbRowKernel()) || !CheckV210Kernels())
+		return 1;
+
+	LookupConverter		lookupConverter;
+	gLookupConverter = &lookupConverter;
+
+	for (size_t i = 0; i < sizeof(kFrameSizes) / sizeof(kFrameSizes[0]); i++)
+	{
+		const FrameSize&		size = kFrameSizes[i];
+		long					uyvyRowBytes = (long)size.width * 2;
+		long					argbRowBytes = (long)size.width * 4;
+		std::vector<uint8_t>	uyvy(uyvyRowBytes * size.height);
+		std::vector<uint8_t>	argb(argbRowBytes * size.height);
+
+		FillNoise(&uyvy[0], uyvy.size());
+
+		printf("UYVY -> ARGB %s %dx%d\n", size.name, size.width, size.height);
+		TimeUyvyToArgb("lut", LookupRow, size, iterations, &uyvy[0], uyvyRowBytes, &argb[0], argbRowBytes);
+		TimeUyvyToArgb("scalar", UyvyToArgbRowScalar, size, iterations, &uyvy[0], uyvyRowBytes, &argb[0], argbRowBytes);
+		if (UyvyToArgbRowKernel() != UyvyToArgbRowScalar)
+			TimeUyvyToArgb(UyvyToArgbKernelName(), UyvyToArgbRowKernel(), size, iterations, &uyvy[0], uyvyRowBytes, &argb[0], argbRowBytes);
+
+		long					v210RowBytes = V210RowBytes(size.width);
+		std::vector<uint8_t>	v210(v210RowBytes * size.height);
+		PlanarFrame				planar(size);
+
+		FillNoise(&v210[0], v210.size());
+		for (size_t k = 3; k < v210.size(); k += 4)
+			v210[k] &= 0x3F;
+
+		printf("v210 %s %dx%d\n", size.name, size.width, size.height);
+		TimeV210("scalar", V210UnpackRowScalar, V210ToUyvyRowScalar, size, iterations, &v210[0], v210RowBytes, planar, &uyvy[0], uyvyRowBytes);
+		if (strcmp(V210KernelName(), "scalar") != 0)
+			TimeV210(V210KernelName(), V210UnpackRowKernel(), V210ToUyvyRowKernel(), size, iterations, &v210[0], v210RowBytes, planar, &uyvy[0], uyvyRowBytes);
+		TimeFrames("argb", iterations, v210RowBytes * size.height, [&]() {
+			V210ToArgbRows(&v210[0], v210RowBytes, &argb[0], argbRowBytes, size.width, 0, size.height);
+		});
+	}
+
+	return 0;
+}
@@ -0,0 +1,386 @@
+//
+//  RecordingCheck.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  Reads the video track's sample table of a QuickTime/MP4 recording and reports how
+//  regular its frame times are: the nominal frame duration, frames missing from the
+//  cadence (gaps of whole frame durations), and durations that are not a whole number
+//  of frames or are zero, which a recording timed from the input's stream time should
+//  never have. Nothing but the moov atom is read, so it is quick on long takes.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+// A day at 120 fps, more samples than that is a corrupt table rather than a take
+static const uint64_t kMaxSamples = 24 * 60 * 60 * 120;
+
+struct Atom
+{
+	uint32_t		type;
+	const uint8_t*	data;		// payload, after the header
+	uint64_t		size;
+};
+
+struct VideoTrack
+{
+	uint32_t				timeScale;
+	std::vector<int64_t>	decodeTimes;
+	std::vector<int64_t>	presentationTimes;
+};
+
+static inline uint32_t FourCC(const char* code)
+{
+	return ((uint32_t)code[0] << 24) | ((uint32_t)code[1] << 16) | ((uint32_t)code[2] << 8) | (uint32_t)code[3];
+}
+
+static inline uint32_t ReadU32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t ReadU64(const uint8_t* p)
+{
+	return ((uint64_t)ReadU32(p) << 32) | ReadU32(p + 4);
+}
+
+// The child atoms of a container payload, false if one runs past the end
+static bool ChildAtoms(const uint8_t* data, uint64_t size, std::vector<Atom>& atoms)
+{
+	uint64_t	offset = 0;
+
+	while (offset + 8 <= size)
+	{
+		uint64_t	atomSize = ReadU32(data + offset);
+		uint32_t	type = ReadU32(data + offset + 4);
+		uint64_t	header = 8;
+
+		if (atomSize == 1)
+		{
+			if (offset + 16 > size)
+				return false;
+			atomSize = ReadU64(data + offset + 8);
+			header = 16;
+		}
+		else if (atomSize == 0)
+		{
+			atomSize = size - offset;
+		}
+		if (atomSize < header || offset + atomSize > size)
+			return false;
+
+		Atom atom = { type, data + offset + header, atomSize - header };
+		atoms.push_back(atom);
+		offset += atomSize;
+	}
+	return true;
+}
+
+static const Atom* FindAtom(const std::vector<Atom>& atoms, const char* type)
+{
+	for (size_t i = 0; i < atoms.size(); i++)
+	{
+		if (atoms[i].type == FourCC(type))
+			return &atoms[i];
+	}
+	return NULL;
+}
+
+// Follows a path of container atoms, eg. "mdia/minf/stbl"
+static bool FindPath(const Atom& root, const char* path, Atom& result)
+{
+	Atom		current = root;
+	const char*	p = path;
+
+	while (*p)
+	{
+		std::vector<Atom>	children;
+		if (!ChildAtoms(current.data, current.size, children))
+			return false;
+		const Atom* child = FindAtom(children, p);
+		if (!child)
+			return false;
+		current = *child;
+		p += 4;
+		if (*p == '/')
+			p++;
+	}
+	result = current;
+	return true;
+}
+
+// Decode times from stts and presentation times from ctts, if the track has one
+static bool ReadSampleTimes(const Atom& stbl, VideoTrack& track)
+{
+	std::vector<Atom>	children;
+	if (!ChildAtoms(stbl.data, stbl.size, children))
+		return false;
+
+	const Atom* stts = FindAtom(children, "stts");
+	if (!stts || stts->size < 8)
+		return false;
+
+	uint32_t	entries = ReadU32(stts->data + 4);
+	int64_t		time = 0;
+	if (8 + (uint64_t)entries * 8 > stts->size)
+		return false;
+
+	// Every sample has a size in stsz, so the counts in stts can not add up to more
+	uint64_t	maxSamples = kMaxSamples;
+	uint64_t	samples = 0;
+	const Atom* stsz = FindAtom(children, "stsz");
+	if (stsz && stsz->size >= 12)
+		maxSamples = std::min(maxSamples, (uint64_t)ReadU32(stsz->data + 8));
+	for (uint32_t i = 0; i < entries; i++)
+		samples += ReadU32(stts->data + 8 + i * 8);
+	if (samples > maxSamples)
+		return false;
+
+	track.decodeTimes.reserve(samples);
+	for (uint32_t i = 0; i < entries; i++)
+	{
+		uint32_t	count = ReadU32(stts->data + 8 + i * 8);
+		uint32_t	delta = ReadU32(stts->data + 12 + i * 8);
+		for (uint32_t j = 0; j < count; j++)
+		{
+			track.decodeTimes.push_back(time);
+			time += delta;
+		}
+	}
+
+	track.presentationTimes = track.decodeTimes;
+	const Atom* ctts = FindAtom(children, "ctts");
+	if (ctts && ctts->size >= 8)
+	{
+		uint8_t		version = ctts->data[0];
+		size_t		sample = 0;
+		entries = ReadU32(ctts->data + 4);
+		if (8 + (uint64_t)entries * 8 > ctts->size)
+			return false;
+		for (uint32_t i = 0; i < entries; i++)
+		{
+			uint32_t	count = ReadU32(ctts->data + 8 + i * 8);
+			uint32_t	raw = ReadU32(ctts->data + 12 + i * 8);
+			int64_t		offset = version == 0 ? (int64_t)raw : (int64_t)(int32_t)raw;
+			for (uint32_t j = 0; j < count && sample < track.presentationTimes.size(); j++, sample++)
+				track.presentationTimes[sample] += offset;
+		}
+	}
+	return true;
+}
+
+static bool ReadVideoTrack(const std::vector<uint8_t>& moov, VideoTrack& track)
+{
+	std::vector<Atom>	traks;
+	if (!ChildAtoms(moov.data(), moov.size(), traks))
+		return false;
+
+	for (size_t i = 0; i < traks.size(); i++)
+	{
+		Atom	hdlr, mdhd, stbl;
+
+		if (traks[i].type != FourCC("trak"))
+			continue;
+		if (!FindPath(traks[i], "mdia/hdlr", hdlr) || hdlr.size < 12 || ReadU32(hdlr.data + 8) != FourCC("vide"))
+			continue;
+		if (!FindPath(traks[i], "mdia/mdhd", mdhd) || mdhd.size < 24)
+			return false;
+		// Version 1 has 64 bit creation and modification times before the time scale
+		track.timeScale = ReadU32(mdhd.data + (mdhd.data[0] == 1 ? 20 : 12));
+		if (!FindPath(traks[i], "mdia/minf/stbl", stbl))
+			return false;
+		return ReadSampleTimes(stbl, track);
+	}
+	return false;
+}
+
+// The moov atom's payload, wherever in the file it is
+static bool ReadMovieAtom(FILE* file, std::vector<uint8_t>& moov)
+{
+	uint8_t		header[16];
+	off_t		offset = 0;
+	off_t		fileSize;
+
+	if (fseeko(file, 0, SEEK_END) != 0 || (fileSize = ftello(file)) < 0)
+		return false;
+
+	while (fseeko(file, offset, SEEK_SET) == 0 && fread(header, 1, 8, file) == 8)
+	{
+		uint64_t	size = ReadU32(header);
+		uint64_t	headerSize = 8;
+
+		if (size == 1)
+		{
+			if (fread(header + 8, 1, 8, file) != 8)
+				return false;
+			size = ReadU64(header + 8);
+			headerSize = 16;
+		}
+		if (size == 0)
+			size = fileSize - offset;
+		// A size past the end of the file is a corrupt or truncated movie
+		if (size < headerSize || size > (uint64_t)(fileSize - offset))
+			return false;
+
+		if (ReadU32(header + 4) == FourCC("moov"))
+		{
+			moov.resize(size - headerSize);
+			return fread(moov.data(), 1, moov.size(), file) == moov.size();
+		}
+		offset += size;
+	}
+	return false;
+}
+
+int usage(int status)
+{
+	fprintf(stderr,
+		"Usage: RecordingCheck [OPTIONS] <movie> [<movie> ...]\n"
+		"\n"
+		"    -v                   List every gap and irregular frame duration\n"
+		"    -d <duration>        Expected frame duration in the track's time scale\n"
+		"                         (default is the most common one)\n"
+		"\n"
+		"Exits with 1 if any movie has irregular or zero frame durations, 2 if one can not\n"
+		"be read. Gaps of whole frames are reported but are not errors, they are frames the\n"
+		"input dropped.\n"
+	);
+
+	exit(status);
+}
+
+// Prints the report for one movie, returns the exit status for it
+static int CheckMovie(const char* path, bool verbose, int64_t expectedDuration)
+{
+	FILE*					file = fopen(path, "rb");
+	std::vector<uint8_t>	moov;
+	VideoTrack				track;
+
+	track.timeScale = 0;
+	if (!file)
+	{
+		fprintf(stderr, "%s: could not open\n", path);
+		return 2;
+	}
+	bool ok = ReadMovieAtom(file, moov) && ReadVideoTrack(moov, track);
+	fclose(file);
+	if (!ok || track.timeScale == 0)
+	{
+		fprintf(stderr, "%s: no readable video track\n", path);
+		return 2;
+	}
+
+	std::vector<int64_t>	times = track.presentationTimes;
+	std::sort(times.begin(), times.end());
+
+	if (times.size() < 2)
+	{
+		printf("%s: %zu frames, nothing to check\n", path, times.size());
+		return 0;
+	}
+
+	std::map<int64_t, uint64_t>	histogram;
+	for (size_t i = 1; i < times.size(); i++)
+		histogram[times[i] - times[i - 1]]++;
+
+	int64_t		nominal = expectedDuration;
+	if (nominal <= 0)
+	{
+		uint64_t	mostCommon = 0;
+		for (std::map<int64_t, uint64_t>::iterator it = histogram.begin(); it != histogram.end(); ++it)
+		{
+			if (it->first > 0 && it->second > mostCommon)
+			{
+				nominal = it->first;
+				mostCommon = it->second;
+			}
+		}
+	}
+	if (nominal <= 0)
+	{
+		fprintf(stderr, "%s: all frames have the same time\n", path);
+		return 1;
+	}
+
+	uint64_t	regular = 0, gaps = 0, missing = 0, irregular = 0, duplicates = 0;
+	for (size_t i = 1; i < times.size(); i++)
+	{
+		int64_t		delta = times[i] - times[i - 1];
+		double		at = (double)times[i - 1] / track.timeScale;
+
+		if (delta == nominal)
+		{
+			regular++;
+		}
+		else if (delta == 0)
+		{
+			duplicates++;
+			if (verbose)
+				printf("  %10.3f s  frame %zu has the same time as the one before\n", at, i);
+		}
+		else if (delta % nominal == 0)
+		{
+			gaps++;
+			missing += delta / nominal - 1;
+			if (verbose)
+				printf("  %10.3f s  gap of %lld frames\n", at, (long long)(delta / nominal - 1));
+		}
+		else
+		{
+			irregular++;
+			if (verbose)
+				printf("  %10.3f s  frame %zu lasts %lld, %.2f frames\n", at, i - 1, (long long)delta, (double)delta / nominal);
+		}
+	}
+
+	double		seconds = (double)(times.back() - times.front() + nominal) / track.timeScale;
+	printf("%s: %zu frames, %.2f s, time scale %u, frame duration %lld (%.3f fps)\n",
+		path, times.size(), seconds, track.timeScale, (long long)nominal, (double)track.timeScale / nominal);
+	printf("    regular %llu  gaps %llu (%llu frames missing)  irregular %llu  duplicate %llu  -> %s\n",
+		(unsigned long long)regular, (unsigned long long)gaps, (unsigned long long)missing,
+		(unsigned long long)irregular, (unsigned long long)duplicates,
+		irregular || duplicates ? "IRREGULAR" : (gaps ? "regular with gaps" : "regular"));
+
+	return irregular || duplicates ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	bool		verbose = false;
+	int64_t		expectedDuration = 0;
+	int			exitStatus = 0;
+	int			ch;
+
+	while ((ch = getopt(argc, argv, "?hvd:")) != -1)
+	{
+		switch (ch)
+		{
+			case 'v':
+				verbose = true;
+				break;
+			case 'd':
+				expectedDuration = atoll(optarg);
+				break;
+			case '?':
+			case 'h':
+				usage(0);
+		}
+	}
+
+	if (optind >= argc)
+		usage(1);
+
+	for (int i = optind; i < argc; i++)
+		exitStatus = std::max(exitStatus, CheckMovie(argv[i], verbose, expectedDuration));
+
+	return exitStatus;
+}
@@ -31,6 +31,10 @@
 
 #include "DeckLinkAPI.h"
 
+#ifdef DECKLINK_EMULATOR
+#include "DeckLinkEmulator.h"
+#endif
+
 #define kDeckLinkAPI_Name "libDeckLinkAPI.so"
 #define KDeckLinkPreviewAPI_Name "libDeckLinkPreviewAPI.so"
 
@@ -53,10 +57,22 @@ void	InitDeckLinkAPI (void)
 {
 	void *libraryHandle;
 	
+#ifdef DECKLINK_EMULATOR
+	if (IsDeckLinkEmulatorForced())
+	{
+		gCreateIteratorFunc = CreateDeckLinkEmulatorIteratorInstance;
+		return;
+	}
+#endif
+	
 	libraryHandle = dlopen(kDeckLinkAPI_Name, RTLD_NOW|RTLD_GLOBAL);
 	if (!libraryHandle)
 	{
 		fprintf(stderr, "%s\n", dlerror());
+#ifdef DECKLINK_EMULATOR
+		// No driver installed, run against emulated devices instead
+		gCreateIteratorFunc = CreateDeckLinkEmulatorIteratorInstance;
+#endif
 		return;
 	}
 	
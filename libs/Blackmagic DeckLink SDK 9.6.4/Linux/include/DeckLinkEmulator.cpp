@@ -0,0 +1,1967 @@
+//
+//  DeckLinkEmulator.cpp
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+
+#include "DeckLinkEmulator.h"
+
+// Input buffers per device, when the application holds on to all of them frames are dropped
+static const unsigned	kInputFrameCount = 8;
+
+// Audio the output accepts ahead of playback, in sample frames
+static const uint32_t	kAudioOutputCapacity = 48000 * 2;
+
+//
+// Configuration
+//
+
+struct EmulatorConfig
+{
+	bool		forced;
+	int			devices;
+	uint64_t	jitterNanos;
+	uint64_t	signalLossEvery;
+	uint64_t	signalLossFrames;
+	uint64_t	formatChangeFrames;
+};
+
+static EmulatorConfig		g_config;
+static pthread_once_t		g_configOnce = PTHREAD_ONCE_INIT;
+
+static void LoadConfig(void)
+{
+	const char* value;
+
+	memset(&g_config, 0, sizeof(g_config));
+	g_config.devices = 1;
+
+	if ((value = getenv("DECKLINK_EMULATOR")) != NULL && *value)
+	{
+		g_config.forced = true;
+		if (atoi(value) > 0)
+			g_config.devices = atoi(value);
+	}
+
+	if ((value = getenv("DECKLINK_EMULATOR_JITTER")) != NULL)
+		g_config.jitterNanos = strtoull(value, NULL, 10) * 1000;
+
+	if ((value = getenv("DECKLINK_EMULATOR_SIGNAL_LOSS")) != NULL)
+	{
+		unsigned long long every = 0, count = 0;
+		if (sscanf(value, "%llu:%llu", &every, &count) == 2 && every > 0 && count <= every)
+		{
+			g_config.signalLossEvery = every;
+			g_config.signalLossFrames = count;
+		}
+		else
+			fprintf(stderr, "DECKLINK_EMULATOR_SIGNAL_LOSS should be <every>:<count>, ignoring \"%s\"\n", value);
+	}
+
+	if ((value = getenv("DECKLINK_EMULATOR_FORMAT_CHANGE")) != NULL)
+		g_config.formatChangeFrames = strtoull(value, NULL, 10);
+}
+
+bool IsDeckLinkEmulatorForced(void)
+{
+	pthread_once(&g_configOnce, LoadConfig);
+	return g_config.forced;
+}
+
+//
+// Helpers
+//
+
+static bool IsIID(REFIID a, REFIID b)
+{
+	return memcmp(&a, &b, sizeof(REFIID)) == 0;
+}
+
+static uint64_t MonotonicNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void SleepUntil(uint64_t nanos)
+{
+	struct timespec ts;
+	ts.tv_sec = nanos / 1000000000ULL;
+	ts.tv_nsec = nanos % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+// Both split into seconds first so long uptimes and fine time scales do not overflow
+static uint64_t TicksToNanos(uint64_t ticks, BMDTimeScale timeScale)
+{
+	return (ticks / timeScale) * 1000000000ULL + (ticks % timeScale) * 1000000000ULL / timeScale;
+}
+
+static BMDTimeValue NanosToTicks(uint64_t nanos, BMDTimeScale timeScale)
+{
+	return (nanos / 1000000000ULL) * timeScale + (nanos % 1000000000ULL) * timeScale / 1000000000ULL;
+}
+
+// Audio sample frames in the first `frames` video frames, so the per frame counts
+// alternate for rates like 29.97 but never drift
+static uint64_t AudioSamplesBefore(uint64_t frames, BMDTimeValue frameDuration, BMDTimeScale timeScale)
+{
+	return frames * frameDuration * 48000 / timeScale;
+}
+
+//
+// Display modes
+//
+
+struct EmulatorMode
+{
+	BMDDisplayMode		mode;
+	const char*			name;
+	long				width;
+	long				height;
+	BMDTimeValue		frameDuration;
+	BMDTimeScale		timeScale;
+	BMDFieldDominance	fieldDominance;
+};
+
+// In the order an Intensity lists them, TestPattern picks index 6
+static const EmulatorMode	kModes[] =
+{
+	{ bmdModeNTSC,			"NTSC",				720,	486,	1001,	30000,	bmdLowerFieldFirst },
+	{ bmdModeNTSC2398,		"NTSC 23.98",		720,	486,	1001,	24000,	bmdLowerFieldFirst },
+	{ bmdModePAL,			"PAL",				720,	576,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080p2398,	"HD 1080p 23.98",	1920,	1080,	1001,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p24,		"HD 1080p 24",		1920,	1080,	1000,	24000,	bmdProgressiveFrame },
+	{ bmdModeHD1080i50,		"HD 1080i 50",		1920,	1080,	1000,	25000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080i5994,	"HD 1080i 59.94",	1920,	1080,	1001,	30000,	bmdUpperFieldFirst },
+	{ bmdModeHD1080p25,		"HD 1080p 25",		1920,	1080,	1000,	25000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p2997,	"HD 1080p 29.97",	1920,	1080,	1001,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD1080p30,		"HD 1080p 30",		1920,	1080,	1000,	30000,	bmdProgressiveFrame },
+	{ bmdModeHD720p50,		"HD 720p 50",		1280,	720,	1000,	50000,	bmdProgressiveFrame },
+	{ bmdModeHD720p5994,	"HD 720p 59.94",	1280,	720,	1001,	60000,	bmdProgressiveFrame },
+	{ bmdModeHD720p60,		"HD 720p 60",		1280,	720,	1000,	60000,	bmdProgressiveFrame },
+};
+
+static const int	kModeCount = sizeof(kModes) / sizeof(kModes[0]);
+
+static const EmulatorMode* FindMode(BMDDisplayMode mode)
+{
+	for (int i = 0; i < kModeCount; i++)
+	{
+		if (kModes[i].mode == mode)
+			return &kModes[i];
+	}
+	return NULL;
+}
+
+static const EmulatorMode* NextMode(const EmulatorMode* mode)
+{
+	return &kModes[(mode - kModes + 1) % kModeCount];
+}
+
+class EmulatorDisplayMode : public IDeckLinkDisplayMode
+{
+public:
+	EmulatorDisplayMode(const EmulatorMode* mode) : m_refCount(1), m_mode(mode) {}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	// Like the driver the caller owns the returned string
+	virtual HRESULT GetName(const char **name) { *name = strdup(m_mode->name); return S_OK; }
+	virtual BMDDisplayMode GetDisplayMode(void) { return m_mode->mode; }
+	virtual long GetWidth(void) { return m_mode->width; }
+	virtual long GetHeight(void) { return m_mode->height; }
+	virtual HRESULT GetFrameRate(BMDTimeValue *frameDuration, BMDTimeScale *timeScale)
+	{
+		*frameDuration = m_mode->frameDuration;
+		*timeScale = m_mode->timeScale;
+		return S_OK;
+	}
+	virtual BMDFieldDominance GetFieldDominance(void) { return m_mode->fieldDominance; }
+	virtual BMDDisplayModeFlags GetFlags(void) { return m_mode->height > 576 ? bmdDisplayModeColorspaceRec709 : bmdDisplayModeColorspaceRec601; }
+
+private:
+	ULONG					m_refCount;
+	const EmulatorMode*		m_mode;
+};
+
+class EmulatorDisplayModeIterator : public IDeckLinkDisplayModeIterator
+{
+public:
+	EmulatorDisplayModeIterator() : m_refCount(1), m_index(0) {}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual HRESULT Next(IDeckLinkDisplayMode **displayMode)
+	{
+		if (m_index >= kModeCount)
+		{
+			*displayMode = NULL;
+			return S_FALSE;
+		}
+		*displayMode = new EmulatorDisplayMode(&kModes[m_index++]);
+		return S_OK;
+	}
+
+private:
+	ULONG		m_refCount;
+	int			m_index;
+};
+
+//
+// Pixel formats and test pattern
+//
+
+static bool IsSupportedFormat(BMDPixelFormat pixelFormat)
+{
+	return pixelFormat == bmdFormat8BitYUV || pixelFormat == bmdFormat10BitYUV ||
+		pixelFormat == bmdFormat8BitARGB || pixelFormat == bmdFormat8BitBGRA || pixelFormat == bmdFormat10BitRGB;
+}
+
+static long RowBytesForFormat(BMDPixelFormat pixelFormat, long width)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		return width * 2;
+		case bmdFormat10BitYUV:		return ((width + 47) / 48) * 128;
+		case bmdFormat10BitRGB:		return ((width + 63) / 64) * 256;
+		default:					return width * 4;
+	}
+}
+
+// Smallest run of pixels that starts on a byte boundary, used to move the marker
+static void PixelGroup(BMDPixelFormat pixelFormat, long *pixels, long *bytes)
+{
+	switch (pixelFormat)
+	{
+		case bmdFormat8BitYUV:		*pixels = 2; *bytes = 4; break;
+		case bmdFormat10BitYUV:		*pixels = 6; *bytes = 16; break;
+		default:					*pixels = 1; *bytes = 4; break;
+	}
+}
+
+// The colour bars of the TestPattern sample, as Cb Y Cr Y words, and the same bars in RGB
+static const uint32_t		kBarsUYVY[8] = { 0xEA80EA80, 0xD292D210, 0xA910A9A5, 0x90229035, 0x6ADD6ACA, 0x51EF515A, 0x286D28EF, 0x10801080 };
+static const unsigned char	kBarsRGB[8][3] = { {255,255,255}, {255,255,0}, {0,255,255}, {0,255,0}, {255,0,255}, {255,0,0}, {0,0,255}, {0,0,0} };
+static const int			kBlackBar = 7;
+
+static void RenderPatternRow(unsigned char* row, long width, long rowBytes, BMDPixelFormat pixelFormat, bool bars)
+{
+	long		paddedWidth = width;
+	if (pixelFormat == bmdFormat10BitYUV)
+		paddedWidth = rowBytes / 16 * 6;
+	else if (pixelFormat == bmdFormat10BitRGB)
+		paddedWidth = rowBytes / 4;
+
+	std::vector<uint32_t>	components;
+
+	for (long x = 0; x < paddedWidth; x++)
+	{
+		int				bar = (bars && x < width) ? (int)(x * 8 / width) : kBlackBar;
+		uint32_t		word = kBarsUYVY[bar];
+		unsigned		cb = word & 0xFF, y = (word >> 8) & 0xFF, cr = (word >> 16) & 0xFF;
+		const unsigned char*	rgb = kBarsRGB[bar];
+
+		switch (pixelFormat)
+		{
+			case bmdFormat8BitYUV:
+				if ((x & 1) == 0)
+					row[x * 2] = cb;
+				else
+					row[x * 2] = cr;
+				row[x * 2 + 1] = y;
+				break;
+
+			case bmdFormat10BitYUV:
+				// Same component order as 2vuy, three to a 32 bit word
+				if ((x & 1) == 0)
+					components.push_back(cb << 2);
+				components.push_back(y << 2);
+				if ((x & 1) == 0)
+					components.push_back(cr << 2);
+				break;
+
+			case bmdFormat8BitARGB:
+				row[x * 4 + 0] = 255;
+				row[x * 4 + 1] = rgb[0];
+				row[x * 4 + 2] = rgb[1];
+				row[x * 4 + 3] = rgb[2];
+				break;
+
+			case bmdFormat8BitBGRA:
+				row[x * 4 + 0] = rgb[2];
+				row[x * 4 + 1] = rgb[1];
+				row[x * 4 + 2] = rgb[0];
+				row[x * 4 + 3] = 255;
+				break;
+
+			case bmdFormat10BitRGB:
+			{
+				uint32_t r = 64 + rgb[0] * 876 / 255, g = 64 + rgb[1] * 876 / 255, b = 64 + rgb[2] * 876 / 255;
+				uint32_t packed = (r << 20) | (g << 10) | b;
+				row[x * 4 + 0] = packed >> 24;
+				row[x * 4 + 1] = packed >> 16;
+				row[x * 4 + 2] = packed >> 8;
+				row[x * 4 + 3] = packed;
+				break;
+			}
+		}
+	}
+
+	if (pixelFormat == bmdFormat10BitYUV)
+	{
+		uint32_t* words = (uint32_t*)row;
+		for (size_t i = 0; i + 2 < components.size(); i += 3)
+			words[i / 3] = components[i] | (components[i + 1] << 10) | (components[i + 2] << 20);
+	}
+}
+
+static void RenderPattern(void* bytes, long width, long height, long rowBytes, BMDPixelFormat pixelFormat, bool bars)
+{
+	memset(bytes, 0, rowBytes * height);
+	RenderPatternRow((unsigned char*)bytes, width, rowBytes, pixelFormat, bars);
+	for (long y = 1; y < height; y++)
+		memcpy((char*)bytes + y * rowBytes, bytes, rowBytes);
+}
+
+//
+// Frames
+//
+
+class EmulatorVideoFrame : public IDeckLinkMutableVideoFrame
+{
+public:
+	EmulatorVideoFrame(long width, long height, long rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags) :
+		m_refCount(1), m_width(width), m_height(height), m_rowBytes(rowBytes), m_pixelFormat(pixelFormat), m_flags(flags)
+	{
+		if (posix_memalign(&m_bytes, 64, rowBytes * height) != 0)
+			m_bytes = NULL;
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual long GetWidth(void) { return m_width; }
+	virtual long GetHeight(void) { return m_height; }
+	virtual long GetRowBytes(void) { return m_rowBytes; }
+	virtual BMDPixelFormat GetPixelFormat(void) { return m_pixelFormat; }
+	virtual BMDFrameFlags GetFlags(void) { return m_flags; }
+	virtual HRESULT GetBytes(void **buffer) { *buffer = m_bytes; return S_OK; }
+	virtual HRESULT GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode) { *timecode = NULL; return S_FALSE; }
+	virtual HRESULT GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary) { *ancillary = NULL; return S_FALSE; }
+
+	virtual HRESULT SetFlags(BMDFrameFlags newFlags) { m_flags = newFlags; return S_OK; }
+	virtual HRESULT SetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode *timecode) { return E_NOTIMPL; }
+	virtual HRESULT SetTimecodeFromComponents(BMDTimecodeFormat format, uint8_t hours, uint8_t minutes, uint8_t seconds, uint8_t frames, BMDTimecodeFlags flags) { return E_NOTIMPL; }
+	virtual HRESULT SetAncillaryData(IDeckLinkVideoFrameAncillary *ancillary) { return E_NOTIMPL; }
+	virtual HRESULT SetTimecodeUserBits(BMDTimecodeFormat format, BMDTimecodeUserBits userBits) { return E_NOTIMPL; }
+
+	bool IsValid() { return m_bytes != NULL; }
+
+private:
+	~EmulatorVideoFrame() { free(m_bytes); }
+
+	ULONG				m_refCount;
+	long				m_width;
+	long				m_height;
+	long				m_rowBytes;
+	BMDPixelFormat		m_pixelFormat;
+	BMDFrameFlags		m_flags;
+	void*				m_bytes;
+};
+
+class EmulatorFramePool;
+
+class EmulatorInputFrame : public IDeckLinkVideoInputFrame
+{
+public:
+	EmulatorInputFrame(EmulatorFramePool* pool, unsigned generation, IDeckLinkMemoryAllocator* allocator, long width, long height, long rowBytes, BMDPixelFormat pixelFormat) :
+		m_refCount(1), m_pool(pool), m_generation(generation), m_allocator(allocator),
+		m_width(width), m_height(height), m_rowBytes(rowBytes), m_pixelFormat(pixelFormat), m_flags(bmdFrameFlagDefault),
+		m_streamTime(0), m_streamDuration(0), m_timeScale(1), m_hardwareNanos(0), m_hardwareDurationNanos(0)
+	{
+		// Buffers come from the application's allocator when it installed one, like on the card
+		if (m_allocator)
+		{
+			m_allocator->AddRef();
+			if (m_allocator->AllocateBuffer(rowBytes * height, &m_bytes) != S_OK)
+				m_bytes = NULL;
+		}
+		else if (posix_memalign(&m_bytes, 64, rowBytes * height) != 0)
+			m_bytes = NULL;
+	}
+
+	~EmulatorInputFrame()
+	{
+		if (m_allocator)
+		{
+			if (m_bytes)
+				m_allocator->ReleaseBuffer(m_bytes);
+			m_allocator->Release();
+		}
+		else
+			free(m_bytes);
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void);
+
+	virtual long GetWidth(void) { return m_width; }
+	virtual long GetHeight(void) { return m_height; }
+	virtual long GetRowBytes(void) { return m_rowBytes; }
+	virtual BMDPixelFormat GetPixelFormat(void) { return m_pixelFormat; }
+	virtual BMDFrameFlags GetFlags(void) { return m_flags; }
+	virtual HRESULT GetBytes(void **buffer) { *buffer = m_bytes; return S_OK; }
+	virtual HRESULT GetTimecode(BMDTimecodeFormat format, IDeckLinkTimecode **timecode) { *timecode = NULL; return S_FALSE; }
+	virtual HRESULT GetAncillaryData(IDeckLinkVideoFrameAncillary **ancillary) { *ancillary = NULL; return S_FALSE; }
+
+	virtual HRESULT GetStreamTime(BMDTimeValue *frameTime, BMDTimeValue *frameDuration, BMDTimeScale timeScale)
+	{
+		*frameTime = m_streamTime * timeScale / m_timeScale;
+		*frameDuration = m_streamDuration * timeScale / m_timeScale;
+		return S_OK;
+	}
+
+	virtual HRESULT GetHardwareReferenceTimestamp(BMDTimeScale timeScale, BMDTimeValue *frameTime, BMDTimeValue *frameDuration)
+	{
+		*frameTime = NanosToTicks(m_hardwareNanos, timeScale);
+		*frameDuration = NanosToTicks(m_hardwareDurationNanos, timeScale);
+		return S_OK;
+	}
+
+	void*					m_bytes;
+	ULONG					m_refCount;
+	EmulatorFramePool*		m_pool;
+	unsigned				m_generation;
+	IDeckLinkMemoryAllocator*	m_allocator;
+	long					m_width;
+	long					m_height;
+	long					m_rowBytes;
+	BMDPixelFormat			m_pixelFormat;
+	BMDFrameFlags			m_flags;
+	BMDTimeValue			m_streamTime;
+	BMDTimeValue			m_streamDuration;
+	BMDTimeScale			m_timeScale;
+	uint64_t				m_hardwareNanos;
+	uint64_t				m_hardwareDurationNanos;
+};
+
+// The fixed set of capture buffers of one input. Released frames come back here from
+// any thread, frames of an older format are freed instead of reused.
+class EmulatorFramePool
+{
+public:
+	EmulatorFramePool() : m_refCount(1), m_allocator(NULL), m_generation(0), m_allocated(0), m_width(0), m_height(0), m_rowBytes(0), m_pixelFormat(0)
+	{
+		pthread_mutex_init(&m_mutex, NULL);
+	}
+
+	void AddRef() { __sync_add_and_fetch(&m_refCount, 1); }
+	void Release()
+	{
+		if (__sync_sub_and_fetch(&m_refCount, 1) == 0)
+			delete this;
+	}
+
+	void Configure(long width, long height, long rowBytes, BMDPixelFormat pixelFormat)
+	{
+		pthread_mutex_lock(&m_mutex);
+			m_width = width;
+			m_height = height;
+			m_rowBytes = rowBytes;
+			m_pixelFormat = pixelFormat;
+			Discard();
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	// Frames still held by the application go back to the allocator they came from
+	void SetAllocator(IDeckLinkMemoryAllocator* allocator)
+	{
+		if (allocator)
+			allocator->AddRef();
+
+		pthread_mutex_lock(&m_mutex);
+			IDeckLinkMemoryAllocator* previous = m_allocator;
+			m_allocator = allocator;
+			Discard();
+		pthread_mutex_unlock(&m_mutex);
+
+		if (previous)
+			previous->Release();
+	}
+
+	// NULL when all buffers are held by the application
+	EmulatorInputFrame* Get()
+	{
+		EmulatorInputFrame* frame = NULL;
+
+		pthread_mutex_lock(&m_mutex);
+			if (!m_free.empty())
+			{
+				frame = m_free.back();
+				m_free.pop_back();
+			}
+			else if (m_allocated < kInputFrameCount && m_width > 0)
+			{
+				frame = new EmulatorInputFrame(this, m_generation, m_allocator, m_width, m_height, m_rowBytes, m_pixelFormat);
+				if (frame->m_bytes)
+					m_allocated++;
+				else
+				{
+					delete frame;
+					frame = NULL;
+				}
+			}
+		pthread_mutex_unlock(&m_mutex);
+
+		if (frame)
+		{
+			frame->m_refCount = 1;
+			AddRef();
+		}
+		return frame;
+	}
+
+	void Return(EmulatorInputFrame* frame)
+	{
+		pthread_mutex_lock(&m_mutex);
+			if (frame->m_generation == m_generation)
+				m_free.push_back(frame);
+			else
+				delete frame;
+		pthread_mutex_unlock(&m_mutex);
+
+		Release();
+	}
+
+private:
+	~EmulatorFramePool()
+	{
+		for (size_t i = 0; i < m_free.size(); i++)
+			delete m_free[i];
+		if (m_allocator)
+			m_allocator->Release();
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	// Called with m_mutex held, frames of the previous generation are freed on return
+	void Discard()
+	{
+		m_generation++;
+		m_allocated = 0;
+		for (size_t i = 0; i < m_free.size(); i++)
+			delete m_free[i];
+		m_free.clear();
+	}
+
+	ULONG								m_refCount;
+	pthread_mutex_t						m_mutex;
+	std::vector<EmulatorInputFrame*>	m_free;
+	IDeckLinkMemoryAllocator*			m_allocator;
+	unsigned							m_generation;
+	unsigned							m_allocated;
+	long								m_width;
+	long								m_height;
+	long								m_rowBytes;
+	BMDPixelFormat						m_pixelFormat;
+};
+
+ULONG EmulatorInputFrame::Release(void)
+{
+	ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+	if (count == 0)
+		m_pool->Return(this);
+	return count;
+}
+
+class EmulatorAudioPacket : public IDeckLinkAudioInputPacket
+{
+public:
+	EmulatorAudioPacket(long sampleFrames, uint32_t channels, uint32_t sampleDepth, uint64_t firstSample) :
+		m_refCount(1), m_sampleFrames(sampleFrames), m_firstSample(firstSample)
+	{
+		m_bytes = malloc(sampleFrames * channels * sampleDepth / 8);
+		if (!m_bytes)
+			return;
+
+		// 1 kHz tone, continuous across packets
+		for (long i = 0; i < sampleFrames; i++)
+		{
+			double value = sin((firstSample + i) * 2.0 * M_PI / 48.0) * 0.5;
+			for (uint32_t ch = 0; ch < channels; ch++)
+			{
+				if (sampleDepth == 16)
+					((int16_t*)m_bytes)[i * channels + ch] = (int16_t)(value * 32767);
+				else
+					((int32_t*)m_bytes)[i * channels + ch] = (int32_t)(value * 2147483647.0);
+			}
+		}
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual long GetSampleFrameCount(void) { return m_bytes ? m_sampleFrames : 0; }
+	virtual HRESULT GetBytes(void **buffer) { *buffer = m_bytes; return m_bytes ? S_OK : E_FAIL; }
+	virtual HRESULT GetPacketTime(BMDTimeValue *packetTime, BMDTimeScale timeScale)
+	{
+		*packetTime = m_firstSample * timeScale / 48000;
+		return S_OK;
+	}
+
+private:
+	~EmulatorAudioPacket() { free(m_bytes); }
+
+	ULONG		m_refCount;
+	void*		m_bytes;
+	long		m_sampleFrames;
+	uint64_t	m_firstSample;
+};
+
+//
+// Input
+//
+
+class EmulatorDevice;
+
+class EmulatorInput : public IDeckLinkInput
+{
+public:
+	EmulatorInput(EmulatorDevice* device, int index);
+	~EmulatorInput();
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG STDMETHODCALLTYPE AddRef(void);
+	virtual ULONG STDMETHODCALLTYPE Release(void);
+
+	virtual HRESULT DoesSupportVideoMode(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags, BMDDisplayModeSupport *result, IDeckLinkDisplayMode **resultDisplayMode);
+	virtual HRESULT GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator);
+	virtual HRESULT SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback *previewCallback) { return E_NOTIMPL; }
+
+	virtual HRESULT EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags);
+	virtual HRESULT DisableVideoInput(void);
+	virtual HRESULT GetAvailableVideoFrameCount(uint32_t *availableFrameCount) { *availableFrameCount = 0; return S_OK; }
+	virtual HRESULT SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator *theAllocator);
+
+	virtual HRESULT EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount);
+	virtual HRESULT DisableAudioInput(void);
+	virtual HRESULT GetAvailableAudioSampleFrameCount(uint32_t *availableSampleFrameCount) { *availableSampleFrameCount = 0; return S_OK; }
+
+	virtual HRESULT StartStreams(void);
+	virtual HRESULT StopStreams(void);
+	virtual HRESULT PauseStreams(void);
+	virtual HRESULT FlushStreams(void) { return S_OK; }
+	virtual HRESULT SetCallback(IDeckLinkInputCallback *theCallback);
+
+	virtual HRESULT GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue *hardwareTime, BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame);
+
+	bool IsBusy() { return m_streaming; }
+
+private:
+	static void*	ThreadFunc(void* arg);
+	void			Run();
+	void			DeliverFrame(uint64_t due);
+	void			WaitForCallback();
+
+	EmulatorDevice*				m_device;
+	int							m_index;
+	pthread_mutex_t				m_mutex;
+	pthread_cond_t				m_cond;
+	pthread_t					m_thread;
+	bool						m_threadStarted;
+	bool						m_exit;
+	bool						m_inCallback;
+	unsigned					m_seed;
+
+	IDeckLinkInputCallback*		m_callback;
+	IDeckLinkMemoryAllocator*	m_allocator;
+	EmulatorFramePool*			m_pool;
+	void*						m_barsPattern;
+	void*						m_blackPattern;
+
+	const EmulatorMode*			m_mode;
+	BMDPixelFormat				m_pixelFormat;
+	BMDVideoInputFlags			m_flags;
+	long						m_rowBytes;
+
+	bool						m_audioEnabled;
+	uint32_t					m_audioChannels;
+	uint32_t					m_audioSampleDepth;
+	uint64_t					m_audioSamples;
+
+	bool						m_streaming;
+	unsigned					m_session;
+	uint64_t					m_startNanos;
+	uint64_t					m_frameNumber;
+
+	// The emulated signal on the connector, which changes independently of the enabled mode
+	const EmulatorMode*			m_sourceMode;
+	uint64_t					m_sourceFrames;
+	bool						m_formatChangePending;
+};
+
+//
+// Output
+//
+
+class EmulatorOutput : public IDeckLinkOutput
+{
+public:
+	EmulatorOutput(EmulatorDevice* device);
+	~EmulatorOutput();
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv);
+	virtual ULONG STDMETHODCALLTYPE AddRef(void);
+	virtual ULONG STDMETHODCALLTYPE Release(void);
+
+	virtual HRESULT DoesSupportVideoMode(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoOutputFlags flags, BMDDisplayModeSupport *result, IDeckLinkDisplayMode **resultDisplayMode);
+	virtual HRESULT GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator);
+	virtual HRESULT SetScreenPreviewCallback(IDeckLinkScreenPreviewCallback *previewCallback) { return E_NOTIMPL; }
+
+	virtual HRESULT EnableVideoOutput(BMDDisplayMode displayMode, BMDVideoOutputFlags flags);
+	virtual HRESULT DisableVideoOutput(void);
+	virtual HRESULT SetVideoOutputFrameMemoryAllocator(IDeckLinkMemoryAllocator *theAllocator) { return E_NOTIMPL; }
+	virtual HRESULT CreateVideoFrame(int32_t width, int32_t height, int32_t rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags, IDeckLinkMutableVideoFrame **outFrame);
+	virtual HRESULT CreateAncillaryData(BMDPixelFormat pixelFormat, IDeckLinkVideoFrameAncillary **outBuffer) { return E_NOTIMPL; }
+
+	virtual HRESULT DisplayVideoFrameSync(IDeckLinkVideoFrame *theFrame);
+	virtual HRESULT ScheduleVideoFrame(IDeckLinkVideoFrame *theFrame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale);
+	virtual HRESULT SetScheduledFrameCompletionCallback(IDeckLinkVideoOutputCallback *theCallback);
+	virtual HRESULT GetBufferedVideoFrameCount(uint32_t *bufferedFrameCount);
+
+	virtual HRESULT EnableAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount, BMDAudioOutputStreamType streamType);
+	virtual HRESULT DisableAudioOutput(void);
+	virtual HRESULT WriteAudioSamplesSync(void *buffer, uint32_t sampleFrameCount, uint32_t *sampleFramesWritten);
+	virtual HRESULT BeginAudioPreroll(void);
+	virtual HRESULT EndAudioPreroll(void);
+	virtual HRESULT ScheduleAudioSamples(void *buffer, uint32_t sampleFrameCount, BMDTimeValue streamTime, BMDTimeScale timeScale, uint32_t *sampleFramesWritten);
+	virtual HRESULT GetBufferedAudioSampleFrameCount(uint32_t *bufferedSampleFrameCount);
+	virtual HRESULT FlushBufferedAudioSamples(void);
+	virtual HRESULT SetAudioCallback(IDeckLinkAudioOutputCallback *theCallback);
+
+	virtual HRESULT StartScheduledPlayback(BMDTimeValue playbackStartTime, BMDTimeScale timeScale, double playbackSpeed);
+	virtual HRESULT StopScheduledPlayback(BMDTimeValue stopPlaybackAtTime, BMDTimeValue *actualStopTime, BMDTimeScale timeScale);
+	virtual HRESULT IsScheduledPlaybackRunning(bool *active);
+	virtual HRESULT GetScheduledStreamTime(BMDTimeScale desiredTimeScale, BMDTimeValue *streamTime, double *playbackSpeed);
+	virtual HRESULT GetReferenceStatus(BMDReferenceStatus *referenceStatus) { *referenceStatus = bmdReferenceNotSupportedByHardware; return S_OK; }
+
+	virtual HRESULT GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue *hardwareTime, BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame);
+
+	bool IsBusy() { return m_playing; }
+
+private:
+	struct ScheduledFrame
+	{
+		IDeckLinkVideoFrame*	frame;
+		BMDTimeValue			time;		// in the mode's time scale
+		BMDTimeValue			duration;
+		bool					displayed;
+
+		bool operator<(const ScheduledFrame& other) const { return time < other.time; }
+	};
+
+	struct CompletedFrame
+	{
+		IDeckLinkVideoFrame*				frame;
+		BMDOutputFrameCompletionResult		result;
+	};
+
+	static void*	ThreadFunc(void* arg);
+	void			Run();
+	void			Tick(BMDTimeValue streamTime);
+	void			StartThread();
+	void			WaitForCallback();
+	void			Complete(std::vector<CompletedFrame>& completed);
+
+	EmulatorDevice*					m_device;
+	pthread_mutex_t					m_mutex;
+	pthread_cond_t					m_cond;
+	pthread_t						m_thread;
+	bool							m_threadStarted;
+	bool							m_exit;
+	bool							m_inCallback;
+
+	IDeckLinkVideoOutputCallback*	m_videoCallback;
+	IDeckLinkAudioOutputCallback*	m_audioCallback;
+
+	const EmulatorMode*				m_mode;
+	std::vector<ScheduledFrame>		m_scheduled;
+
+	bool							m_audioEnabled;
+	bool							m_prerolling;
+	uint32_t						m_bufferedAudio;
+
+	bool							m_playing;
+	unsigned						m_session;
+	BMDTimeValue					m_playbackStart;
+	uint64_t						m_startNanos;
+	uint64_t						m_tick;
+	uint64_t						m_completed;
+	uint64_t						m_dropped;
+	uint64_t						m_underruns;
+};
+
+//
+// Device
+//
+
+class EmulatorDevice : public IDeckLink, public IDeckLinkAttributes
+{
+public:
+	EmulatorDevice(int index) : m_refCount(1), m_index(index)
+	{
+		m_input = new EmulatorInput(this, index);
+		m_output = new EmulatorOutput(this);
+	}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv)
+	{
+		if (IsIID(iid, IID_IUnknown) || IsIID(iid, IID_IDeckLink))
+			*ppv = static_cast<IDeckLink*>(this);
+		else if (IsIID(iid, IID_IDeckLinkAttributes))
+			*ppv = static_cast<IDeckLinkAttributes*>(this);
+		else if (IsIID(iid, IID_IDeckLinkInput))
+			*ppv = m_input;
+		else if (IsIID(iid, IID_IDeckLinkOutput))
+			*ppv = m_output;
+		else
+		{
+			*ppv = NULL;
+			return E_NOINTERFACE;
+		}
+		AddRef();
+		return S_OK;
+	}
+
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual HRESULT GetModelName(const char **modelName)
+	{
+		*modelName = strdup("DeckLink Emulator");
+		return S_OK;
+	}
+
+	virtual HRESULT GetDisplayName(const char **displayName)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "DeckLink Emulator (%d)", m_index + 1);
+		*displayName = strdup(name);
+		return S_OK;
+	}
+
+	virtual HRESULT GetFlag(BMDDeckLinkAttributeID cfgID, bool *value)
+	{
+		switch (cfgID)
+		{
+			case BMDDeckLinkSupportsInputFormatDetection:	*value = true; return S_OK;
+			case BMDDeckLinkSupportsInternalKeying:
+			case BMDDeckLinkSupportsExternalKeying:
+			case BMDDeckLinkSupportsHDKeying:
+			case BMDDeckLinkHasReferenceInput:
+			case BMDDeckLinkHasSerialPort:
+			case BMDDeckLinkHasBypass:
+			case BMDDeckLinkSupportsDesktopDisplay:			*value = false; return S_OK;
+		}
+		return E_INVALIDARG;
+	}
+
+	virtual HRESULT GetInt(BMDDeckLinkAttributeID cfgID, int64_t *value)
+	{
+		switch (cfgID)
+		{
+			case BMDDeckLinkMaximumAudioChannels:	*value = 16; return S_OK;
+			case BMDDeckLinkNumberOfSubDevices:		*value = 1; return S_OK;
+			case BMDDeckLinkSubDeviceIndex:			*value = 0; return S_OK;
+			case BMDDeckLinkDeviceBusyState:
+				*value = (m_input->IsBusy() ? bmdDeviceCaptureBusy : 0) | (m_output->IsBusy() ? bmdDevicePlaybackBusy : 0);
+				return S_OK;
+		}
+		return E_INVALIDARG;
+	}
+
+	virtual HRESULT GetFloat(BMDDeckLinkAttributeID cfgID, double *value) { return E_INVALIDARG; }
+	virtual HRESULT GetString(BMDDeckLinkAttributeID cfgID, const char **value) { return E_INVALIDARG; }
+
+private:
+	~EmulatorDevice()
+	{
+		delete m_input;
+		delete m_output;
+	}
+
+	ULONG				m_refCount;
+	int					m_index;
+	EmulatorInput*		m_input;
+	EmulatorOutput*		m_output;
+};
+
+//
+// EmulatorInput
+//
+
+EmulatorInput::EmulatorInput(EmulatorDevice* device, int index) :
+	m_device(device), m_index(index), m_threadStarted(false), m_exit(false), m_inCallback(false), m_seed(index + 1),
+	m_callback(NULL), m_allocator(NULL), m_barsPattern(NULL), m_blackPattern(NULL),
+	m_mode(NULL), m_pixelFormat(bmdFormat8BitYUV), m_flags(bmdVideoInputFlagDefault), m_rowBytes(0),
+	m_audioEnabled(false), m_audioChannels(2), m_audioSampleDepth(16), m_audioSamples(0),
+	m_streaming(false), m_session(0), m_startNanos(0), m_frameNumber(0),
+	m_sourceMode(NULL), m_sourceFrames(0), m_formatChangePending(false)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+	m_pool = new EmulatorFramePool();
+}
+
+EmulatorInput::~EmulatorInput()
+{
+	pthread_mutex_lock(&m_mutex);
+		m_exit = true;
+		m_streaming = false;
+		pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	if (m_threadStarted)
+		pthread_join(m_thread, NULL);
+
+	if (m_callback)
+		m_callback->Release();
+
+	if (m_allocator)
+		m_allocator->Release();
+
+	m_pool->Release();
+	free(m_barsPattern);
+	free(m_blackPattern);
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+HRESULT EmulatorInput::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG EmulatorInput::AddRef(void)
+{
+	return m_device->AddRef();
+}
+
+ULONG EmulatorInput::Release(void)
+{
+	return m_device->Release();
+}
+
+HRESULT EmulatorInput::DoesSupportVideoMode(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags, BMDDisplayModeSupport *result, IDeckLinkDisplayMode **resultDisplayMode)
+{
+	const EmulatorMode* mode = FindMode(displayMode);
+
+	*result = (mode && IsSupportedFormat(pixelFormat)) ? bmdDisplayModeSupported : bmdDisplayModeNotSupported;
+	if (resultDisplayMode)
+		*resultDisplayMode = mode ? new EmulatorDisplayMode(mode) : NULL;
+	return S_OK;
+}
+
+HRESULT EmulatorInput::GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator)
+{
+	*iterator = new EmulatorDisplayModeIterator();
+	return S_OK;
+}
+
+HRESULT EmulatorInput::EnableVideoInput(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoInputFlags flags)
+{
+	const EmulatorMode* mode = FindMode(displayMode);
+	if (!mode || !IsSupportedFormat(pixelFormat))
+		return E_INVALIDARG;
+
+	long rowBytes = RowBytesForFormat(pixelFormat, mode->width);
+	void* bars = NULL;
+	void* black = NULL;
+	if (posix_memalign(&bars, 64, rowBytes * mode->height) != 0 || posix_memalign(&black, 64, rowBytes * mode->height) != 0)
+	{
+		free(bars);
+		return E_OUTOFMEMORY;
+	}
+	RenderPattern(bars, mode->width, mode->height, rowBytes, pixelFormat, true);
+	RenderPattern(black, mode->width, mode->height, rowBytes, pixelFormat, false);
+
+	pthread_mutex_lock(&m_mutex);
+		if (m_streaming)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			free(bars);
+			free(black);
+			return E_ACCESSDENIED;
+		}
+
+		free(m_barsPattern);
+		free(m_blackPattern);
+		m_barsPattern = bars;
+		m_blackPattern = black;
+
+		m_mode = mode;
+		m_pixelFormat = pixelFormat;
+		m_flags = flags;
+		m_rowBytes = rowBytes;
+		m_pool->Configure(mode->width, mode->height, rowBytes, pixelFormat);
+
+		// Whatever is asked for first is what is plugged in
+		if (!m_sourceMode)
+			m_sourceMode = mode;
+		if (m_sourceMode == mode)
+			m_formatChangePending = false;
+	pthread_mutex_unlock(&m_mutex);
+
+	return S_OK;
+}
+
+HRESULT EmulatorInput::DisableVideoInput(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		m_mode = NULL;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorInput::EnableAudioInput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount)
+{
+	if (sampleRate != bmdAudioSampleRate48kHz || (sampleType != 16 && sampleType != 32) ||
+		(channelCount != 2 && channelCount != 8 && channelCount != 16))
+		return E_INVALIDARG;
+
+	pthread_mutex_lock(&m_mutex);
+		m_audioEnabled = true;
+		m_audioChannels = channelCount;
+		m_audioSampleDepth = sampleType;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorInput::DisableAudioInput(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		m_audioEnabled = false;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorInput::StartStreams(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (!m_mode)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_FAIL;
+		}
+
+		if (!m_threadStarted)
+		{
+			if (pthread_create(&m_thread, NULL, ThreadFunc, this) != 0)
+			{
+				pthread_mutex_unlock(&m_mutex);
+				return E_FAIL;
+			}
+			m_threadStarted = true;
+		}
+
+		if (!m_streaming && m_allocator)
+			m_allocator->Commit();
+
+		// Stream time restarts at zero, like it does on the card
+		m_streaming = true;
+		m_session++;
+		m_startNanos = MonotonicNanos();
+		m_frameNumber = 0;
+		m_audioSamples = 0;
+		pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+// No callbacks are made once this returns, unless it is called from a callback
+void EmulatorInput::WaitForCallback()
+{
+	if (m_threadStarted && pthread_equal(m_thread, pthread_self()))
+		return;
+
+	while (m_inCallback)
+		pthread_cond_wait(&m_cond, &m_mutex);
+}
+
+HRESULT EmulatorInput::StopStreams(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		bool wasStreaming = m_streaming;
+		m_streaming = false;
+		m_session++;
+		pthread_cond_broadcast(&m_cond);
+		WaitForCallback();
+		if (wasStreaming && m_allocator)
+			m_allocator->Decommit();
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorInput::SetVideoInputFrameMemoryAllocator(IDeckLinkMemoryAllocator *theAllocator)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (m_streaming)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_ACCESSDENIED;
+		}
+
+		if (theAllocator)
+			theAllocator->AddRef();
+		if (m_allocator)
+			m_allocator->Release();
+		m_allocator = theAllocator;
+		m_pool->SetAllocator(theAllocator);
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorInput::PauseStreams(void)
+{
+	return StopStreams();
+}
+
+HRESULT EmulatorInput::SetCallback(IDeckLinkInputCallback *theCallback)
+{
+	if (theCallback)
+		theCallback->AddRef();
+
+	pthread_mutex_lock(&m_mutex);
+		IDeckLinkInputCallback* previous = m_callback;
+		m_callback = theCallback;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (previous)
+		previous->Release();
+	return S_OK;
+}
+
+HRESULT EmulatorInput::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue *hardwareTime, BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame)
+{
+	uint64_t now = MonotonicNanos();
+
+	pthread_mutex_lock(&m_mutex);
+		*hardwareTime = NanosToTicks(now, desiredTimeScale);
+		if (m_mode)
+		{
+			uint64_t frameNanos = TicksToNanos(m_mode->frameDuration, m_mode->timeScale);
+			*ticksPerFrame = NanosToTicks(frameNanos, desiredTimeScale);
+			*timeInFrame = NanosToTicks(m_streaming ? (now - m_startNanos) % frameNanos : 0, desiredTimeScale);
+		}
+		else
+		{
+			*ticksPerFrame = 0;
+			*timeInFrame = 0;
+		}
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+void* EmulatorInput::ThreadFunc(void* arg)
+{
+	((EmulatorInput*)arg)->Run();
+	return NULL;
+}
+
+void EmulatorInput::Run()
+{
+	pthread_mutex_lock(&m_mutex);
+	while (!m_exit)
+	{
+		if (!m_streaming || !m_mode)
+		{
+			pthread_cond_wait(&m_cond, &m_mutex);
+			continue;
+		}
+
+		// Frame n arrives once it has been fully received, one frame after it started
+		unsigned session = m_session;
+		uint64_t due = m_startNanos + TicksToNanos((m_frameNumber + 1) * m_mode->frameDuration, m_mode->timeScale);
+		uint64_t wake = due;
+		if (g_config.jitterNanos > 0)
+			wake += (uint64_t)rand_r(&m_seed) % (g_config.jitterNanos + 1);
+
+		pthread_mutex_unlock(&m_mutex);
+		SleepUntil(wake);
+		pthread_mutex_lock(&m_mutex);
+
+		if (m_exit || !m_streaming || session != m_session || !m_mode)
+			continue;
+
+		DeliverFrame(due);
+
+		// The callback may have restarted the streams
+		if (session == m_session)
+			m_frameNumber++;
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// Called with m_mutex held, it is dropped around the callbacks
+void EmulatorInput::DeliverFrame(uint64_t due)
+{
+	uint64_t sourceFrame = m_sourceFrames++;
+
+	if (g_config.formatChangeFrames > 0 && sourceFrame > 0 && sourceFrame % g_config.formatChangeFrames == 0)
+	{
+		m_sourceMode = NextMode(m_sourceMode);
+		m_formatChangePending = true;
+	}
+
+	IDeckLinkInputCallback* callback = m_callback;
+
+	if (m_sourceMode != m_mode && m_formatChangePending && (m_flags & bmdVideoInputEnableFormatDetection))
+	{
+		BMDVideoInputFormatChangedEvents events = bmdVideoInputDisplayModeChanged;
+		if (m_sourceMode->fieldDominance != m_mode->fieldDominance)
+			events |= bmdVideoInputFieldDominanceChanged;
+
+		m_formatChangePending = false;
+		if (!callback)
+			return;
+
+		EmulatorDisplayMode* displayMode = new EmulatorDisplayMode(m_sourceMode);
+		callback->AddRef();
+		m_inCallback = true;
+		pthread_mutex_unlock(&m_mutex);
+
+		callback->VideoInputFormatChanged(events, displayMode, bmdDetectedVideoInputYCbCr422);
+		callback->Release();
+		displayMode->Release();
+
+		pthread_mutex_lock(&m_mutex);
+		m_inCallback = false;
+		pthread_cond_broadcast(&m_cond);
+		return;
+	}
+
+	bool noSignal = m_sourceMode != m_mode;
+	if (g_config.signalLossEvery > 0 && sourceFrame % g_config.signalLossEvery >= g_config.signalLossEvery - g_config.signalLossFrames)
+		noSignal = true;
+
+	EmulatorInputFrame* frame = m_pool->Get();
+	if (!frame)
+		return;
+
+	long height = m_mode->height;
+	if (noSignal)
+	{
+		memcpy(frame->m_bytes, m_blackPattern, m_rowBytes * height);
+		frame->m_flags = bmdFrameHasNoInputSource;
+	}
+	else
+	{
+		memcpy(frame->m_bytes, m_barsPattern, m_rowBytes * height);
+		frame->m_flags = bmdFrameFlagDefault;
+
+		// A white block moving along the bottom of the picture, so dropped or repeated
+		// frames can be seen. It is copied from the white bar at the start of the pattern.
+		long groupPixels, groupBytes;
+		PixelGroup(m_pixelFormat, &groupPixels, &groupBytes);
+		long groups = m_mode->width / groupPixels;
+		long markerGroups = std::max(1L, groups / 32);
+		long step = std::max(1L, groups / 100);
+		long offset = (long)((m_frameNumber * step) % (groups - markerGroups)) * groupBytes;
+
+		for (long y = height * 3 / 4; y < height; y++)
+		{
+			memcpy((char*)frame->m_bytes + y * m_rowBytes + offset, (char*)m_barsPattern + y * m_rowBytes, markerGroups * groupBytes);
+		}
+	}
+
+	frame->m_streamTime = m_frameNumber * m_mode->frameDuration;
+	frame->m_streamDuration = m_mode->frameDuration;
+	frame->m_timeScale = m_mode->timeScale;
+	frame->m_hardwareNanos = due;
+	frame->m_hardwareDurationNanos = TicksToNanos(m_mode->frameDuration, m_mode->timeScale);
+
+	EmulatorAudioPacket* packet = NULL;
+	if (m_audioEnabled)
+	{
+		uint64_t end = AudioSamplesBefore(m_frameNumber + 1, m_mode->frameDuration, m_mode->timeScale);
+		packet = new EmulatorAudioPacket((long)(end - m_audioSamples), m_audioChannels, m_audioSampleDepth, m_audioSamples);
+		m_audioSamples = end;
+	}
+
+	if (callback)
+		callback->AddRef();
+	m_inCallback = true;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (callback)
+	{
+		callback->VideoInputFrameArrived(frame, packet);
+		callback->Release();
+	}
+	frame->Release();
+	if (packet)
+		packet->Release();
+
+	pthread_mutex_lock(&m_mutex);
+	m_inCallback = false;
+	pthread_cond_broadcast(&m_cond);
+}
+
+//
+// EmulatorOutput
+//
+
+EmulatorOutput::EmulatorOutput(EmulatorDevice* device) :
+	m_device(device), m_threadStarted(false), m_exit(false), m_inCallback(false),
+	m_videoCallback(NULL), m_audioCallback(NULL), m_mode(NULL),
+	m_audioEnabled(false), m_prerolling(false), m_bufferedAudio(0),
+	m_playing(false), m_session(0), m_playbackStart(0), m_startNanos(0), m_tick(0), m_completed(0), m_dropped(0), m_underruns(0)
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_cond, NULL);
+}
+
+EmulatorOutput::~EmulatorOutput()
+{
+	pthread_mutex_lock(&m_mutex);
+		m_exit = true;
+		m_playing = false;
+		m_prerolling = false;
+		pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+
+	if (m_threadStarted)
+		pthread_join(m_thread, NULL);
+
+	for (size_t i = 0; i < m_scheduled.size(); i++)
+		m_scheduled[i].frame->Release();
+
+	if (m_videoCallback)
+		m_videoCallback->Release();
+	if (m_audioCallback)
+		m_audioCallback->Release();
+
+	pthread_cond_destroy(&m_cond);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+HRESULT EmulatorOutput::QueryInterface(REFIID iid, LPVOID *ppv)
+{
+	return m_device->QueryInterface(iid, ppv);
+}
+
+ULONG EmulatorOutput::AddRef(void)
+{
+	return m_device->AddRef();
+}
+
+ULONG EmulatorOutput::Release(void)
+{
+	return m_device->Release();
+}
+
+HRESULT EmulatorOutput::DoesSupportVideoMode(BMDDisplayMode displayMode, BMDPixelFormat pixelFormat, BMDVideoOutputFlags flags, BMDDisplayModeSupport *result, IDeckLinkDisplayMode **resultDisplayMode)
+{
+	const EmulatorMode* mode = FindMode(displayMode);
+
+	*result = (mode && IsSupportedFormat(pixelFormat)) ? bmdDisplayModeSupported : bmdDisplayModeNotSupported;
+	if (resultDisplayMode)
+		*resultDisplayMode = mode ? new EmulatorDisplayMode(mode) : NULL;
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::GetDisplayModeIterator(IDeckLinkDisplayModeIterator **iterator)
+{
+	*iterator = new EmulatorDisplayModeIterator();
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::EnableVideoOutput(BMDDisplayMode displayMode, BMDVideoOutputFlags flags)
+{
+	const EmulatorMode* mode = FindMode(displayMode);
+	if (!mode)
+		return E_INVALIDARG;
+
+	pthread_mutex_lock(&m_mutex);
+		if (m_playing)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_ACCESSDENIED;
+		}
+		m_mode = mode;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::DisableVideoOutput(void)
+{
+	std::vector<ScheduledFrame> scheduled;
+
+	pthread_mutex_lock(&m_mutex);
+		m_mode = NULL;
+		m_scheduled.swap(scheduled);
+	pthread_mutex_unlock(&m_mutex);
+
+	for (size_t i = 0; i < scheduled.size(); i++)
+		scheduled[i].frame->Release();
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::CreateVideoFrame(int32_t width, int32_t height, int32_t rowBytes, BMDPixelFormat pixelFormat, BMDFrameFlags flags, IDeckLinkMutableVideoFrame **outFrame)
+{
+	*outFrame = NULL;
+	if (width <= 0 || height <= 0 || !IsSupportedFormat(pixelFormat) || rowBytes < RowBytesForFormat(pixelFormat, width))
+		return E_INVALIDARG;
+
+	EmulatorVideoFrame* frame = new EmulatorVideoFrame(width, height, rowBytes, pixelFormat, flags);
+	if (!frame->IsValid())
+	{
+		frame->Release();
+		return E_OUTOFMEMORY;
+	}
+	*outFrame = frame;
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::DisplayVideoFrameSync(IDeckLinkVideoFrame *theFrame)
+{
+	pthread_mutex_lock(&m_mutex);
+		bool enabled = m_mode != NULL;
+		const EmulatorMode* mode = m_mode;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (!enabled || !theFrame)
+		return E_FAIL;
+
+	// Returns at the next frame boundary, like the card does
+	uint64_t frameNanos = TicksToNanos(mode->frameDuration, mode->timeScale);
+	uint64_t now = MonotonicNanos();
+	SleepUntil(now - now % frameNanos + frameNanos);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::ScheduleVideoFrame(IDeckLinkVideoFrame *theFrame, BMDTimeValue displayTime, BMDTimeValue displayDuration, BMDTimeScale timeScale)
+{
+	if (!theFrame || timeScale <= 0)
+		return E_INVALIDARG;
+
+	pthread_mutex_lock(&m_mutex);
+		if (!m_mode)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_ACCESSDENIED;
+		}
+
+		ScheduledFrame scheduled;
+		scheduled.frame = theFrame;
+		scheduled.time = displayTime * m_mode->timeScale / timeScale;
+		scheduled.duration = displayDuration * m_mode->timeScale / timeScale;
+		scheduled.displayed = false;
+
+		theFrame->AddRef();
+		m_scheduled.insert(std::upper_bound(m_scheduled.begin(), m_scheduled.end(), scheduled), scheduled);
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::SetScheduledFrameCompletionCallback(IDeckLinkVideoOutputCallback *theCallback)
+{
+	if (theCallback)
+		theCallback->AddRef();
+
+	pthread_mutex_lock(&m_mutex);
+		IDeckLinkVideoOutputCallback* previous = m_videoCallback;
+		m_videoCallback = theCallback;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (previous)
+		previous->Release();
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::GetBufferedVideoFrameCount(uint32_t *bufferedFrameCount)
+{
+	pthread_mutex_lock(&m_mutex);
+		*bufferedFrameCount = m_scheduled.size();
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::EnableAudioOutput(BMDAudioSampleRate sampleRate, BMDAudioSampleType sampleType, uint32_t channelCount, BMDAudioOutputStreamType streamType)
+{
+	if (sampleRate != bmdAudioSampleRate48kHz || (sampleType != 16 && sampleType != 32) ||
+		(channelCount != 2 && channelCount != 8 && channelCount != 16))
+		return E_INVALIDARG;
+
+	pthread_mutex_lock(&m_mutex);
+		m_audioEnabled = true;
+		m_bufferedAudio = 0;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::DisableAudioOutput(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		m_audioEnabled = false;
+		m_prerolling = false;
+		m_bufferedAudio = 0;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+// Only the amount of audio is tracked, the samples themselves are not played
+HRESULT EmulatorOutput::WriteAudioSamplesSync(void *buffer, uint32_t sampleFrameCount, uint32_t *sampleFramesWritten)
+{
+	return ScheduleAudioSamples(buffer, sampleFrameCount, 0, 0, sampleFramesWritten);
+}
+
+HRESULT EmulatorOutput::ScheduleAudioSamples(void *buffer, uint32_t sampleFrameCount, BMDTimeValue streamTime, BMDTimeScale timeScale, uint32_t *sampleFramesWritten)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (!m_audioEnabled)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_ACCESSDENIED;
+		}
+
+		uint32_t accepted = std::min(sampleFrameCount, kAudioOutputCapacity - m_bufferedAudio);
+		m_bufferedAudio += accepted;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (sampleFramesWritten)
+		*sampleFramesWritten = accepted;
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::GetBufferedAudioSampleFrameCount(uint32_t *bufferedSampleFrameCount)
+{
+	pthread_mutex_lock(&m_mutex);
+		*bufferedSampleFrameCount = m_bufferedAudio;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::FlushBufferedAudioSamples(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		m_bufferedAudio = 0;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::SetAudioCallback(IDeckLinkAudioOutputCallback *theCallback)
+{
+	if (theCallback)
+		theCallback->AddRef();
+
+	pthread_mutex_lock(&m_mutex);
+		IDeckLinkAudioOutputCallback* previous = m_audioCallback;
+		m_audioCallback = theCallback;
+	pthread_mutex_unlock(&m_mutex);
+
+	if (previous)
+		previous->Release();
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::BeginAudioPreroll(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (!m_audioEnabled)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_ACCESSDENIED;
+		}
+		m_prerolling = true;
+		StartThread();
+		pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::EndAudioPreroll(void)
+{
+	pthread_mutex_lock(&m_mutex);
+		m_prerolling = false;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+// Called with m_mutex held
+void EmulatorOutput::StartThread()
+{
+	if (!m_threadStarted && pthread_create(&m_thread, NULL, ThreadFunc, this) == 0)
+		m_threadStarted = true;
+}
+
+HRESULT EmulatorOutput::StartScheduledPlayback(BMDTimeValue playbackStartTime, BMDTimeScale timeScale, double playbackSpeed)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (!m_mode || timeScale <= 0)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_FAIL;
+		}
+
+		StartThread();
+		if (!m_threadStarted)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			return E_FAIL;
+		}
+
+		m_playing = true;
+		m_prerolling = false;
+		m_session++;
+		m_playbackStart = playbackStartTime * m_mode->timeScale / timeScale;
+		m_startNanos = MonotonicNanos();
+		m_tick = 0;
+		m_completed = 0;
+		m_dropped = 0;
+		m_underruns = 0;
+		pthread_cond_broadcast(&m_cond);
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+void EmulatorOutput::WaitForCallback()
+{
+	if (m_threadStarted && pthread_equal(m_thread, pthread_self()))
+		return;
+
+	while (m_inCallback)
+		pthread_cond_wait(&m_cond, &m_mutex);
+}
+
+HRESULT EmulatorOutput::StopScheduledPlayback(BMDTimeValue stopPlaybackAtTime, BMDTimeValue *actualStopTime, BMDTimeScale timeScale)
+{
+	std::vector<CompletedFrame>		flushed;
+	IDeckLinkVideoOutputCallback*	callback;
+	bool							wasPlaying;
+
+	// Stops right away, stopPlaybackAtTime is not emulated
+	pthread_mutex_lock(&m_mutex);
+		wasPlaying = m_playing;
+		m_playing = false;
+		m_session++;
+		pthread_cond_broadcast(&m_cond);
+		WaitForCallback();
+
+		if (actualStopTime && m_mode && timeScale > 0)
+			*actualStopTime = (m_playbackStart + (BMDTimeValue)m_tick * m_mode->frameDuration) * timeScale / m_mode->timeScale;
+
+		if (wasPlaying)
+			fprintf(stderr, "DeckLink emulator output stopped after %llu frames: %llu completed, %llu dropped, %llu underruns\n",
+				(unsigned long long)m_tick, (unsigned long long)m_completed, (unsigned long long)m_dropped, (unsigned long long)m_underruns);
+
+		// Frames scheduled from the completion callbacks below stay queued for the next start
+		for (size_t i = 0; i < m_scheduled.size(); i++)
+		{
+			CompletedFrame completed = { m_scheduled[i].frame, bmdOutputFrameFlushed };
+			flushed.push_back(completed);
+		}
+		m_scheduled.clear();
+
+		callback = m_videoCallback;
+		if (callback)
+			callback->AddRef();
+	pthread_mutex_unlock(&m_mutex);
+
+	Complete(flushed);
+
+	if (callback)
+	{
+		if (wasPlaying)
+			callback->ScheduledPlaybackHasStopped();
+		callback->Release();
+	}
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::IsScheduledPlaybackRunning(bool *active)
+{
+	*active = m_playing;
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::GetScheduledStreamTime(BMDTimeScale desiredTimeScale, BMDTimeValue *streamTime, double *playbackSpeed)
+{
+	pthread_mutex_lock(&m_mutex);
+		if (!m_playing)
+		{
+			pthread_mutex_unlock(&m_mutex);
+			*streamTime = 0;
+			*playbackSpeed = 0;
+			return S_OK;
+		}
+		*streamTime = m_playbackStart * desiredTimeScale / m_mode->timeScale + NanosToTicks(MonotonicNanos() - m_startNanos, desiredTimeScale);
+		*playbackSpeed = 1.0;
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+HRESULT EmulatorOutput::GetHardwareReferenceClock(BMDTimeScale desiredTimeScale, BMDTimeValue *hardwareTime, BMDTimeValue *timeInFrame, BMDTimeValue *ticksPerFrame)
+{
+	uint64_t now = MonotonicNanos();
+
+	pthread_mutex_lock(&m_mutex);
+		*hardwareTime = NanosToTicks(now, desiredTimeScale);
+		if (m_mode)
+		{
+			uint64_t frameNanos = TicksToNanos(m_mode->frameDuration, m_mode->timeScale);
+			*ticksPerFrame = NanosToTicks(frameNanos, desiredTimeScale);
+			*timeInFrame = NanosToTicks(m_playing ? (now - m_startNanos) % frameNanos : 0, desiredTimeScale);
+		}
+		else
+		{
+			*ticksPerFrame = 0;
+			*timeInFrame = 0;
+		}
+	pthread_mutex_unlock(&m_mutex);
+	return S_OK;
+}
+
+void* EmulatorOutput::ThreadFunc(void* arg)
+{
+	((EmulatorOutput*)arg)->Run();
+	return NULL;
+}
+
+void EmulatorOutput::Complete(std::vector<CompletedFrame>& completed)
+{
+	IDeckLinkVideoOutputCallback* callback = NULL;
+
+	pthread_mutex_lock(&m_mutex);
+		callback = m_videoCallback;
+		if (callback)
+			callback->AddRef();
+	pthread_mutex_unlock(&m_mutex);
+
+	for (size_t i = 0; i < completed.size(); i++)
+	{
+		if (callback)
+			callback->ScheduledFrameCompleted(completed[i].frame, completed[i].result);
+		completed[i].frame->Release();
+	}
+
+	if (callback)
+		callback->Release();
+}
+
+void EmulatorOutput::Run()
+{
+	pthread_mutex_lock(&m_mutex);
+	while (!m_exit)
+	{
+		if (!m_playing)
+		{
+			if (!m_prerolling || !m_audioCallback)
+			{
+				pthread_cond_wait(&m_cond, &m_mutex);
+				continue;
+			}
+
+			// Keep asking for preroll audio until playback is started
+			IDeckLinkAudioOutputCallback* audioCallback = m_audioCallback;
+			audioCallback->AddRef();
+			m_inCallback = true;
+			pthread_mutex_unlock(&m_mutex);
+
+			audioCallback->RenderAudioSamples(true);
+			audioCallback->Release();
+
+			pthread_mutex_lock(&m_mutex);
+			m_inCallback = false;
+			pthread_cond_broadcast(&m_cond);
+
+			if (!m_playing && m_prerolling)
+			{
+				struct timespec timeout;
+				clock_gettime(CLOCK_REALTIME, &timeout);
+				timeout.tv_nsec += 10000000L;
+				if (timeout.tv_nsec >= 1000000000L)
+				{
+					timeout.tv_nsec -= 1000000000L;
+					timeout.tv_sec++;
+				}
+				pthread_cond_timedwait(&m_cond, &m_mutex, &timeout);
+			}
+			continue;
+		}
+
+		unsigned session = m_session;
+		uint64_t due = m_startNanos + TicksToNanos((m_tick + 1) * m_mode->frameDuration, m_mode->timeScale);
+
+		pthread_mutex_unlock(&m_mutex);
+		SleepUntil(due);
+		pthread_mutex_lock(&m_mutex);
+
+		if (m_exit || !m_playing || session != m_session)
+			continue;
+
+		m_tick++;
+		Tick(m_playbackStart + (BMDTimeValue)m_tick * m_mode->frameDuration);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+// Called with m_mutex held at the end of each frame. The latest frame due by the start
+// of the frame was on screen, frames whose time has passed without being shown are dropped.
+void EmulatorOutput::Tick(BMDTimeValue streamTime)
+{
+	std::vector<CompletedFrame> completed;
+	BMDTimeValue frameStart = streamTime - m_mode->frameDuration;
+
+	size_t shown = 0;
+	while (shown < m_scheduled.size() && m_scheduled[shown].time <= frameStart)
+		shown++;
+
+	if (shown > 0)
+		m_scheduled[shown - 1].displayed = true;
+	else
+		m_underruns++;
+
+	while (!m_scheduled.empty() && m_scheduled.front().time + m_scheduled.front().duration <= streamTime)
+	{
+		CompletedFrame done = { m_scheduled.front().frame, m_scheduled.front().displayed ? bmdOutputFrameCompleted : bmdOutputFrameDropped };
+		completed.push_back(done);
+		if (done.result == bmdOutputFrameCompleted)
+			m_completed++;
+		else
+			m_dropped++;
+		m_scheduled.erase(m_scheduled.begin());
+	}
+
+	if (m_audioEnabled)
+	{
+		uint32_t played = (uint32_t)(AudioSamplesBefore(m_tick, m_mode->frameDuration, m_mode->timeScale) - AudioSamplesBefore(m_tick - 1, m_mode->frameDuration, m_mode->timeScale));
+		m_bufferedAudio -= std::min(played, m_bufferedAudio);
+	}
+
+	IDeckLinkAudioOutputCallback* audioCallback = m_audioEnabled ? m_audioCallback : NULL;
+	if (audioCallback)
+		audioCallback->AddRef();
+	m_inCallback = true;
+	pthread_mutex_unlock(&m_mutex);
+
+	Complete(completed);
+
+	if (audioCallback)
+	{
+		audioCallback->RenderAudioSamples(false);
+		audioCallback->Release();
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	m_inCallback = false;
+	pthread_cond_broadcast(&m_cond);
+}
+
+//
+// Iterator
+//
+
+class EmulatorIterator : public IDeckLinkIterator
+{
+public:
+	EmulatorIterator() : m_refCount(1), m_index(0) {}
+
+	virtual HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, LPVOID *ppv) { *ppv = NULL; return E_NOINTERFACE; }
+	virtual ULONG STDMETHODCALLTYPE AddRef(void) { return __sync_add_and_fetch(&m_refCount, 1); }
+	virtual ULONG STDMETHODCALLTYPE Release(void)
+	{
+		ULONG count = __sync_sub_and_fetch(&m_refCount, 1);
+		if (count == 0)
+			delete this;
+		return count;
+	}
+
+	virtual HRESULT Next(IDeckLink **deckLinkInstance)
+	{
+		if (m_index >= g_config.devices)
+		{
+			*deckLinkInstance = NULL;
+			return S_FALSE;
+		}
+		*deckLinkInstance = static_cast<IDeckLink*>(new EmulatorDevice(m_index++));
+		return S_OK;
+	}
+
+private:
+	virtual ~EmulatorIterator() {}
+
+	ULONG		m_refCount;
+	int			m_index;
+};
+
+static pthread_once_t		g_announceOnce = PTHREAD_ONCE_INIT;
+
+static void Announce(void)
+{
+	fprintf(stderr, "Using the DeckLink emulator: %d device%s", g_config.devices, g_config.devices == 1 ? "" : "s");
+	if (g_config.jitterNanos)
+		fprintf(stderr, ", %llu us jitter", (unsigned long long)(g_config.jitterNanos / 1000));
+	if (g_config.signalLossEvery)
+		fprintf(stderr, ", no signal for %llu of every %llu frames", (unsigned long long)g_config.signalLossFrames, (unsigned long long)g_config.signalLossEvery);
+	if (g_config.formatChangeFrames)
+		fprintf(stderr, ", format change every %llu frames", (unsigned long long)g_config.formatChangeFrames);
+	fprintf(stderr, "\n");
+}
+
+IDeckLinkIterator* CreateDeckLinkEmulatorIteratorInstance(void)
+{
+	pthread_once(&g_configOnce, LoadConfig);
+	pthread_once(&g_announceOnce, Announce);
+	return new EmulatorIterator();
+}
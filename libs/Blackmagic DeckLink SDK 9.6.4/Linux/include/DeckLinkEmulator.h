@@ -0,0 +1,32 @@
+//
+//  DeckLinkEmulator.h
+//  SH
+//
+//  Copyright (c) 2013 HalfdanJ. All rights reserved.
+//
+//  In-process stand-in for DeckLink hardware, so capture and playout can be run and
+//  measured on machines without cards. DeckLinkAPIDispatch.cpp falls back to it when
+//  built with -DDECKLINK_EMULATOR (make EMULATOR=1 in the samples) and libDeckLinkAPI.so
+//  can not be loaded.
+//
+//  The emulated devices deliver colour bars at the cadence of the enabled display mode,
+//  paced from CLOCK_MONOTONIC, and play out scheduled frames at the same rate. The
+//  input signal can be disturbed through the environment:
+//
+//    DECKLINK_EMULATOR=<devices>                   Use the emulator even if the library is installed (default 1 device)
+//    DECKLINK_EMULATOR_JITTER=<microseconds>       Deliver each input frame up to this much late
+//    DECKLINK_EMULATOR_SIGNAL_LOSS=<every>:<count> Flag <count> of every <every> frames with bmdFrameHasNoInputSource
+//    DECKLINK_EMULATOR_FORMAT_CHANGE=<frames>      Switch the input signal to the next display mode every <frames> frames
+//
+
+#ifndef __DECKLINK_EMULATOR_H__
+#define __DECKLINK_EMULATOR_H__
+
+#include "DeckLinkAPI.h"
+
+// True when DECKLINK_EMULATOR is set, the dispatch then skips loading the library
+bool					IsDeckLinkEmulatorForced (void);
+
+IDeckLinkIterator*		CreateDeckLinkEmulatorIteratorInstance (void);
+
+#endif